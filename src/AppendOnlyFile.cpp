@@ -0,0 +1,319 @@
+#include "AppendOnlyFile.h"
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <random>
+#include <fcntl.h>
+#include <unistd.h>
+
+AppendOnlyFile::AppendOnlyFile(const std::string& path,AppendFsync policy):path(path),policy(policy){}
+
+AppendOnlyFile::~AppendOnlyFile(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping=true;
+    }
+    cond.notify_all();
+    if(fsyncThread.joinable()){
+        fsyncThread.join();
+    }
+    if(fd!=-1){
+        waitFor(appendSequence);
+        if(policy!=FSYNC_NO){
+            fdatasync(fd);
+        }
+        close(fd);
+    }
+}
+
+bool AppendOnlyFile::parsePolicy(const std::string& name,AppendFsync& policy){
+    if(name=="always"){
+        policy=FSYNC_ALWAYS;
+    }else if(name=="everysec"){
+        policy=FSYNC_EVERYSEC;
+    }else if(name=="no"){
+        policy=FSYNC_NO;
+    }else{
+        return false;
+    }
+    return true;
+}
+
+//文件头：APPENDONLY_HEADER和AOF编号
+std::string AppendOnlyFile::header(uint64_t id){
+    return std::string(APPENDONLY_HEADER)+" "+std::to_string(id)+"\n";
+}
+
+bool AppendOnlyFile::parseHeader(const std::string& line,uint64_t& id){
+    std::string prefix=std::string(APPENDONLY_HEADER)+" ";
+    if(line.compare(0,prefix.size(),prefix)!=0){
+        return false;
+    }
+    try{
+        id=std::stoull(line.substr(prefix.size()));
+    }catch(const std::exception&){
+        return false;
+    }
+    return id!=0;
+}
+
+//随机生成，0表示没有AOF
+uint64_t AppendOnlyFile::newId(){
+    static std::mt19937_64 generator(std::random_device{}()^(uint64_t)std::chrono::steady_clock::now().time_since_epoch().count());
+    uint64_t id=0;
+    while(id==0){
+        id=generator();
+    }
+    return id;
+}
+
+bool AppendOnlyFile::open(uint64_t fileId,uint64_t validLength,int dataBaseIndex){
+    fd=::open(path.c_str(),O_WRONLY|O_CREAT|O_APPEND,0644);
+    if(fd==-1){
+        std::cout<<"AOF："<<path<<"打开失败："<<strerror(errno)<<std::endl;
+        return false;
+    }
+    if(fileId==0){
+        validLength=0; //新的AOF
+    }
+    off_t length=lseek(fd,0,SEEK_END);
+    if(length>(off_t)validLength){
+        //上次写到一半就崩溃了，截掉不完整的命令
+        std::cout<<"AOF："<<path<<"末尾有不完整的命令，截断到"<<validLength<<"字节"<<std::endl;
+        if(ftruncate(fd,validLength)!=0){
+            std::cout<<"AOF："<<path<<"截断失败："<<strerror(errno)<<std::endl;
+            return false;
+        }
+        length=validLength;
+    }
+    fileSize=length;
+    id=fileId;
+    lastDataBase=dataBaseIndex;
+    if(fileSize==0){
+        id=newId();
+        lastDataBase=-1;
+        std::string head=header(id);
+        if(!writeAllTo(fd,head)){
+            std::cout<<"AOF："<<path<<"写入失败："<<strerror(errno)<<std::endl;
+            return false;
+        }
+        fileSize=head.size();
+    }
+    baseSize=fileSize;
+    if(policy==FSYNC_EVERYSEC){
+        fsyncThread=std::thread(&AppendOnlyFile::backgroundFsync,this);
+    }
+    return true;
+}
+
+uint64_t AppendOnlyFile::append(int dataBaseIndex,const std::string& command){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(dataBaseIndex!=lastDataBase){
+        buffer+="select "+std::to_string(dataBaseIndex)+"\n";
+        lastDataBase=dataBaseIndex;
+    }
+    buffer+=command;
+    buffer+='\n';
+    if(rewriting){
+        if(dataBaseIndex!=rewriteDataBase){
+            rewriteBuffer+="select "+std::to_string(dataBaseIndex)+"\n";
+            rewriteDataBase=dataBaseIndex;
+        }
+        rewriteBuffer+=command;
+        rewriteBuffer+='\n';
+    }
+    commandCount++;
+    return ++appendSequence;
+}
+
+void AppendOnlyFile::waitFor(uint64_t sequence){
+    std::unique_lock<std::mutex> lock(mutex);
+    while(writtenSequence<sequence){
+        if(writing){
+            cond.wait(lock); //其他线程正在写，它会把我们的命令一起写入
+            continue;
+        }
+        //成为leader：取走缓冲区中的所有命令，解锁后写文件，其他线程可以继续追加
+        writing=true;
+        std::string batch;
+        batch.swap(buffer);
+        uint64_t target=appendSequence;
+        lock.unlock();
+        bool ok=writeAllTo(fd,batch);
+        if(ok&&policy==FSYNC_ALWAYS){
+            ok=fdatasync(fd)==0;
+        }
+        lock.lock();
+        if(!ok&&!writeError){
+            std::cout<<"AOF："<<path<<"写入失败："<<strerror(errno)<<std::endl;
+        }
+        writeError=writeError||!ok;
+        fileSize+=batch.size();
+        writeCount++;
+        if(policy==FSYNC_ALWAYS){
+            fsyncCount++;
+        }else{
+            unsyncedBytes+=batch.size();
+        }
+        writtenSequence=target;
+        writing=false;
+        cond.notify_all();
+    }
+}
+
+bool AppendOnlyFile::writeAllTo(int fd,const std::string& data){
+    size_t written=0;
+    while(written<data.size()){
+        ssize_t n=write(fd,data.data()+written,data.size()-written);
+        if(n<0){
+            if(errno==EINTR){
+                continue;
+            }
+            return false;
+        }
+        written+=n;
+    }
+    return true;
+}
+
+void AppendOnlyFile::truncate(){
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock,[this]{ return !writing; });
+    //缓冲区中的命令已经执行，包含在刚保存的数据库文件中，直接丢弃
+    buffer.clear();
+    writtenSequence=appendSequence;
+    cond.notify_all();
+    //换一个新的编号：数据库文件中记录的是旧编号，重放时不会跳过新写入的命令
+    id=newId();
+    std::string head=header(id);
+    if(ftruncate(fd,0)!=0||!writeAllTo(fd,head)){
+        std::cout<<"AOF："<<path<<"清空失败："<<strerror(errno)<<std::endl;
+        writeError=true;
+    }else{
+        writeError=false; //数据都在数据库文件中，新的AOF是完整的
+    }
+    fileSize=head.size();
+    baseSize=fileSize;
+    unsyncedBytes=head.size();
+    lastDataBase=-1;
+}
+
+void AppendOnlyFile::position(uint64_t& fileId,uint64_t& offset){
+    std::lock_guard<std::mutex> lock(mutex);
+    fileId=id;
+    offset=fileSize+buffer.size();
+}
+
+//fork之后调用，调用前需要持有所有分片的锁：之后追加的命令同时记录到重写缓冲区
+void AppendOnlyFile::startRewrite(){
+    std::lock_guard<std::mutex> lock(mutex);
+    rewriting=true;
+    rewriteDataBase=-1;
+    rewriteBuffer.clear();
+}
+
+void AppendOnlyFile::cancelRewrite(){
+    std::lock_guard<std::mutex> lock(mutex);
+    rewriting=false;
+    std::string().swap(rewriteBuffer);
+}
+
+//子进程保存成功：新的AOF只包含重写缓冲区中fork之后的命令，写入临时文件后改名替换
+//先不加锁写入已经缓冲的命令并刷盘，加锁后只写入这期间新追加的少量命令，写入期间命令可以继续执行
+//临时文件以追加方式打开，改名后直接作为新AOF的fd，不需要重新打开（重新打开失败会使之后的写入都失败）
+void AppendOnlyFile::finishRewrite(){
+    std::string tmpPath=path+".rewrite";
+    int tmpFd=::open(tmpPath.c_str(),O_WRONLY|O_CREAT|O_TRUNC|O_APPEND,0644);
+    uint64_t nextId=newId();
+    std::unique_lock<std::mutex> lock(mutex);
+    if(!rewriting){
+        if(tmpFd!=-1){
+            close(tmpFd);
+            std::remove(tmpPath.c_str());
+        }
+        return;
+    }
+    std::string data=header(nextId)+rewriteBuffer;
+    std::string().swap(rewriteBuffer);
+    lock.unlock();
+    bool ok=tmpFd!=-1&&writeAllTo(tmpFd,data)&&fdatasync(tmpFd)==0;
+    lock.lock();
+    cond.wait(lock,[this]{ return !writing&&!fsyncing; }); //之后不会再有命令写入旧文件，后台线程也不再使用旧的fd
+    uint64_t size=data.size()+rewriteBuffer.size();
+    ok=ok&&(rewriteBuffer.empty()||(writeAllTo(tmpFd,rewriteBuffer)&&fdatasync(tmpFd)==0))
+        &&rename(tmpPath.c_str(),path.c_str())==0;
+    rewriting=false;
+    std::string().swap(rewriteBuffer);
+    if(!ok){
+        std::cout<<"AOF："<<path<<"重写失败："<<strerror(errno)<<std::endl;
+        if(tmpFd!=-1){
+            close(tmpFd);
+        }
+        std::remove(tmpPath.c_str());
+        return;
+    }
+    //改名后的临时文件成为新的AOF，缓冲区中还没写入的命令已经包含在其中
+    close(fd);
+    fd=tmpFd;
+    writeError=false;
+    id=nextId;
+    fileSize=size;
+    baseSize=size;
+    lastDataBase=rewriteDataBase;
+    buffer.clear();
+    writtenSequence=appendSequence;
+    unsyncedBytes=0;
+    rewriteCount++;
+    cond.notify_all();
+}
+
+//AOF比上次重写（或清空、启动）之后增长了APPENDONLY_REWRITE_PERCENTAGE%，并且超过APPENDONLY_REWRITE_MIN_SIZE
+bool AppendOnlyFile::rewriteNeeded(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return !rewriting&&fileSize>=APPENDONLY_REWRITE_MIN_SIZE
+        &&fileSize>=baseSize+baseSize*APPENDONLY_REWRITE_PERCENTAGE/100;
+}
+
+bool AppendOnlyFile::writeFailed(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return writeError;
+}
+
+void AppendOnlyFile::backgroundFsync(){
+    std::unique_lock<std::mutex> lock(mutex);
+    while(!stopping){
+        cond.wait_for(lock,std::chrono::milliseconds(APPENDONLY_FSYNC_INTERVAL),[this]{ return stopping; });
+        if(unsyncedBytes==0){
+            continue;
+        }
+        unsyncedBytes=0;
+        //不持有锁，刷盘期间命令可以继续写入；fsyncing期间finishRewrite不会关闭这个fd
+        int syncFd=fd;
+        fsyncing=true;
+        lock.unlock();
+        fdatasync(syncFd);
+        lock.lock();
+        fsyncing=false;
+        fsyncCount++;
+        cond.notify_all();
+    }
+}
+
+std::string AppendOnlyFile::info(){
+    std::lock_guard<std::mutex> lock(mutex);
+    const char* names[]={"always","everysec","no"};
+    std::string res="aof_enabled:1\n";
+    res+="aof_fsync:"+std::string(names[policy])+"\n";
+    res+="aof_current_size:"+std::to_string(fileSize)+"\n";
+    res+="aof_buffer_length:"+std::to_string(buffer.size())+"\n";
+    res+="aof_commands:"+std::to_string(commandCount)+"\n";
+    res+="aof_writes:"+std::to_string(writeCount)+"\n"; //commands/writes为组提交平均每次合并的命令数
+    res+="aof_fsyncs:"+std::to_string(fsyncCount)+"\n";
+    res+="aof_base_size:"+std::to_string(baseSize)+"\n";
+    res+="aof_rewrite_in_progress:"+std::string(rewriting?"1":"0")+"\n";
+    res+="aof_rewrite_buffer_length:"+std::to_string(rewriteBuffer.size())+"\n";
+    res+="aof_rewrites:"+std::to_string(rewriteCount)+"\n";
+    res+="aof_last_write_status:"+std::string(writeError?"err":"ok");
+    return res;
+}
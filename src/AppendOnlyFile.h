@@ -0,0 +1,91 @@
+#ifndef APPENDONLYFILE_H
+#define APPENDONLYFILE_H
+#include<string>
+#include<mutex>
+#include<condition_variable>
+#include<thread>
+#include<cstdint>
+#define APPENDONLY_FILE_NAME "appendonly.aof"
+#define APPENDONLY_FSYNC_INTERVAL 1000 //everysec策略的刷盘间隔，毫秒
+#define APPENDONLY_HEADER "#aof" //AOF的第一行：#aof 编号
+#define APPENDONLY_REWRITE_PERCENTAGE 100 //AOF比上次重写之后增长了这么多（百分比）时自动重写
+#define APPENDONLY_REWRITE_MIN_SIZE (64*1024*1024) //AOF小于这个大小时不自动重写
+
+//AOF的刷盘策略
+enum AppendFsync{
+    FSYNC_ALWAYS, //每批命令写入后立即fdatasync，命令返回时已经落盘
+    FSYNC_EVERYSEC, //后台线程每秒fdatasync一次，操作系统崩溃时最多丢失1秒的数据
+    FSYNC_NO //只write，由操作系统决定何时刷盘
+};
+
+/*
+    追加写日志（AOF）：每条修改了数据的命令按执行顺序记录为一行文本，启动时重放
+    数据库文件（快照）和AOF一起构成完整的数据：AOF只记录上次保存之后的命令
+        同步保存成功后清空AOF，命令所在的数据库改变时先记录一条select
+        重写：fork出的子进程保存某一时刻的数据库文件，这是数据最紧凑的形式，父进程把fork之后的命令同时记录到重写缓冲区，
+            子进程成功后用只包含重写缓冲区的新AOF替换旧AOF，重放时间只和数据量有关，和历史命令的条数无关；
+            bgsave就是一次重写，AOF增长过快时也会自动触发
+        每次清空或重写后AOF换一个新的随机编号；快照中记录保存时的AOF编号和长度，
+        保存成功到替换AOF之间崩溃时，重放会跳过已经包含在快照中的命令，不会重复执行
+    写入分两步：
+        append：持有命令涉及的分片锁时调用，只把命令追加到内存缓冲区，日志顺序和执行顺序一致
+        waitFor：释放分片锁之后调用，等待命令写入文件再返回给客户端。
+            组提交：第一个等待的线程成为leader，把缓冲区中所有线程的命令一次write（always策略下再fdatasync），
+            其他线程等待leader完成，多个工作线程的命令合并成一次系统调用
+*/
+class AppendOnlyFile{
+public:
+    AppendOnlyFile(const std::string& path,AppendFsync policy);
+    ~AppendOnlyFile(); //写出缓冲区，停止后台线程
+    AppendOnlyFile(const AppendOnlyFile&)=delete;
+    AppendOnlyFile& operator=(const AppendOnlyFile&)=delete;
+    static bool parsePolicy(const std::string& name,AppendFsync& policy); //"always"、"everysec"、"no"
+    static bool parseHeader(const std::string& line,uint64_t& id); //解析AOF的第一行
+    //以追加方式打开：fileId为重放时读到的编号（0表示创建新的AOF），validLength之后不完整的命令被截掉
+    //dataBaseIndex为AOF中最后一条select选择的数据库
+    bool open(uint64_t fileId,uint64_t validLength,int dataBaseIndex);
+    uint64_t append(int dataBaseIndex,const std::string& command); //追加到缓冲区，返回命令的序号
+    void waitFor(uint64_t sequence); //等待序号不大于sequence的命令写入文件
+    void truncate(); //所有数据已经保存到数据库文件，清空AOF；调用前需要持有所有分片的锁
+    void position(uint64_t& fileId,uint64_t& offset); //AOF编号和已追加的总长度（包括还在缓冲区中的），保存时记录到快照中
+    void startRewrite(); //bgsave子进程开始保存
+    void finishRewrite(); //子进程保存成功，用重写缓冲区替换AOF
+    void cancelRewrite(); //子进程失败或被终止，丢弃重写缓冲区
+    bool rewriteNeeded(); //是否需要自动重写
+    //最近一次写入是否失败（aof_last_write_status:err）：失败后服务器拒绝写命令，清空或重写出完整的新文件后恢复
+    bool writeFailed();
+    std::string info();
+private:
+    void backgroundFsync(); //everysec策略的后台刷盘线程
+    static bool writeAllTo(int fd,const std::string& data);
+    static std::string header(uint64_t id);
+    static uint64_t newId();
+    std::string path;
+    AppendFsync policy;
+    int fd=-1;
+    uint64_t id=0; //AOF编号
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::string buffer; //还没有写入文件的命令
+    uint64_t appendSequence=0; //最后一条追加到缓冲区的命令的序号
+    uint64_t writtenSequence=0; //最后一条已经写入文件的命令的序号
+    bool writing=false; //是否有leader正在写文件
+    bool fsyncing=false; //后台线程是否正在不持有锁地fdatasync，此时不能关闭或替换fd
+    int lastDataBase=-1; //最后一条命令所在的数据库，数据库改变时先写入一条select
+    uint64_t fileSize=0;
+    uint64_t unsyncedBytes=0; //写入文件但还没有fdatasync的字节数
+    uint64_t baseSize=0; //上次重写（或清空、启动）之后的大小，用于判断增长比例
+    bool rewriting=false; //是否有子进程正在保存
+    int rewriteDataBase=-1; //重写缓冲区中最后一条命令所在的数据库
+    std::string rewriteBuffer; //fork之后追加的命令
+    bool writeError=false;
+    bool stopping=false;
+    std::thread fsyncThread;
+    //统计信息
+    uint64_t commandCount=0;
+    uint64_t writeCount=0;
+    uint64_t fsyncCount=0;
+    uint64_t rewriteCount=0;
+};
+
+#endif
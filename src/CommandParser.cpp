@@ -1,8 +1,56 @@
 #include "CommandParser.h"
+#include <cctype>
 
 // 静态成员变量的初始化
 std::shared_ptr<RedisHelper> CommandParser::redisHelper = std::make_shared<RedisHelper>();
 
+// 选项不区分大小写
+static std::string toUpper(std::string text) {
+    for (auto& ch : text) {
+        ch = std::toupper(static_cast<unsigned char>(ch));
+    }
+    return text;
+}
+
+// 配置参数名不区分大小写
+static std::string toLower(std::string text) {
+    for (auto& ch : text) {
+        ch = std::tolower(static_cast<unsigned char>(ch));
+    }
+    return text;
+}
+
+// 把过期时间参数转换为绝对时间（毫秒时间戳），unit为参数单位对应的毫秒数，absolute表示参数已经是时间戳
+// 溢出时返回false
+static bool expireTimestamp(int64_t value, int64_t unit, bool absolute, int64_t& timestampMs) {
+    if (value > INT64_MAX / unit || value < INT64_MIN / unit) {
+        return false;
+    }
+    value *= unit;
+    if (!absolute) {
+        int64_t now = RedisHelper::currentTimeMs();
+        if (value > INT64_MAX - now) {
+            return false;
+        }
+        value += now;
+    }
+    timestampMs = value;
+    return true;
+}
+
+// expire/pexpire/expireat/pexpireat共用：参数为负数或者已经过去的时间时key被删除
+static std::string parseExpire(std::vector<std::string>& tokens, int64_t unit, bool absolute, const std::string& name) {
+    if (tokens.size() != 3) {
+        return "wrong number of arguments for " + name + ".";
+    }
+    int64_t value = 0;
+    int64_t timestampMs = 0;
+    if (!RedisValue::toInteger(tokens[2], value) || !expireTimestamp(value, unit, absolute, timestampMs)) {
+        return "invalid expire time in " + name + ".";
+    }
+    return CommandParser::getRedisHelper()->expireAt(tokens[1], timestampMs);
+}
+
 // SelectParser 
 //select命令来选择数据库
 std::string SelectParser::parse(std::vector<std::string>& tokens) {
@@ -19,18 +67,29 @@ std::string SelectParser::parse(std::vector<std::string>& tokens) {
 }
 
 // SetParser 
+// set key value [NX|XX] [EX seconds|PX milliseconds|EXAT timestamp|PXAT milliseconds-timestamp]，选项的顺序任意
 std::string SetParser::parse(std::vector<std::string>& tokens) {
     if (tokens.size() < 3) {
         return "wrong number of arguments for SET.";
     }
-    if (tokens.size() == 4) {
-        if (tokens.back() == "NX") {
-            return redisHelper->set(tokens[1], tokens[2], NX);
-        } else if (tokens.back() == "XX") {
-            return redisHelper->set(tokens[1], tokens[2], XX);
+    SET_MODEL model = NONE;
+    int64_t expireAt = -1;
+    for (size_t i = 3; i < tokens.size(); i++) {
+        std::string option = toUpper(tokens[i]);
+        if ((option == "NX" || option == "XX") && model == NONE) {
+            model = option == "NX" ? NX : XX;
+        } else if ((option == "EX" || option == "PX" || option == "EXAT" || option == "PXAT") && expireAt < 0 && i + 1 < tokens.size()) {
+            int64_t value = 0;
+            int64_t unit = option[0] == 'E' ? 1000 : 1;
+            bool absolute = option.size() == 4;
+            if (!RedisValue::toInteger(tokens[++i], value) || value <= 0 || !expireTimestamp(value, unit, absolute, expireAt)) {
+                return "invalid expire time in SET.";
+            }
+        } else {
+            return "syntax error";
         }
     }
-    return redisHelper->set(tokens[1], tokens[2]);
+    return redisHelper->set(tokens[1], RedisValue::fromString(tokens[2]), model, expireAt); //整数按整数编码保存
 }
 
 // SetnxParser 
@@ -38,15 +97,20 @@ std::string SetnxParser::parse(std::vector<std::string>& tokens) {
     if (tokens.size() < 3) {
         return "wrong number of arguments for SETNX.";
     }
-    return redisHelper->setnx(tokens[1], tokens[2]);
+    return redisHelper->setnx(tokens[1], RedisValue::fromString(tokens[2]));
 }
 
 // SetexParser 
+// setex key seconds value
 std::string SetexParser::parse(std::vector<std::string>& tokens) {
-    if (tokens.size() < 3) {
+    if (tokens.size() != 4) {
         return "wrong number of arguments for SETEX.";
     }
-    return redisHelper->setex(tokens[1], tokens[2]);
+    int64_t seconds = 0;
+    if (!RedisValue::toInteger(tokens[2], seconds)) {
+        return tokens[2] + " is not a numeric type";
+    }
+    return redisHelper->setex(tokens[1], seconds, RedisValue::fromString(tokens[3]));
 }
 
 // GetParser 
@@ -93,6 +157,50 @@ std::string RenameParser::parse(std::vector<std::string>& tokens) {
     return redisHelper->rename(tokens[1], tokens[2]);
 }
 
+// ExpireParser 
+std::string ExpireParser::parse(std::vector<std::string>& tokens) {
+    return parseExpire(tokens, 1000, false, "EXPIRE");
+}
+
+// PExpireParser 
+std::string PExpireParser::parse(std::vector<std::string>& tokens) {
+    return parseExpire(tokens, 1, false, "PEXPIRE");
+}
+
+// ExpireAtParser 
+std::string ExpireAtParser::parse(std::vector<std::string>& tokens) {
+    return parseExpire(tokens, 1000, true, "EXPIREAT");
+}
+
+// PExpireAtParser 
+std::string PExpireAtParser::parse(std::vector<std::string>& tokens) {
+    return parseExpire(tokens, 1, true, "PEXPIREAT");
+}
+
+// TtlParser 
+std::string TtlParser::parse(std::vector<std::string>& tokens) {
+    if (tokens.size() != 2) {
+        return "wrong number of arguments for TTL.";
+    }
+    return redisHelper->ttl(tokens[1]);
+}
+
+// PTtlParser 
+std::string PTtlParser::parse(std::vector<std::string>& tokens) {
+    if (tokens.size() != 2) {
+        return "wrong number of arguments for PTTL.";
+    }
+    return redisHelper->ttl(tokens[1], true);
+}
+
+// PersistParser 
+std::string PersistParser::parse(std::vector<std::string>& tokens) {
+    if (tokens.size() != 2) {
+        return "wrong number of arguments for PERSIST.";
+    }
+    return redisHelper->persist(tokens[1]);
+}
+
 // IncrParser 
 std::string IncrParser::parse(std::vector<std::string>& tokens) {
     if (tokens.size() < 2) {
@@ -106,10 +214,8 @@ std::string IncrbyParser::parse(std::vector<std::string>& tokens) {
     if (tokens.size() < 3) {
         return "wrong number of arguments for INCRBY.";
     }
-    int increment = 0;
-    try {
-        increment = std::stoi(tokens[2]);
-    } catch (std::invalid_argument const& e) {
+    int64_t increment = 0;
+    if (!RedisValue::toInteger(tokens[2], increment)) {
         return tokens[2] + " is not a numeric type";
     }
     return redisHelper->incrby(tokens[1], increment);
@@ -142,10 +248,8 @@ std::string DecrbyParser::parse(std::vector<std::string>& tokens) {
     if (tokens.size() < 3) {
         return "wrong number of arguments for DECRBY.";
     }
-    int decrement = 0;
-    try {
-        decrement = std::stoi(tokens[2]);
-    } catch (std::invalid_argument const& e) {
+    int64_t decrement = 0;
+    if (!RedisValue::toInteger(tokens[2], decrement)) {
         return tokens[2] + " is not a numeric type";
     }
     return redisHelper->decrby(tokens[1], decrement);
@@ -267,3 +371,74 @@ std::string HValsParser::parse(std::vector<std::string>& tokens) {
     }
     return redisHelper->hvals(tokens[1]);
 }
+
+// SaveParser
+std::string SaveParser::parse(std::vector<std::string>& tokens) {
+    return redisHelper->save();
+}
+
+// BgsaveParser
+std::string BgsaveParser::parse(std::vector<std::string>& tokens) {
+    return redisHelper->bgsave();
+}
+
+// BgrewriteaofParser
+std::string BgrewriteaofParser::parse(std::vector<std::string>& tokens) {
+    return redisHelper->bgrewriteaof();
+}
+
+// InfoParser
+std::string InfoParser::parse(std::vector<std::string>& tokens) {
+    return redisHelper->info();
+}
+
+// config get parameter / config set parameter value
+std::string ConfigParser::parse(std::vector<std::string>& tokens) {
+    if (tokens.size() < 2) {
+        return "wrong number of arguments for CONFIG.";
+    }
+    std::string subcommand = toUpper(tokens[1]);
+    if (subcommand == "GET") {
+        if (tokens.size() != 3) {
+            return "wrong number of arguments for CONFIG GET.";
+        }
+        return redisHelper->configGet(toLower(tokens[2]));
+    }
+    if (subcommand == "SET") {
+        if (tokens.size() != 4) {
+            return "wrong number of arguments for CONFIG SET.";
+        }
+        return redisHelper->configSet(toLower(tokens[2]), tokens[3]);
+    }
+    return "Unknown subcommand '" + tokens[1] + "'. Try CONFIG GET, CONFIG SET.";
+}
+
+// memory usage key [samples count] / memory stats
+std::string MemoryParser::parse(std::vector<std::string>& tokens) {
+    if (tokens.size() < 2) {
+        return "wrong number of arguments for MEMORY.";
+    }
+    std::string subcommand = toUpper(tokens[1]);
+    if (subcommand == "USAGE") {
+        if (tokens.size() != 3 && tokens.size() != 5) {
+            return "wrong number of arguments for MEMORY USAGE.";
+        }
+        int64_t samples = MEMORY_USAGE_SAMPLES;
+        if (tokens.size() == 5) {
+            if (toUpper(tokens[3]) != "SAMPLES") {
+                return "syntax error";
+            }
+            if (!RedisValue::toInteger(tokens[4], samples) || samples < 0) {
+                return "value is not an integer or out of range";
+            }
+        }
+        return redisHelper->memoryUsage(tokens[2], samples);
+    }
+    if (subcommand == "STATS") {
+        if (tokens.size() != 2) {
+            return "wrong number of arguments for MEMORY STATS.";
+        }
+        return redisHelper->memoryStats();
+    }
+    return "Unknown subcommand '" + tokens[1] + "'. Try MEMORY USAGE, MEMORY STATS.";
+}
@@ -78,6 +78,48 @@ public:
     std::string parse(std::vector<std::string>& tokens) override;
 };
 
+// ExpireParser 
+class ExpireParser : public CommandParser {
+public:
+    std::string parse(std::vector<std::string>& tokens) override;
+};
+
+// PExpireParser 
+class PExpireParser : public CommandParser {
+public:
+    std::string parse(std::vector<std::string>& tokens) override;
+};
+
+// ExpireAtParser 
+class ExpireAtParser : public CommandParser {
+public:
+    std::string parse(std::vector<std::string>& tokens) override;
+};
+
+// PExpireAtParser 
+class PExpireAtParser : public CommandParser {
+public:
+    std::string parse(std::vector<std::string>& tokens) override;
+};
+
+// TtlParser 
+class TtlParser : public CommandParser {
+public:
+    std::string parse(std::vector<std::string>& tokens) override;
+};
+
+// PTtlParser 
+class PTtlParser : public CommandParser {
+public:
+    std::string parse(std::vector<std::string>& tokens) override;
+};
+
+// PersistParser 
+class PersistParser : public CommandParser {
+public:
+    std::string parse(std::vector<std::string>& tokens) override;
+};
+
 // IncrParser 
 class IncrParser : public CommandParser {
 public:
@@ -198,4 +240,40 @@ public:
 
 
 
+// SaveParser
+class SaveParser : public CommandParser {
+public:
+    std::string parse(std::vector<std::string>& tokens) override;
+};
+
+// BgsaveParser
+class BgsaveParser : public CommandParser {
+public:
+    std::string parse(std::vector<std::string>& tokens) override;
+};
+
+// BgrewriteaofParser
+class BgrewriteaofParser : public CommandParser {
+public:
+    std::string parse(std::vector<std::string>& tokens) override;
+};
+
+// InfoParser
+class InfoParser : public CommandParser {
+public:
+    std::string parse(std::vector<std::string>& tokens) override;
+};
+
+// ConfigParser
+class ConfigParser : public CommandParser {
+public:
+    std::string parse(std::vector<std::string>& tokens) override;
+};
+
+// MemoryParser
+class MemoryParser : public CommandParser {
+public:
+    std::string parse(std::vector<std::string>& tokens) override;
+};
+
 #endif // COMMANDPARSER_H
@@ -0,0 +1,353 @@
+#ifndef CONCURRENTSKIPLIST_H
+#define CONCURRENTSKIPLIST_H
+#include<atomic>
+#include<random>
+#include<cstdint>
+#include<new>
+#include"SkipList.h"
+#include"EpochManager.h"
+
+/*
+    无锁跳表：查找不加锁，插入和删除通过CAS修改指针，可以有多个线程同时插入、删除和查找
+    每一层的next指针最低位用作删除标记：节点在某一层的next被标记，表示节点在这一层已经被逻辑删除
+    删除时从高层到低层依次标记，第0层标记成功的线程是真正删除该节点的线程
+    被标记的节点在之后的find中被顺手摘除，摘除后交给EpochManager，等到没有线程再访问它时释放
+
+    访问节点的线程必须处于EpochManager临界区（持有EpochManager::Guard），并且只在Guard的作用域内使用节点；
+    或者由外部的锁保证没有线程同时删除节点（RedisHelper的写命令持有分片的独占锁）
+*/
+
+//不加锁的读取看到的value：节点的value在外部的写锁下原地修改，不加锁的线程不能直接读取，
+//持有读锁的线程把value和过期时间复制一份发布到节点上，之后不加锁的读取只读这份不再修改的副本（写时复制）
+template<typename Value>
+struct PublishedValue{
+    Value value;
+    int64_t expireAt; //过期时间（毫秒时间戳），-1表示没有
+};
+
+// 无锁跳表节点，和SkipListNode一样forward数组紧跟在对象之后，只分配前level个元素
+template<typename Key,typename Value>
+class ConcurrentSkipListNode{
+public:
+    typedef std::atomic<uintptr_t> Link; //指向下一个节点的指针，最低位为删除标记
+    Key key;
+    Value value; //只在外部的锁下访问，不加锁的读取使用getPublished()
+    int level;
+    std::atomic<uint32_t> access{0}; //LRU时钟或LFU计数（见Eviction.h）
+    //插入线程和删除线程各持有一份，两者都完成摘除后才回收：插入线程在节点被标记后仍可能把它链入索引层
+    std::atomic<int> owners{2};
+    ConcurrentSkipListNode(const Key& key,const Value& value,int level):
+    key(key),value(value),level(level){
+        for(int i=0;i<level;i++){
+            new(&forward()[i]) Link(0);
+        }
+    }
+    //节点已经没有线程访问，发布的副本随节点一起释放
+    ~ConcurrentSkipListNode(){
+        delete published.load(std::memory_order_relaxed);
+    }
+    ConcurrentSkipListNode(const ConcurrentSkipListNode&)=delete;
+    ConcurrentSkipListNode& operator=(const ConcurrentSkipListNode&)=delete;
+    Link* forward(){
+        static_assert(sizeof(ConcurrentSkipListNode)%alignof(Link)==0,"forward array after the node must be pointer aligned");
+        return reinterpret_cast<Link*>(this+1);
+    }
+    //层高为level的节点（包括forward数组）占用的字节数
+    static size_t allocSize(int level){
+        return sizeof(ConcurrentSkipListNode)+level*sizeof(Link);
+    }
+    static ConcurrentSkipListNode* pointer(uintptr_t link){return reinterpret_cast<ConcurrentSkipListNode*>(link&~uintptr_t(1));}
+    static bool isMarked(uintptr_t link){return (link&1)!=0;}
+    //第i层中的下一个未被删除的节点，默认为原始链表层（第0层）
+    ConcurrentSkipListNode* getNext(int i=0){
+        ConcurrentSkipListNode* node=pointer(forward()[i].load());
+        while(node!=nullptr&&isMarked(node->forward()[i].load())){
+            node=pointer(node->forward()[i].load());
+        }
+        return node;
+    }
+
+    //发布的副本，没有发布时为nullptr；返回的副本和节点一样只在调用者的Guard作用域内有效
+    const PublishedValue<Value>* getPublished() const{
+        return published.load();
+    }
+    //把value和过期时间复制一份发布，已经有副本时不替换；调用者持有外部的读锁，value不会同时被修改
+    void publish(int64_t expireAt){
+        if(published.load()!=nullptr){
+            return;
+        }
+        PublishedValue<Value>* copy=new PublishedValue<Value>{value,expireAt};
+        const PublishedValue<Value>* expected=nullptr;
+        if(!published.compare_exchange_strong(expected,copy)){
+            delete copy; //其他读线程已经发布，copy还没有被任何线程看到
+        }
+    }
+    //撤销发布的副本，正在读它的线程退出临界区后再释放；调用者持有外部的写锁，撤销之后才能修改value和过期时间
+    void unpublish(){
+        if(published.load()==nullptr){ //发布只在读锁下进行，写锁下读到nullptr就不会再变化
+            return;
+        }
+        const PublishedValue<Value>* old=published.exchange(nullptr);
+        if(old!=nullptr){
+            EpochManager::instance().retire(const_cast<PublishedValue<Value>*>(old),&destroyPublished);
+        }
+    }
+private:
+    std::atomic<const PublishedValue<Value>*> published{nullptr};
+    static void destroyPublished(void* copy){
+        delete static_cast<PublishedValue<Value>*>(copy);
+    }
+};
+
+template<typename Key,typename Value>
+class ConcurrentSkipList{
+public:
+    typedef ConcurrentSkipListNode<Key,Value> Node;
+private:
+    Node* head; //头节点，层高为MAX_SKIP_LIST_LEVEL
+    std::atomic<int> elementNumber{0};
+private:
+    static int randomLevel();
+    static Node* createNode(const Key& key,const Value& value,int level);
+    static void destroyNode(void* node); //交给EpochManager的释放函数
+    static void release(Node* node); //插入线程或删除线程放弃对节点的持有，最后一个放弃的线程回收节点
+    //查找key在每一层的前驱和后继，并摘除路过的已标记节点；返回第0层的后继是否就是key；调用者处于临界区
+    bool find(const Key& key,Node** preds,Node** succs);
+public:
+    ConcurrentSkipList();
+    ~ConcurrentSkipList();
+    ConcurrentSkipList(const ConcurrentSkipList&)=delete;
+    ConcurrentSkipList& operator=(const ConcurrentSkipList&)=delete;
+    //添加节点，key已存在时返回nullptr；返回的节点在调用者的Guard作用域内，或者外部的锁阻止了并发删除时有效
+    Node* addItem(const Key& key,const Value& value);
+    Node* appendItem(const Key& key,const Value& value){return addItem(key,value);} //没有末尾指针，直接按key插入
+    //查找节点，不加锁，不修改跳表；调用者处于EpochManager临界区，或者外部的锁阻止了并发删除
+    Node* searchItem(const Key& key);
+    bool deleteItem(const Key& key); //删除节点
+    int size(){return elementNumber.load();}
+    Node* randomNode(uint64_t random); //随机选取一个节点，用于淘汰时抽样，跳表为空时返回nullptr
+public:
+    Node* getHead(){return head;}
+    Node* getFirst(){return head->getNext();} //第一个数据节点
+};
+
+/*--------------函数定义---------------------*/
+
+template<typename Key,typename Value>
+int ConcurrentSkipList<Key,Value>::randomLevel(){
+    //每个线程一个随机数生成器，不需要加锁
+    static thread_local std::mt19937 generator{std::random_device{}()};
+    std::uniform_real_distribution<double> distribution(0.0,1.0);
+    int level=1;
+    while(distribution(generator)<PROBABILITY_FACTOR&&level<MAX_SKIP_LIST_LEVEL){
+        level++;
+    }
+    return level;
+}
+
+template<typename Key,typename Value>
+ConcurrentSkipListNode<Key,Value>* ConcurrentSkipList<Key,Value>::createNode(const Key& key,const Value& value,int level){
+    void* memory=::operator new(Node::allocSize(level));
+    return new(memory) Node(key,value,level);
+}
+
+//节点可能在跳表析构之后才被EpochManager释放，因此不使用跳表自己的内存池
+template<typename Key,typename Value>
+void ConcurrentSkipList<Key,Value>::destroyNode(void* node){
+    static_cast<Node*>(node)->~Node();
+    ::operator delete(node);
+}
+
+template<typename Key,typename Value>
+void ConcurrentSkipList<Key,Value>::release(Node* node){
+    if(node->owners.fetch_sub(1)==1){
+        EpochManager::instance().retire(node,&ConcurrentSkipList::destroyNode);
+    }
+}
+
+template<typename Key,typename Value>
+ConcurrentSkipList<Key,Value>::ConcurrentSkipList(){
+    head=createNode(Key(),Value(),MAX_SKIP_LIST_LEVEL);
+}
+
+//析构时不应再有其他线程访问跳表，直接释放第0层上的所有节点；已经摘除的节点由EpochManager释放
+template<typename Key,typename Value>
+ConcurrentSkipList<Key,Value>::~ConcurrentSkipList(){
+    Node* node=head;
+    while(node!=nullptr){
+        Node* next=Node::pointer(node->forward()[0].load());
+        destroyNode(node);
+        node=next;
+    }
+}
+
+template<typename Key,typename Value>
+bool ConcurrentSkipList<Key,Value>::find(const Key& key,Node** preds,Node** succs){
+retry:
+    Node* pred=head;
+    for(int i=MAX_SKIP_LIST_LEVEL-1;i>=0;i--){
+        Node* current=Node::pointer(pred->forward()[i].load());
+        while(current!=nullptr){
+            uintptr_t succ=current->forward()[i].load();
+            if(Node::isMarked(succ)){
+                //current在这一层已被删除，把它从pred后面摘除；pred自身被标记或已改变时CAS失败，从头开始
+                uintptr_t expected=reinterpret_cast<uintptr_t>(current);
+                if(!pred->forward()[i].compare_exchange_strong(expected,succ&~uintptr_t(1))){
+                    goto retry;
+                }
+                current=Node::pointer(succ);
+            }else if(current->key<key){
+                pred=current;
+                current=Node::pointer(succ);
+            }else{
+                break;
+            }
+        }
+        preds[i]=pred;
+        succs[i]=current;
+    }
+    return succs[0]!=nullptr&&succs[0]->key==key;
+}
+
+template<typename Key,typename Value>
+ConcurrentSkipListNode<Key,Value>* ConcurrentSkipList<Key,Value>::addItem(const Key& key,const Value& value){
+    EpochManager::Guard guard;
+    Node* preds[MAX_SKIP_LIST_LEVEL];
+    Node* succs[MAX_SKIP_LIST_LEVEL];
+    Node* newNode=nullptr;
+    while(true){
+        if(find(key,preds,succs)){
+            if(newNode!=nullptr){
+                destroyNode(newNode); //还没有链入跳表，可以直接释放
+            }
+            return nullptr;
+        }
+        if(newNode==nullptr){
+            newNode=createNode(key,value,randomLevel());
+        }
+        for(int i=0;i<newNode->level;i++){
+            newNode->forward()[i].store(reinterpret_cast<uintptr_t>(succs[i]),std::memory_order_relaxed);
+        }
+        //先链入第0层，成功之后节点就算插入了
+        uintptr_t expected=reinterpret_cast<uintptr_t>(succs[0]);
+        if(preds[0]->forward()[0].compare_exchange_strong(expected,reinterpret_cast<uintptr_t>(newNode))){
+            break;
+        }
+    }
+    elementNumber++;
+    //再从低到高链入索引层，索引层只影响查找速度，链入失败时重新find
+    for(int i=1;i<newNode->level;i++){
+        while(true){
+            uintptr_t link=newNode->forward()[i].load();
+            if(Node::isMarked(link)){
+                break; //节点已经被其他线程删除，不再继续链入
+            }
+            //链入之前让新节点指向最新的后继，不能指向已经摘除（可能已经交给EpochManager）的节点
+            if(Node::pointer(link)!=succs[i]){
+                if(!newNode->forward()[i].compare_exchange_strong(link,reinterpret_cast<uintptr_t>(succs[i]))){
+                    break; //CAS期间被标记
+                }
+            }
+            uintptr_t expected=reinterpret_cast<uintptr_t>(succs[i]);
+            if(preds[i]->forward()[i].compare_exchange_strong(expected,reinterpret_cast<uintptr_t>(newNode))){
+                break;
+            }
+            find(key,preds,succs);
+            if(succs[0]!=newNode){
+                goto done; //节点已经被删除
+            }
+        }
+    }
+done:
+    //链入过程中节点可能被删除，删除线程的find可能早于这里的链入，所以再find一次确保节点被摘除
+    if(Node::isMarked(newNode->forward()[0].load())){
+        find(key,preds,succs);
+    }
+    release(newNode);
+    return newNode;
+}
+
+//不在这里进入临界区：返回的节点在调用者使用完之前必须一直受保护，由调用者持有Guard
+template<typename Key,typename Value>
+ConcurrentSkipListNode<Key,Value>* ConcurrentSkipList<Key,Value>::searchItem(const Key& key){
+    Node* pred=head;
+    Node* current=nullptr;
+    for(int i=MAX_SKIP_LIST_LEVEL-1;i>=0;i--){
+        current=Node::pointer(pred->forward()[i].load());
+        while(current!=nullptr){
+            uintptr_t succ=current->forward()[i].load();
+            if(Node::isMarked(succ)){
+                current=Node::pointer(succ); //跳过已删除的节点，但不摘除
+            }else if(current->key<key){
+                pred=current;
+                current=Node::pointer(succ);
+            }else{
+                break;
+            }
+        }
+    }
+    if(current!=nullptr&&current->key==key){
+        return current; //第0层的循环已经跳过了被标记的节点
+    }
+    return nullptr;
+}
+
+template<typename Key,typename Value>
+bool ConcurrentSkipList<Key,Value>::deleteItem(const Key& key){
+    EpochManager::Guard guard;
+    Node* preds[MAX_SKIP_LIST_LEVEL];
+    Node* succs[MAX_SKIP_LIST_LEVEL];
+    if(!find(key,preds,succs)){
+        return false;
+    }
+    Node* victim=succs[0];
+    //从高层到第1层依次标记
+    for(int i=victim->level-1;i>=1;i--){
+        uintptr_t link=victim->forward()[i].load();
+        while(!Node::isMarked(link)){
+            victim->forward()[i].compare_exchange_weak(link,link|1);
+        }
+    }
+    //标记第0层，标记成功的线程负责摘除和回收
+    uintptr_t link=victim->forward()[0].load();
+    while(true){
+        if(Node::isMarked(link)){
+            return false; //被其他线程抢先删除
+        }
+        if(victim->forward()[0].compare_exchange_strong(link,link|1)){
+            break;
+        }
+    }
+    find(key,preds,succs); //摘除victim
+    elementNumber--;
+    release(victim);
+    return true;
+}
+
+//和SkipList::randomNode的选择方法相同，只经过没有被删除的节点；没有并发修改时（外部的锁下）和SkipList的分布一致
+template<typename Key,typename Value>
+ConcurrentSkipListNode<Key,Value>* ConcurrentSkipList<Key,Value>::randomNode(uint64_t random){
+    Node* node=head;
+    uint64_t length=1;
+    for(int i=MAX_SKIP_LIST_LEVEL-1;i>=0;i--){
+        Node* end=i+1<MAX_SKIP_LIST_LEVEL?node->getNext(i+1):nullptr;
+        length=1;
+        for(Node* next=node->getNext(i);next!=nullptr&&next!=end;next=next->getNext(i)){
+            length++;
+        }
+        if(i==0){
+            break;
+        }
+        random=random*6364136223846793005ULL+1442695040888963407ULL; //每次取随机数时推进一步
+        for(uint64_t steps=(random>>32)%length;steps>0&&node->getNext(i)!=nullptr;steps--){
+            node=node->getNext(i);
+        }
+    }
+    random=random*6364136223846793005ULL+1442695040888963407ULL;
+    for(uint64_t steps=1+(random>>32)%std::max<uint64_t>(SKIP_LIST_SAMPLE_WALK,length);steps>0&&node->getNext()!=nullptr;steps--){
+        node=node->getNext();
+    }
+    return node==head?nullptr:node;
+}
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef EPOCHMANAGER_H
+#define EPOCHMANAGER_H
+#include<atomic>
+#include<vector>
+#include<mutex>
+#include<cstdint>
+#include<stdexcept>
+#define EPOCH_MAX_THREADS 1024 //同时访问无锁结构的最大线程数
+#define EPOCH_RECLAIM_THRESHOLD 64 //每个线程积累这么多待回收对象后尝试推进纪元并回收
+
+/*
+    基于纪元（epoch）的内存回收，用于无锁数据结构
+    线程访问无锁结构之前进入临界区（Guard），在自己的槽位上公布当前的全局纪元，退出时清除。
+    从结构中摘除的对象不能立即释放（其他线程可能还在读它），而是连同当时的全局纪元一起放入待回收列表。
+    只有当所有处于临界区的线程都已经看到当前纪元时，全局纪元才能加1；
+    因此纪元为e时摘除的对象，在全局纪元达到e+2之后，已经没有任何线程持有它的指针，可以安全释放。
+    从无锁结构中取得的指针只在取得它的Guard的作用域内有效：Guard析构之后不能再访问，也不能保存下来以后使用。
+    进程内所有无锁结构共享一个EpochManager。
+*/
+class EpochManager{
+public:
+    //不析构：其他静态对象（例如RedisServer的单例）析构时可能还会访问无锁结构，进程退出时剩下的对象随进程释放
+    static EpochManager& instance(){
+        static EpochManager* manager=new EpochManager();
+        return *manager;
+    }
+    //临界区守卫：构造时进入临界区，析构时退出，可以嵌套
+    class Guard{
+    public:
+        Guard(){ EpochManager::instance().enter(); }
+        ~Guard(){ EpochManager::instance().exit(); }
+        Guard(const Guard&)=delete;
+        Guard& operator=(const Guard&)=delete;
+    };
+    void enter();
+    void exit();
+    //对象已经从无锁结构中摘除，等到安全时调用deleter(ptr)释放
+    void retire(void* ptr,void(*deleter)(void*));
+    EpochManager(const EpochManager&)=delete;
+    EpochManager& operator=(const EpochManager&)=delete;
+private:
+    static const uint64_t QUIESCENT=UINT64_MAX; //线程不在临界区
+    struct alignas(64) Slot{ //每个线程一个槽位，按缓存行对齐避免伪共享
+        std::atomic<uint64_t> epoch{QUIESCENT};
+        std::atomic<bool> inUse{false};
+    };
+    struct Retired{
+        void* ptr;
+        void(*deleter)(void*);
+        uint64_t epoch; //摘除时的全局纪元
+    };
+    //线程本地状态，线程退出时归还槽位，未回收的对象交给orphans
+    struct ThreadState{
+        int slot=-1;
+        int depth=0; //临界区嵌套深度
+        std::vector<Retired> retired;
+        size_t reclaimAt=EPOCH_RECLAIM_THRESHOLD; //retired达到这个长度时回收；有线程停留在旧纪元时剩下的对象不会每次retire都重新检查
+        ~ThreadState();
+    };
+    EpochManager()=default;
+    ThreadState& threadState();
+    bool tryAdvance(); //所有处于临界区的线程都已看到当前纪元时，将全局纪元加1
+    void reclaim(std::vector<Retired>& list); //释放list中已经安全的对象
+
+    std::atomic<uint64_t> globalEpoch{2};
+    std::atomic<int> slotLimit{0}; //用过的槽位的最大下标加1，推进纪元时只检查这些槽位
+    Slot slots[EPOCH_MAX_THREADS];
+    std::mutex orphanMutex;
+    std::vector<Retired> orphans; //已退出线程遗留的待回收对象
+};
+
+inline EpochManager::ThreadState& EpochManager::threadState(){
+    static thread_local ThreadState state;
+    if(state.slot<0){
+        //第一次使用时申请一个空闲槽位
+        for(int i=0;i<EPOCH_MAX_THREADS;i++){
+            bool expected=false;
+            if(!slots[i].inUse.load()&&slots[i].inUse.compare_exchange_strong(expected,true)){
+                state.slot=i;
+                break;
+            }
+        }
+        if(state.slot<0){
+            throw std::runtime_error("too many threads for EpochManager");
+        }
+        int limit=slotLimit.load();
+        while(limit<state.slot+1&&!slotLimit.compare_exchange_weak(limit,state.slot+1)){
+        }
+    }
+    return state;
+}
+
+inline EpochManager::ThreadState::~ThreadState(){
+    if(slot<0){
+        return;
+    }
+    EpochManager& manager=EpochManager::instance();
+    if(!retired.empty()){
+        std::lock_guard<std::mutex> lock(manager.orphanMutex);
+        manager.orphans.insert(manager.orphans.end(),retired.begin(),retired.end());
+    }
+    manager.slots[slot].epoch.store(QUIESCENT);
+    manager.slots[slot].inUse.store(false);
+}
+
+inline void EpochManager::enter(){
+    ThreadState& state=threadState();
+    if(state.depth++==0){
+        slots[state.slot].epoch.store(globalEpoch.load());
+        //公布纪元之后才能读取共享指针：推进纪元的线程要么看到这里的纪元，要么推进在先，之后摘除的对象不会被这里读到
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+inline void EpochManager::exit(){
+    ThreadState& state=threadState();
+    if(--state.depth==0){
+        slots[state.slot].epoch.store(QUIESCENT,std::memory_order_release);
+    }
+}
+
+inline bool EpochManager::tryAdvance(){
+    uint64_t epoch=globalEpoch.load();
+    int limit=slotLimit.load();
+    for(int i=0;i<limit;i++){
+        uint64_t threadEpoch=slots[i].epoch.load();
+        if(threadEpoch!=QUIESCENT&&threadEpoch!=epoch){
+            return false; //还有线程停留在旧纪元
+        }
+    }
+    return globalEpoch.compare_exchange_strong(epoch,epoch+1);
+}
+
+inline void EpochManager::reclaim(std::vector<Retired>& list){
+    uint64_t epoch=globalEpoch.load();
+    size_t kept=0;
+    for(size_t i=0;i<list.size();i++){
+        if(list[i].epoch+2<=epoch){
+            list[i].deleter(list[i].ptr);
+        }else{
+            list[kept++]=list[i];
+        }
+    }
+    list.resize(kept);
+}
+
+inline void EpochManager::retire(void* ptr,void(*deleter)(void*)){
+    ThreadState& state=threadState();
+    state.retired.push_back({ptr,deleter,globalEpoch.load()});
+    if(state.retired.size()>=state.reclaimAt){
+        tryAdvance();
+        reclaim(state.retired);
+        state.reclaimAt=state.retired.size()+EPOCH_RECLAIM_THRESHOLD;
+        std::unique_lock<std::mutex> lock(orphanMutex,std::try_to_lock);
+        if(lock.owns_lock()&&!orphans.empty()){
+            reclaim(orphans);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,152 @@
+#include "Eviction.h"
+#include<atomic>
+#include<chrono>
+#include<random>
+#include<cctype>
+#include<cstdint>
+
+namespace{
+std::atomic<size_t> maxMemory{0};
+std::atomic<int> maxMemoryPolicy{NOEVICTION};
+
+const struct{
+    MaxMemoryPolicy policy;
+    const char* name;
+} POLICY_NAMES[]={
+    {NOEVICTION,"noeviction"},
+    {ALLKEYS_LRU,"allkeys-lru"},
+    {VOLATILE_LRU,"volatile-lru"},
+    {ALLKEYS_LFU,"allkeys-lfu"},
+};
+
+int64_t monotonicMs(){
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint32_t lruClock(){
+    return (monotonicMs()/LRU_CLOCK_RESOLUTION)&LRU_CLOCK_MAX;
+}
+
+uint32_t lfuMinutes(){
+    return (monotonicMs()/60000)&0xFFFF;
+}
+
+//按经过的分钟数衰减计数，分钟数是16位的，回绕后按回绕计算
+uint32_t lfuDecayedCounter(uint32_t info){
+    uint32_t last=info>>8;
+    uint32_t counter=info&0xFF;
+    uint32_t now=lfuMinutes();
+    uint32_t elapsed=now>=last?now-last:0x10000-last+now;
+    uint32_t periods=elapsed/LFU_DECAY_TIME;
+    return periods>=counter?0:counter-periods;
+}
+
+uint32_t lfuLogIncrement(uint32_t counter){
+    if(counter==0xFF){
+        return counter;
+    }
+    static thread_local std::mt19937 generator{std::random_device{}()};
+    std::uniform_real_distribution<double> distribution(0.0,1.0);
+    double base=counter>LFU_INIT_VAL?counter-LFU_INIT_VAL:0;
+    if(distribution(generator)<1.0/(base*LFU_LOG_FACTOR+1)){
+        counter++;
+    }
+    return counter;
+}
+}
+
+bool parseMaxMemoryPolicy(const std::string& name,MaxMemoryPolicy& policy){
+    for(auto& item:POLICY_NAMES){
+        if(name==item.name){
+            policy=item.policy;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string maxMemoryPolicyName(MaxMemoryPolicy policy){
+    for(auto& item:POLICY_NAMES){
+        if(policy==item.policy){
+            return item.name;
+        }
+    }
+    return "unknown";
+}
+
+bool parseMemorySize(const std::string& text,size_t& bytes){
+    size_t digits=0;
+    while(digits<text.size()&&std::isdigit(static_cast<unsigned char>(text[digits]))){
+        digits++;
+    }
+    if(digits==0||digits>18){
+        return false;
+    }
+    std::string unit;
+    for(size_t i=digits;i<text.size();i++){
+        unit.push_back(std::tolower(static_cast<unsigned char>(text[i])));
+    }
+    size_t multiple;
+    if(unit.empty()||unit=="b"){
+        multiple=1;
+    }else if(unit=="k"){
+        multiple=1000;
+    }else if(unit=="kb"){
+        multiple=1024;
+    }else if(unit=="m"){
+        multiple=1000*1000;
+    }else if(unit=="mb"){
+        multiple=1024*1024;
+    }else if(unit=="g"){
+        multiple=1000*1000*1000;
+    }else if(unit=="gb"){
+        multiple=1024*1024*1024;
+    }else{
+        return false;
+    }
+    unsigned long long value=std::stoull(text.substr(0,digits));
+    if(value>SIZE_MAX/multiple){
+        return false;
+    }
+    bytes=value*multiple;
+    return true;
+}
+
+void setMaxMemory(size_t bytes){
+    maxMemory=bytes;
+}
+
+size_t getMaxMemory(){
+    return maxMemory.load(std::memory_order_relaxed);
+}
+
+void setMaxMemoryPolicy(MaxMemoryPolicy policy){
+    maxMemoryPolicy=policy;
+}
+
+MaxMemoryPolicy getMaxMemoryPolicy(){
+    return static_cast<MaxMemoryPolicy>(maxMemoryPolicy.load(std::memory_order_relaxed));
+}
+
+uint32_t newAccessInfo(){
+    if(getMaxMemoryPolicy()==ALLKEYS_LFU){
+        return lfuMinutes()<<8|LFU_INIT_VAL;
+    }
+    return lruClock();
+}
+
+uint32_t touchAccessInfo(uint32_t info){
+    if(getMaxMemoryPolicy()==ALLKEYS_LFU){
+        return lfuMinutes()<<8|lfuLogIncrement(lfuDecayedCounter(info));
+    }
+    return lruClock();
+}
+
+uint64_t evictionScore(uint32_t info){
+    if(getMaxMemoryPolicy()==ALLKEYS_LFU){
+        return 0xFF-lfuDecayedCounter(info);
+    }
+    uint32_t clock=lruClock();
+    uint32_t lru=info&LRU_CLOCK_MAX;
+    return clock>=lru?clock-lru:LRU_CLOCK_MAX-lru+clock;
+}
@@ -0,0 +1,42 @@
+#ifndef EVICTION_H
+#define EVICTION_H
+#include<string>
+#include<cstdint>
+#include<cstddef>
+#define LRU_CLOCK_BITS 24 //节点中LRU时钟的位数
+#define LRU_CLOCK_MAX ((1u<<LRU_CLOCK_BITS)-1)
+#define LRU_CLOCK_RESOLUTION 100 //LRU时钟的精度，毫秒；24位约19天回绕一次，回绕后空闲时间按回绕计算
+#define LFU_INIT_VAL 5 //新key的LFU计数，避免刚写入的key马上被淘汰
+#define LFU_LOG_FACTOR 10 //计数越大增长越慢，计数为c时每次访问以1/((c-LFU_INIT_VAL)*LFU_LOG_FACTOR+1)的概率加1
+#define LFU_DECAY_TIME 1 //每隔多少分钟没有访问，LFU计数减1
+#define MAXMEMORY_SAMPLES 5 //每次淘汰时每个数据库抽样的key数
+#define EVICTION_POOL_SIZE 16 //淘汰池保留的候选key数
+
+//超过maxmemory时的处理策略
+enum MaxMemoryPolicy{
+    NOEVICTION, //不淘汰，会增加内存的写命令返回错误
+    ALLKEYS_LRU, //在所有key中淘汰最久没有访问的
+    VOLATILE_LRU, //只在设置了过期时间的key中淘汰最久没有访问的
+    ALLKEYS_LFU //在所有key中淘汰访问频率最低的
+};
+
+bool parseMaxMemoryPolicy(const std::string& name,MaxMemoryPolicy& policy);
+std::string maxMemoryPolicyName(MaxMemoryPolicy policy);
+bool parseMemorySize(const std::string& text,size_t& bytes); //和Redis一样支持k/m/g（1000进制）和kb/mb/gb（1024进制）后缀，不区分大小写
+
+//进程内只有一份的淘汰配置，跳表节点创建时需要知道按LRU还是LFU记录访问信息
+void setMaxMemory(size_t bytes); //0表示不限制
+size_t getMaxMemory();
+void setMaxMemoryPolicy(MaxMemoryPolicy policy);
+MaxMemoryPolicy getMaxMemoryPolicy();
+
+/*
+    每个跳表节点有32位的访问信息：
+        LRU：低24位是最后一次访问时的LRU时钟；
+        LFU：高16位是上次衰减时的分钟数，低8位是对数计数器（Morris计数器），访问越多增长越慢，最大255，长时间不访问时衰减。
+    按当前的策略解释，切换策略后旧的访问信息会被当作另一种格式，之后的访问会逐渐覆盖。
+*/
+uint32_t newAccessInfo(); //新节点的访问信息
+uint32_t touchAccessInfo(uint32_t info); //访问后的访问信息
+uint64_t evictionScore(uint32_t info); //越大越应该被淘汰：LRU为空闲时间，LFU为255减去衰减后的计数
+#endif
@@ -0,0 +1,173 @@
+#ifndef HASHINDEX_H
+#define HASHINDEX_H
+#include<vector>
+#include<string>
+#include<cstdint>
+#include<cstring>
+#define HASH_INDEX_INIT_CAPACITY 16 //初始槽位数，必须是2的幂
+#define HASH_INDEX_MAX_LOAD 0.75 //装载因子超过该值时扩容为原来的两倍
+#define HASH_INDEX_MIN_LOAD 0.125 //删除后装载因子低于该值时缩小为原来的一半，不小于初始槽位数
+#define HASH_INDEX_SAMPLE_TRIES 64 //抽样时最多随机探测的槽位数，装载因子不低于HASH_INDEX_MIN_LOAD时几乎不会全部落空
+
+//非加密哈希函数（MurmurHash64A），每次处理8个字节，比逐字节的std::hash更快
+inline uint64_t hashBytes(const void* data,size_t length,uint64_t seed=0xc70f6907UL){
+    const uint64_t m=0xc6a4a7935bd1e995ULL;
+    const int r=47;
+    uint64_t h=seed^(length*m);
+    const unsigned char* p=static_cast<const unsigned char*>(data);
+    const unsigned char* end=p+(length/8)*8;
+    for(;p!=end;p+=8){
+        uint64_t k;
+        std::memcpy(&k,p,8); //不要求对齐
+        k*=m;
+        k^=k>>r;
+        k*=m;
+        h^=k;
+        h*=m;
+    }
+    switch(length&7){
+    case 7: h^=uint64_t(p[6])<<48; //fallthrough
+    case 6: h^=uint64_t(p[5])<<40; //fallthrough
+    case 5: h^=uint64_t(p[4])<<32; //fallthrough
+    case 4: h^=uint64_t(p[3])<<24; //fallthrough
+    case 3: h^=uint64_t(p[2])<<16; //fallthrough
+    case 2: h^=uint64_t(p[1])<<8; //fallthrough
+    case 1: h^=uint64_t(p[0]);
+            h*=m;
+    }
+    h^=h>>r;
+    h*=m;
+    h^=h>>r;
+    return h;
+}
+
+inline uint64_t hashKey(const std::string& key){
+    return hashBytes(key.data(),key.size());
+}
+
+/*
+    key到跳表节点的开放寻址哈希索引，用于点查询，跳表只负责有序遍历
+    线性探测，槽位中保存key的哈希值和节点指针，比较key之前先比较哈希值；
+    删除时把后面的元素向前移动（backward shift），不使用墓碑，查找长度不会因为删除而变长；
+    大量删除后缩小槽位数组，保持装载因子，抽样时随机探测槽位命中的概率不会太低。
+    索引不持有节点，节点的生命周期由跳表管理；索引本身不加锁，由使用它的分片保证互斥。
+*/
+template<typename Node>
+class HashIndex{
+public:
+    HashIndex():slots(HASH_INDEX_INIT_CAPACITY){}
+    Node* find(const std::string& key) const; //查找key对应的节点，不存在时返回nullptr
+    void insert(Node* node); //插入node，node->key已存在时替换
+    bool erase(const std::string& key); //删除key，返回是否存在
+    void clear(){ slots.assign(HASH_INDEX_INIT_CAPACITY,Slot()); count=0; }
+    size_t size() const{ return count; }
+    Node* sample(uint64_t random) const; //随机选取一个元素，用于淘汰时抽样，索引为空时返回nullptr
+    size_t memoryBytes() const{ return slots.capacity()*sizeof(Slot); } //槽位数组占用的字节数
+private:
+    struct Slot{
+        uint64_t hash=0;
+        Node* node=nullptr; //nullptr表示空槽位
+    };
+    size_t mask() const{ return slots.size()-1; }
+    void rehash(size_t capacity); //改变槽位数并重新放置所有元素
+    std::vector<Slot> slots;
+    size_t count=0;
+};
+
+template<typename Node>
+Node* HashIndex<Node>::find(const std::string& key) const{
+    uint64_t hash=hashKey(key);
+    for(size_t i=hash&mask();slots[i].node!=nullptr;i=(i+1)&mask()){
+        if(slots[i].hash==hash&&slots[i].node->key==key){
+            return slots[i].node;
+        }
+    }
+    return nullptr;
+}
+
+//每次探测一个随机槽位，每个元素被选中的概率相同；
+//从随机位置向后找第一个元素则会偏向前面空槽位多的元素，删除较多时还要扫描很长一段
+template<typename Node>
+Node* HashIndex<Node>::sample(uint64_t random) const{
+    if(count==0){
+        return nullptr;
+    }
+    for(int tries=0;tries<HASH_INDEX_SAMPLE_TRIES;tries++){
+        random=random*6364136223846793005ULL+1442695040888963407ULL; //线性同余，由一个随机数得到探测序列
+        size_t i=(random>>32)&mask();
+        if(slots[i].node!=nullptr){
+            return slots[i].node;
+        }
+    }
+    for(size_t i=random&mask();;i=(i+1)&mask()){ //都落空时退回到线性查找
+        if(slots[i].node!=nullptr){
+            return slots[i].node;
+        }
+    }
+}
+
+template<typename Node>
+void HashIndex<Node>::insert(Node* node){
+    if(count+1>slots.size()*HASH_INDEX_MAX_LOAD){
+        rehash(slots.size()*2);
+    }
+    uint64_t hash=hashKey(node->key);
+    size_t i=hash&mask();
+    for(;slots[i].node!=nullptr;i=(i+1)&mask()){
+        if(slots[i].hash==hash&&slots[i].node->key==node->key){
+            slots[i].node=node;
+            return;
+        }
+    }
+    slots[i].hash=hash;
+    slots[i].node=node;
+    count++;
+}
+
+template<typename Node>
+bool HashIndex<Node>::erase(const std::string& key){
+    uint64_t hash=hashKey(key);
+    size_t i=hash&mask();
+    for(;slots[i].node!=nullptr;i=(i+1)&mask()){
+        if(slots[i].hash==hash&&slots[i].node->key==key){
+            break;
+        }
+    }
+    if(slots[i].node==nullptr){
+        return false;
+    }
+    //把空出来的槽位之后、不在自己理想位置上的元素向前移动，保证线性探测的查找不会提前遇到空槽位
+    size_t hole=i;
+    for(size_t j=(i+1)&mask();slots[j].node!=nullptr;j=(j+1)&mask()){
+        size_t home=slots[j].hash&mask();
+        //home不在(hole,j]这个环形区间内时，元素j可以移动到hole
+        if(((j-home)&mask())>=((j-hole)&mask())){
+            slots[hole]=slots[j];
+            hole=j;
+        }
+    }
+    slots[hole]=Slot();
+    count--;
+    if(slots.size()>HASH_INDEX_INIT_CAPACITY&&count<slots.size()*HASH_INDEX_MIN_LOAD){
+        rehash(slots.size()/2);
+    }
+    return true;
+}
+
+template<typename Node>
+void HashIndex<Node>::rehash(size_t capacity){
+    std::vector<Slot> old(capacity);
+    old.swap(slots);
+    for(auto& slot:old){
+        if(slot.node==nullptr){
+            continue;
+        }
+        size_t i=slot.hash&mask();
+        while(slots[i].node!=nullptr){
+            i=(i+1)&mask();
+        }
+        slots[i]=slot;
+    }
+}
+
+#endif
@@ -0,0 +1,160 @@
+#include "MemoryCounter.h"
+#include<atomic>
+#include<cstdint>
+#include<cstdlib>
+#include<new>
+#include<cstdio>
+#include<malloc.h>
+#include<unistd.h>
+
+namespace{
+struct alignas(64) CounterSlot{
+    std::atomic<int64_t> bytes{0};
+    std::atomic<int64_t> allocations{0};
+};
+CounterSlot counterSlots[MEMORY_COUNTER_SLOTS];
+std::atomic<unsigned> nextSlot{0};
+thread_local int threadSlot=-1; //不需要动态初始化，operator new在静态初始化期间也可以使用
+
+inline CounterSlot& currentSlot(){
+    if(threadSlot<0){
+        threadSlot=nextSlot.fetch_add(1,std::memory_order_relaxed)%MEMORY_COUNTER_SLOTS;
+    }
+    return counterSlots[threadSlot];
+}
+
+inline void countBytes(int64_t bytes){
+    currentSlot().bytes.fetch_add(bytes,std::memory_order_relaxed);
+}
+
+inline void countAllocation(int64_t bytes){
+    CounterSlot& slot=currentSlot();
+    slot.bytes.fetch_add(bytes,std::memory_order_relaxed);
+    slot.allocations.fetch_add(1,std::memory_order_relaxed);
+}
+
+//operator new失败时按标准调用new_handler，没有时抛出bad_alloc
+void* allocateOrThrow(size_t size){
+    if(size==0){
+        size=1;
+    }
+    while(true){
+        void* pointer=countedMalloc(size);
+        if(pointer!=nullptr){
+            return pointer;
+        }
+        std::new_handler handler=std::get_new_handler();
+        if(handler==nullptr){
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+}
+
+void* countedMalloc(size_t size){
+    void* pointer=std::malloc(size);
+    if(pointer!=nullptr){
+        countAllocation(malloc_usable_size(pointer));
+    }
+    return pointer;
+}
+
+void* countedCalloc(size_t count,size_t size){
+    void* pointer=std::calloc(count,size);
+    if(pointer!=nullptr){
+        countAllocation(malloc_usable_size(pointer));
+    }
+    return pointer;
+}
+
+void countedFree(void* pointer){
+    if(pointer!=nullptr){
+        countBytes(-int64_t(malloc_usable_size(pointer)));
+        std::free(pointer);
+    }
+}
+
+size_t allocationSize(const void* pointer){
+    return pointer!=nullptr?malloc_usable_size(const_cast<void*>(pointer)):0;
+}
+
+void adjustUsedMemory(ptrdiff_t bytes){
+    countBytes(bytes);
+}
+
+//各个槽位分别读取，不是同一时刻的精确值；不同线程分配和释放同一块内存时单个槽位可能为负数，总和不会
+size_t usedMemory(){
+    int64_t total=0;
+    for(auto& slot:counterSlots){
+        total+=slot.bytes.load(std::memory_order_relaxed);
+    }
+    return total>0?total:0;
+}
+
+size_t allocationCount(){
+    int64_t total=0;
+    for(auto& slot:counterSlots){
+        total+=slot.allocations.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+size_t residentMemory(){
+    FILE* file=std::fopen("/proc/self/statm","r");
+    if(file==nullptr){
+        return 0;
+    }
+    unsigned long long pages=0,residentPages=0;
+    int fields=std::fscanf(file,"%llu %llu",&pages,&residentPages);
+    std::fclose(file);
+    return fields==2?residentPages*sysconf(_SC_PAGESIZE):0;
+}
+
+void* operator new(size_t size){
+    return allocateOrThrow(size);
+}
+
+void* operator new[](size_t size){
+    return allocateOrThrow(size);
+}
+
+void* operator new(size_t size,const std::nothrow_t&) noexcept{
+    try{
+        return allocateOrThrow(size);
+    }catch(...){
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t size,const std::nothrow_t&) noexcept{
+    try{
+        return allocateOrThrow(size);
+    }catch(...){
+        return nullptr;
+    }
+}
+
+void operator delete(void* pointer) noexcept{
+    countedFree(pointer);
+}
+
+void operator delete[](void* pointer) noexcept{
+    countedFree(pointer);
+}
+
+void operator delete(void* pointer,size_t) noexcept{
+    countedFree(pointer);
+}
+
+void operator delete[](void* pointer,size_t) noexcept{
+    countedFree(pointer);
+}
+
+void operator delete(void* pointer,const std::nothrow_t&) noexcept{
+    countedFree(pointer);
+}
+
+void operator delete[](void* pointer,const std::nothrow_t&) noexcept{
+    countedFree(pointer);
+}
@@ -0,0 +1,32 @@
+#ifndef MEMORYCOUNTER_H
+#define MEMORYCOUNTER_H
+#include<cstddef>
+#include<string>
+#define MEMORY_COUNTER_SLOTS 64 //计数器的槽位数，线程按创建顺序分配槽位，超过槽位数时共用
+
+/*
+    统计服务器使用的内存字节数（相当于Redis的used_memory），maxmemory按它判断是否需要淘汰key：
+        全局的operator new/delete替换为带统计的版本，按malloc_usable_size计入分配器的对齐开销；
+        直接调用malloc的地方使用countedCalloc/countedFree；
+        跳表节点的内存池按正在使用的字节数调用adjustUsedMemory，空闲链表中的节点和分配器中的空闲内存一样不计入。
+    每个线程把增减累加到自己的槽位上（缓存行对齐），分配路径上没有线程之间共享的缓存行，读取时对所有槽位求和。
+*/
+void* countedMalloc(size_t size);
+void* countedCalloc(size_t count,size_t size);
+void countedFree(void* pointer);
+void adjustUsedMemory(ptrdiff_t bytes); //不经过上面的函数分配的内存（例如内存池）自己报告增减
+size_t usedMemory();
+size_t allocationCount(); //累计的分配次数（operator new、countedMalloc、countedCalloc），基准测试用来统计每次操作的分配次数
+size_t residentMemory(); //进程的常驻内存（RSS），从/proc/self/statm读取，读取失败时为0
+
+//按分配器统计单个对象占用的内存（MEMORY USAGE、按数据库统计）：
+size_t allocationSize(const void* pointer); //malloc或operator new分配的内存块实际占用的字节数（包括分配器的对齐），nullptr为0
+inline size_t stringHeapBytes(const std::string& value){ //字符串在堆上占用的字节数，短字符串保存在对象内部时为0
+    const char* data=value.data();
+    const char* object=reinterpret_cast<const char*>(&value);
+    if(data>=object&&data<object+sizeof(value)){
+        return 0;
+    }
+    return allocationSize(data);
+}
+#endif
@@ -0,0 +1,84 @@
+#ifndef NODEARENA_H
+#define NODEARENA_H
+#include<vector>
+#include<cstddef>
+#include<cstdlib>
+#include<new>
+#include"MemoryCounter.h"
+#define ARENA_BLOCK_SIZE (64*1024) //每次向系统申请的内存块大小
+#define ARENA_ALIGNMENT alignof(std::max_align_t) //分配的内存按该值对齐
+
+/*
+    跳表节点的内存池（slab分配器）
+    节点的大小由层高决定，每种层高是一个大小类别，每个类别有自己的空闲链表：
+    释放的节点挂到空闲链表上，下次分配同样大小的节点时直接复用，不再调用malloc/free。
+    内存按块向系统申请，节点在块中连续切分，内存池析构时一次性释放所有的块。
+    内存池本身不加锁，由使用它的跳表保证互斥。
+    正在使用的字节数计入MemoryCounter，空闲链表中的节点不计入：删除key后used_memory下降，maxmemory淘汰才能生效。
+*/
+class NodeArena{
+public:
+    explicit NodeArena(size_t classNumber):freeLists(classNumber,nullptr){}
+    ~NodeArena();
+    NodeArena(const NodeArena&)=delete;
+    NodeArena& operator=(const NodeArena&)=delete;
+
+    void* allocate(size_t sizeClass,size_t bytes); //分配bytes字节，sizeClass相同的分配请求bytes也必须相同
+    void deallocate(size_t sizeClass,size_t bytes,void* ptr); //归还到sizeClass的空闲链表
+    size_t allocatedBytes() const{ return allocated; } //向系统申请的总字节数
+    size_t usedBytes() const{ return used; } //正在被使用的字节数
+private:
+    struct FreeNode{ FreeNode* next; };
+    static size_t alignSize(size_t bytes){ return (bytes+ARENA_ALIGNMENT-1)/ARENA_ALIGNMENT*ARENA_ALIGNMENT; }
+    std::vector<FreeNode*> freeLists; //每个大小类别的空闲链表
+    std::vector<void*> blocks; //向系统申请的所有内存块
+    char* current=nullptr; //当前块中下一个可分配的位置
+    size_t remaining=0; //当前块剩余的字节数
+    size_t allocated=0;
+    size_t used=0;
+};
+
+inline NodeArena::~NodeArena(){
+    adjustUsedMemory(-ptrdiff_t(used));
+    for(void* block:blocks){
+        std::free(block);
+    }
+}
+
+inline void* NodeArena::allocate(size_t sizeClass,size_t bytes){
+    bytes=alignSize(bytes);
+    used+=bytes;
+    adjustUsedMemory(bytes);
+    //优先复用空闲链表中的节点
+    FreeNode* node=freeLists[sizeClass];
+    if(node!=nullptr){
+        freeLists[sizeClass]=node->next;
+        return node;
+    }
+    if(remaining<bytes){
+        //当前块不够用，申请新块（超过块大小的请求单独申请一块），旧块剩余的部分不再使用
+        size_t blockSize=bytes>ARENA_BLOCK_SIZE?bytes:ARENA_BLOCK_SIZE;
+        void* block=std::malloc(blockSize);
+        if(block==nullptr){
+            throw std::bad_alloc();
+        }
+        blocks.push_back(block);
+        allocated+=blockSize;
+        current=static_cast<char*>(block);
+        remaining=blockSize;
+    }
+    void* ptr=current;
+    current+=bytes;
+    remaining-=bytes;
+    return ptr;
+}
+
+inline void NodeArena::deallocate(size_t sizeClass,size_t bytes,void* ptr){
+    used-=alignSize(bytes);
+    adjustUsedMemory(-ptrdiff_t(alignSize(bytes)));
+    FreeNode* node=static_cast<FreeNode*>(ptr);
+    node->next=freeLists[sizeClass];
+    freeLists[sizeClass]=node;
+}
+
+#endif
@@ -1,6 +1,7 @@
 #include"ParserFlyweightFactory.h"
 
 std::shared_ptr<CommandParser> ParserFlyweightFactory::getParser(std::string& command){
+    std::lock_guard<std::mutex> lock(mutex);
     if(parserMaps.find(command)!=parserMaps.end()){
         return parserMaps[command];
     }
@@ -54,6 +55,34 @@ std::shared_ptr<CommandParser> ParserFlyweightFactory::createCommandParser(std::
             parserMaps[command]=std::make_shared<RenameParser>();
             break;
         }
+        case EXPIRE:{
+            parserMaps[command]=std::make_shared<ExpireParser>();
+            break;
+        }
+        case PEXPIRE:{
+            parserMaps[command]=std::make_shared<PExpireParser>();
+            break;
+        }
+        case EXPIREAT:{
+            parserMaps[command]=std::make_shared<ExpireAtParser>();
+            break;
+        }
+        case PEXPIREAT:{
+            parserMaps[command]=std::make_shared<PExpireAtParser>();
+            break;
+        }
+        case TTL:{
+            parserMaps[command]=std::make_shared<TtlParser>();
+            break;
+        }
+        case PTTL:{
+            parserMaps[command]=std::make_shared<PTtlParser>();
+            break;
+        }
+        case PERSIST:{
+            parserMaps[command]=std::make_shared<PersistParser>();
+            break;
+        }
         case INCR:{
             parserMaps[command]=std::make_shared<IncrParser>();
             break;
@@ -134,6 +163,30 @@ std::shared_ptr<CommandParser> ParserFlyweightFactory::createCommandParser(std::
             parserMaps[command]=std::make_shared<HValsParser>();
             break;
         }
+        case SAVE:{
+            parserMaps[command]=std::make_shared<SaveParser>();
+            break;
+        }
+        case BGSAVE:{
+            parserMaps[command]=std::make_shared<BgsaveParser>();
+            break;
+        }
+        case BGREWRITEAOF:{
+            parserMaps[command]=std::make_shared<BgrewriteaofParser>();
+            break;
+        }
+        case INFO:{
+            parserMaps[command]=std::make_shared<InfoParser>();
+            break;
+        }
+        case CONFIG:{
+            parserMaps[command]=std::make_shared<ConfigParser>();
+            break;
+        }
+        case MEMORY:{
+            parserMaps[command]=std::make_shared<MemoryParser>();
+            break;
+        }
         default:{
             return nullptr;
         }
@@ -2,6 +2,7 @@
 #define PARSER_FLYWEIGHT_FACTORY
 #include"CommandParser.h"
 #include<unordered_map>
+#include<mutex>
 //享元模式工厂
 /*
     这个类用来返回解析器的
@@ -9,6 +10,7 @@
 class ParserFlyweightFactory{
 private:
     std::unordered_map<std::string,std::shared_ptr<CommandParser>> parserMaps; //解析器映射
+    std::mutex mutex; //多个工作线程会同时获取解析器，parserMaps按需创建，需要加锁
     std::shared_ptr<CommandParser> createCommandParser(std::string& command); //创建解析器
 public:
     std::shared_ptr<CommandParser> getParser(std::string& command); //获取解析器
@@ -1,60 +1,855 @@
 #include"RedisHelper.h"
 #include"FileCreator.h"
+#include"Snapshot.h"
+#include<cstring>
+#include<cstdio>
+#include<cerrno>
+#include<csignal>
+#include<unistd.h>
+#include<sys/wait.h>
+#include<sys/resource.h>
+#include<algorithm>
+#include<functional>
 
+//当前线程正在执行的命令，由CommandScope设置，propagate写入AOF
+struct CommandContext{
+    const std::string* command=nullptr; //没有开启AOF时为空
+    uint64_t aofSequence=0; //命令在AOF中的序号，0表示命令没有修改数据
+    bool batch=false; //正在执行批量命令，由BatchScope统一等待AOF写入
+    uint64_t batchSequence=0; //批量命令中已执行的命令在AOF中的最大序号
+};
+static thread_local CommandContext currentCommand;
+//当前线程选择的数据库，由select设置
+static thread_local int currentDataBaseIndex=0;
 
-//写入文件
+//获取数据库，第一次访问时从文件加载
+//已加载时只读一个原子变量，不加锁；加载在loadMutex下进行，同一个数据库只加载一次
+DataBase& RedisHelper::getDataBase(int index){
+    DataBase& dataBase=*dataBases[index];
+    if(dataBase.loaded.load(std::memory_order_acquire)){
+        return dataBase;
+    }
+    std::lock_guard<std::mutex> lock(loadMutex);
+    if(!dataBase.loaded.load(std::memory_order_relaxed)){
+        loadData(dataBase,getFilePath(index));
+        dataBase.loaded.store(true,std::memory_order_release);
+    }
+    return dataBase;
+}
+
+DataBase& RedisHelper::currentDataBase(){
+    return getDataBase(currentDataBaseIndex);
+}
+
+//已经加载的数据库，调用前需要持有loadMutex
+std::vector<int> RedisHelper::loadedDataBases(){
+    std::vector<int> indexes;
+    for(int i=0;i<DATABASE_FILE_NUMBER;i++){
+        if(dataBases[i]->loaded){
+            indexes.push_back(i);
+        }
+    }
+    return indexes;
+}
+
+//key所在分片的下标
+size_t RedisHelper::shardIndex(const std::string& key) const{
+    return std::hash<std::string>()(key)%DATABASE_SHARD_NUMBER;
+}
+
+//当前数据库中key所在的分片
+DataBaseShard& RedisHelper::getShard(const std::string& key){
+    return *currentDataBase().shards[shardIndex(key)];
+}
+
+//对keys涉及的所有分片加锁
+//先对分片下标排序去重，再按从小到大的顺序加锁，保证所有多key命令的加锁顺序一致，不会互相等待造成死锁
+template<typename Lock>
+std::vector<Lock> RedisHelper::lockShards(const std::vector<std::string>& keys){
+    std::vector<size_t> indexes;
+    for(auto& key:keys){
+        indexes.push_back(shardIndex(key));
+    }
+    std::sort(indexes.begin(),indexes.end());
+    indexes.erase(std::unique(indexes.begin(),indexes.end()),indexes.end());
+    DataBase& dataBase=currentDataBase();
+    std::vector<Lock> locks;
+    for(size_t index:indexes){
+        locks.emplace_back(dataBase.shards[index]->mutex);
+    }
+    return locks;
+}
+
+//按顺序对当前数据库的所有分片加锁，用于keys等整库操作
+template<typename Lock>
+std::vector<Lock> RedisHelper::lockAllShards(){
+    std::vector<Lock> locks;
+    for(auto& shard:currentDataBase().shards){
+        locks.emplace_back(shard->mutex);
+    }
+    return locks;
+}
+
+//按数据库下标、分片下标的顺序对多个数据库的所有分片加锁，调用前需要持有loadMutex
+template<typename Lock>
+std::vector<Lock> RedisHelper::lockDataBases(const std::vector<int>& indexes){
+    std::vector<Lock> locks;
+    for(int index:indexes){
+        for(auto& shard:dataBases[index]->shards){
+            locks.emplace_back(shard->mutex);
+        }
+    }
+    return locks;
+}
+
+//写入文件：保存所有已加载的数据库，没有加载的数据库和文件中的一样
 void RedisHelper::flush(){
-    // 打开文件并覆盖写入
-    std::string filePath=getFilePath(); //获取要写入的文件的路径
-    std::ofstream outputFile(filePath); //打开文件
-    // 检查文件是否成功打开
-    if (!outputFile) {
-        std::cout<<"文件："<<filePath<<"打开失败"<<std::endl;
-        return ;
-    }
-    //redisDataBase是个跳表，通过getHead()获取redisDataBase跳表的头节点
-    auto currentNode=redisDataBase->getHead();
-    //遍历redisDataBase跳表，将跳表中的数据写入文件
-    while(currentNode!=nullptr){
-        std::string key=currentNode->key; //获取当前节点的key
-        RedisValue value=currentNode->value; //获取当前节点的value
-        if(!key.empty()) //如果key不为空，则将 {key : value} 键值对写入文件
-            //dump()函数将value（RedisValue类型）转换为字符串（string类型）
-            outputFile<<key<<":"<<value.dump()<<std::endl;
-        //将currentNode指向currentNode在原始链表层（即第0层）中的下一个节点
-        currentNode=currentNode->forward[0];  //forward[i]中的i表示第i层
-    }
-    // 关闭文件
-    outputFile.close();
+    std::lock_guard<std::mutex> lock(loadMutex);
+    std::vector<int> indexes=loadedDataBases();
+    auto locks=lockDataBases<ReadLock>(indexes); //只读取数据，不阻塞其他只读命令
+    flushLocked(indexes);
+}
+
+//写入文件，调用前需要持有loadMutex和这些数据库所有分片的锁
+void RedisHelper::flushLocked(const std::vector<int>& indexes){
+    stopBackgroundSave(); //子进程保存的是更早的数据，不能让它在之后覆盖这次保存的文件
+    uint64_t aofId=0,aofOffset=0;
+    if(aof){
+        aof->position(aofId,aofOffset);
+    }
+    bool ok=true;
+    for(int index:indexes){
+        ok=writeSnapshot(index,countKeys(index),aofId,aofOffset)&&ok;
+    }
+    if(ok){
+        dirty=0;
+        lastSaveTime=time(nullptr);
+        if(aof){
+            aof->truncate(); //AOF中的命令都已经包含在数据库文件中
+        }
+    }
+}
+
+//命令修改了数据，调用前需要持有命令涉及的分片锁：同一个key上的命令按执行顺序写入AOF
+void RedisHelper::propagate(){
+    dirty++;
+    if(aof&&currentCommand.command!=nullptr){
+        currentCommand.aofSequence=aof->append(currentDataBaseIndex,*currentCommand.command);
+    }
+}
+
+//和执行时的时间有关的命令（例如expire、set ... ex）改写为绝对时间后写入AOF，重放的结果和执行时一致
+void RedisHelper::propagate(const std::string& command){
+    dirty++;
+    if(aof&&currentCommand.command!=nullptr){
+        currentCommand.aofSequence=aof->append(currentDataBaseIndex,command);
+    }
+}
+
+int64_t RedisHelper::currentTimeMs(){
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+//重放AOF时不检查过期时间：key在执行时过期被删除的时刻已经作为del记录在AOF中
+void RedisHelper::setExpireEnabled(bool enabled){
+    expireEnabled=enabled;
+}
+
+bool RedisHelper::keyExpired(DataBaseShard& shard,const std::string& key){
+    if(shard.expires.empty()||!expireEnabled){ //没有key设置过期时间时不需要查找
+        return false;
+    }
+    int64_t when=shard.getExpire(key);
+    return when>=0&&when<=currentTimeMs();
+}
+
+//只读命令持有共享锁，不能删除过期的key，只当作不存在，由之后的写命令或主动过期删除
+//找到的key更新访问信息，共享锁下多个线程可能同时更新，丢失一次更新不影响淘汰的近似效果
+DataBaseShard::Node* RedisHelper::lookupKeyRead(DataBaseShard& shard,const std::string& key){
+    DataBaseShard::Node* node=shard.searchItem(key);
+    if(node!=nullptr&&keyExpired(shard,key)){
+        return nullptr;
+    }
+    if(node!=nullptr){
+        node->access.store(touchAccessInfo(node->access.load(std::memory_order_relaxed)),std::memory_order_relaxed);
+    }
+    return node;
+}
+
+//写命令先删除过期的key，之后的addItem不会遇到已经存在的节点
+//无锁跳表：所有修改已有key的value或过期时间的写命令都经过这里，先撤销发布的副本，不加锁的读取改为等待分片锁
+DataBaseShard::Node* RedisHelper::lookupKeyWrite(DataBaseShard& shard,const std::string& key){
+    DataBaseShard::Node* node=shard.searchItem(key);
+    if(node!=nullptr&&keyExpired(shard,key)){
+        deleteExpiredKey(shard,key,currentDataBaseIndex);
+        return nullptr;
+    }
+    if(node!=nullptr){
+        node->access.store(touchAccessInfo(node->access.load(std::memory_order_relaxed)),std::memory_order_relaxed);
+#ifdef USE_CONCURRENT_SKIPLIST
+        node->unpublish();
+#endif
+    }
+    return node;
+}
+
+#ifdef USE_CONCURRENT_SKIPLIST
+//直接在无锁跳表中查找，不经过哈希索引（索引只在分片锁下访问）；发布的副本中有过期时间，不需要访问expires
+bool RedisHelper::readPublished(DataBaseShard& shard,const std::string& key,const RedisValue*& value){
+    value=nullptr;
+    DataBaseShard::Node* node=shard.skipList->searchItem(key);
+    if(node==nullptr){
+        return true;
+    }
+    const PublishedValue<RedisValue>* published=node->getPublished();
+    if(published==nullptr){
+        return false;
+    }
+    if(published->expireAt>=0&&expireEnabled&&published->expireAt<=currentTimeMs()){
+        return true; //和lookupKeyRead一样，已过期的key当作不存在
+    }
+    node->access.store(touchAccessInfo(node->access.load(std::memory_order_relaxed)),std::memory_order_relaxed);
+    value=&published->value;
+    return true;
+}
+
+//和分片锁下的多key命令一样，结果是同一时刻的：读取之前记录每个分片的version，读取之后version都没有变化，
+//说明读取期间这些分片上没有写命令执行，所有副本在读完第一个version和读最后一个version之间的任意时刻都是最新的
+bool RedisHelper::readPublished(const std::vector<std::string>& keys,std::vector<const RedisValue*>& values){
+    values.assign(keys.size(),nullptr);
+    if(keys.size()==1){
+        return readPublished(getShard(keys[0]),keys[0],values[0]);
+    }
+    std::vector<DataBaseShard*> shards;
+    std::vector<uint64_t> versions;
+    shards.reserve(keys.size());
+    versions.reserve(keys.size());
+    for(auto& key:keys){
+        shards.push_back(&getShard(key));
+        versions.push_back(shards.back()->mutex.getVersion());
+        if(versions.back()%2!=0){
+            return false; //分片上有写命令正在执行
+        }
+    }
+    for(size_t i=0;i<keys.size();i++){
+        if(!readPublished(*shards[i],keys[i],values[i])){
+            return false;
+        }
+    }
+    for(size_t i=0;i<keys.size();i++){
+        if(shards[i]->mutex.getVersion()!=versions[i]){
+            return false;
+        }
+    }
+    return true;
+}
+
+//只发布字符串（包括整数编码）：副本和value一样大，列表、哈希和JSON的读取一直加锁
+void RedisHelper::publishValue(DataBaseShard& shard,DataBaseShard::Node* node){
+    if(node->value.isString()||node->value.isNumber()){
+        node->publish(shard.getExpire(node->key));
+    }
+}
+#endif
+
+void RedisHelper::deleteExpiredKey(DataBaseShard& shard,std::string key,int dataBaseIndex){
+    deleteAndPropagate(shard,std::move(key),dataBaseIndex);
+    expiredKeys++;
+}
+
+//key按值传入：调用者传入的可能是节点或expires中的key，删除之后就失效了
+//del记录在当前命令之前，命令没有修改数据时也等待del写入AOF
+void RedisHelper::deleteAndPropagate(DataBaseShard& shard,std::string key,int dataBaseIndex){
+    shard.deleteItem(key);
+    dirty++;
+    if(aof){
+        uint64_t sequence=aof->append(dataBaseIndex,"del "+key);
+        if(currentCommand.command!=nullptr){
+            currentCommand.aofSequence=sequence;
+        }
+    }
+}
+
+//已经有过期时间时先从时间轮中取出，按新的过期时间重新放入
+void DataBaseShard::setExpire(const std::string& key,int64_t when){
+    if(wheel==nullptr){
+        wheel.reset(new TimingWheel(RedisHelper::currentTimeMs()));
+    }
+    auto result=expires.emplace(key,TimerNode());
+    TimerNode& node=result.first->second;
+    wheel->cancel(&node);
+    node.when=when;
+    node.key=&result.first->first;
+    wheel->schedule(&node);
+}
+
+//从上次停下的分片开始，依次推进每个已加载数据库的每个分片的时间轮，删除到期的key：
+//每次持有分片的锁最多删除ACTIVE_EXPIRE_CYCLE_KEYS个，代价只和到期的key数有关；超过时间限制时停下，下次从这个分片继续
+void RedisHelper::activeExpireCycle(long long timeLimitUs){
+    if(!expireEnabled){
+        return;
+    }
+    auto start=std::chrono::steady_clock::now();
+    const size_t shardCount=DATABASE_FILE_NUMBER*DATABASE_SHARD_NUMBER;
+    for(size_t visited=0;visited<shardCount;visited++,expireShardCursor++){
+        int dataBaseIndex=expireShardCursor/DATABASE_SHARD_NUMBER%DATABASE_FILE_NUMBER;
+        DataBase& dataBase=*dataBases[dataBaseIndex];
+        if(!dataBase.loaded){
+            continue;
+        }
+        DataBaseShard& shard=*dataBase.shards[expireShardCursor%DATABASE_SHARD_NUMBER];
+        while(true){
+            std::vector<std::string> expiredList;
+            {
+                WriteLock lock(shard.mutex);
+                if(shard.wheel==nullptr){
+                    break;
+                }
+                shard.wheel->expire(currentTimeMs(),ACTIVE_EXPIRE_CYCLE_KEYS,expiredList);
+                for(auto& key:expiredList){
+                    deleteExpiredKey(shard,key,dataBaseIndex);
+                }
+            }
+            if(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-start).count()>=timeLimitUs){
+                return;
+            }
+            if(expiredList.size()<ACTIVE_EXPIRE_CYCLE_KEYS){
+                break;
+            }
+        }
+    }
+}
+
+//和Redis一样在执行会增加内存的写命令之前检查：先释放内存，再执行命令
+//淘汰的key和过期的key一样在AOF中记录为del，重放时不依赖当时的内存使用
+std::string RedisHelper::performEvictions(){
+    size_t limit=getMaxMemory();
+    if(limit==0||usedMemory()<=limit){
+        return "";
+    }
+    MaxMemoryPolicy policy=getMaxMemoryPolicy();
+    if(policy==NOEVICTION){
+        return OOM_ERROR;
+    }
+    std::lock_guard<std::mutex> lock(evictionMutex);
+    while(usedMemory()>limit){
+        if(!evictOne(policy)){
+            return OOM_ERROR;
+        }
+    }
+    return "";
+}
+
+//每个已加载的数据库各抽样MAXMEMORY_SAMPLES个key，分数高于池中最低分的key放入淘汰池
+void RedisHelper::sampleEvictionPool(MaxMemoryPolicy policy){
+    size_t shard=evictionShardCursor++%DATABASE_SHARD_NUMBER;
+    for(int index=0;index<DATABASE_FILE_NUMBER;index++){
+        DataBase& dataBase=*dataBases[index];
+        if(!dataBase.loaded){
+            continue;
+        }
+        DataBaseShard& sampled=*dataBase.shards[shard];
+        ReadLock lock(sampled.mutex);
+        for(int i=0;i<MAXMEMORY_SAMPLES;i++){
+            DataBaseShard::Node* node=policy==VOLATILE_LRU?sampled.sampleVolatileItem(evictionRandom()):sampled.sampleItem(evictionRandom());
+            if(node==nullptr){
+                break;
+            }
+            uint64_t score=evictionScore(node->access.load(std::memory_order_relaxed));
+            if(evictionPool.size()==EVICTION_POOL_SIZE&&score<=evictionPool.front().score){
+                continue;
+            }
+            bool duplicate=false;
+            for(auto& candidate:evictionPool){
+                if(candidate.dataBaseIndex==index&&candidate.key==node->key){
+                    duplicate=true;
+                    break;
+                }
+            }
+            if(duplicate){
+                continue;
+            }
+            if(evictionPool.size()==EVICTION_POOL_SIZE){
+                evictionPool.erase(evictionPool.begin());
+            }
+            auto position=evictionPool.begin();
+            while(position!=evictionPool.end()&&position->score<score){
+                ++position;
+            }
+            evictionPool.insert(position,EvictionCandidate{score,index,node->key});
+        }
+    }
+}
+
+//池中的分数是抽样时计算的，key可能已经被删除；按分数从高到低找到仍然存在的key淘汰
+bool RedisHelper::evictOne(MaxMemoryPolicy policy){
+    sampleEvictionPool(policy);
+    while(!evictionPool.empty()){
+        EvictionCandidate candidate=std::move(evictionPool.back());
+        evictionPool.pop_back();
+        DataBaseShard& shard=*dataBases[candidate.dataBaseIndex]->shards[shardIndex(candidate.key)];
+        WriteLock lock(shard.mutex);
+        if(shard.searchItem(candidate.key)==nullptr||(policy==VOLATILE_LRU&&shard.getExpire(candidate.key)<0)){
+            continue;
+        }
+        deleteAndPropagate(shard,candidate.key,candidate.dataBaseIndex);
+        evictedKeys++;
+        return true;
+    }
+    return false;
+}
+
+std::string RedisHelper::configGet(const std::string& name){
+    if(name=="maxmemory"){
+        return "1) \"maxmemory\"\n2) \""+std::to_string(getMaxMemory())+"\"";
+    }
+    if(name=="maxmemory-policy"){
+        return "1) \"maxmemory-policy\"\n2) \""+maxMemoryPolicyName(getMaxMemoryPolicy())+"\"";
+    }
+    return "(empty list or set)";
+}
+
+std::string RedisHelper::configSet(const std::string& name,const std::string& value){
+    if(name=="maxmemory"){
+        size_t bytes;
+        if(!parseMemorySize(value,bytes)){
+            return "Invalid argument '"+value+"' for CONFIG SET 'maxmemory'";
+        }
+        setMaxMemory(bytes);
+        return "OK";
+    }
+    if(name=="maxmemory-policy"){
+        MaxMemoryPolicy policy;
+        if(!parseMaxMemoryPolicy(value,policy)){
+            return "Invalid argument '"+value+"' for CONFIG SET 'maxmemory-policy'";
+        }
+        setMaxMemoryPolicy(policy);
+        return "OK";
+    }
+    return "Unsupported CONFIG parameter: "+name;
+}
+
+//只读取key，不更新访问信息，不影响淘汰；哈希索引的槽位按key个数平摊
+std::string RedisHelper::memoryUsage(const std::string& key,size_t samples){
+    DataBaseShard& shard=getShard(key);
+    ReadLock lock(shard.mutex);
+    DataBaseShard::Node* node=shard.searchItem(key);
+    if(node==nullptr||keyExpired(shard,key)){
+        return "(nil)";
+    }
+    size_t bytes=DataBaseShard::nodeBytes(node)+node->value.memoryUsage(samples);
+    if(shard.getExpire(key)>=0){
+        bytes+=DataBaseShard::expireEntryBytes(key);
+    }
+#ifdef USE_HASH_INDEX
+    bytes+=shard.index.memoryBytes()/shard.index.size();
+#endif
+    return "(integer) "+std::to_string(bytes);
+}
+
+//各分片分别加锁读取计数器，总数只是近似值；overhead为数据集以外的内存：连接和AOF的缓冲区、空闲的节点内存池等
+std::string RedisHelper::memoryStats(){
+    std::vector<std::pair<std::string,std::string>> items;
+    size_t allocated=usedMemory();
+    size_t rss=residentMemory();
+    uint64_t totalKeys=0;
+    size_t totalKeyBytes=0,totalValueBytes=0,totalIndexBytes=0;
+    for(int i=0;i<DATABASE_FILE_NUMBER;i++){
+        DataBase& dataBase=*dataBases[i];
+        if(!dataBase.loaded){
+            continue;
+        }
+        uint64_t keyCount=0;
+        size_t keyBytes=0,valueBytes=0,indexBytes=0;
+        for(auto& shard:dataBase.shards){
+            ReadLock lock(shard->mutex);
+            keyCount+=shard->skipList->size();
+            keyBytes+=shard->keyBytes;
+            valueBytes+=shard->valueBytes;
+            indexBytes+=shard->indexBytes();
+        }
+        items.emplace_back("db."+std::to_string(i),"\"keys="+std::to_string(keyCount)+",keys.bytes="+std::to_string(keyBytes)
+            +",values.bytes="+std::to_string(valueBytes)+",index.bytes="+std::to_string(indexBytes)+"\"");
+        totalKeys+=keyCount;
+        totalKeyBytes+=keyBytes;
+        totalValueBytes+=valueBytes;
+        totalIndexBytes+=indexBytes;
+    }
+    size_t dataset=totalKeyBytes+totalValueBytes+totalIndexBytes;
+    char ratio[32];
+    snprintf(ratio,sizeof(ratio),"%.2f",allocated==0?0.0:double(rss)/allocated);
+    char percentage[32];
+    snprintf(percentage,sizeof(percentage),"%.2f",allocated==0?0.0:100.0*dataset/allocated);
+    std::vector<std::pair<std::string,std::string>> header={
+        {"total.allocated","(integer) "+std::to_string(allocated)},
+        {"rss","(integer) "+std::to_string(rss)},
+        {"fragmentation",std::string("\"")+ratio+"\""},
+        {"keys.count","(integer) "+std::to_string(totalKeys)},
+        {"keys.bytes","(integer) "+std::to_string(totalKeyBytes)},
+        {"values.bytes","(integer) "+std::to_string(totalValueBytes)},
+        {"index.bytes","(integer) "+std::to_string(totalIndexBytes)},
+        {"dataset.bytes","(integer) "+std::to_string(dataset)},
+        {"dataset.percentage",std::string("\"")+percentage+"\""},
+        {"overhead.bytes","(integer) "+std::to_string(allocated>dataset?allocated-dataset:0)}
+    };
+    items.insert(items.begin(),header.begin(),header.end());
+    std::string res;
+    int number=1;
+    for(auto& item:items){
+        res+=std::to_string(number++)+") \""+item.first+"\"\n";
+        res+=std::to_string(number++)+") "+item.second+"\n";
+    }
+    res.pop_back();
+    return res;
+}
+
+RedisHelper::CommandScope::CommandScope(RedisHelper& helper,const std::vector<std::string>& tokens):helper(helper){
+    if(!helper.aof){
+        return;
+    }
+    //解析器会修改tokens，先拼出原始命令
+    for(auto& token:tokens){
+        if(!command.empty()){
+            command.push_back(' ');
+        }
+        command+=token;
+    }
+    currentCommand.command=&command;
+    currentCommand.aofSequence=0;
+}
+
+RedisHelper::CommandScope::~CommandScope(){
+    if(currentCommand.command!=&command){
+        return;
+    }
+    currentCommand.command=nullptr;
+    helper.waitAppendOnly(currentCommand.aofSequence);
+}
+
+RedisHelper::BatchScope::BatchScope(RedisHelper& helper):helper(helper){
+    currentCommand.batch=true;
+    currentCommand.batchSequence=0;
+}
+
+//AOF按序号顺序写入，等待最大的序号就包含了批量中所有的命令
+RedisHelper::BatchScope::~BatchScope(){
+    currentCommand.batch=false;
+    if(currentCommand.batchSequence!=0){
+        helper.aof->waitFor(currentCommand.batchSequence);
+    }
+}
+
+void RedisHelper::waitAppendOnly(uint64_t sequence){
+    if(sequence==0){
+        return;
+    }
+    if(currentCommand.batch){
+        currentCommand.batchSequence=std::max(currentCommand.batchSequence,sequence);
+        return;
+    }
+    aof->waitFor(sequence);
+}
+
+//当前数据库的文件包含了编号为aofId的AOF中前多少字节的命令
+uint64_t RedisHelper::coveredAppendOnlyBytes(uint64_t aofId){
+    DataBase& dataBase=currentDataBase();
+    return aofId!=0&&aofId==dataBase.loadedAofId?dataBase.loadedAofOffset:0;
+}
+
+//开启AOF
+bool RedisHelper::openAppendOnly(const std::string& path,AppendFsync policy,uint64_t aofId,uint64_t validLength){
+    std::unique_ptr<AppendOnlyFile> file(new AppendOnlyFile(path,policy));
+    if(!file->open(aofId,validLength,currentDataBaseIndex)){
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(loadMutex);
+    aof=std::move(file);
+    return true;
+}
+
+std::string RedisHelper::appendOnlyWriteError(){
+    if(aof&&aof->writeFailed()){
+        return AOF_WRITE_ERROR;
+    }
+    return "";
+}
+
+//数据库所有分片的key个数之和，调用前需要持有所有分片的锁
+uint64_t RedisHelper::countKeys(int index){
+    uint64_t keyCount=0;
+    for(auto& shard:dataBases[index]->shards){
+        keyCount+=shard->skipList->size();
+    }
+    return keyCount;
+}
+
+//以二进制快照格式写入，先写临时文件再改名，写入失败时原来的文件不受影响
+//只遍历跳表，不加任何锁（fork出的子进程中其他线程持有的锁永远不会释放），keyCount由调用者事先统计
+bool RedisHelper::writeSnapshot(int index,uint64_t keyCount,uint64_t aofId,uint64_t aofOffset){
+    std::string filePath=getFilePath(index); //获取要写入的文件的路径
+    SnapshotWriter writer(filePath);
+    if(!writer.begin(keyCount,aofId,aofOffset)){
+        return false;
+    }
+    //依次遍历每个分片的跳表，通过getFirst()获取跳表的第一个数据节点
+    //每个分片内按key从小到大写入，加载时每个分片的key仍然是有序到达的，可以直接追加
+    for(auto& shard:dataBases[index]->shards){
+        auto currentNode=shard->skipList->getFirst();
+        while(currentNode!=nullptr){
+            writer.append(currentNode->key,currentNode->value,shard->getExpire(currentNode->key));
+            //将currentNode指向currentNode在原始链表层（即第0层）中的下一个节点
+            currentNode=currentNode->getNext();
+        }
+    }
+    return writer.commit();
+}
+
+//save命令：同步保存，保存期间其他客户端的修改命令被阻塞
+std::string RedisHelper::save(){
+    flush();
+    return "OK";
+}
+
+//bgsave命令：fork子进程，子进程从写时复制的内存中写快照，父进程继续处理命令
+std::string RedisHelper::bgsave(){
+    //fork期间持有所有已加载数据库的分片锁，没有写到一半的修改，子进程看到的是某一时刻的一致数据
+    std::lock_guard<std::mutex> loadLock(loadMutex);
+    std::vector<int> indexes=loadedDataBases();
+    auto locks=lockDataBases<ReadLock>(indexes);
+    std::lock_guard<std::mutex> lock(saveMutex);
+    if(saveChildPid!=-1){
+        return "Background save already in progress";
+    }
+    std::vector<uint64_t> keyCounts; //子进程中不能调用会加锁的size()
+    for(int index:indexes){
+        keyCounts.push_back(countKeys(index));
+    }
+    uint64_t aofId=0,aofOffset=0;
+    if(aof){
+        aof->position(aofId,aofOffset);
+    }
+    lastBgsaveTryTime=time(nullptr);
+    auto start=std::chrono::steady_clock::now();
+    pid_t pid=fork();
+    if(pid==0){
+        //子进程只有当前一个线程：写完快照后直接_exit，不执行析构函数和atexit（否则会再次flush）
+        bool ok=true;
+        for(size_t i=0;i<indexes.size();i++){
+            ok=writeSnapshot(indexes[i],keyCounts[i],aofId,aofOffset)&&ok;
+        }
+        _exit(ok?0:1);
+    }
+    lastForkUsec=std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-start).count();
+    if(pid<0){
+        lastBgsaveOk=false;
+        return "Background save failed: "+std::string(strerror(errno));
+    }
+    saveChildPid=pid;
+    saveStartTime=start;
+    dirtyAtFork=dirty;
+    if(aof){
+        aof->startRewrite(); //之后的命令同时记录到重写缓冲区
+    }
+    return "Background saving started";
+}
+
+//bgrewriteaof命令：数据库文件就是数据最紧凑的形式，重写AOF就是执行一次bgsave，
+//成功后AOF中只留下fork之后的命令
+std::string RedisHelper::bgrewriteaof(){
+    if(!aof){
+        return "Append only file is not enabled";
+    }
+    std::string res=bgsave();
+    if(res=="Background saving started"){
+        res="Background append only file rewriting started";
+    }
+    return res;
+}
+
+//由服务器定时调用：回收结束的bgsave子进程，没有子进程时检查自动保存规则
+void RedisHelper::backgroundSaveCron(){
+    time_t now=time(nullptr);
+    {
+        std::lock_guard<std::mutex> lock(saveMutex);
+        if(saveChildPid!=-1){
+            int status=0;
+            struct rusage usage;
+            if(wait4(saveChildPid,&status,WNOHANG,&usage)==saveChildPid){
+                lastBgsaveMs=std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()-saveStartTime).count();
+                lastBgsaveCpuMs=(usage.ru_utime.tv_sec+usage.ru_stime.tv_sec)*1000LL
+                    +(usage.ru_utime.tv_usec+usage.ru_stime.tv_usec)/1000;
+                lastBgsaveOk=WIFEXITED(status)&&WEXITSTATUS(status)==0;
+                if(lastBgsaveOk){
+                    dirty-=dirtyAtFork; //fork之后的修改还没有保存
+                    lastSaveTime=now;
+                    bgsaveCount++;
+                }
+                if(aof&&lastBgsaveOk){
+                    aof->finishRewrite(); //fork之前的命令已经包含在数据库文件中
+                }else if(aof){
+                    aof->cancelRewrite();
+                }
+                saveChildPid=-1;
+            }
+            return;
+        }
+        if(!lastBgsaveOk&&now-lastBgsaveTryTime<BGSAVE_RETRY_DELAY){
+            return;
+        }
+    }
+    for(auto& rule:SAVE_RULES){
+        if(dirty>=rule.changes&&now-lastSaveTime>=rule.seconds){
+            bgsave();
+            return;
+        }
+    }
+    if(aof&&aof->rewriteNeeded()){
+        bgrewriteaof();
+    }
+}
+
+//终止正在运行的bgsave子进程并回收，调用前不能持有saveMutex
+void RedisHelper::stopBackgroundSave(){
+    std::lock_guard<std::mutex> lock(saveMutex);
+    if(saveChildPid==-1){
+        return;
+    }
+    kill(saveChildPid,SIGKILL);
+    waitpid(saveChildPid,nullptr,0);
+    for(int i=0;i<DATABASE_FILE_NUMBER;i++){
+        std::remove((getFilePath(i)+".tmp").c_str()); //子进程没来得及改名的临时文件
+    }
+    saveChildPid=-1;
+    if(aof){
+        aof->cancelRewrite();
+    }
+}
+
+//info命令：持久化相关的统计信息，以及每个数据库是否已加载、key个数（没有加载的数据库显示文件大小）
+std::string RedisHelper::info(){
+    std::string keyspace="# Keyspace\n";
+    for(int i=0;i<DATABASE_FILE_NUMBER;i++){
+        DataBase& dataBase=*dataBases[i];
+        keyspace+="db"+std::to_string(i)+":";
+        if(dataBase.loaded){
+            uint64_t keyCount=0;
+            uint64_t expireCount=0;
+            for(auto& shard:dataBase.shards){
+                ReadLock lock(shard->mutex); //各分片分别加锁，总数只是近似值
+                keyCount+=shard->skipList->size();
+                expireCount+=shard->expires.size();
+            }
+            keyspace+="loaded=1,keys="+std::to_string(keyCount)+",expires="+std::to_string(expireCount)+"\n";
+        }else{
+            std::ifstream file(getFilePath(i),std::ios::binary|std::ios::ate);
+            keyspace+="loaded=0,file_bytes="+std::to_string(file.is_open()?(long long)file.tellg():0)+"\n";
+        }
+    }
+    keyspace.pop_back();
+    std::lock_guard<std::mutex> lock(saveMutex);
+    std::string res="# Persistence\n";
+    res+="rdb_changes_since_last_save:"+std::to_string(dirty)+"\n";
+    res+="rdb_bgsave_in_progress:"+std::string(saveChildPid!=-1?"1":"0")+"\n";
+    res+="rdb_last_save_time:"+std::to_string(lastSaveTime)+"\n";
+    res+="rdb_last_bgsave_status:"+std::string(lastBgsaveOk?"ok":"err")+"\n";
+    res+="rdb_last_bgsave_time_ms:"+std::to_string(lastBgsaveMs)+"\n";
+    res+="rdb_last_bgsave_cpu_ms:"+std::to_string(lastBgsaveCpuMs)+"\n";
+    res+="rdb_last_fork_usec:"+std::to_string(lastForkUsec)+"\n";
+    res+="rdb_bgsave_count:"+std::to_string(bgsaveCount)+"\n";
+    res+=aof?aof->info():"aof_enabled:0";
+    res+="\n# Memory\nused_memory:"+std::to_string(usedMemory())+"\n";
+    res+="maxmemory:"+std::to_string(getMaxMemory())+"\n";
+    res+="maxmemory_policy:"+maxMemoryPolicyName(getMaxMemoryPolicy())+"\n";
+    res+="# Stats\nexpired_keys:"+std::to_string(expiredKeys)+"\n";
+    res+="evicted_keys:"+std::to_string(evictedKeys)+"\n";
+    res+=keyspace;
+    return res;
 }
 
 //获取文件路径
-std::string RedisHelper::getFilePath(){
-    std::string folder = DEFAULT_DB_FOLDER; //文件夹名
+std::string RedisHelper::getFilePath(int index){
+    std::string folder = dataFolder; //文件夹名
     std::string fileName = DATABASE_FILE_NAME; //文件名
-    std::string filePath=folder+"/"+fileName+dataBaseIndex; //文件路径
+    std::string filePath=folder+"/"+fileName+std::to_string(index); //文件路径
     return filePath;
 }
 
-//从文件中加载
-void RedisHelper::loadData(std::string loadPath){
-    redisDataBase->loadFile(loadPath);
+//从文件中加载，调用前需要持有loadMutex，数据库还没有标记为已加载，其他线程不会访问
+//文件以快照的magic开头时按二进制快照加载，否则按旧的文本格式加载
+void RedisHelper::loadData(DataBase& dataBase,const std::string& loadPath){
+    dataBase.loadedAofId=0;
+    dataBase.loadedAofOffset=0;
+    if(SnapshotReader::isSnapshot(loadPath)){
+        loadSnapshot(dataBase,loadPath);
+    }else{
+        loadText(dataBase,loadPath);
+    }
 }
 
-//选择数据库
+void RedisHelper::loadSnapshot(DataBase& dataBase,const std::string& loadPath){
+    SnapshotReader reader;
+    bool loaded=reader.open(loadPath);
+    if(loaded){
+        dataBase.loadedAofId=reader.appendOnlyId();
+        dataBase.loadedAofOffset=reader.appendOnlyOffset();
+        std::string key;
+        RedisValue value;
+        int64_t expireAt;
+        while(reader.next(key,value,expireAt)){
+            DataBaseShard& shard=*dataBase.shards[shardIndex(key)];
+            shard.appendItem(key,value);
+            if(expireAt>=0){ //已经过期的key也加载，之后的AOF中可能还有它的del
+                shard.setExpire(key,expireAt);
+            }
+        }
+        loaded=reader.error().empty();
+    }
+    if(!loaded){
+        //损坏的快照改名保留，否则下次写入时会被覆盖
+        std::string corruptPath=loadPath+".corrupt";
+        std::rename(loadPath.c_str(),corruptPath.c_str());
+        std::cout<<"快照："<<loadPath<<"加载失败："<<reader.error()<<"，已改名为"<<corruptPath<<std::endl;
+    }
+}
+
+//每一行的格式为 key:value，按key分配到对应的分片中
+void RedisHelper::loadText(DataBase& dataBase,const std::string& loadPath){
+    std::ifstream readFile(loadPath);
+    if(!readFile.is_open()){
+        return;
+    }
+    std::string line;
+    std::string err;
+    while(std::getline(readFile,line)){
+        size_t index=line.find(DELIMITER);
+        if(line.empty()||index==std::string::npos){
+            continue;
+        }
+        std::string key=line.substr(0,index);
+        RedisValue value=RedisValue::parse(line.substr(index+1),err);
+        if(value.isArray()){
+            value=RedisValue::listFromArray(value.arrayItems()); //列表按QuickList保存
+        }else if(value.isObject()){
+            value=RedisValue::hashFromObject(value.objectItems()); //哈希表按RedisHash保存
+        }
+        dataBase.shards[shardIndex(key)]->addItem(key,value);
+    }
+}
+
+//选择数据库：所有数据库都留在内存中，只切换当前线程使用的数据库，不需要保存和重新加载
+//第一次选择某个数据库时从文件加载
 std::string RedisHelper::select(int index){
     if(index<0||index>DATABASE_FILE_NUMBER-1){
         return "database index out of range.";
     }
-    flush(); //切换数据库之前先将当前数据库的数据写入文件，保证数据不丢失
-    //创建一个新的跳表并让redisDataBase指向这个新的跳表，作为新的数据库
-    redisDataBase=std::make_shared<SkipList<std::string, RedisValue>>();
-    dataBaseIndex=std::to_string(index); //更新当前数据库索引
-    std::string filePath=getFilePath(); //根据选择的数据库，修改文件路径，然后加载
-
-    loadData(filePath);
+    getDataBase(index);
+    currentDataBaseIndex=index;
     return "OK";
 }
+
+int RedisHelper::getDataBaseIndex() const{
+    return currentDataBaseIndex;
+}
 // key操作命令
 // 获取所有键
 // 语法：keys pattern
@@ -63,12 +858,25 @@ std::string RedisHelper::select(int index){
 // *表示通配符，表示任意字符，会遍历所有键显示所有的键列表，时间复杂度O(n)，在生产环境不建议使用。
 std::string RedisHelper::keys(const std::string pattern){
     std::string res="";
-    auto node=redisDataBase->getHead()->forward[0];
+    std::vector<std::string> allKeys;
+    {
+        auto locks=lockAllShards<ReadLock>();
+        for(auto& shard:currentDataBase().shards){
+            auto node=shard->skipList->getFirst();
+            while(node!=nullptr){
+                if(!keyExpired(*shard,node->key)){ //已过期但还没有删除的key不返回
+                    allKeys.push_back(node->key);
+                }
+                node=node->getNext();
+            }
+        }
+    }
+    //每个分片内部有序，合并后重新排序，保持和单个跳表时一样的输出顺序
+    std::sort(allKeys.begin(),allKeys.end());
     int count=0;
-    while(node!=nullptr){
+    for(auto& key:allKeys){
         //每个键以 1) "javastack" 的形式加入到res中
-        res+=std::to_string(++count)+") "+"\""+node->key+"\""+"\n";
-        node=node->forward[0];
+        res+=std::to_string(++count)+") "+"\""+key+"\""+"\n";
     }
     //去掉最后一个换行符
     if(!res.empty())
@@ -83,9 +891,16 @@ std::string RedisHelper::keys(const std::string pattern){
 // 127.0.0.1:6379> dbsize
 // (integer) 6
 // 获取键总数时不会遍历所有的键，直接获取内部变量，时间复杂度O(1)。
-std::string RedisHelper::dbsize()const{
-    //redisDataBase->size()方法直接获取跳表元素个数elementNumber，时间复杂度O(1)
-    std::string res="(integer) " +std::to_string(redisDataBase->size());
+// 和Redis一样，已经过期但还没有被惰性或主动过期删除的key也计入总数
+std::string RedisHelper::dbsize(){
+    //skipList->size()方法直接获取跳表元素个数elementNumber，时间复杂度O(1)，总数为各分片之和
+    //各分片分别加锁读取，总数只是近似值（和memoryStats一样）
+    size_t size=0;
+    for(auto& shard:currentDataBase().shards){
+        ReadLock lock(shard->mutex);
+        size+=shard->skipList->size();
+    }
+    std::string res="(integer) " +std::to_string(size);
     return res;
 }
 // 批量查询键是否存在
@@ -94,10 +909,25 @@ std::string RedisHelper::dbsize()const{
 // (integer) 2
 // 查询查询多个，返回存在的个数。
 std::string RedisHelper::exists(const std::vector<std::string>&keys){
+#ifdef USE_CONCURRENT_SKIPLIST
+    {
+        EpochManager::Guard guard;
+        std::vector<const RedisValue*> values;
+        if(readPublished(keys,values)){
+            return "(integer) "+std::to_string(std::count_if(values.begin(),values.end(),[](const RedisValue* value){ return value!=nullptr; }));
+        }
+    }
+#endif
+    auto locks=lockShards<ReadLock>(keys); //同时持有所有相关分片的锁，保证结果是同一时刻的
     int count=0;
     for(auto& key:keys){
-        if(redisDataBase->searchItem(key)!=nullptr){
+        DataBaseShard& shard=getShard(key);
+        auto currentNode=lookupKeyRead(shard,key);
+        if(currentNode!=nullptr){
             count++;
+#ifdef USE_CONCURRENT_SKIPLIST
+            publishValue(shard,currentNode);
+#endif
         }
     }
     std::string res="(integer) " +std::to_string(count);
@@ -109,11 +939,16 @@ std::string RedisHelper::exists(const std::vector<std::string>&keys){
 // (integer) 1
 // 可以删除多个，返回删除成功的个数。
 std::string RedisHelper::del(const std::vector<std::string>&keys){
+    auto locks=lockShards<WriteLock>(keys);
     int count=0;
     for(auto& key:keys){
-        if(redisDataBase->deleteItem(key)){
+        DataBaseShard& shard=getShard(key);
+        if(lookupKeyWrite(shard,key)!=nullptr&&shard.deleteItem(key)){ //已过期的key不计数
             count++;
         }
+    }
+    if(count>0){
+        propagate();
     }
         std::string res="(integer) " +std::to_string(count);
     return res;
@@ -124,62 +959,179 @@ std::string RedisHelper::del(const std::vector<std::string>&keys){
 // 127.0.0.1:6379[2]> rename javastack javastack123
 // OK
 std::string RedisHelper::rename(const std::string&oldName,const std::string&newName){
+    //oldName和newName可能在不同的分片上，两个分片一起加锁
+    auto locks=lockShards<WriteLock>({oldName,newName});
     //先查找oldName节点
-    auto currentNode=redisDataBase->searchItem(oldName);
+    auto currentNode=lookupKeyWrite(getShard(oldName),oldName);
     std::string resMessage="";
     //如果oldName节点不存在，则返回错误信息
     if(currentNode==nullptr){
         resMessage+=oldName+" does not exist!";
         return resMessage;
     }
-    //如果oldName节点存在，则将oldName节点的key（节点名称）更改为newName
-    currentNode->key=newName;
+    if(oldName==newName){
+        return "OK";
+    }
+    //跳表按key排序，不能直接修改节点的key：先删除oldName节点，再以newName插入到newName所在的分片（覆盖已有的newName）
+    RedisValue value=currentNode->value;
+    int64_t expireAt=getShard(oldName).getExpire(oldName);
+    getShard(oldName).deleteItem(oldName);
+    setLocked(newName,value);
+    if(expireAt>=0){ //过期时间跟着key一起改名
+        getShard(newName).setExpire(newName,expireAt);
+    }
+    propagate();
     resMessage="OK";
     return resMessage;
 }
 
+// 设置过期时间
+// 语法：expire key seconds / pexpire key milliseconds / expireat key timestamp / pexpireat key milliseconds-timestamp
+// 127.0.0.1:6379> expire javastack 100
+// (integer) 1
+// 都转换为绝对时间保存，AOF中记录为pexpireat；过期时间已经过去时直接删除key，记录为del
+std::string RedisHelper::expireAt(const std::string& key,int64_t timestampMs){
+    timestampMs=std::max<int64_t>(timestampMs,0); //-1表示没有过期时间
+    DataBaseShard& shard=getShard(key);
+    WriteLock lock(shard.mutex);
+    if(lookupKeyWrite(shard,key)==nullptr){
+        return "(integer) 0";
+    }
+    if(timestampMs<=currentTimeMs()&&expireEnabled){
+        shard.deleteItem(key);
+        propagate("del "+key);
+    }else{
+        shard.setExpire(key,timestampMs);
+        propagate("pexpireat "+key+" "+std::to_string(timestampMs));
+    }
+    return "(integer) 1";
+}
+
+// 查询剩余的过期时间
+// 语法：ttl key / pttl key
+// 127.0.0.1:6379> ttl javastack
+// (integer) 96
+// key不存在返回-2，没有设置过期时间返回-1
+std::string RedisHelper::ttl(const std::string& key,bool milliseconds){
+    DataBaseShard& shard=getShard(key);
+    ReadLock lock(shard.mutex);
+    if(lookupKeyRead(shard,key)==nullptr){
+        return "(integer) -2";
+    }
+    int64_t when=shard.getExpire(key);
+    if(when<0){
+        return "(integer) -1";
+    }
+    int64_t remaining=std::max<int64_t>(when-currentTimeMs(),0);
+    return "(integer) "+std::to_string(milliseconds?remaining:(remaining+500)/1000);
+}
+
+// 去掉过期时间
+// 语法：persist key
+// 127.0.0.1:6379> persist javastack
+// (integer) 1
+std::string RedisHelper::persist(const std::string& key){
+    DataBaseShard& shard=getShard(key);
+    WriteLock lock(shard.mutex);
+    if(lookupKeyWrite(shard,key)==nullptr||!shard.removeExpire(key)){
+        return "(integer) 0";
+    }
+    propagate();
+    return "(integer) 1";
+}
+
 // 字符串操作命令
 // 存放键值
-// 语法：set key value [EX seconds] [PX milliseconds] [NX|XX]
-// nx：如果key不存在则建立，xx：如果key存在则修改其值，也可以直接使用setnx/setex命令。
-std::string RedisHelper::set(const std::string& key, const RedisValue& value,const SET_MODEL model){
-    
+// 语法：set key value [EX seconds|PX milliseconds|EXAT timestamp|PXAT milliseconds-timestamp] [NX|XX]
+// nx：如果key不存在则建立，xx：如果key存在则修改其值，也可以直接使用setnx命令。
+// 设置了过期时间时，AOF中记录为 set key value [NX|XX] PXAT 绝对时间
+std::string RedisHelper::set(const std::string& key, const RedisValue& value,const SET_MODEL model,int64_t expireAt){
+    std::string oom=performEvictions();
+    if(!oom.empty()){
+        return oom;
+    }
+    DataBaseShard& shard=getShard(key);
+    WriteLock lock(shard.mutex);
+    std::string res;
     if(model==XX){ //xx模式：如果key存在则修改其值value
-        return setex(key,value);
+        res=setxxLocked(key,value);
     }else if(model==NX){ //nx模式：如果key不存在则添加{key, value}
-        return setnx(key,value);
-    }else{ //输入的model参数既不是NX也不是XX，则根据key是否存在来判断调用setnx还是setex函数
-        auto currentNode=redisDataBase->searchItem(key);
-        if(currentNode==nullptr){ //如果key节点不存在，则调用setnx函数添加{key, value}
-            setnx(key,value);
-        }else{ //如果key节点存在，则调用setex函数将key节点的值更改为value
-            setex(key,value);
-        }
+        res=setnxLocked(key,value);
+    }else{
+        res=setLocked(key,value);
+    }
+    if(res!="OK"){
+        return res;
+    }
+    if(expireAt<0){
+        propagate();
+        return res;
+    }
+    shard.setExpire(key,expireAt);
+    std::string command="set "+key+" "+value.plainString();
+    if(model!=NONE){
+        command+=model==NX?" NX":" XX";
+    }
+    propagate(command+" PXAT "+std::to_string(expireAt));
+    return res;
+}
+
+//输入的model参数既不是NX也不是XX，则根据key是否存在来判断调用setnx还是setxx函数
+std::string RedisHelper::setLocked(const std::string& key, const RedisValue& value){
+    auto currentNode=lookupKeyWrite(getShard(key),key);
+    if(currentNode==nullptr){ //如果key节点不存在，则调用setnx函数添加{key, value}
+        setnxLocked(key,value);
+    }else{ //如果key节点存在，则调用setxx函数将key节点的值更改为value
+        setxxLocked(key,value);
     }
-    
     return "OK";
 }
 
-//nx模式：如果key不存在则添加{key, value}
 std::string RedisHelper::setnx(const std::string& key, const RedisValue& value){
-    auto currentNode=redisDataBase->searchItem(key); //查找key节点
+    std::string oom=performEvictions();
+    if(!oom.empty()){
+        return oom;
+    }
+    WriteLock lock(getShard(key).mutex);
+    std::string res=setnxLocked(key,value);
+    if(res=="OK"){
+        propagate();
+    }
+    return res;
+}
+
+//SETEX key seconds value：等同于 set key value EX seconds
+std::string RedisHelper::setex(const std::string& key, int64_t seconds, const RedisValue& value){
+    int64_t now=currentTimeMs();
+    if(seconds<=0||seconds>(INT64_MAX-now)/1000){
+        return "invalid expire time in SETEX.";
+    }
+    return set(key,value,NONE,now+seconds*1000);
+}
+
+//nx模式：如果key不存在则添加{key, value}
+std::string RedisHelper::setnxLocked(const std::string& key, const RedisValue& value){
+    auto currentNode=lookupKeyWrite(getShard(key),key); //查找key节点，已过期的key先删除
     //如果key节点存在，则返回错误信息
     if(currentNode!=nullptr){
         return "key: "+ key +"  exists!";
     }else{ //如果key节点不存在，则添加{key, value}节点
-        redisDataBase->addItem(key,value);
+        getShard(key).addItem(key,value);
         
     }
     return "OK";
 }
-//xx模式：如果key存在则修改其值value
-std::string RedisHelper::setex(const std::string& key, const RedisValue& value){
-    auto currentNode=redisDataBase->searchItem(key); //查找key节点
+//xx模式：如果key存在则修改其值value，并去掉原来的过期时间
+std::string RedisHelper::setxxLocked(const std::string& key, const RedisValue& value){
+    DataBaseShard& shard=getShard(key);
+    auto currentNode=lookupKeyWrite(shard,key); //查找key节点
     //如果key节点不存在，则返回错误信息
     if(currentNode==nullptr){
         return "key: "+ key +" does not exist!";
     }else{ //如果key节点存在，则将key节点的值更改为value
+        DataBaseShard::ValueUpdate update(shard,currentNode);
         currentNode->value=value;
+        shard.removeExpire(key);
     }
     return "OK";
 }
@@ -191,13 +1143,62 @@ std::string RedisHelper::setex(const std::string& key, const RedisValue& value){
 // "666"
 //根据输入的key查找对应的value，返回value
 std::string RedisHelper::get(const std::string&key){
-    auto currentNode=redisDataBase->searchItem(key);
+    DataBaseShard& shard=getShard(key);
+#ifdef USE_CONCURRENT_SKIPLIST
+    {
+        EpochManager::Guard guard; //读取的副本在Guard析构之前有效，dump之后才能析构
+        const RedisValue* value;
+        if(readPublished(shard,key,value)){
+            return value==nullptr?"key: "+ key +" does not exist!":value->dump();
+        }
+    }
+#endif
+    ReadLock lock(shard.mutex);
+    auto currentNode=lookupKeyRead(shard,key);
     if(currentNode==nullptr){
         return "key: "+ key +" does not exist!";
     }
+#ifdef USE_CONCURRENT_SKIPLIST
+    publishValue(shard,currentNode); //之后的读取不再加锁，直到下一次写命令修改这个key
+#endif
     return currentNode->value.dump(); //将value（RedisValue类型）转换为字符串并返回
 
 }
+// 批量命令中连续的set key value：和mset一样先淘汰再一次锁住所有相关分片，按顺序设置
+// AOF中为每个key记录一条set，重放时和单独执行的结果一致
+void RedisHelper::setBatch(const std::vector<std::string>& keys,const std::vector<std::string>& values,std::vector<std::string>& responses){
+    std::string oom=performEvictions();
+    if(!oom.empty()){
+        responses.insert(responses.end(),keys.size(),oom);
+        return;
+    }
+    uint64_t sequence=0;
+    {
+        auto locks=lockShards<WriteLock>(keys);
+        for(size_t i=0;i<keys.size();i++){
+            setLocked(keys[i],RedisValue::fromString(values[i])); //整数按整数编码保存
+            dirty++;
+            if(aof){
+                sequence=aof->append(currentDataBaseIndex,"set "+keys[i]+" "+values[i]);
+            }
+            responses.emplace_back("OK");
+        }
+    }
+    waitAppendOnly(sequence); //释放分片锁之后等待，过期key的del在set之前写入，也包含在内
+}
+
+// 批量命令中连续的get key：一次锁住所有相关分片，结果和get相同
+void RedisHelper::getBatch(const std::vector<std::string>& keys,std::vector<std::string>& responses){
+    auto locks=lockShards<ReadLock>(keys);
+    for(auto& key:keys){
+        auto currentNode=lookupKeyRead(getShard(key),key);
+        if(currentNode==nullptr){
+            responses.emplace_back("key: "+ key +" does not exist!");
+        }else{
+            responses.emplace_back(currentNode->value.dump());
+        }
+    }
+}
 // 值递增/递减
 // 如果字符串中的值是数字类型的，可以使用incr命令每次递增，不是数字类型则报错。
 
@@ -210,55 +1211,69 @@ std::string RedisHelper::incr(const std::string& key){
     return incrby(key,1);
 }
 //将key节点的值value递增increment，返回递增后的值
-std::string RedisHelper::incrby(const std::string& key,int increment){
-    auto currentNode=redisDataBase->searchItem(key); //查找key节点
-    std::string value="";
-    //如果key节点不存在，则新建节点{key, value}，并将key节点的值value设为increment，返回value
+//值按整数编码保存时直接在原地递增，不经过字符串转换，也不分配内存
+std::string RedisHelper::incrby(const std::string& key,int64_t increment){
+    std::string oom=performEvictions();
+    if(!oom.empty()){
+        return oom;
+    }
+    DataBaseShard& shard=getShard(key);
+    WriteLock lock(shard.mutex);
+    auto currentNode=lookupKeyWrite(shard,key); //查找key节点
+    //如果key节点不存在，则新建节点{key, increment}，按整数编码保存
     if(currentNode==nullptr){
-        value=std::to_string(increment);
-        redisDataBase->addItem(key,value);
-        return "(integer) "+value;
-    }
-    value=currentNode->value.dump(); //先将value（RedisValue类型）转换为字符串（前后有双引号）
-    //去掉双引号
-    value.erase(0, 1); 
-    value.erase(value.size()-1);
-    //如果value不是数字类型，则返回错误信息
-    for(char ch:value){
-        if(!isdigit(ch)){
-            std::string res="The value of "+key +" is not a numeric type";
-            return res;
-        }
+        shard.addItem(key,RedisValue(increment));
+        propagate();
+        return "(integer) "+std::to_string(increment);
     }
-    //将去掉双引号的value转换为整型，然后递增increment，再将递增后的值转换为字符串
-    int curValue=std::stoi(value)+increment;
-    value=std::to_string(curValue);
-    //将key节点的值value更新为递增后的值
-    currentNode->value=value;
-    std::string res="(integer) "+value;
-    return res;
+    DataBaseShard::ValueUpdate update(shard,currentNode); //字符串编码转换为整数编码时释放字符串
+    RedisValue& value=currentNode->value;
+    int64_t curValue=0;
+    if(value.isNumber()){
+        curValue=value.integerValue();
+    }else if(!value.isString()||!RedisValue::toInteger(value.stringValue(),curValue)){
+        //如果value不是整数，则返回错误信息
+        return "The value of "+key +" is not a numeric type";
+    }
+    if((increment>0&&curValue>INT64_MAX-increment)||(increment<0&&curValue<INT64_MIN-increment)){
+        return "increment or decrement would overflow";
+    }
+    curValue+=increment;
+    value=RedisValue(curValue); //字符串编码的值（例如旧的数据库文件中加载的）在这里转换为整数编码
+    propagate();
+    return "(integer) "+std::to_string(curValue);
 }
 
 //对浮点型value进行递增
 std::string RedisHelper::incrbyfloat(const std::string&key,double increment){
-    auto currentNode=redisDataBase->searchItem(key);
+    std::string oom=performEvictions();
+    if(!oom.empty()){
+        return oom;
+    }
+    DataBaseShard& shard=getShard(key);
+    WriteLock lock(shard.mutex);
+    auto currentNode=lookupKeyWrite(shard,key);
     std::string value="";
     if(currentNode==nullptr){
         value=std::to_string(increment);
-        redisDataBase->addItem(key,value);
+        shard.addItem(key,value);
+        propagate();
         return "(float) "+value;
     }
-    value=currentNode->value.dump();
-    value.erase(0, 1); 
-    value.erase(value.size()-1);
     double curValue=0.0;
-    try {
-        curValue = std::stod(value)+increment;
-    } catch (std::invalid_argument const &e) {
-        return "The value of "+key +" is not a numeric type";
-    } 
+    if(currentNode->value.isNumber()){
+        curValue=currentNode->value.integerValue()+increment;
+    }else{
+        try {
+            curValue = std::stod(currentNode->value.stringValue())+increment;
+        } catch (std::exception const &e) { //不是数字，或者超出double的范围
+            return "The value of "+key +" is not a numeric type";
+        }
+    }
     value=std::to_string(curValue);
+    DataBaseShard::ValueUpdate update(shard,currentNode);
     currentNode->value=value;
+    propagate();
     std::string res="(float) "+value;
     return res;
 }
@@ -266,7 +1281,10 @@ std::string RedisHelper::incrbyfloat(const std::string&key,double increment){
 std::string RedisHelper::decr(const std::string&key){
     return incrby(key,-1);
 }
-std::string RedisHelper::decrby(const std::string&key,int increment){
+std::string RedisHelper::decrby(const std::string&key,int64_t increment){
+    if(increment==INT64_MIN){
+        return "increment or decrement would overflow";
+    }
     return incrby(key,-increment);
 }
 // 批量存放键值
@@ -277,11 +1295,19 @@ std::string RedisHelper::mset(std::vector<std::string>&items){
     if(items.size()%2!=0){ //items中存放的是若干个键值对，所以items的大小必须是偶数
         return "wrong number of arguments for MSET.";
     }
-    for(int i=0;i<items.size();i+=2){
-        std::string key=items[i];
-        std::string value=items[i+1];
-        set(key,value); //设置键值对{key, value}
+    std::string oom=performEvictions();
+    if(!oom.empty()){
+        return oom;
+    }
+    std::vector<std::string> keys;
+    for(size_t i=0;i<items.size();i+=2){
+        keys.push_back(items[i]);
     }
+    auto locks=lockShards<WriteLock>(keys); //一次性锁住所有相关分片，其他客户端看不到只写了一半的mset
+    for(size_t i=0;i<items.size();i+=2){
+        setLocked(items[i],RedisValue::fromString(items[i+1])); //设置键值对{key, value}，整数按整数编码保存
+    }
+    propagate();
     return "OK";
 }
 // 批量获取键的值
@@ -296,15 +1322,32 @@ std::string RedisHelper::mget(std::vector<std::string>&keys){
     }
     std::vector<std::string>values;
     std::string res="";
-    for(int i=0;i<keys.size();i++){
+#ifdef USE_CONCURRENT_SKIPLIST
+    {
+        EpochManager::Guard guard;
+        std::vector<const RedisValue*> published;
+        if(readPublished(keys,published)){
+            for(size_t i=0;i<keys.size();i++){
+                res+=std::to_string(i+1)+") "+(published[i]==nullptr?"(nil)":published[i]->dump())+"\n";
+            }
+            res.pop_back();
+            return res;
+        }
+    }
+#endif
+    auto locks=lockShards<ReadLock>(keys);
+    for(size_t i=0;i<keys.size();i++){
         std::string& key=keys[i];
         std::string value="";
-        auto currentNode=redisDataBase->searchItem(key);
+        auto currentNode=lookupKeyRead(getShard(key),key);
         //如果key节点不存在，则将value设为"(nil)"
         if(currentNode==nullptr){
             value="(nil)";
             res+=std::to_string(i+1)+") "+value+"\n";
         }else{
+#ifdef USE_CONCURRENT_SKIPLIST
+            publishValue(getShard(key),currentNode);
+#endif
             value=currentNode->value.dump();
             res+=std::to_string(i+1)+") "+value+"\n";
         }
@@ -313,15 +1356,40 @@ std::string RedisHelper::mget(std::vector<std::string>&keys){
     res.pop_back();
     return res;
 }
+//strlen的结果：整数编码按十进制字符串的长度，列表、哈希和JSON按dump的长度
+static size_t valueLength(const RedisValue& value){
+    if(value.isNumber()){
+        return std::to_string(value.integerValue()).size();
+    }
+    if(value.isString()){
+        return value.stringValue().size();
+    }
+    return value.dump().size();
+}
+
 // 获取值长度
 // 语法：strlen key
 // 127.0.0.1:6379[2]> strlen javastack (integer) 3
 std::string RedisHelper::strlen(const std::string& key){
-    auto currentNode=redisDataBase->searchItem(key);
+    DataBaseShard& shard=getShard(key);
+#ifdef USE_CONCURRENT_SKIPLIST
+    {
+        EpochManager::Guard guard;
+        const RedisValue* value;
+        if(readPublished(shard,key,value)){
+            return "(integer) "+std::to_string(value==nullptr?0:valueLength(*value));
+        }
+    }
+#endif
+    ReadLock lock(shard.mutex);
+    auto currentNode=lookupKeyRead(shard,key);
     if(currentNode==nullptr){
         return "(integer) 0";
     }
-    return "(integer) "+std::to_string(currentNode->value.dump().size());
+#ifdef USE_CONCURRENT_SKIPLIST
+    publishValue(shard,currentNode);
+#endif
+    return "(integer) "+std::to_string(valueLength(currentNode->value));
 }
 // 追加内容
 // 语法：append key value
@@ -329,23 +1397,58 @@ std::string RedisHelper::strlen(const std::string& key){
 // (integer) 5
 // 向键值尾部添加，如上命令执行后由666变成666hi
 std::string RedisHelper::append(const std::string&key,const std::string &value){
-    auto currentNode=redisDataBase->searchItem(key);
+    std::string oom=performEvictions();
+    if(!oom.empty()){
+        return oom;
+    }
+    DataBaseShard& shard=getShard(key);
+    WriteLock lock(shard.mutex);
+    auto currentNode=lookupKeyWrite(shard,key);
     if(currentNode==nullptr){
-        redisDataBase->addItem(key,value);
+        shard.addItem(key,value);
+        propagate();
         return "(integer) "+std::to_string(value.size());
     }
-    currentNode->value=currentNode->value.dump()+value;
-    return "(integer) "+std::to_string(currentNode->value.dump().size());
+    DataBaseShard::ValueUpdate update(shard,currentNode);
+    RedisValue& currentValue=currentNode->value;
+    if(currentValue.isNumber()){
+        //追加之后一般不再是整数，转换回字符串编码
+        currentValue=RedisValue(std::to_string(currentValue.integerValue())+value);
+    }else if(currentValue.isString()){
+        currentValue.stringValue()+=value; //直接追加到原来的字符串后面
+    }else{
+        currentValue=currentValue.dump()+value;
+    }
+    propagate();
+    return "(integer) "+std::to_string(currentValue.stringValue().size());
 }
 
 //RedisHelper构造函数
-RedisHelper::RedisHelper(){
-    FileCreator::createFolderAndFiles(DEFAULT_DB_FOLDER,DATABASE_FILE_NAME,DATABASE_FILE_NUMBER);
-    std::string filePath=getFilePath();
-    loadData(filePath);
+//数据库在第一次访问时才加载，启动时不读取任何数据库文件
+RedisHelper::RedisHelper(const std::string& folder):dataFolder(folder){
+    for(int i=0;i<DATABASE_FILE_NUMBER;i++){
+        std::unique_ptr<DataBase> dataBase(new DataBase());
+        for(int j=0;j<DATABASE_SHARD_NUMBER;j++){
+            dataBase->shards.push_back(std::make_shared<DataBaseShard>());
+        }
+        dataBases.push_back(std::move(dataBase));
+    }
+    FileCreator::createFolderAndFiles(dataFolder,DATABASE_FILE_NAME,DATABASE_FILE_NUMBER);
+    lastSaveTime=time(nullptr);
+}
+//服务器退出前调用，此时已经没有线程执行命令
+void RedisHelper::shutdown(){
+    flush();
+    aof.reset(); //写出缓冲区，刷盘后关闭文件
+    shutDown=true;
 }
+
 //RedisHelper析构函数,析构时将数据写入文件
-RedisHelper::~RedisHelper(){flush();}
+RedisHelper::~RedisHelper(){
+    if(!shutDown){
+        flush();
+    }
+}
 
 
 //列表操作
@@ -355,110 +1458,125 @@ RedisHelper::~RedisHelper(){flush();}
 // RPOP key：移出并获取列表的最后一个元素。
 // LRANGE key start stop：获取列表指定范围内的元素。
 std::string RedisHelper::lpush(const std::string&key,const std::string &value){
-    auto currentNode=redisDataBase->searchItem(key);
+    std::string oom=performEvictions();
+    if(!oom.empty()){
+        return oom;
+    }
+    DataBaseShard& shard=getShard(key);
+    WriteLock lock(shard.mutex);
+    auto currentNode=lookupKeyWrite(shard,key);
     std::string resMessage = "";
     int size = 0;
     //
     if(currentNode==nullptr){
-        std::vector<RedisValue>data;
-        RedisValue redisList(data) ;
-        RedisValue::array& valueList = redisList.arrayItems();
-        valueList.insert(valueList.begin(),value);
-        redisDataBase->addItem(key,redisList);
+        QuickList valueList;
+        valueList.pushFront(value);
+        shard.addItem(key,RedisValue(std::move(valueList)));
         size = 1;
     }else{
-        if(currentNode->value.type()!=RedisValue::ARRAY){
+        if(!currentNode->value.isList()){
             resMessage="The key:" +key+" "+"already exists and the value is not a list!";
             return resMessage;
         }else{
-            RedisValue::array& valueList = currentNode->value.arrayItems();
-            valueList.insert(valueList.begin(),value);
+            DataBaseShard::ValueUpdate update(shard,currentNode);
+            QuickList& valueList = currentNode->value.listItems();
+            valueList.pushFront(value); //头部的块向左增长，不移动已有的元素
             size = valueList.size();
         }
     }
-
+    propagate();
     resMessage="(integer) "+std::to_string(size);
     return resMessage;
 }
 std::string RedisHelper::rpush(const std::string&key,const std::string &value){
-    auto currentNode=redisDataBase->searchItem(key);
+    std::string oom=performEvictions();
+    if(!oom.empty()){
+        return oom;
+    }
+    DataBaseShard& shard=getShard(key);
+    WriteLock lock(shard.mutex);
+    auto currentNode=lookupKeyWrite(shard,key);
     std::string resMessage = "";
     int size = 0;
     if(currentNode==nullptr){
-        std::vector<RedisValue>data;
-        RedisValue redisList(data) ;
-        RedisValue::array& valueList = redisList.arrayItems();
-        valueList.push_back(value);
-        redisDataBase->addItem(key,redisList);
+        QuickList valueList;
+        valueList.pushBack(value);
+        shard.addItem(key,RedisValue(std::move(valueList)));
         size = 1;
     }else{
-        if(currentNode->value.type()!=RedisValue::ARRAY){
+        if(!currentNode->value.isList()){
             resMessage="The key:" +key+" "+"already exists and the value is not a list!";
             return resMessage;
         }else{
-            RedisValue::array& valueList = currentNode->value.arrayItems();
-            valueList.push_back(value);
+            DataBaseShard::ValueUpdate update(shard,currentNode);
+            QuickList& valueList = currentNode->value.listItems();
+            valueList.pushBack(value);
             size = valueList.size();
         }
     }
-
+    propagate();
     resMessage="(integer) "+std::to_string(size);
     return resMessage;
 }
 std::string RedisHelper::lpop(const std::string&key){
-    auto currentNode=redisDataBase->searchItem(key);
+    DataBaseShard& shard=getShard(key);
+    WriteLock lock(shard.mutex);
+    auto currentNode=lookupKeyWrite(shard,key);
+    if(currentNode==nullptr||!currentNode->value.isList()){
+        return "(nil)";
+    }
+    DataBaseShard::ValueUpdate update(shard,currentNode); //弹出后变空的块被释放
     std::string resMessage = "";
-    int size = 0;
-    if(currentNode==nullptr||currentNode->value.type()!=RedisValue::ARRAY){
+    if(!currentNode->value.listItems().popFront(resMessage)){
         resMessage="(nil)";
     }else{
-        
-        RedisValue::array& valueList = currentNode->value.arrayItems();
-        resMessage = (*valueList.begin()).dump();
-        valueList.erase(valueList.begin());
-        resMessage.erase(0,1);
-        resMessage.erase(resMessage.size()-1);
+        propagate();
     }
     return resMessage;
 }
 std::string RedisHelper::rpop(const std::string&key){
-    auto currentNode=redisDataBase->searchItem(key);
+    DataBaseShard& shard=getShard(key);
+    WriteLock lock(shard.mutex);
+    auto currentNode=lookupKeyWrite(shard,key);
+    if(currentNode==nullptr||!currentNode->value.isList()){
+        return "(nil)";
+    }
+    DataBaseShard::ValueUpdate update(shard,currentNode); //弹出后变空的块被释放
     std::string resMessage = "";
-    int size = 0;
-    if(currentNode==nullptr||currentNode->value.type()!=RedisValue::ARRAY){
+    if(!currentNode->value.listItems().popBack(resMessage)){
         resMessage="(nil)";
     }else{
-        RedisValue::array& valueList = currentNode->value.arrayItems();
-        resMessage = (valueList.back()).dump();
-        valueList.pop_back();
-        resMessage.erase(0,1);
-        resMessage.erase(resMessage.size()-1);
+        propagate();
     }
     return resMessage;
 }
 std::string RedisHelper::lrange(const std::string&key,const std::string &start,const std::string&end){
-    auto currentNode=redisDataBase->searchItem(key);
+    DataBaseShard& shard=getShard(key);
+    ReadLock lock(shard.mutex);
+    auto currentNode=lookupKeyRead(shard,key);
     std::string resMessage = "";
-    int size = 0;
-    if(currentNode==nullptr||currentNode->value.type()!=RedisValue::ARRAY){
+    if(currentNode==nullptr||!currentNode->value.isList()){
         resMessage="(nil)";
     }else{
         
-        RedisValue::array& valueList = currentNode->value.arrayItems();
+        const QuickList& valueList = currentNode->value.listItems();
         int left = std::stoi(start);
         int right = std::stoi(end);
         left = std::max(left,0);
-        right = std::min(right,int(valueList.size()-1));
-        if(right<left||left>=valueList.size()){
+        right = std::min(right,int(valueList.size())-1);
+        if(right<left||left>=int(valueList.size())){
             resMessage="(empty list or set)";
+            return resMessage;
         }
-        for(int i=left;i<=right;i++){
-            auto item = valueList[i];
-            resMessage+=std::to_string(i+1)+") "+item.dump();
+        //按块跳过start之前的元素，之后在块内顺序读取
+        int i=left;
+        valueList.range(left,right,[&](const char* data,size_t length){
+            resMessage+=std::to_string(i+1)+") "+RedisValue(std::string(data,length)).dump();
             if(i!=right){
                 resMessage+="\n";
             }
-        }
+            i++;
+        });
     }
     return resMessage;
 }
@@ -472,121 +1590,126 @@ std::string RedisHelper::lrange(const std::string&key,const std::string &start,c
 
 
 std::string RedisHelper::hset(const std::string&key,const std::vector<std::string>&filed){
-    auto currentNode=redisDataBase->searchItem(key);
+    std::string oom=performEvictions();
+    if(!oom.empty()){
+        return oom;
+    }
+    DataBaseShard& shard=getShard(key);
+    WriteLock lock(shard.mutex);
+    auto currentNode=lookupKeyWrite(shard,key);
     std::string resMessage = "";
     int count = 0;
     if(currentNode==nullptr){
-        std::map<std::string,RedisValue>data;
-        RedisValue redisHash(data) ;
-        RedisValue::object& valueMap = redisHash.objectItems();
-        for(int i=0;i<filed.size();i+=2){
-            std::string hkey=filed[i];
-            RedisValue hval=filed[i+1];
-            if(!valueMap.count(hkey)){
-                valueMap[hkey] = hval;
+        RedisHash valueMap; //字段少时使用紧凑编码
+        for(size_t i=0;i<filed.size();i+=2){
+            if(valueMap.insert(filed[i],filed[i+1])){
                 count++;
             }
         }
-        redisDataBase->addItem(key,valueMap);
+        shard.addItem(key,RedisValue(std::move(valueMap)));
     }else{
-        if(currentNode->value.type()!=RedisValue::OBJECT){
+        if(!currentNode->value.isHash()){
             resMessage="The key:" +key+" "+"already exists and the value is not a hashtable!";
             return resMessage;
         }else{
-            RedisValue::object& valueMap = currentNode->value.objectItems();
-            for(int i=0;i<filed.size();i+=2){
-                std::string hkey=filed[i];
-                RedisValue hval=filed[i+1];
-                if(!valueMap.count(hkey)){
-                    valueMap[hkey] = hval;
+            DataBaseShard::ValueUpdate update(shard,currentNode);
+            RedisHash& valueMap = currentNode->value.hashItems();
+            for(size_t i=0;i<filed.size();i+=2){
+                if(valueMap.insert(filed[i],filed[i+1])){ //字段已存在时不修改
                     count++;
                 }
             }
         }
     }
-
+    if(count>0){
+        propagate();
+    }
     resMessage="(integer) "+std::to_string(count);
     return resMessage;
 }
 std::string RedisHelper::hget(const std::string&key,const std::string&filed){
-    auto currentNode=redisDataBase->searchItem(key);
+    DataBaseShard& shard=getShard(key);
+    ReadLock lock(shard.mutex);
+    auto currentNode=lookupKeyRead(shard,key);
     std::string resMessage = "";
-    int count = 0;
-    if(currentNode==nullptr||currentNode->value.type()!=RedisValue::OBJECT){
+    if(currentNode==nullptr||!currentNode->value.isHash()||!currentNode->value.hashItems().get(filed,resMessage)){
         resMessage="(nil)";
-    }else{
-        RedisValue::object& valueMap = currentNode->value.objectItems();
-        if(!valueMap.count(filed)){
-            resMessage="(nil)";
-        }else{
-            resMessage = valueMap[filed].stringValue();
-        }
-        
     }
     return resMessage;
 }
 std::string RedisHelper::hdel(const std::string&key,const std::vector<std::string>&filed){
-    auto currentNode=redisDataBase->searchItem(key);
+    DataBaseShard& shard=getShard(key);
+    WriteLock lock(shard.mutex);
+    auto currentNode=lookupKeyWrite(shard,key);
     std::string resMessage = "";
     int count = 0;
-    if(currentNode==nullptr||currentNode->value.type()!=RedisValue::OBJECT){
+    if(currentNode==nullptr||!currentNode->value.isHash()){
         count = 0;
     }else{
-        RedisValue::object& valueMap = currentNode->value.objectItems();
+        DataBaseShard::ValueUpdate update(shard,currentNode);
+        RedisHash& valueMap = currentNode->value.hashItems();
         for(auto& hkey:filed){
-            if(valueMap.count(hkey)){
+            if(valueMap.erase(hkey)){
                 count++;
-                valueMap.erase(hkey);
             }
         }
     }
+    if(count>0){
+        propagate();
+    }
     resMessage="(integer) "+std::to_string(count);
     return resMessage;
 }
 
 std::string RedisHelper::hkeys(const std::string&key){
-    auto currentNode=redisDataBase->searchItem(key);
+    DataBaseShard& shard=getShard(key);
+    ReadLock lock(shard.mutex);
+    auto currentNode=lookupKeyRead(shard,key);
     std::string resMessage = "";
-    int count = 0;
     if(currentNode==nullptr){
         resMessage="The key:" +key+" "+"does not exist!";
         return resMessage;
     }else{
-        if(currentNode->value.type()!=RedisValue::OBJECT){
+        if(!currentNode->value.isHash()){
             resMessage="The key:" +key+" "+"already exists and the value is not a hashtable!";
             return resMessage;
         }else{
-            RedisValue::object& valueMap = currentNode->value.objectItems();
             int index = 1;
-            for(auto hkey:valueMap){
-                resMessage+=std::to_string(index)+") "+hkey.first+"\n";
+            currentNode->value.hashItems().forEach([&](const char* field,size_t fieldLength,const char*,size_t){
+                resMessage+=std::to_string(index)+") ";
+                resMessage.append(field,fieldLength).push_back('\n');
                 index++;
+            });
+            if(!resMessage.empty()){
+                resMessage.pop_back();
             }
-            resMessage.erase(resMessage.size()-1);
         }
     }
     return resMessage;
 }
 
 std::string RedisHelper::hvals(const std::string&key){
-    auto currentNode=redisDataBase->searchItem(key);
+    DataBaseShard& shard=getShard(key);
+    ReadLock lock(shard.mutex);
+    auto currentNode=lookupKeyRead(shard,key);
     std::string resMessage = "";
-    int count = 0;
     if(currentNode==nullptr){
         resMessage="The key:" +key+" "+"does not exist!";
         return resMessage;
     }else{
-        if(currentNode->value.type()!=RedisValue::OBJECT){
+        if(!currentNode->value.isHash()){
             resMessage="The key:" +key+" "+"already exists and the value is not a hashtable!";
             return resMessage;
         }else{
-            RedisValue::object& valueMap = currentNode->value.objectItems();
             int index = 1;
-            for(auto hkey:valueMap){
-                resMessage+=std::to_string(index)+") "+hkey.second.stringValue()+"\n";
+            currentNode->value.hashItems().forEach([&](const char*,size_t,const char* value,size_t valueLength){
+                resMessage+=std::to_string(index)+") ";
+                resMessage.append(value,valueLength).push_back('\n');
                 index++;
+            });
+            if(!resMessage.empty()){
+                resMessage.pop_back();
             }
-            resMessage.erase(resMessage.size()-1);
         }
     }
     return resMessage;
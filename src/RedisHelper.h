@@ -3,37 +3,383 @@
 #include <memory>
 #include <string>
 #include <vector>
-#include "SkipList.h" 
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <cstdint>
+#include <random>
+#include <sys/types.h>
+#include "SkipList.h"
+#ifdef USE_CONCURRENT_SKIPLIST
+#include "ConcurrentSkipList.h"
+#endif
+#ifdef USE_HASH_INDEX
+#include "HashIndex.h"
+#endif
 #include "RedisValue/RedisValue.h"
+#include "AppendOnlyFile.h"
+#include "TimingWheel.h"
+#include "Eviction.h"
+#include "MemoryCounter.h"
 //#define DEFAULT_DB_FOLDER "data_files"
 #define DATABASE_FILE_NAME "db"
 #define DATABASE_FILE_NUMBER 15
+#define DATABASE_SHARD_NUMBER 16 //每个数据库按key的哈希值划分的分片数
+#define BGSAVE_RETRY_DELAY 5 //bgsave失败后，自动保存至少间隔这么多秒再重试
+#define ACTIVE_EXPIRE_CYCLE_KEYS 64 //主动过期时每次持有分片的锁最多删除的key数
+#define EVICTION_VOLATILE_BUCKETS 1024 //volatile策略抽样时最多检查的expires桶数
+#define OOM_ERROR "OOM command not allowed when used memory > 'maxmemory'."
+#define AOF_WRITE_ERROR "MISCONF Errors writing to the AOF file. Write commands are disabled until save, bgsave or bgrewriteaof succeeds."
+#define MEMORY_USAGE_SAMPLES 5 //MEMORY USAGE默认对JSON数组和对象每一层抽样的元素个数，0表示全部统计
+
+//自动保存规则：距离上次保存超过seconds秒，并且至少有changes次修改时，触发bgsave
+struct SaveRule{
+    int seconds;
+    long long changes;
+};
+static const SaveRule SAVE_RULES[]={{900,1},{300,10},{60,10000}};
+
+//存储引擎：每个分片一个跳表，由分片的读写锁保护
+//打开USE_CONCURRENT_SKIPLIST时使用无锁跳表，get、strlen、exists和mget读取字符串时不加分片锁（见RedisHelper::readPublished）
+#ifdef USE_CONCURRENT_SKIPLIST
+typedef ConcurrentSkipList<std::string, RedisValue> DataBaseEngine;
+
+//分片锁：独占加锁之后和解锁之前各把version加1，version为奇数时有写命令正在修改分片
+//不加锁读取多个key时在读取前后比较涉及分片的version，没有变化时读到的是同一时刻的结果
+class ShardMutex:public std::shared_timed_mutex{
+public:
+    void lock(){
+        std::shared_timed_mutex::lock();
+        version.fetch_add(1);
+    }
+    bool try_lock(){
+        if(!std::shared_timed_mutex::try_lock()){
+            return false;
+        }
+        version.fetch_add(1);
+        return true;
+    }
+    void unlock(){
+        version.fetch_add(1);
+        std::shared_timed_mutex::unlock();
+    }
+    uint64_t getVersion() const{ return version.load(); }
+private:
+    std::atomic<uint64_t> version{0};
+};
+#else
+typedef SkipList<std::string, RedisValue> DataBaseEngine;
+typedef std::shared_timed_mutex ShardMutex;
+#endif
+
+typedef std::shared_lock<ShardMutex> ReadLock; //只读命令持有分片的共享锁
+typedef std::unique_lock<ShardMutex> WriteLock; //修改命令持有分片的独占锁
+
+//数据库分片：每个分片有自己的跳表和锁，不同分片上的命令可以并行执行
+//按key增删查都通过分片的addItem/deleteItem/searchItem，打开USE_HASH_INDEX时同时维护哈希索引；有序遍历直接使用skipList
+//searchItem不检查过期时间，命令通过RedisHelper的lookupKeyRead/lookupKeyWrite查找
+struct DataBaseShard{
+    typedef DataBaseEngine::Node Node;
+    std::shared_ptr<DataBaseEngine> skipList = std::make_shared<DataBaseEngine>();
+#ifdef USE_HASH_INDEX
+    HashIndex<Node> index; //key到跳表节点的索引，点查询O(1)，不用在跳表中逐层比较字符串
+#endif
+    //保护整条命令的执行过程（查找、修改节点的value），而不仅是跳表结构
+    //读写锁：同一分片上的只读命令可以并行执行
+    ShardMutex mutex;
+    //设置了过期时间的key -> 过期时间（毫秒时间戳）和时间轮中的定时器，没有过期时间的key不占用额外的内存
+    std::unordered_map<std::string,TimerNode> expires;
+    std::unique_ptr<TimingWheel> wheel; //第一次设置过期时间时创建，主动过期只处理其中到期的定时器
+    //按分配器统计的内存（见MemoryCounter.h），在独占锁下随每次增删和修改value更新，MEMORY STATS直接读取不用遍历
+    size_t keyBytes=0; //跳表节点和key字符串
+    size_t valueBytes=0; //value在节点之外占用的内存（无锁跳表发布的只读副本不计入）
+
+    static size_t nodeBytes(const Node* node){
+        return Node::allocSize(node->level)+stringHeapBytes(node->key);
+    }
+    //expires中一个key的估算：unordered_map的节点（next指针、key和定时器、缓存的哈希值）和key的堆内存
+    static size_t expireEntryBytes(const std::string& key){
+        return sizeof(void*)+sizeof(std::pair<const std::string,TimerNode>)+sizeof(size_t)+stringHeapBytes(key);
+    }
+    //索引结构占用的内存：哈希索引的槽位数组、expires的节点和桶数组（不包括长key的堆内存）、时间轮
+    size_t indexBytes() const{
+        size_t bytes=expires.size()*expireEntryBytes(std::string())+expires.bucket_count()*sizeof(void*)+allocationSize(wheel.get());
+#ifdef USE_HASH_INDEX
+        bytes+=index.memoryBytes();
+#endif
+        return bytes;
+    }
+    //原地修改节点的value时在修改前创建，析构时把value占用内存的变化计入分片；作用域内不能删除节点
+    class ValueUpdate{
+    public:
+        ValueUpdate(DataBaseShard& shard,Node* node):shard(shard),node(node),before(node->value.memoryUsage()){}
+        ~ValueUpdate(){
+            shard.valueBytes+=node->value.memoryUsage()-before;
+        }
+        ValueUpdate(const ValueUpdate&)=delete;
+        ValueUpdate& operator=(const ValueUpdate&)=delete;
+    private:
+        DataBaseShard& shard;
+        Node* node;
+        size_t before;
+    };
+
+    Node* searchItem(const std::string& key){
+#ifdef USE_HASH_INDEX
+        return index.find(key);
+#else
+        return skipList->searchItem(key);
+#endif
+    }
+    Node* addItem(const std::string& key, const RedisValue& value){
+        Node* node=skipList->addItem(key,value);
+        if(node!=nullptr){
+            node->access.store(newAccessInfo(),std::memory_order_relaxed);
+            keyBytes+=nodeBytes(node);
+            valueBytes+=node->value.memoryUsage();
+#ifdef USE_HASH_INDEX
+            index.insert(node);
+#endif
+        }
+        return node;
+    }
+    //加载快照时使用，key按从小到大的顺序到达时直接接在跳表末尾
+    Node* appendItem(const std::string& key, const RedisValue& value){
+        Node* node=skipList->appendItem(key,value);
+        if(node!=nullptr){
+            node->access.store(newAccessInfo(),std::memory_order_relaxed);
+            keyBytes+=nodeBytes(node);
+            valueBytes+=node->value.memoryUsage();
+#ifdef USE_HASH_INDEX
+            index.insert(node);
+#endif
+        }
+        return node;
+    }
+    //淘汰时抽样一个key，分片为空时返回nullptr
+    Node* sampleItem(uint64_t random){
+#ifdef USE_HASH_INDEX
+        return index.sample(random);
+#else
+        return skipList->randomNode(random);
+#endif
+    }
+    //只在设置了过期时间的key中抽样：从随机的桶开始找非空的桶，大量key删除后expires不会缩小，最多检查EVICTION_VOLATILE_BUCKETS个桶
+    Node* sampleVolatileItem(uint64_t random){
+        if(expires.empty()){
+            return nullptr;
+        }
+        size_t bucketCount=expires.bucket_count();
+        for(size_t i=0;i<bucketCount&&i<EVICTION_VOLATILE_BUCKETS;i++){
+            size_t bucket=(random+i)%bucketCount;
+            if(expires.begin(bucket)!=expires.end(bucket)){
+                return searchItem(expires.begin(bucket)->first);
+            }
+        }
+        return nullptr;
+    }
+    bool deleteItem(const std::string& key){
+        removeExpire(key);
+        Node* node=searchItem(key);
+        if(node==nullptr){
+            return false;
+        }
+        keyBytes-=nodeBytes(node);
+        valueBytes-=node->value.memoryUsage();
+#ifdef USE_HASH_INDEX
+        index.erase(key); //先从索引中删除，跳表删除后节点就被释放了
+#endif
+        return skipList->deleteItem(key);
+    }
+    int64_t getExpire(const std::string& key) const{ //没有设置过期时间时返回-1
+        if(expires.empty()){
+            return -1;
+        }
+        auto it=expires.find(key);
+        return it==expires.end()?-1:it->second.when;
+    }
+    void setExpire(const std::string& key,int64_t when);
+    bool removeExpire(const std::string& key){
+        if(expires.empty()){
+            return false;
+        }
+        auto it=expires.find(key);
+        if(it==expires.end()){
+            return false;
+        }
+        wheel->cancel(&it->second);
+        expires.erase(it);
+        return true;
+    }
+};
+
+//一个数据库：由DATABASE_SHARD_NUMBER个分片组成，第一次访问时才从文件加载，之后一直留在内存中
+struct DataBase{
+    std::vector<std::shared_ptr<DataBaseShard>> shards;
+    std::atomic<bool> loaded{false};
+    uint64_t loadedAofId=0; //加载的数据库文件中记录的AOF编号和长度
+    uint64_t loadedAofOffset=0;
+};
+
 //增删改查操作
 class RedisHelper{
 private:
     // static const std::string DEFAULT_DB_FOLDER;
     // static const std::string DATABASE_FILE_NAME;
     // static const int DATABASE_FILE_NUMBER;
-    std::string dataBaseIndex="0"; //当前数据库索引
-    std::shared_ptr<SkipList<std::string, RedisValue>> redisDataBase = std::make_shared<SkipList<std::string, RedisValue>>(); //数据库
+    //所有数据库同时留在内存中，各自独立；命令作用于当前线程选择的数据库（见select）
+    std::vector<std::unique_ptr<DataBase>> dataBases;
+    std::string dataFolder; //数据库文件所在的目录
+    std::mutex loadMutex; //加载数据库时持有；保存时持有，保存期间不会有新加载的数据库；加锁顺序：先loadMutex，后分片锁
+
+    //持久化状态
+    std::atomic<long long> dirty{0}; //上次保存之后的修改次数
+    std::atomic<time_t> lastSaveTime{0}; //上次保存成功的时间
+    std::mutex saveMutex; //保护以下后台保存的状态；加锁顺序：先分片锁，后saveMutex
+    pid_t saveChildPid=-1; //正在执行bgsave的子进程，-1表示没有
+    long long dirtyAtFork=0; //fork时的修改次数，保存成功后从dirty中减去
+    std::chrono::steady_clock::time_point saveStartTime; //fork的时间
+    time_t lastBgsaveTryTime=0; //上次尝试bgsave的时间
+    bool lastBgsaveOk=true; //上次bgsave是否成功
+    long long lastForkUsec=0; //上次fork耗时（微秒），fork期间持有所有分片的锁，服务器暂停响应
+    long long lastBgsaveMs=-1; //上次bgsave从fork到子进程结束的时间（毫秒）
+    long long lastBgsaveCpuMs=-1; //上次bgsave子进程消耗的CPU时间（毫秒）
+    long long bgsaveCount=0; //成功的bgsave次数
+    std::unique_ptr<AppendOnlyFile> aof; //没有开启AOF时为空
+    bool shutDown=false; //已经调用过shutdown，析构时不再保存
+
+    //过期
+    std::atomic<bool> expireEnabled{true}; //重放AOF时关闭：执行时删除过期key记录了del，重放时按记录的顺序删除
+    std::atomic<long long> expiredKeys{0}; //因为过期被删除的key数
+    size_t expireShardCursor=0; //主动过期下一次从这个分片（所有数据库的分片依次编号）开始，只在定时任务线程中访问
+
+    //淘汰：同一时间只有一个线程淘汰，淘汰池在多次淘汰之间保留
+    struct EvictionCandidate{
+        uint64_t score; //越大越应该被淘汰
+        int dataBaseIndex;
+        std::string key;
+    };
+    std::mutex evictionMutex; //保护以下淘汰状态；不和分片锁同时等待：持有它时只按顺序获取单个分片的锁
+    std::vector<EvictionCandidate> evictionPool; //按score从小到大，最多EVICTION_POOL_SIZE个
+    std::mt19937_64 evictionRandom{std::random_device{}()};
+    size_t evictionShardCursor=0; //每次从每个数据库的这个分片抽样
+    std::atomic<long long> evictedKeys{0}; //因为maxmemory被淘汰的key数
 public:
-    RedisHelper();
+    explicit RedisHelper(const std::string& folder=DEFAULT_DB_FOLDER); //folder：数据库文件所在的目录
     ~RedisHelper();
+    const std::string& getDataFolder() const{ return dataFolder; } //AOF也放在这个目录中
 private:
     
     //从文件中加载数据  持久性保存数据
-    void loadData(std::string loadPath);  
-    std::string getFilePath();
+    void loadData(DataBase& dataBase,const std::string& loadPath);
+    void loadSnapshot(DataBase& dataBase,const std::string& loadPath); //加载二进制快照
+    void loadText(DataBase& dataBase,const std::string& loadPath); //加载旧的文本格式（每行 key:value），用于迁移
+    std::string getFilePath(int index);
+    DataBase& getDataBase(int index); //没有加载的数据库先从文件加载
+    DataBase& currentDataBase(); //当前线程选择的数据库
+    std::vector<int> loadedDataBases(); //已经加载的数据库，调用前需要持有loadMutex
+
+    //分片相关
+    size_t shardIndex(const std::string& key) const; //key所在分片的下标
+    DataBaseShard& getShard(const std::string& key); //当前数据库中key所在的分片
+    //按分片下标从小到大加锁，多key命令之间不会死锁；Lock为ReadLock或WriteLock
+    template<typename Lock>
+    std::vector<Lock> lockShards(const std::vector<std::string>& keys);
+    template<typename Lock>
+    std::vector<Lock> lockAllShards(); //当前数据库的所有分片
+    template<typename Lock>
+    std::vector<Lock> lockDataBases(const std::vector<int>& indexes); //多个数据库的所有分片，用于保存
+
+    //持久化，调用前需要持有loadMutex和所有已加载数据库的分片锁
+    void flushLocked(const std::vector<int>& indexes);
+    uint64_t countKeys(int index); //数据库所有分片的key个数之和
+    //不加任何锁，可以在fork出的子进程中调用
+    bool writeSnapshot(int index,uint64_t keyCount,uint64_t aofId,uint64_t aofOffset);
+    void stopBackgroundSave(); //终止正在运行的bgsave子进程（同步保存会写入更新的数据）
+    void propagate(); //命令修改了数据，在持有分片锁时调用：计入修改次数，并把当前命令追加到AOF
+    void propagate(const std::string& command); //同上，AOF中记录改写后的命令（例如相对的过期时间改写为绝对时间）
+    void waitAppendOnly(uint64_t sequence); //等待AOF写入到sequence，在BatchScope中时推迟到批量命令结束
+
+    //过期，调用前需要持有key所在分片的锁
+    bool keyExpired(DataBaseShard& shard,const std::string& key); //key设置的过期时间已到
+    DataBaseShard::Node* lookupKeyRead(DataBaseShard& shard,const std::string& key); //已过期的key当作不存在，不修改数据，共享锁下调用
+    DataBaseShard::Node* lookupKeyWrite(DataBaseShard& shard,const std::string& key); //已过期的key先删除，独占锁下调用
+#ifdef USE_CONCURRENT_SKIPLIST
+    //不加分片锁读取：调用者持有EpochManager::Guard，value在Guard析构之前有效，key不存在或已过期时为nullptr
+    //value还没有发布（刚被写命令修改过，或者不是字符串）时返回false，调用者改为加锁读取，并用publishValue发布
+    bool readPublished(DataBaseShard& shard,const std::string& key,const RedisValue*& value);
+    //多个key：另外要求读取期间涉及的分片都没有执行写命令，保证结果是同一时刻的，否则返回false
+    bool readPublished(const std::vector<std::string>& keys,std::vector<const RedisValue*>& values);
+    void publishValue(DataBaseShard& shard,DataBaseShard::Node* node); //共享锁下调用：发布字符串value的副本
+#endif
+    void deleteExpiredKey(DataBaseShard& shard,std::string key,int dataBaseIndex); //删除过期的key，并在AOF中记录一条del
+    void deleteAndPropagate(DataBaseShard& shard,std::string key,int dataBaseIndex); //删除key并在AOF中记录一条del，过期和淘汰共用
+
+    //淘汰，调用前不能持有分片锁：会增加内存的写命令在加锁之前调用
+    std::string performEvictions(); //超过maxmemory时按策略淘汰key直到低于maxmemory，不能淘汰时返回OOM错误，否则返回空字符串
+    void sampleEvictionPool(MaxMemoryPolicy policy); //从每个已加载的数据库抽样，放入淘汰池
+    bool evictOne(MaxMemoryPolicy policy); //淘汰池中分数最高并且仍然存在的key，没有可以淘汰的key时返回false
+
+    //调用前必须已经持有key所在分片的锁
+    std::string setLocked(const std::string& key, const RedisValue& value);
+    std::string setnxLocked(const std::string& key, const RedisValue& value);
+    std::string setxxLocked(const std::string& key, const RedisValue& value);
 public:
+    static int64_t currentTimeMs(); //当前时间，毫秒时间戳；过期时间都按绝对时间保存，重启后仍然有效
     void flush(); //写入文件 
-    //选择数据库
+    void shutdown(); //服务器退出前在主线程调用：保存数据库文件，写出并关闭AOF
+    std::string save(); //save命令：同步保存
+    std::string bgsave(); //bgsave命令：fork子进程在后台保存
+    std::string bgrewriteaof(); //bgrewriteaof命令：在后台重写AOF
+    void backgroundSaveCron(); //由服务器定时调用：回收结束的子进程，检查自动保存规则
+    std::string info(); //info命令：持久化相关的统计信息，以及每个数据库是否已加载、key个数
+    //开启AOF，调用前需要先重放已有的AOF；aofId为AOF的编号（0表示创建新的AOF），validLength为完整命令的长度
+    bool openAppendOnly(const std::string& path,AppendFsync policy,uint64_t aofId,uint64_t validLength);
+    uint64_t coveredAppendOnlyBytes(uint64_t aofId); //重放AOF时跳过的长度：当前数据库的文件中已经包含的命令
+    //和Redis一样，AOF最近一次写入失败时拒绝写命令，返回MISCONF错误，否则返回空字符串
+    std::string appendOnlyWriteError();
+    void setExpireEnabled(bool enabled); //重放AOF期间关闭过期
+    //主动过期：由服务器定时调用，抽查设置了过期时间的key并删除已过期的，最多执行timeLimitUs微秒
+    void activeExpireCycle(long long timeLimitUs);
+    //config get/set：目前支持maxmemory和maxmemory-policy
+    std::string configGet(const std::string& name);
+    std::string configSet(const std::string& name,const std::string& value);
+    //memory usage：key占用的字节数，samples为JSON数组和对象每一层统计的元素个数（0表示全部）
+    std::string memoryUsage(const std::string& key,size_t samples=MEMORY_USAGE_SAMPLES);
+    //memory stats：进程的内存、已加载数据库中key、value和索引占用的内存
+    std::string memoryStats();
+
+    //一条命令的执行范围：记录正在执行的命令，命令修改了数据时由propagate写入AOF
+    //析构时（已经释放分片锁）等待命令写入文件，保证客户端收到回复时命令已经按策略持久化
+    class CommandScope{
+    public:
+        CommandScope(RedisHelper& helper,const std::vector<std::string>& tokens);
+        ~CommandScope();
+    private:
+        RedisHelper& helper;
+        std::string command; //空格分隔的原始命令
+    };
+    //一批命令（redis_batch）的执行范围：其中的命令结束时不再各自等待AOF写入，析构时等待最后一条命令写入一次
+    //调用者的约定：析构时（等待AOF写入）不能持有分片锁，也不能持有服务器全局的数据库锁的独占锁，可以不持有或持有共享锁
+    class BatchScope{
+    public:
+        explicit BatchScope(RedisHelper& helper);
+        ~BatchScope();
+    private:
+        RedisHelper& helper;
+    };
+    //选择数据库：只对当前线程有效，之后的命令作用于这个数据库；服务器在执行每条命令前按会话选择
     std::string select(int index);
+    int getDataBaseIndex() const; //当前线程选择的数据库索引
 
     // key操作命令
     std::string keys(const std::string pattern="*");
 
     // 获取键总数
-    std::string dbsize()const;
+    std::string dbsize();
 
     // 查询键是否存在
     std::string exists(const std::vector<std::string>&keys);
@@ -44,26 +390,40 @@ public:
     // 更改键名称
     std::string rename(const std::string&oldName,const std::string&newName);
 
+    // 过期时间
+    // EXPIRE/PEXPIRE/EXPIREAT/PEXPIREAT都转换为绝对时间（毫秒时间戳）
+    std::string expireAt(const std::string& key,int64_t timestampMs);
+    // TTL/PTTL：剩余的秒数/毫秒数，key不存在时为-2，没有设置过期时间时为-1
+    std::string ttl(const std::string& key,bool milliseconds=false);
+    // 去掉过期时间
+    std::string persist(const std::string& key);
+
     // 字符串操作命令
-    std::string set(const std::string& key, const RedisValue& value,const SET_MODEL model=NONE);
+    // expireAt为过期时间（毫秒时间戳），-1表示不设置过期时间；没有设置时会去掉key原来的过期时间
+    std::string set(const std::string& key, const RedisValue& value,const SET_MODEL model=NONE,int64_t expireAt=-1);
 
     std::string setnx(const std::string& key, const RedisValue& value);
 
-    std::string setex(const std::string& key, const RedisValue& value);
+    // SETEX key seconds value：设置值和过期时间
+    std::string setex(const std::string& key, int64_t seconds, const RedisValue& value);
 
     // 获取键值
     std::string get(const std::string&key);
+    // 批量命令中连续的set key value和get key：涉及的分片只加一次锁，responses中追加每条命令的结果，和单独执行时相同
+    // setBatch在AOF中为每个key记录一条set
+    void setBatch(const std::vector<std::string>& keys,const std::vector<std::string>& values,std::vector<std::string>& responses);
+    void getBatch(const std::vector<std::string>& keys,std::vector<std::string>& responses);
     // 值递增/递减
     std::string incr(const std::string& key);
 
-    std::string incrby(const std::string& key,int increment);
+    std::string incrby(const std::string& key,int64_t increment);
 
     std::string incrbyfloat(const std::string&key,double increment);
 
     // 同样，递减使用decr、decrby命令。
     std::string decr(const std::string&key);
 
-    std::string decrby(const std::string&key,int increment);
+    std::string decrby(const std::string&key,int64_t increment);
 
     // 批量存放键值
     std::string mset(std::vector<std::string>&items);
@@ -37,10 +37,17 @@ void RedisServer::printStartMessage() {
     std::cout << initMessage << std::endl;
 }
 
+int RedisServer::stopPipe[2] = {-1, -1};
+
 void RedisServer::start() {
-    signal(SIGINT, signalHandler);  //注册信号处理函数，当Ctrl+C终止程序时，执行signalHandler函数，将未保存的数据写入到文件中 
+    //写端非阻塞：连续收到多个信号时管道写满也不会阻塞在信号处理函数中
+    if (pipe(stopPipe) == 0) {
+        fcntl(stopPipe[1], F_SETFL, fcntl(stopPipe[1], F_GETFL) | O_NONBLOCK);
+    }
+    signal(SIGINT, signalHandler);  //注册信号处理函数，当Ctrl+C终止程序时，通知主线程将未保存的数据写入到文件中 
     printLogo(); //打印启动logo
     printStartMessage(); //打印RedisServer的启动信息
+    cronThread = std::thread(&RedisServer::serverCron, this); //启动定时任务
     // string s ;
     // while (!stop) {
     //     getline(cin,s);
@@ -49,7 +56,242 @@ void RedisServer::start() {
     // }
 }
 
-string RedisServer::executeTransaction(std::queue<std::string>&commandsQueue){
+//定时任务：回收bgsave子进程，检查自动保存规则，主动清理过期key
+void RedisServer::serverCron() {
+    while (!stop) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(SERVER_CRON_INTERVAL));
+        CommandParser::getRedisHelper()->backgroundSaveCron();
+        {
+            //和普通命令一样持有共享锁，事务执行期间不删除key
+            std::shared_lock<std::shared_timed_mutex> sharedLock(dataBaseMutex);
+            CommandParser::getRedisHelper()->activeExpireCycle(SERVER_CRON_INTERVAL * 1000LL * ACTIVE_EXPIRE_CYCLE_TIME_PERCENT / 100);
+        }
+    }
+}
+
+//获取客户端的会话，不存在则创建
+std::shared_ptr<ClientSession> RedisServer::getSession(const std::string& identity) {
+    std::lock_guard<std::mutex> lock(sessionsMutex);
+    auto now = std::chrono::steady_clock::now();
+    auto it = sessions.find(identity);
+    if (it != sessions.end()) {
+        return it->second;
+    }
+    //创建新会话时顺便清理空闲的会话（客户端没有发送quit就断开时，会话会一直留在表中）
+    if (now - lastSweepTime > std::chrono::seconds(SESSION_IDLE_TIMEOUT)) {
+        lastSweepTime = now;
+        for (auto iter = sessions.begin(); iter != sessions.end();) {
+            std::unique_lock<std::mutex> sessionLock(iter->second->mutex, std::try_to_lock);
+            if (sessionLock.owns_lock() && !iter->second->startMulti
+                && now - iter->second->lastActiveTime > std::chrono::seconds(SESSION_IDLE_TIMEOUT)) {
+                sessionLock.unlock();
+                iter = sessions.erase(iter);
+            } else {
+                ++iter;
+            }
+        }
+    }
+    std::shared_ptr<ClientSession> session = std::make_shared<ClientSession>();
+    std::ostringstream oss; //路由标识是二进制的，转成十六进制便于显示
+    for (unsigned char ch : identity) {
+        oss << std::hex << std::setw(2) << std::setfill('0') << (int)ch;
+    }
+    session->id = oss.str();
+    session->createTime = now;
+    session->lastActiveTime = now;
+    sessions[identity] = session;
+    return session;
+}
+
+//客户端断开连接（quit/exit）时删除会话
+void RedisServer::removeSession(const std::string& identity) {
+    std::lock_guard<std::mutex> lock(sessionsMutex);
+    sessions.erase(identity);
+}
+
+//select命令：只修改会话选择的数据库，执行之后的命令时由RedisHelper切换到这个数据库
+string RedisServer::selectDataBase(ClientSession& session, std::vector<std::string>& tokens) {
+    if (tokens.size() < 2) {
+        return "wrong number of arguments for SELECT.";
+    }
+    int index = 0;
+    try {
+        index = std::stoi(tokens[1]); //将字符串转换为整数
+    } catch (std::invalid_argument const& e) { //如果转换失败
+        return tokens[1] + " is not a numeric type"; //返回错误信息
+    }
+    if (index < 0 || index > DATABASE_FILE_NUMBER - 1) {
+        return "database index out of range.";
+    }
+    session.dataBaseIndex = index;
+    return "OK";
+}
+
+bool isWriteCommand(const std::string& command) {
+    auto it = commandMaps.find(command);
+    if (it == commandMaps.end()) {
+        return false;
+    }
+    switch (it->second) {
+        case SET: case SETNX: case SETEX: case DEL: case RENAME:
+        case EXPIRE: case PEXPIRE: case EXPIREAT: case PEXPIREAT: case PERSIST:
+        case INCR: case INCRBY: case INCRBYFLOAT: case DECR: case DECRBY:
+        case MSET: case APPEND: case LPUSH: case RPUSH: case LPOP: case RPOP:
+        case HSET: case HDEL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+//在会话选择的数据库上执行一条普通命令，调用前需要持有dataBaseMutex
+string RedisServer::executeCommand(ClientSession& session, std::vector<std::string>& tokens) {
+    std::string& command = tokens.front();
+    if (command == "select") {
+        return selectDataBase(session, tokens);
+    }
+    std::shared_ptr<RedisHelper> redisHelper = CommandParser::getRedisHelper();
+    redisHelper->select(session.dataBaseIndex); //所有数据库都在内存中，只切换当前线程使用的数据库
+    std::string responseMessage;
+    std::shared_ptr<CommandParser> commandParser = flyweightFactory->getParser(command); //获取解析器
+    if (commandParser == nullptr) {
+        return "Error: Command '" + command + "' not recognized.";
+    }
+    if (isWriteCommand(command)) {
+        std::string error = redisHelper->appendOnlyWriteError();
+        if (!error.empty()) {
+            return error;
+        }
+    }
+    //命令修改了数据时写入AOF，离开作用域时等待写入完成
+    RedisHelper::CommandScope commandScope(*redisHelper, tokens);
+    try {
+        responseMessage = commandParser->parse(tokens);
+    } catch (const std::exception& e) {
+        responseMessage = "Error processing command '" + command + "': " + e.what();
+    }
+    return responseMessage;
+}
+
+//开启AOF：先重放已有的AOF，恢复上次保存之后执行的命令，再以追加方式打开
+//policy为always、everysec、no，off表示不开启
+bool RedisServer::enableAppendOnly(const std::string& policy) {
+    AppendFsync fsync;
+    if (policy != "off" && !AppendOnlyFile::parsePolicy(policy, fsync)) {
+        std::cout << "unknown appendfsync policy: " << policy << std::endl;
+        return false;
+    }
+    std::shared_ptr<RedisHelper> redisHelper = CommandParser::getRedisHelper();
+    std::string path = redisHelper->getDataFolder() + "/" + APPENDONLY_FILE_NAME;
+    uint64_t aofId = 0;
+    uint64_t validLength = replayAppendOnlyFile(path, aofId);
+    if (policy == "off" || aofId == 0) {
+        //重放的命令先保存到数据库文件，之后不开启AOF或者创建新的AOF，否则这些命令会丢失
+        if (validLength > 0) {
+            redisHelper->save();
+        }
+        std::remove(path.c_str());
+        if (policy == "off") {
+            return true;
+        }
+    }
+    return redisHelper->openAppendOnly(path, fsync, aofId, validLength);
+}
+
+bool RedisServer::setConfig(const std::string& name, const std::string& value) {
+    std::string res = CommandParser::getRedisHelper()->configSet(name, value);
+    if (res != "OK") {
+        std::cout << res << std::endl;
+        return false;
+    }
+    return true;
+}
+
+//逐行重放AOF，返回完整命令的总长度，aofId为第一行记录的编号（没有时为0）
+//最后一行没有换行符说明写到一半时崩溃，丢弃；已经包含在数据库文件中的命令跳过
+uint64_t RedisServer::replayAppendOnlyFile(const std::string& path, uint64_t& aofId) {
+    aofId = 0;
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs.is_open()) {
+        return 0;
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::shared_ptr<RedisHelper> redisHelper = CommandParser::getRedisHelper();
+    //重放期间不删除过期的key，AOF中记录的命令按原来的结果执行，过期的key之后再删除并写入AOF
+    redisHelper->setExpireEnabled(false);
+    uint64_t validLength = 0;
+    uint64_t coveredLength = 0;
+    long long commandCount = 0;
+    long long skippedCount = 0;
+    std::string line;
+    while (std::getline(ifs, line)) {
+        if (ifs.eof()) {
+            break;
+        }
+        validLength += line.size() + 1;
+        if (validLength == line.size() + 1 && AppendOnlyFile::parseHeader(line, aofId)) {
+            continue;
+        }
+        std::vector<std::string> tokens = split(line);
+        if (tokens.empty()) {
+            continue;
+        }
+        if (tokens[0] == "select") {
+            //AOF中的select只由服务器写入；编号不合法说明文件损坏，和写到一半的最后一行一样，从这一行开始丢弃
+            int64_t index = -1;
+            if (tokens.size() != 2 || !RedisValue::toInteger(tokens[1], index)
+                || index < 0 || index > DATABASE_FILE_NUMBER - 1) {
+                validLength -= line.size() + 1;
+                std::cout << "[" << pid << "] " << getDate() << " # Bad select in append only file at offset "
+                    << validLength << ", ignoring the rest of the file" << std::endl;
+                break;
+            }
+            //之后的命令属于这个数据库，跳过的长度取决于这个数据库的文件保存时的AOF位置
+            redisHelper->select((int)index);
+            coveredLength = redisHelper->coveredAppendOnlyBytes(aofId);
+            continue;
+        }
+        if (validLength <= coveredLength) {
+            skippedCount++;
+            continue;
+        }
+        std::shared_ptr<CommandParser> commandParser = flyweightFactory->getParser(tokens[0]);
+        if (commandParser != nullptr) {
+            commandParser->parse(tokens);
+            commandCount++;
+        }
+    }
+    redisHelper->setExpireEnabled(true);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "[" << pid << "] " << getDate() << " * DB loaded from append only file: "
+        << commandCount << " commands, " << skippedCount << " already saved, " << ms << " ms" << std::endl;
+    return validLength;
+}
+
+//client list命令：列出所有客户端会话及其统计信息
+string RedisServer::clientList() {
+    std::lock_guard<std::mutex> lock(sessionsMutex);
+    auto now = std::chrono::steady_clock::now();
+    std::string res;
+    for (auto& item : sessions) {
+        ClientSession& session = *item.second;
+        //这里不加会话锁，统计信息只是近似值
+        res += "id=" + session.id
+            + " db=" + std::to_string(session.dataBaseIndex)
+            + " cmds=" + std::to_string(session.commandsProcessed)
+            + " age=" + std::to_string(std::chrono::duration_cast<std::chrono::seconds>(now - session.createTime).count())
+            + " idle=" + std::to_string(std::chrono::duration_cast<std::chrono::seconds>(now - session.lastActiveTime).count())
+            + " multi=" + (session.startMulti ? "1" : "0") + "\n";
+    }
+    if (!res.empty()) {
+        res.pop_back();
+    }
+    return res;
+}
+
+//执行事务，调用前需要持有dataBaseMutex的独占锁，事务中的命令不会和其他客户端的命令交错执行
+string RedisServer::executeTransaction(ClientSession& session){
+    std::queue<std::string>& commandsQueue = session.commandsQueue;
     //存储所有的执行结果
     std::vector<std::string>responseMessagesList; 
     while(!commandsQueue.empty()){
@@ -64,7 +306,6 @@ string RedisServer::executeTransaction(std::queue<std::string>&commandsQueue){
         while (iss >> command) {
             tokens.push_back(command);
         }
-        command = tokens.front();
         if (!tokens.empty()) {
             command = tokens.front();
             std::string responseMessage;
@@ -82,14 +323,7 @@ string RedisServer::executeTransaction(std::queue<std::string>&commandsQueue){
                 continue;
             }else{
                 //处理常规指令
-                
-                std::shared_ptr<CommandParser> commandParser = flyweightFactory->getParser(command); //获取解析器
-                
-                try {
-                    responseMessage = commandParser->parse(tokens);
-                } catch (const std::exception& e) {
-                    responseMessage = "Error processing command '" + command + "': " + e.what();
-                }   
+                responseMessage = executeCommand(session, tokens);
                 responseMessagesList.emplace_back(responseMessage);
             }
                     
@@ -97,7 +331,7 @@ string RedisServer::executeTransaction(std::queue<std::string>&commandsQueue){
                 
     }
     string res = "";
-    for(int i=0;i<responseMessagesList.size();i++){      
+    for(size_t i=0;i<responseMessagesList.size();i++){      
         std::string responseMessage = std::to_string(i+1)+")"+responseMessagesList[i];
         res += responseMessage;
         if(i!=responseMessagesList.size()-1){
@@ -108,9 +342,115 @@ string RedisServer::executeTransaction(std::queue<std::string>&commandsQueue){
     return res;
 }
     
+//identity是客户端的路由标识，用来找到该客户端的会话
 //receivedData格式类似于 "set key value"，是redis 命令
-string RedisServer::handleClient(string receivedData) {
-    
+string RedisServer::handleClient(const string& identity, string receivedData) {
+    std::shared_ptr<ClientSession> session = getSession(identity);
+    std::lock_guard<std::mutex> sessionLock(session->mutex);
+    session->commandsProcessed++;
+    session->lastActiveTime = std::chrono::steady_clock::now();
+    return processCommand(*session, identity, std::move(receivedData));
+}
+
+//按空白分割命令，和handleClient相同
+static std::vector<std::string> splitCommand(const std::string& receivedData) {
+    std::istringstream iss(receivedData);
+    std::vector<std::string> tokens;
+    std::string token;
+    while (iss >> token) {
+        tokens.push_back(std::move(token));
+    }
+    return tokens;
+}
+
+//批量命令中可以连续执行的普通命令：不是事务和连接相关的命令，并且没有开启事务
+bool RedisServer::isRegularCommand(ClientSession& session, const std::vector<std::string>& tokens) {
+    if (tokens.empty() || session.startMulti) {
+        return false;
+    }
+    const std::string& command = tokens.front();
+    return command != "quit" && command != "exit" && command != "multi" && command != "exec"
+        && command != "discard" && command != "client";
+}
+
+//一次请求执行一批命令，按顺序返回每条命令的结果，和逐条调用handleClient的结果相同：
+//  会话只加一次锁；连续的普通命令持有同一次dataBaseMutex的共享锁，其中连续的set key value、get key合并后只加一次分片锁；
+//  事务和连接相关的命令按handleClient的逻辑逐条处理，quit/exit之后的命令不再执行；
+//  命令结束时不各自等待AOF写入，返回之前等待一次
+std::vector<std::string> RedisServer::handleBatch(const string& identity, std::vector<std::string> commands) {
+    std::vector<std::string> responses;
+    responses.reserve(commands.size());
+    std::shared_ptr<ClientSession> session = getSession(identity);
+    std::lock_guard<std::mutex> sessionLock(session->mutex);
+    session->commandsProcessed += commands.size();
+    session->lastActiveTime = std::chrono::steady_clock::now();
+    std::shared_ptr<RedisHelper> redisHelper = CommandParser::getRedisHelper();
+    RedisHelper::BatchScope batchScope(*redisHelper);
+    std::vector<std::string> keys;
+    std::vector<std::string> values;
+    size_t i = 0;
+    while (i < commands.size()) {
+        std::vector<std::string> tokens = splitCommand(commands[i]);
+        if (!isRegularCommand(*session, tokens)) {
+            responses.push_back(processCommand(*session, identity, std::move(commands[i])));
+            i++;
+            if (!tokens.empty() && (tokens.front() == "quit" || tokens.front() == "exit")) {
+                break; //会话已经删除
+            }
+            continue;
+        }
+        std::shared_lock<std::shared_timed_mutex> sharedLock(dataBaseMutex);
+        while (true) {
+            std::string command = tokens.front(); //收集时tokens会被替换，不能引用
+            if ((command == "set" && tokens.size() == 3) || (command == "get" && tokens.size() == 2)) {
+                //收集连续的同一种命令
+                bool isSet = command == "set";
+                keys.clear();
+                values.clear();
+                while (true) {
+                    keys.push_back(std::move(tokens[1]));
+                    if (isSet) {
+                        values.push_back(std::move(tokens[2]));
+                    }
+                    i++;
+                    if (i == commands.size()) {
+                        break;
+                    }
+                    tokens = splitCommand(commands[i]);
+                    if (tokens.empty() || tokens.front() != command || tokens.size() != (isSet ? 3u : 2u)) {
+                        break;
+                    }
+                }
+                redisHelper->select(session->dataBaseIndex);
+                std::string error = isSet ? redisHelper->appendOnlyWriteError() : "";
+                if (!error.empty()) {
+                    responses.insert(responses.end(), keys.size(), error);
+                } else if (isSet) {
+                    redisHelper->setBatch(keys, values, responses);
+                } else {
+                    redisHelper->getBatch(keys, responses);
+                }
+            } else {
+                responses.push_back(executeCommand(*session, tokens));
+                i++;
+                if (i < commands.size()) {
+                    tokens = splitCommand(commands[i]);
+                }
+            }
+            if (i == commands.size() || !isRegularCommand(*session, tokens)) {
+                break;
+            }
+        }
+    }
+    return responses;
+}
+
+//处理一条命令，调用前需要持有会话的锁
+string RedisServer::processCommand(ClientSession& session, const string& identity, string receivedData) {
+    bool& startMulti = session.startMulti;
+    bool& fallback = session.fallback;
+    std::queue<std::string>& commandsQueue = session.commandsQueue;
+
    size_t bytesRead = receivedData.length();
      if (bytesRead > 0) {
          std::istringstream iss(receivedData);  //类似于cin
@@ -129,7 +469,7 @@ string RedisServer::handleClient(string receivedData) {
              //quit：与服务器断开连接； exit：退出客户端
              if (command == "quit" || command == "exit") {
                  responseMessage = "stop";
-                 
+                 removeSession(identity);
                  return responseMessage;
              }
              //multi命令：开启事物：
@@ -163,8 +503,9 @@ string RedisServer::handleClient(string receivedData) {
                  }
                  startMulti = false;
                  if (!fallback) {
-                     //执行事物
-                     responseMessage =  executeTransaction(commandsQueue);
+                     //执行事物，持有独占锁，其他客户端的命令在事务执行完之后才能执行
+                     std::unique_lock<std::shared_timed_mutex> exclusiveLock(dataBaseMutex);
+                     responseMessage =  executeTransaction(session);
 
                      return responseMessage;
                  }
@@ -181,21 +522,19 @@ string RedisServer::handleClient(string receivedData) {
                  responseMessage = "OK";
                  return responseMessage;
              }
+             //client list命令：列出所有客户端会话
+             else if (command == "client") {
+                 if (tokens.size() < 2 || tokens[1] != "list") {
+                     return "wrong arguments for CLIENT, only CLIENT LIST is supported.";
+                 }
+                 return clientList();
+             }
              else {
                  //处理常规指令，不是事物
                  if (!startMulti) {
-                    std::shared_ptr<CommandParser> commandParser = flyweightFactory->getParser(command);
-                     if (commandParser == nullptr) {
-                         responseMessage = "Error: Command '" + command + "' not recognized.";
-                     }
-                     else {
-                         try {
-                             responseMessage = commandParser->parse(tokens);
-                         }
-                         catch (const std::exception& e) {
-                             responseMessage = "Error processing command '" + command + "': " + e.what();
-                         }
-                     }
+                     //持有共享锁，和其他客户端的命令（包括其他数据库上的命令）并行执行
+                     std::shared_lock<std::shared_timed_mutex> sharedLock(dataBaseMutex);
+                     responseMessage = executeCommand(session, tokens);
 
                      // 发送响应消息回客户端
                      return responseMessage;
@@ -252,18 +591,37 @@ std::string RedisServer::getDate() {
     oss << std::put_time(&local_tm, "%Y-%m-%d %H:%M:%S");
     return oss.str();
 }
- //信号处理函数
+ //信号处理函数：只能调用异步信号安全的函数，保存数据需要加锁和分配内存，交给主线程在RPC循环返回后执行
 void RedisServer::signalHandler(int sig) {
-    if (sig == SIGINT) {
-        CommandParser::getRedisHelper()->flush();
-        exit(0);
+    if (sig == SIGINT && stopPipe[1] != -1) {
+        int savedErrno = errno; //不能影响被信号打断的代码看到的errno
+        char byte = 0;
+        ssize_t n = write(stopPipe[1], &byte, 1);
+        (void)n;
+        errno = savedErrno;
     }
 }
 
+void RedisServer::shutdown() {
+    stop = true;
+    if (cronThread.joinable()) {
+        cronThread.join(); //定时任务可能正在bgsave或主动过期，等它结束
+    }
+    CommandParser::getRedisHelper()->shutdown();
+}
+
 
 //构造函数
 RedisServer::RedisServer(int port, const std::string& logoFilePath) 
-: port(port), logoFilePath(logoFilePath),
-flyweightFactory(new ParserFlyweightFactory()){
+: flyweightFactory(new ParserFlyweightFactory()),
+port(port), logoFilePath(logoFilePath){
     pid = getpid();
+    lastSweepTime = std::chrono::steady_clock::now();
+}
+
+RedisServer::~RedisServer() {
+    stop = true;
+    if (cronThread.joinable()) {
+        cronThread.join();
+    }
 }
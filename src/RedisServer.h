@@ -17,13 +17,35 @@
 #include <chrono>
 #include <ctime>
 #include <signal.h>
+#include <cerrno>
 #include<fcntl.h>
 #include <cstring> 
 #include "ParserFlyweightFactory.h"
 #include <queue>
 #include <string>
+#include <memory>
+#include <unordered_map>
+#include <shared_mutex>
 using namespace std;
 
+#define SESSION_IDLE_TIMEOUT 300 //没有开启事务的会话空闲超过300秒后被清理
+#define SERVER_CRON_INTERVAL 100 //定时任务（回收bgsave子进程、检查自动保存规则、主动清理过期key）的执行间隔，毫秒
+#define ACTIVE_EXPIRE_CYCLE_TIME_PERCENT 25 //每次定时任务中主动清理过期key最多占用执行间隔的百分比
+
+//客户端会话：每个客户端连接（ZeroMQ路由标识）对应一个会话，保存该客户端的事务状态、当前数据库和统计信息
+//不同客户端的事务互不影响，可以同时进行
+struct ClientSession {
+    std::string id; //客户端编号，路由标识的十六进制表示
+    bool startMulti = false;  //是否已开启事务
+    bool fallback = false;  //是否需要回滚
+    std::queue<std::string> commandsQueue; //事物指令队列，存储一条条的命令：{"set a 1", "get a", "del a"}
+    int dataBaseIndex = 0; //该客户端选择的数据库
+    long long commandsProcessed = 0; //已处理的命令数
+    std::chrono::steady_clock::time_point createTime; //会话创建时间
+    std::chrono::steady_clock::time_point lastActiveTime; //最近一次请求的时间
+    std::mutex mutex; //同一个客户端的请求串行处理
+};
+
 //单例模式，局部静态变量懒汉模式，体现在getInstance()静态成员函数中
 class RedisServer {
 private:
@@ -32,23 +54,44 @@ private:
     std::atomic<bool> stop{false};
     pid_t pid; 
     std::string logoFilePath;
-    bool startMulti = false;  //是否已开启事务
-    bool fallback = false;  //是否需要回滚
-    std::queue<std::string>commandsQueue;//事物指令队列，存储一条条的命令：{"set a 1", "get a", "del a"}
+    std::unordered_map<std::string, std::shared_ptr<ClientSession>> sessions; //路由标识 -> 客户端会话
+    std::mutex sessionsMutex; //保护sessions
+    std::chrono::steady_clock::time_point lastSweepTime; //上一次清理空闲会话的时间
+    //普通命令持有共享锁并行执行，执行事务时持有独占锁，保证事务中的命令不会和其他客户端的命令交错执行
+    std::shared_timed_mutex dataBaseMutex;
+    std::thread cronThread; //定时任务线程
+    static int stopPipe[2]; //自管道：信号处理函数只向写端写入一个字节，主线程的RPC循环监听读端
 
 private:
     //构造函数声明为私有，防止外部创建对象
     RedisServer(int port = 5555, const std::string& logoFilePath = "logo");
-    static void signalHandler(int sig);  //信号处理函数，当Ctrl+C终止程序时，执行signalHandler函数，将未保存的数据写入到文件中
+    static void signalHandler(int sig);  //信号处理函数，当Ctrl+C终止程序时通知主线程停止，由主线程保存数据
     void printLogo(); //打印logo
     void printStartMessage(); //打印Redisserver的启动信息
     void replaceText(std::string &text, const std::string &toReplaceText, const std::string &replaceText); //替换字符串，用于printLogo()和printStartMessage()函数
     std::string getDate(); //获取当前时间，例如：2021-07-01 12:00:00
-    string executeTransaction(std::queue<std::string>&commandsQueue);
+    string executeTransaction(ClientSession& session);
+    std::shared_ptr<ClientSession> getSession(const std::string& identity); //获取（或创建）客户端的会话
+    void removeSession(const std::string& identity);
+    string executeCommand(ClientSession& session, std::vector<std::string>& tokens); //执行一条普通命令，调用前需要持有dataBaseMutex
+    string selectDataBase(ClientSession& session, std::vector<std::string>& tokens); //select命令只修改会话选择的数据库
+    string clientList(); //client list命令，列出所有会话
+    string processCommand(ClientSession& session, const string& identity, string receivedData); //处理一条命令，调用前需要持有会话的锁
+    bool isRegularCommand(ClientSession& session, const std::vector<std::string>& tokens); //不是事务和连接相关的命令，并且会话没有开启事务
+    void serverCron(); //定时任务线程的循环
+    uint64_t replayAppendOnlyFile(const std::string& path, uint64_t& aofId); //重放AOF，返回完整命令的长度
 public:
-    string handleClient(string receivedData);
+    ~RedisServer();
+    //identity是客户端的ZeroMQ路由标识，receivedData格式类似于 "set key value"
+    string handleClient(const string& identity, string receivedData);
+    //一次执行一批命令（redis_batch），按顺序返回每条命令的结果；quit/exit之后的命令不执行，没有结果
+    std::vector<std::string> handleBatch(const string& identity, std::vector<std::string> commands);
     static RedisServer* getInstance();  //静态成员函数，获取单例
     void start();
+    int stopFd() const { return stopPipe[0]; } //收到SIGINT后可读，start之后有效
+    void shutdown(); //RPC循环返回、工作线程退出后在主线程调用：停止定时任务，保存数据库并关闭AOF
+    bool enableAppendOnly(const std::string& policy); //开启AOF，在start之前调用
+    bool setConfig(const std::string& name, const std::string& value); //启动参数中的配置，和config set相同
 };
 
 #endif 
@@ -35,6 +35,13 @@ static void dump(int value, std::string &out) {
     out += buf;
 }
 
+// 用于将64位整数值转换为字符串并追加到输出字符串中
+static void dump(int64_t value, std::string &out) {
+    char buf[32];
+    snprintf(buf, sizeof buf, "%lld", static_cast<long long>(value));
+    out += buf;
+}
+
 // 用于将布尔值转换为字符串并追加到输出字符串中
 static void dump(bool value, std::string &out) {
     out += value ? "true" : "false";
@@ -93,4 +100,30 @@ static void dump(const RedisValue::object &values, std::string &out) {
     out += "}";
 }
 
+// 用于将列表转换为字符串并追加到输出字符串中，格式和字符串数组相同
+static void dump(const QuickList &values, std::string &out) {
+    bool first = true;
+    out += "[";
+    values.forEach([&](const char* data, size_t length) {
+        if (!first) out += ", ";
+        dump(std::string(data, length), out);
+        first = false;
+    });
+    out += "]";
+}
+
+// 用于将哈希表转换为字符串并追加到输出字符串中，格式和对象相同，字段按保存的顺序输出
+static void dump(const RedisHash &values, std::string &out) {
+    bool first = true;
+    out += "{";
+    values.forEach([&](const char* field, size_t fieldLength, const char* value, size_t valueLength) {
+        if (!first) out += ", ";
+        dump(std::string(field, fieldLength), out);
+        out += ": ";
+        dump(std::string(value, valueLength), out);
+        first = false;
+    });
+    out += "}";
+}
+
 #endif
@@ -1,6 +1,7 @@
 #ifndef GLOBAL_H
 #define GLOBAL_H
-#include "RedisValueType.h"
+#include "RedisValue.h"
+#include "Dump.h"
 
 // 定义最大深度常量，用于限制JSON解析或序列化的最大深度，防止栈溢出等问题。
 static const int max_depth = 200;
@@ -8,8 +9,6 @@ static const int max_depth = 200;
 // Statics结构体，用于存储JSON值的一些静态实例，如null、true、false等，以及空的字符串、向量和映射。
 // 这样做是为了避免重复创建这些常用对象，提高效率。
 struct Statics{
-    std::shared_ptr<RedisValueType> null = std::make_shared<RedisValueNull>();
-
     // 定义一个静态的空字符串
     std::string emptyString;
 
@@ -19,6 +18,12 @@ struct Statics{
     // 定义一个静态的空Json对象映射
     std::map<std::string,RedisValue> emptyMap;
 
+    // 定义一个静态的空列表
+    QuickList emptyList;
+
+    // 定义一个静态的空哈希表
+    RedisHash emptyHash;
+
     // 默认构造函数
     Statics(){}
 };
@@ -0,0 +1,276 @@
+#include "HashTable.h"
+#include "../HashIndex.h"
+#include "../MemoryCounter.h"
+#include<cstring>
+#include<cstdlib>
+#include<new>
+#include<utility>
+#include<algorithm>
+#ifdef __SSE2__
+#include<emmintrin.h>
+#endif
+
+namespace{
+//EMPTY为0，新分配的控制字节用calloc清零即可，大表不需要先memset一遍；经过MemoryCounter统计
+const int8_t CTRL_EMPTY=0;
+const int8_t CTRL_DELETED=1;
+
+//一组控制字节的比较结果，第i位为1表示组内第i个槽位满足条件
+#ifdef __SSE2__
+inline uint32_t matchByte(const int8_t* group,int8_t value){
+    __m128i ctrl=_mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl,_mm_set1_epi8(value)));
+}
+inline uint32_t matchFree(const int8_t* group){ //EMPTY或DELETED，最高位都是0
+    __m128i ctrl=_mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return ~_mm_movemask_epi8(ctrl)&0xFFFF;
+}
+#else
+inline uint32_t matchByte(const int8_t* group,int8_t value){
+    uint32_t mask=0;
+    for(int i=0;i<HASH_TABLE_GROUP;i++){
+        mask|=uint32_t(group[i]==value)<<i;
+    }
+    return mask;
+}
+inline uint32_t matchFree(const int8_t* group){
+    uint32_t mask=0;
+    for(int i=0;i<HASH_TABLE_GROUP;i++){
+        mask|=uint32_t(group[i]>=0)<<i;
+    }
+    return mask;
+}
+#endif
+
+inline int lowestBit(uint32_t mask){
+    return __builtin_ctz(mask);
+}
+
+//哈希值的低7位保存在控制字节中，最高位置1表示槽位有元素，其余位决定从哪一组开始探测
+inline int8_t hashTag(uint64_t hash){
+    return static_cast<int8_t>((hash&0x7F)|0x80);
+}
+inline size_t firstGroup(uint64_t hash,size_t groups){
+    return (hash>>7)&(groups-1);
+}
+
+//装载因子上限7/8，控制字节中至少有1/8的EMPTY，探测序列一定会结束
+inline size_t maxUsed(size_t capacity){
+    return capacity-capacity/8;
+}
+}
+
+HashTable::HashTable(const HashTable& other){
+    reserve(other.size());
+    other.forEach([&](const char* field,size_t fieldLength,const char* value,size_t valueLength){
+        Entry* entry=allocateEntry(field,fieldLength,value,valueLength);
+        uint64_t hash=hashField(field,fieldLength);
+        place(current,findFree(current,hash),hash,entry);
+    });
+}
+
+HashTable::HashTable(HashTable&& other) noexcept:current(other.current),old(other.old),rehashIndex(other.rehashIndex),allocated(other.allocated){
+    other.current=Table();
+    other.old=Table();
+    other.rehashIndex=0;
+    other.allocated=0;
+}
+
+HashTable::~HashTable(){
+    freeTable(old);
+    freeTable(current);
+}
+
+HashTable::Entry* HashTable::allocateEntry(const char* field,size_t fieldLength,const char* value,size_t valueLength){
+    Entry* entry=static_cast<Entry*>(::operator new(sizeof(Entry)+fieldLength+valueLength));
+    allocated+=allocationSize(entry);
+    entry->fieldLength=fieldLength;
+    entry->valueLength=valueLength;
+    std::memcpy(entry->data(),field,fieldLength);
+    std::memcpy(entry->data()+fieldLength,value,valueLength);
+    return entry;
+}
+
+void HashTable::freeEntry(Entry* entry){
+    allocated-=allocationSize(entry);
+    ::operator delete(entry);
+}
+
+bool HashTable::fieldEquals(const Entry* entry,const std::string& field){
+    return entry->fieldLength==field.size()&&std::memcmp(entry->data(),field.data(),field.size())==0;
+}
+
+uint64_t HashTable::hashField(const char* field,size_t length){
+    return hashBytes(field,length);
+}
+
+void HashTable::allocateTable(Table& table,size_t capacity){
+    char* memory=static_cast<char*>(countedCalloc(capacity+capacity*sizeof(Entry*),1));
+    if(memory==nullptr){
+        throw std::bad_alloc();
+    }
+    allocated+=allocationSize(memory);
+    table.ctrl=reinterpret_cast<int8_t*>(memory);
+    table.slots=reinterpret_cast<Entry**>(memory+capacity); //capacity是16的倍数，槽位数组是对齐的
+    table.capacity=capacity;
+    table.count=0;
+    table.used=0;
+}
+
+//释放表中所有的Entry和槽位数组
+void HashTable::freeTable(Table& table){
+    for(size_t i=0;i<table.capacity;i++){
+        if(table.ctrl[i]<0){
+            freeEntry(table.slots[i]);
+        }
+    }
+    allocated-=allocationSize(table.ctrl);
+    countedFree(table.ctrl);
+    table=Table();
+}
+
+void HashTable::reserve(size_t count){
+    size_t capacity=HASH_TABLE_INIT_CAPACITY;
+    while(maxUsed(capacity)<count){
+        capacity*=2;
+    }
+    allocateTable(current,capacity);
+}
+
+size_t HashTable::find(const Table& table,const std::string& field,uint64_t hash){
+    if(table.count==0){
+        return table.capacity;
+    }
+    size_t groups=table.capacity/HASH_TABLE_GROUP;
+    int8_t tag=hashTag(hash);
+    size_t group=firstGroup(hash,groups);
+    for(size_t step=1;;step++){
+        const int8_t* ctrl=table.ctrl+group*HASH_TABLE_GROUP;
+        for(uint32_t mask=matchByte(ctrl,tag);mask!=0;mask&=mask-1){
+            size_t index=group*HASH_TABLE_GROUP+lowestBit(mask);
+            if(fieldEquals(table.slots[index],field)){
+                return index;
+            }
+        }
+        if(matchByte(ctrl,CTRL_EMPTY)!=0){
+            return table.capacity;
+        }
+        group=(group+step)&(groups-1); //三角数序列，组数是2的幂时能访问到每一组
+    }
+}
+
+size_t HashTable::findFree(const Table& table,uint64_t hash){
+    size_t groups=table.capacity/HASH_TABLE_GROUP;
+    size_t group=firstGroup(hash,groups);
+    for(size_t step=1;;step++){
+        uint32_t mask=matchFree(table.ctrl+group*HASH_TABLE_GROUP);
+        if(mask!=0){
+            return group*HASH_TABLE_GROUP+lowestBit(mask);
+        }
+        group=(group+step)&(groups-1);
+    }
+}
+
+void HashTable::place(Table& table,size_t index,uint64_t hash,Entry* entry){
+    if(table.ctrl[index]==CTRL_EMPTY){
+        table.used++;
+    }
+    table.ctrl[index]=hashTag(hash);
+    table.slots[index]=entry;
+    table.count++;
+}
+
+//组内已经有EMPTY时，没有字段的探测经过这一组，可以直接置为EMPTY；否则置为DELETED，不打断其他字段的探测
+void HashTable::removeSlot(Table& table,size_t index){
+    const int8_t* group=table.ctrl+index/HASH_TABLE_GROUP*HASH_TABLE_GROUP;
+    if(matchByte(group,CTRL_EMPTY)!=0){
+        table.ctrl[index]=CTRL_EMPTY;
+        table.used--;
+    }else{
+        table.ctrl[index]=CTRL_DELETED;
+    }
+    table.count--;
+}
+
+bool HashTable::get(const std::string& field,std::string& value) const{
+    uint64_t hash=hashField(field.data(),field.size());
+    for(const Table* table:{&current,&old}){
+        size_t index=find(*table,field,hash);
+        if(index!=table->capacity){
+            const Entry* entry=table->slots[index];
+            value.assign(entry->data()+entry->fieldLength,entry->valueLength);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HashTable::insert(const std::string& field,const std::string& value){
+    if(isRehashing()){
+        rehashStep(HASH_TABLE_REHASH_STEP);
+    }
+    uint64_t hash=hashField(field.data(),field.size());
+    if(find(current,field,hash)!=current.capacity||find(old,field,hash)!=old.capacity){
+        return false;
+    }
+    if(current.capacity==0){
+        allocateTable(current,HASH_TABLE_INIT_CAPACITY);
+    }else if(current.used+old.count+1>maxUsed(current.capacity)){ //旧表剩下的元素也要能放进新表
+        startRehash();
+    }
+    place(current,findFree(current,hash),hash,allocateEntry(field.data(),field.size(),value.data(),value.size()));
+    return true;
+}
+
+bool HashTable::erase(const std::string& field){
+    if(isRehashing()){
+        rehashStep(HASH_TABLE_REHASH_STEP);
+    }
+    uint64_t hash=hashField(field.data(),field.size());
+    for(Table* table:{&current,&old}){
+        size_t index=find(*table,field,hash);
+        if(index!=table->capacity){
+            freeEntry(table->slots[index]);
+            removeSlot(*table,index);
+            return true;
+        }
+    }
+    return false;
+}
+
+//按元素个数决定新表的大小：一直插入时扩容为两倍，DELETED很多时可能不变甚至缩小，相当于清理DELETED
+//上一次rehash还没有完成时先一次迁移完，保证最多只有两张表
+void HashTable::startRehash(){
+    if(isRehashing()){
+        rehashStep(old.capacity);
+    }
+    size_t capacity=HASH_TABLE_INIT_CAPACITY;
+    while(maxUsed(capacity)<2*(current.count+1)){
+        capacity*=2;
+    }
+    old=current;
+    allocateTable(current,capacity);
+    rehashIndex=0;
+    if(old.count==0){
+        freeTable(old);
+    }
+}
+
+//迁移的槽位在旧表中置为DELETED而不是EMPTY，旧表中剩下的字段仍然可以查找到
+void HashTable::rehashStep(size_t slots){
+    size_t end=std::min(old.capacity,rehashIndex+slots);
+    for(;rehashIndex<end&&old.count!=0;rehashIndex++){
+        if(old.ctrl[rehashIndex]>=0){
+            continue;
+        }
+        Entry* entry=old.slots[rehashIndex];
+        uint64_t hash=hashField(entry->data(),entry->fieldLength);
+        place(current,findFree(current,hash),hash,entry);
+        old.ctrl[rehashIndex]=CTRL_DELETED;
+        old.count--;
+    }
+    if(old.count==0){
+        freeTable(old);
+        rehashIndex=0;
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef HASHTABLE_H
+#define HASHTABLE_H
+#include<string>
+#include<cstdint>
+#include<cstddef>
+#define HASH_TABLE_GROUP 16 //每组的槽位数，一次比较一组的控制字节
+#define HASH_TABLE_INIT_CAPACITY 16 //初始槽位数，必须是2的幂且不小于HASH_TABLE_GROUP
+#define HASH_TABLE_REHASH_STEP 64 //渐进式rehash时每次写操作最多迁移的旧表槽位数
+
+/*
+    大哈希表使用的开放寻址哈希表（参考Swiss Table）：
+    每个槽位对应一个控制字节，空槽位为EMPTY，删除后为DELETED，否则最高位为1，低7位是字段的哈希值；
+    槽位按HASH_TABLE_GROUP个一组，查找时用SSE2一次比较一组的控制字节，只有低7位相同的槽位才去比较字段，
+    组内有空槽位时查找结束，组之间按三角数序列探测。
+    字段和值一起保存在一次分配的Entry中，槽位中只保存指针。
+    扩容时不一次搬移所有元素：新建一张表接收新的写入，之后每次写操作从旧表迁移HASH_TABLE_REHASH_STEP个槽位，
+    迁移期间查找两张表。读操作在分片的共享锁下执行，所以只有写操作推进迁移。
+    不加锁，由使用它的分片保证互斥。
+*/
+class HashTable{
+public:
+    HashTable(){}
+    HashTable(const HashTable& other); //深拷贝所有元素，拷贝结果不处于rehash状态
+    HashTable(HashTable&& other) noexcept;
+    HashTable& operator=(const HashTable& other)=delete;
+    ~HashTable();
+
+    size_t size() const{ return current.count+old.count; }
+    size_t memoryUsage() const{ return allocated; } //所有Entry和槽位数组实际占用的字节数，O(1)
+    bool isRehashing() const{ return old.capacity!=0; }
+    void reserve(size_t count); //只在表为空时调用，预先分配能容纳count个元素的槽位
+    bool get(const std::string& field,std::string& value) const; //字段不存在时返回false
+    bool insert(const std::string& field,const std::string& value); //字段不存在时插入，返回是否插入
+    bool erase(const std::string& field); //返回字段是否存在
+
+    //访问所有字段，顺序不确定，func(const char* field,size_t fieldLength,const char* value,size_t valueLength)
+    template<typename Func>
+    void forEach(Func func) const;
+private:
+    struct Entry{
+        uint32_t fieldLength;
+        uint32_t valueLength;
+        char* data(){ return reinterpret_cast<char*>(this+1); } //字段和值紧跟在后面，和Entry一起分配
+        const char* data() const{ return reinterpret_cast<const char*>(this+1); }
+    };
+    struct Table{
+        int8_t* ctrl=nullptr; //控制字节和槽位数组一次分配
+        Entry** slots=nullptr;
+        size_t capacity=0;
+        size_t count=0; //元素个数
+        size_t used=0; //元素个数加上DELETED的个数，决定什么时候扩容
+    };
+    Entry* allocateEntry(const char* field,size_t fieldLength,const char* value,size_t valueLength);
+    void freeEntry(Entry* entry);
+    static bool fieldEquals(const Entry* entry,const std::string& field);
+    static uint64_t hashField(const char* field,size_t length);
+    void allocateTable(Table& table,size_t capacity);
+    void freeTable(Table& table);
+    static size_t find(const Table& table,const std::string& field,uint64_t hash); //返回槽位下标，不存在时返回capacity
+    static size_t findFree(const Table& table,uint64_t hash); //返回探测序列上第一个EMPTY或DELETED的槽位
+    static void place(Table& table,size_t index,uint64_t hash,Entry* entry);
+    static void removeSlot(Table& table,size_t index);
+    void startRehash();
+    void rehashStep(size_t slots); //从旧表迁移最多slots个槽位，迁移完后释放旧表
+
+    Table current; //新的写入都放在这张表
+    Table old; //rehash期间还没有迁移完的旧表
+    size_t rehashIndex=0; //旧表中下一个要迁移的槽位
+    size_t allocated=0; //分配和释放Entry、槽位数组时按分配器的实际大小增减
+};
+
+template<typename Func>
+void HashTable::forEach(Func func) const{
+    for(const Table* table:{&old,&current}){
+        for(size_t i=0;i<table->capacity;i++){
+            if(table->ctrl[i]<0){ //最高位为1的槽位有元素
+                const Entry* entry=table->slots[i];
+                func(entry->data(),entry->fieldLength,entry->data()+entry->fieldLength,entry->valueLength);
+            }
+        }
+    }
+}
+#endif
@@ -2,7 +2,7 @@
 #define PARSE_H
 
 #include<iostream>
-#include"RedisValueType.h"
+#include<cassert>
 #include"RedisValue.h"
 class RedisValueParser final { //final表示该类不能被继承
 public:
@@ -0,0 +1,227 @@
+#include "QuickList.h"
+#include "../MemoryCounter.h"
+#include<cstring>
+#include<new>
+#include<algorithm>
+
+QuickList::QuickList(const QuickList& other){
+    for(const Chunk* chunk=other.head;chunk!=nullptr;chunk=chunk->next){
+        Chunk* copy=allocateChunk(chunk->capacity,chunk->begin);
+        std::memcpy(copy->data()+chunk->begin,chunk->data()+chunk->begin,chunk->end-chunk->begin);
+        copy->end=chunk->end;
+        copy->count=chunk->count;
+        copy->prev=tail;
+        if(tail!=nullptr){
+            tail->next=copy;
+        }else{
+            head=copy;
+        }
+        tail=copy;
+    }
+    count=other.count;
+}
+
+QuickList::~QuickList(){
+    while(head!=nullptr){
+        Chunk* next=head->next;
+        freeChunk(head);
+        head=next;
+    }
+}
+
+//块头和数据区一次分配，begin==end表示块中还没有元素
+QuickList::Chunk* QuickList::allocateChunk(size_t capacity,size_t begin){
+    Chunk* chunk=static_cast<Chunk*>(::operator new(sizeof(Chunk)+capacity));
+    allocated+=allocationSize(chunk);
+    chunk->prev=nullptr;
+    chunk->next=nullptr;
+    chunk->capacity=capacity;
+    chunk->begin=begin;
+    chunk->end=begin;
+    chunk->count=0;
+    return chunk;
+}
+
+void QuickList::freeChunk(Chunk* chunk){
+    allocated-=allocationSize(chunk);
+    ::operator delete(chunk);
+}
+
+size_t QuickList::varintLength(size_t value){
+    size_t length=1;
+    while(value>=0x80){
+        value>>=7;
+        length++;
+    }
+    return length;
+}
+
+//长度的低7位在前，最高位为1表示后面还有字节
+size_t QuickList::readEntry(const char* p,const char*& data){
+    size_t length=0;
+    int shift=0;
+    unsigned char byte;
+    do{
+        byte=static_cast<unsigned char>(*p++);
+        length|=size_t(byte&0x7F)<<shift;
+        shift+=7;
+    }while(byte&0x80);
+    data=p;
+    return length;
+}
+
+//元素末尾的长度是反向存放的：最后一个字节是长度的低7位
+size_t QuickList::readEntryBackward(const char* end,const char*& data){
+    size_t length=0;
+    int shift=0;
+    unsigned char byte;
+    do{
+        byte=static_cast<unsigned char>(*--end);
+        length|=size_t(byte&0x7F)<<shift;
+        shift+=7;
+    }while(byte&0x80);
+    data=end-length;
+    return length;
+}
+
+void QuickList::writeEntry(char* p,const char* data,size_t length){
+    size_t lengthBytes=varintLength(length);
+    char* back=p+lengthBytes+length+lengthBytes; //反向的长度从元素末尾往前写
+    size_t value=length;
+    for(size_t i=0;i<lengthBytes;i++){
+        unsigned char byte=value&0x7F;
+        value>>=7;
+        if(i+1<lengthBytes){
+            byte|=0x80;
+        }
+        p[i]=byte;
+        *--back=byte;
+    }
+    std::memcpy(p+lengthBytes,data,length);
+}
+
+//头（或尾）部的块空间不够时：
+//列表只有一个不满QUICKLIST_CHUNK_BYTES的块时，成倍扩容并把数据放在中间，两端都留出空闲空间；
+//否则在这一端新建一个块，头部的块从数据区末尾开始向左写，尾部的块从开头开始向右写
+QuickList::Chunk* QuickList::reserve(size_t need,bool front){
+    Chunk* chunk=front?head:tail;
+    if(chunk==nullptr){
+        size_t capacity=QUICKLIST_INIT_BYTES;
+        while(capacity<2*need&&capacity<QUICKLIST_CHUNK_BYTES){
+            capacity*=2;
+        }
+        capacity=std::max(capacity,need);
+        head=tail=allocateChunk(capacity,(capacity-need)/2+(front?need:0));
+        return head;
+    }
+    if(front?chunk->begin>=need:chunk->capacity-chunk->end>=need){
+        return chunk;
+    }
+    size_t used=chunk->end-chunk->begin;
+    if(head==tail&&chunk->capacity<QUICKLIST_CHUNK_BYTES&&used+need<=QUICKLIST_CHUNK_BYTES){
+        size_t capacity=chunk->capacity*2;
+        while(capacity<used+2*need&&capacity<QUICKLIST_CHUNK_BYTES){
+            capacity*=2;
+        }
+        capacity=std::min<size_t>(capacity,QUICKLIST_CHUNK_BYTES);
+        size_t slack=capacity-used-need;
+        Chunk* grown=allocateChunk(capacity,slack/2+(front?need:0));
+        std::memcpy(grown->data()+grown->begin,chunk->data()+chunk->begin,used);
+        grown->end=grown->begin+used;
+        grown->count=chunk->count;
+        freeChunk(chunk);
+        head=tail=grown;
+        return grown;
+    }
+    size_t capacity=std::max<size_t>(QUICKLIST_CHUNK_BYTES,need); //大元素单独占一个块
+    Chunk* added=allocateChunk(capacity,front?capacity:0);
+    if(front){
+        added->next=head;
+        head->prev=added;
+        head=added;
+    }else{
+        added->prev=tail;
+        tail->next=added;
+        tail=added;
+    }
+    return added;
+}
+
+void QuickList::pushFront(const char* data,size_t length){
+    size_t need=entryLength(length);
+    Chunk* chunk=reserve(need,true);
+    chunk->begin-=need;
+    writeEntry(chunk->data()+chunk->begin,data,length);
+    chunk->count++;
+    count++;
+}
+
+void QuickList::pushBack(const char* data,size_t length){
+    size_t need=entryLength(length);
+    Chunk* chunk=reserve(need,false);
+    writeEntry(chunk->data()+chunk->end,data,length);
+    chunk->end+=need;
+    chunk->count++;
+    count++;
+}
+
+bool QuickList::popFront(std::string& value){
+    if(head==nullptr){
+        return false;
+    }
+    const char* data;
+    size_t length=readEntry(head->data()+head->begin,data);
+    value.assign(data,length);
+    head->begin+=entryLength(length);
+    count--;
+    if(--head->count==0){
+        removeChunk(head);
+    }
+    return true;
+}
+
+bool QuickList::popBack(std::string& value){
+    if(tail==nullptr){
+        return false;
+    }
+    const char* data;
+    size_t length=readEntryBackward(tail->data()+tail->end,data);
+    value.assign(data,length);
+    tail->end-=entryLength(length);
+    count--;
+    if(--tail->count==0){
+        removeChunk(tail);
+    }
+    return true;
+}
+
+//删除已经没有元素的块
+void QuickList::removeChunk(Chunk* chunk){
+    if(chunk->prev!=nullptr){
+        chunk->prev->next=chunk->next;
+    }else{
+        head=chunk->next;
+    }
+    if(chunk->next!=nullptr){
+        chunk->next->prev=chunk->prev;
+    }else{
+        tail=chunk->prev;
+    }
+    freeChunk(chunk);
+}
+
+//比较只在RedisValue的==和<中用到，不在命令的执行路径上，先取出所有元素再比较
+std::vector<std::string> QuickList::items() const{
+    std::vector<std::string> values;
+    values.reserve(count);
+    forEach([&](const char* data,size_t length){ values.emplace_back(data,length); });
+    return values;
+}
+
+bool QuickList::operator==(const QuickList& other) const{
+    return count==other.count&&items()==other.items();
+}
+
+bool QuickList::operator<(const QuickList& other) const{
+    return items()<other.items();
+}
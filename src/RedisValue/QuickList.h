@@ -0,0 +1,99 @@
+#ifndef QUICKLIST_H
+#define QUICKLIST_H
+#include<string>
+#include<vector>
+#include<cstdint>
+#include<cstddef>
+#define QUICKLIST_CHUNK_BYTES 8192 //每个块最多保存的字节数，超过后在两端新建块
+#define QUICKLIST_INIT_BYTES 64 //只有一个块时的初始容量，小列表不占用一整块，之后成倍扩容
+
+/*
+    列表的存储结构：由固定大小的块组成的双向链表，每个块中的元素紧凑地连续存放
+    元素编码为 长度(varint) + 内容 + 反向的长度(varint)，可以从块的两端分别向中间读取；
+    块的有效数据在[begin,end)区间，头部的块向左增长，尾部的块向右增长，
+    所以两端的push/pop只在头尾的块内移动下标，均摊O(1)，不需要像std::vector那样搬移所有元素。
+    列表不加锁，由使用它的分片保证互斥。
+*/
+class QuickList{
+public:
+    QuickList(){}
+    QuickList(const QuickList& other); //深拷贝所有块
+    QuickList(QuickList&& other) noexcept:head(other.head),tail(other.tail),count(other.count),allocated(other.allocated){
+        other.head=other.tail=nullptr;
+        other.count=0;
+        other.allocated=0;
+    }
+    QuickList& operator=(const QuickList& other)=delete;
+    ~QuickList();
+
+    size_t size() const{ return count; }
+    bool empty() const{ return count==0; }
+    size_t memoryUsage() const{ return allocated; } //所有块实际占用的字节数，O(1)
+    void pushFront(const char* data,size_t length);
+    void pushBack(const char* data,size_t length);
+    void pushFront(const std::string& value){ pushFront(value.data(),value.size()); }
+    void pushBack(const std::string& value){ pushBack(value.data(),value.size()); }
+    bool popFront(std::string& value); //列表为空时返回false
+    bool popBack(std::string& value);
+
+    //按顺序访问下标在[start,stop]之间的元素，func(const char* data,size_t length)，调用者保证下标有效
+    //先按块的元素个数跳过整块，再在块内顺序读取
+    template<typename Func>
+    void range(size_t start,size_t stop,Func func) const;
+    template<typename Func>
+    void forEach(Func func) const{
+        if(count!=0){
+            range(0,count-1,func);
+        }
+    }
+
+    bool operator==(const QuickList& other) const;
+    bool operator<(const QuickList& other) const; //按元素逐个比较
+    std::vector<std::string> items() const; //所有元素
+private:
+    struct Chunk{
+        Chunk* prev;
+        Chunk* next;
+        uint32_t capacity; //数据区的字节数
+        uint32_t begin; //有效数据在数据区的[begin,end)
+        uint32_t end;
+        uint32_t count; //块中的元素个数
+        char* data(){ return reinterpret_cast<char*>(this+1); } //数据区紧跟在块头后面，和块头一起分配
+        const char* data() const{ return reinterpret_cast<const char*>(this+1); }
+    };
+    Chunk* allocateChunk(size_t capacity,size_t begin);
+    void freeChunk(Chunk* chunk);
+    static size_t varintLength(size_t value);
+    static size_t entryLength(size_t length){ return 2*varintLength(length)+length; }
+    static size_t readEntry(const char* p,const char*& data); //从元素开头读取，返回元素内容的长度
+    static size_t readEntryBackward(const char* end,const char*& data); //从元素末尾读取
+    static void writeEntry(char* p,const char* data,size_t length);
+    Chunk* reserve(size_t need,bool front); //返回头（或尾）部有need字节空闲空间的块
+    void removeChunk(Chunk* chunk);
+
+    Chunk* head=nullptr;
+    Chunk* tail=nullptr;
+    size_t count=0;
+    size_t allocated=0; //分配和释放块时按分配器的实际大小增减
+};
+
+template<typename Func>
+void QuickList::range(size_t start,size_t stop,Func func) const{
+    size_t index=0;
+    for(const Chunk* chunk=head;chunk!=nullptr&&index<=stop;chunk=chunk->next){
+        if(index+chunk->count<=start){ //整块都在start之前
+            index+=chunk->count;
+            continue;
+        }
+        const char* p=chunk->data()+chunk->begin;
+        for(uint32_t i=0;i<chunk->count&&index<=stop;i++,index++){
+            const char* data;
+            size_t length=readEntry(p,data);
+            if(index>=start){
+                func(data,length);
+            }
+            p=data+length+varintLength(length);
+        }
+    }
+}
+#endif
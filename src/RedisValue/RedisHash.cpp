@@ -0,0 +1,142 @@
+#include "RedisHash.h"
+#include "../MemoryCounter.h"
+#include<cstring>
+#include<algorithm>
+
+RedisHash::RedisHash(const RedisHash& other):packed(other.packed),packedCount(other.packedCount){
+    if(other.table!=nullptr){
+        table.reset(new HashTable(*other.table));
+    }
+}
+
+size_t RedisHash::size() const{
+    return table!=nullptr?table->size():packedCount;
+}
+
+size_t RedisHash::memoryUsage() const{
+    if(table!=nullptr){
+        return stringHeapBytes(packed)+allocationSize(table.get())+table->memoryUsage();
+    }
+    return stringHeapBytes(packed);
+}
+
+//长度的低7位在前，最高位为1表示后面还有字节
+size_t RedisHash::readEntry(const char* p,const char*& data){
+    size_t length=0;
+    int shift=0;
+    unsigned char byte;
+    do{
+        byte=static_cast<unsigned char>(*p++);
+        length|=size_t(byte&0x7F)<<shift;
+        shift+=7;
+    }while(byte&0x80);
+    data=p;
+    return length;
+}
+
+void RedisHash::appendEntry(std::string& out,const std::string& data){
+    size_t length=data.size();
+    while(length>=0x80){
+        out.push_back(static_cast<char>((length&0x7F)|0x80));
+        length>>=7;
+    }
+    out.push_back(static_cast<char>(length));
+    out.append(data);
+}
+
+//顺序扫描紧凑编码，比较长度相同的字段
+bool RedisHash::findPacked(const std::string& field,size_t& position,size_t& length) const{
+    const char* begin=packed.data();
+    const char* p=begin;
+    for(uint32_t i=0;i<packedCount;i++){
+        const char* data;
+        const char* value;
+        size_t fieldLength=readEntry(p,data);
+        size_t valueLength=readEntry(data+fieldLength,value);
+        const char* next=value+valueLength;
+        if(fieldLength==field.size()&&std::memcmp(data,field.data(),fieldLength)==0){
+            position=p-begin;
+            length=next-p;
+            return true;
+        }
+        p=next;
+    }
+    return false;
+}
+
+bool RedisHash::get(const std::string& field,std::string& value) const{
+    if(table!=nullptr){
+        return table->get(field,value);
+    }
+    size_t position,length;
+    if(!findPacked(field,position,length)){
+        return false;
+    }
+    const char* data;
+    const char* valueData;
+    size_t fieldLength=readEntry(packed.data()+position,data);
+    size_t valueLength=readEntry(data+fieldLength,valueData);
+    value.assign(valueData,valueLength);
+    return true;
+}
+
+bool RedisHash::insert(const std::string& field,const std::string& value){
+    if(table==nullptr){
+        size_t position,length;
+        if(findPacked(field,position,length)){
+            return false;
+        }
+        if(packedCount<HASH_MAX_LISTPACK_ENTRIES&&field.size()<=HASH_MAX_LISTPACK_VALUE&&value.size()<=HASH_MAX_LISTPACK_VALUE){
+            appendEntry(packed,field);
+            appendEntry(packed,value);
+            packedCount++;
+            return true;
+        }
+        convertToTable();
+    }
+    return table->insert(field,value);
+}
+
+bool RedisHash::erase(const std::string& field){
+    if(table!=nullptr){
+        return table->erase(field);
+    }
+    size_t position,length;
+    if(!findPacked(field,position,length)){
+        return false;
+    }
+    packed.erase(position,length);
+    packedCount--;
+    return true;
+}
+
+//紧凑编码的字段全部移到哈希表中，释放紧凑编码的内存
+void RedisHash::convertToTable(){
+    std::unique_ptr<HashTable> converted(new HashTable());
+    converted->reserve(packedCount+1);
+    forEach([&](const char* field,size_t fieldLength,const char* value,size_t valueLength){
+        converted->insert(std::string(field,fieldLength),std::string(value,valueLength));
+    });
+    table=std::move(converted);
+    std::string().swap(packed);
+    packedCount=0;
+}
+
+std::vector<std::pair<std::string,std::string>> RedisHash::items() const{
+    std::vector<std::pair<std::string,std::string>> values;
+    values.reserve(size());
+    forEach([&](const char* field,size_t fieldLength,const char* value,size_t valueLength){
+        values.emplace_back(std::string(field,fieldLength),std::string(value,valueLength));
+    });
+    std::sort(values.begin(),values.end());
+    return values;
+}
+
+//两种编码的字段顺序不同，排序后比较
+bool RedisHash::operator==(const RedisHash& other) const{
+    return size()==other.size()&&items()==other.items();
+}
+
+bool RedisHash::operator<(const RedisHash& other) const{
+    return items()<other.items();
+}
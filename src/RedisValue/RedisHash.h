@@ -0,0 +1,67 @@
+#ifndef REDISHASH_H
+#define REDISHASH_H
+#include<string>
+#include<vector>
+#include<memory>
+#include<cstdint>
+#include"HashTable.h"
+#define HASH_MAX_LISTPACK_ENTRIES 128 //紧凑编码最多保存的字段数，超过后转换为哈希表
+#define HASH_MAX_LISTPACK_VALUE 64 //字段或值超过该字节数时转换为哈希表
+
+/*
+    哈希命令使用的哈希表，有两种编码：
+    紧凑编码：字段和值交替紧凑地保存在一块连续的内存中，每一项为 长度(varint) + 内容，查找时顺序扫描；
+    小哈希表只占一次内存分配（不超过15字节时不分配），字段很少时顺序扫描比哈希查找更快。
+    字段数超过HASH_MAX_LISTPACK_ENTRIES，或者字段、值的长度超过HASH_MAX_LISTPACK_VALUE时，
+    一次性转换为哈希表编码（HashTable），之后不再转换回来。
+    不加锁，由使用它的分片保证互斥。
+*/
+class RedisHash{
+public:
+    RedisHash(){}
+    RedisHash(const RedisHash& other);
+    RedisHash(RedisHash&& other) noexcept=default;
+    RedisHash& operator=(const RedisHash& other)=delete;
+
+    size_t size() const;
+    bool isPacked() const{ return table==nullptr; }
+    size_t memoryUsage() const; //紧凑编码的字符串或哈希表在堆上占用的字节数，O(1)
+    bool get(const std::string& field,std::string& value) const; //字段不存在时返回false
+    bool insert(const std::string& field,const std::string& value); //字段不存在时插入，返回是否插入
+    bool erase(const std::string& field); //返回字段是否存在
+
+    //按保存的顺序访问所有字段，func(const char* field,size_t fieldLength,const char* value,size_t valueLength)
+    template<typename Func>
+    void forEach(Func func) const;
+
+    bool operator==(const RedisHash& other) const;
+    bool operator<(const RedisHash& other) const; //按字段排序后逐个比较
+    std::vector<std::pair<std::string,std::string>> items() const; //按字段排序的所有字段和值
+private:
+    static size_t readEntry(const char* p,const char*& data); //返回内容的长度，data指向内容
+    static void appendEntry(std::string& out,const std::string& data);
+    bool findPacked(const std::string& field,size_t& position,size_t& length) const; //字段和值在packed中的位置和总长度
+    void convertToTable();
+
+    std::string packed; //紧凑编码的字段和值
+    uint32_t packedCount=0; //紧凑编码的字段数
+    std::unique_ptr<HashTable> table; //不为空时使用哈希表编码
+};
+
+template<typename Func>
+void RedisHash::forEach(Func func) const{
+    if(table!=nullptr){
+        table->forEach(func);
+        return;
+    }
+    const char* p=packed.data();
+    for(uint32_t i=0;i<packedCount;i++){
+        const char* field;
+        const char* value;
+        size_t fieldLength=readEntry(p,field);
+        size_t valueLength=readEntry(field+fieldLength,value);
+        func(field,fieldLength,value,valueLength);
+        p=value+valueLength;
+    }
+}
+#endif
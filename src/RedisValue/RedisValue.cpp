@@ -1,152 +1,327 @@
-
 #include"Global.h"
 #include "Parse.h"
+#include "../MemoryCounter.h"
+#include<cerrno>
+#include<cstdlib>
 
 
 /*************构造函数******************/
 
-/*
-statics()函数返回一个静态的Statics实例的引用，它的null成员是一个指向RedisValueNull对象的shared_ptr指针
-这个构造函数构建了一个RedisValue对象，并将其redisValue成员初始化为指向RedisValueNull对象的shared_ptr指针
-表示RedisValue对象的值为null
-*/
-RedisValue::RedisValue() noexcept : redisValue(statics().null) {}
+//默认构造的RedisValue表示null值，不分配任何内存
+RedisValue::RedisValue() noexcept : tag(NUL) {}
 
-RedisValue::RedisValue(std::nullptr_t) noexcept : redisValue(statics().null) {}
+RedisValue::RedisValue(std::nullptr_t) noexcept : tag(NUL) {}
 
-//创建一个std::shared_ptr<RedisString>智能指针，指向一个RedisString对象，用该指针初始化redisValue成员
-//std::make_shared<RedisString>(value)会调用RedisString的构造函数RedisString(const std::string& value)
-//而RedisString继承自Value<RedisValue::STRING,std::string>，
-//所以RedisString的构造函数会调用Value<RedisValue::STRING,std::string>的构造函数，将Value类的value成员变量初始化为传入的参数value
-RedisValue::RedisValue(const std::string& value) : redisValue(std::make_shared<RedisString>(value)) {}
+//字符串保存在联合体的stringData成员中，用placement new在联合体的内存上构造std::string
+//不超过std::string短字符串容量（libstdc++为15字节）的字符串完全保存在RedisValue对象内部，不分配内存
+RedisValue::RedisValue(const std::string& value) : tag(STRING) { new(&stringData) std::string(value); }
 
-//同上，只不过这里传入的是右值引用，调用的是RedisString的构造函数RedisString(std::string&& value)
-RedisValue::RedisValue(std::string&& value) : redisValue(std::make_shared<RedisString>(std::move(value))) {}
+//同上，只不过这里传入的是右值引用，直接接管value的缓冲区
+RedisValue::RedisValue(std::string&& value) : tag(STRING) { new(&stringData) std::string(std::move(value)); }
 
-//首先，通过std::string构造函数将const char*类型的value转化为std::string类型的临时string对象，
-//然后调用RedisString的构造函数RedisString(const std::string& value)
-RedisValue::RedisValue(const char* value) : redisValue(std::make_shared<RedisString>(value)) {}
+RedisValue::RedisValue(const char* value) : tag(STRING) { new(&stringData) std::string(value); }
 
-RedisValue::RedisValue(const RedisValue::array& value) : redisValue(std::make_shared<RedisList>(value)) {}
+//数组和对象在堆上分配，联合体中只保存指针
+RedisValue::RedisValue(const RedisValue::array& value) : tag(ARRAY), arrayData(new array(value)) {}
 
-RedisValue::RedisValue(RedisValue::array&& value) : redisValue(std::make_shared<RedisList>(std::move(value))) {}
+RedisValue::RedisValue(RedisValue::array&& value) : tag(ARRAY), arrayData(new array(std::move(value))) {}
 
-RedisValue::RedisValue(const RedisValue::object& value) : redisValue(std::make_shared<RedisObject>(value)) {}
+RedisValue::RedisValue(const RedisValue::object& value) : tag(OBJECT), objectData(new object(value)) {}
 
-RedisValue::RedisValue(RedisValue::object &&value) : redisValue(std::make_shared<RedisObject>(std::move(value))) {}
+RedisValue::RedisValue(RedisValue::object &&value) : tag(OBJECT), objectData(new object(std::move(value))) {}
 
-/************* Member Functions ******************/
+RedisValue::RedisValue(int64_t value) noexcept : tag(NUMBER), integerData(value) {}
 
-RedisValue::Type RedisValue::type() const {
-    //redisValue是一个std::shared_ptr<RedisValueType>类型的智能指针
-    //调用RedisValueType类的type()函数，返回tag, tag是个RedisValue::Type类型
-    /*
-    RedisValue::Type类型包括以下六个枚举值：
-    enum Type{
-    NUL,NUMBER,BOOL,STRING,ARRAY,OBJECT
-    };
-    因此tag是这六个枚举值中的一个
-    */
-    return redisValue->type(); //返回NUL,NUMBER,BOOL,STRING,ARRAY,OBJECT中的一个
+RedisValue::RedisValue(QuickList&& values) : tag(LIST), listData(new QuickList(std::move(values))) {}
+
+RedisValue::RedisValue(RedisHash&& values) : tag(HASH), hashData(new RedisHash(std::move(values))) {}
+
+RedisValue RedisValue::fromString(const std::string& value) {
+    int64_t number;
+    if (toInteger(value, number)) {
+        return RedisValue(number);
+    }
+    return RedisValue(value);
+}
+
+//字符串原样返回，整数转换为字符串，其他类型返回dump的结果
+std::string RedisValue::plainString() const {
+    if (tag == STRING) {
+        return stringData;
+    }
+    if (tag == NUMBER) {
+        return std::to_string(integerData);
+    }
+    return dump();
+}
+
+RedisValue RedisValue::listFromArray(const array& items) {
+    QuickList list;
+    for (auto& item : items) {
+        list.pushBack(item.plainString());
+    }
+    return RedisValue(std::move(list));
+}
+
+RedisValue RedisValue::hashFromObject(const object& items) {
+    RedisHash hash;
+    for (auto& item : items) {
+        hash.insert(item.first, item.second.plainString());
+    }
+    return RedisValue(std::move(hash));
+}
+
+//"-"、"01"、"-0"、"+1"这样的字符串转换成整数后不能还原，仍按字符串保存
+bool RedisValue::toInteger(const std::string& value, int64_t& result) {
+    if (value.empty() || value.size() > 20) {
+        return false;
+    }
+    size_t start = (value[0] == '-') ? 1 : 0;
+    if (start == value.size() || (value[start] == '0' && (value.size() > start + 1 || start == 1))) {
+        return false;
+    }
+    for (size_t i = start; i < value.size(); i++) {
+        if (value[i] < '0' || value[i] > '9') {
+            return false;
+        }
+    }
+    errno = 0;
+    long long number = std::strtoll(value.c_str(), nullptr, 10);
+    if (errno == ERANGE) {
+        return false;
+    }
+    result = number;
+    return true;
+}
+
+/*************拷贝、移动和析构******************/
+
+//拷贝构造：深拷贝，两个RedisValue之后互不影响
+RedisValue::RedisValue(const RedisValue& other) : tag(NUL) {
+    copyFrom(other);
+}
+
+//移动构造：字符串移动到新对象中，数组和对象只转移指针
+RedisValue::RedisValue(RedisValue&& other) noexcept : tag(NUL) {
+    moveFrom(other);
+}
+
+RedisValue& RedisValue::operator=(const RedisValue& other) {
+    if (this != &other) {
+        if (tag == STRING && other.tag == STRING) {
+            stringData = other.stringData; //复用已有的缓冲区
+        } else {
+            RedisValue copy(other); //先拷贝再释放，拷贝时抛出异常不影响当前对象
+            destroy();
+            moveFrom(copy);
+        }
+    }
+    return *this;
+}
+
+RedisValue& RedisValue::operator=(RedisValue&& other) noexcept {
+    if (this != &other) {
+        destroy();
+        moveFrom(other);
+    }
+    return *this;
+}
+
+RedisValue::~RedisValue() {
+    destroy();
+}
+
+void RedisValue::copyFrom(const RedisValue& other) {
+    switch (other.tag) {
+        case NUMBER: integerData = other.integerData; break;
+        case STRING: new(&stringData) std::string(other.stringData); break;
+        case ARRAY: arrayData = new array(*other.arrayData); break;
+        case OBJECT: objectData = new object(*other.objectData); break;
+        case LIST: listData = new QuickList(*other.listData); break;
+        case HASH: hashData = new RedisHash(*other.hashData); break;
+        default: break;
+    }
+    tag = other.tag;
 }
 
+void RedisValue::moveFrom(RedisValue& other) noexcept {
+    switch (other.tag) {
+        case NUMBER: integerData = other.integerData; break;
+        case STRING:
+            new(&stringData) std::string(std::move(other.stringData));
+            other.stringData.~basic_string();
+            break;
+        case ARRAY: arrayData = other.arrayData; break;
+        case OBJECT: objectData = other.objectData; break;
+        case LIST: listData = other.listData; break;
+        case HASH: hashData = other.hashData; break;
+        default: break;
+    }
+    tag = other.tag;
+    other.tag = NUL;
+}
+
+void RedisValue::destroy() noexcept {
+    switch (tag) {
+        case STRING: stringData.~basic_string(); break;
+        case ARRAY: delete arrayData; break;
+        case OBJECT: delete objectData; break;
+        case LIST: delete listData; break;
+        case HASH: delete hashData; break;
+        default: break;
+    }
+    tag = NUL;
+}
+
+/************* Member Functions ******************/
+
+//类型不符时返回一个静态的空字符串、空数组、空对象，防止调用失败
 std::string & RedisValue::stringValue() {
-    return redisValue->stringValue(); //调用73行的std::string& RedisValueType::stringValue()函数
+    return tag == STRING ? stringData : statics().emptyString;
 }
 
 std::vector<RedisValue> & RedisValue::arrayItems() {
-    return redisValue->arrayItems(); //调用77行的std::vector<RedisValue> & RedisValueType::arrayItems()函数
+    return tag == ARRAY ? *arrayData : statics().emptyVector;
 }
 
 std::map<std::string, RedisValue> & RedisValue::objectItems()  {
-    return redisValue->objectItems(); //调用85行的std::map<std::string, RedisValue> & RedisValueType::objectItems()函数
+    return tag == OBJECT ? *objectData : statics().emptyMap;
 }
 
-//重载[]操作符，用于访问数组元素和对象成员
-RedisValue & RedisValue::operator[] (size_t i)  {
-    return (*redisValue)[i];
+const std::string & RedisValue::stringValue() const {
+    return tag == STRING ? stringData : statics().emptyString;
 }
 
-RedisValue & RedisValue::operator[] (const std::string& key) {
-    return (*redisValue)[key];
+const std::vector<RedisValue> & RedisValue::arrayItems() const {
+    return tag == ARRAY ? *arrayData : statics().emptyVector;
 }
 
-//RedisValueType是抽象基类，其stringValue函数,arrayItems()函数,objectItems()函数，重载 [] 运算符都是虚函数，需要在派生类中重写
-//这里提供了默认实现，返回一个静态的空字符串、空Json数组、空Json对象映射，一个静态的redisValueNull对象的引用（表示null值）
-//当派生类没有重写这些函数时，就会调用这里的默认实现，防止调用失败
-std::string& RedisValueType::stringValue() {
-    return statics().emptyString; //返回一个静态的空字符串
+const std::map<std::string, RedisValue> & RedisValue::objectItems() const {
+    return tag == OBJECT ? *objectData : statics().emptyMap;
 }
 
-std::vector<RedisValue> & RedisValueType::arrayItems() {
-    return statics().emptyVector; //返回一个静态的空Json数组
+size_t RedisValue::memoryUsage(size_t samples) const {
+    switch (tag) {
+        case STRING:
+            return stringHeapBytes(stringData);
+        case LIST:
+            return allocationSize(listData) + listData->memoryUsage();
+        case HASH:
+            return allocationSize(hashData) + hashData->memoryUsage();
+        case ARRAY: {
+            size_t bytes = allocationSize(arrayData) + allocationSize(arrayData->data());
+            size_t counted = 0, itemBytes = 0;
+            for (const auto& item : *arrayData) {
+                if (samples != 0 && counted == samples) {
+                    break;
+                }
+                itemBytes += item.memoryUsage(samples);
+                counted++;
+            }
+            if (counted == arrayData->size()) {
+                return bytes + itemBytes;
+            }
+            return bytes + itemBytes / counted * arrayData->size();
+        }
+        case OBJECT: {
+            //红黑树的每个节点有颜色和三个指针，后面是pair<const std::string,RedisValue>
+            const size_t nodeBytes = 4 * sizeof(void*) + sizeof(object::value_type);
+            size_t bytes = allocationSize(objectData);
+            size_t counted = 0, itemBytes = 0;
+            for (const auto& item : *objectData) {
+                if (samples != 0 && counted == samples) {
+                    break;
+                }
+                itemBytes += nodeBytes + stringHeapBytes(item.first) + item.second.memoryUsage(samples);
+                counted++;
+            }
+            if (counted == objectData->size()) {
+                return bytes + itemBytes;
+            }
+            return bytes + itemBytes / counted * objectData->size();
+        }
+        default:
+            return 0;
+    }
 }
 
-std::map<std::string, RedisValue> & RedisValueType::objectItems() {
-    return statics().emptyMap; //返回一个静态的空Json对象映射
+QuickList & RedisValue::listItems() {
+    return tag == LIST ? *listData : statics().emptyList;
 }
 
-//RedisValueType是抽象基类，不支持下标访问，所以总是返回一个静态的redisValueNull对象的引用，表示null值
-RedisValue& RedisValueType::operator[] (size_t) {
-    return staticNull();
+const QuickList & RedisValue::listItems() const {
+    return tag == LIST ? *listData : statics().emptyList;
 }
 
-RedisValue& RedisValueType::operator[] (const std::string&) {
-    return staticNull();
+RedisHash & RedisValue::hashItems() {
+    return tag == HASH ? *hashData : statics().emptyHash;
 }
 
-//重载[]操作符，用于访问map对象成员
-RedisValue& RedisObject::operator[] (const std::string&key) {
-    auto it = value.find(key);
-    return (it==value.end()) ? staticNull() : it->second;
-}
-//重载[]操作符，用于访问vector对象成员
-RedisValue& RedisList::operator[](size_t i ) {
-    if(i>=value.size()) return staticNull();
-    return value[i];
+const RedisHash & RedisValue::hashItems() const {
+    return tag == HASH ? *hashData : statics().emptyHash;
 }
 
-/*比较*/
+//重载[]操作符，用于访问数组元素和对象成员
+//不是数组/对象，或者下标越界、key不存在时，返回一个静态的redisValueNull对象的引用，表示null值
+RedisValue & RedisValue::operator[] (size_t i)  {
+    if (tag != ARRAY || i >= arrayData->size()) return staticNull();
+    return (*arrayData)[i];
+}
 
-/*
-redisValue 是一个基类智能指针，它指向一个RedisValueType 类型的对象。 
-less 是 Value 类的成员函数， Value 类是 RedisValueType类的派生类。
-基类指针 (或引用）可以指向派生类对象并且可以调用派生类中覆盖的虚函数。 
-但是，基类指针 (或引用） 不能直接调用派生类中新增的成员函数，除非进行向下转型。
-type(), less(), equal(), dump()这四个函数在抽象基类RedisValueType中都是纯虚函数，
-并且在派生类Value类中都被覆盖重写，所以redisValue智能指针可以调用这四个函数 
-*/
+RedisValue & RedisValue::operator[] (const std::string& key) {
+    if (tag != OBJECT) return staticNull();
+    auto it = objectData->find(key);
+    return (it == objectData->end()) ? staticNull() : it->second;
+}
 
+/*比较*/
 
-//重载==操作符，比较两个RedisValue对象是否相等
+//重载==操作符，比较两个RedisValue对象是否相等：类型相同且值相等
 bool RedisValue::operator== (const RedisValue&other) const{
-    //若两个RedisValue对象的redisValue成员（都是智能指针）指向同一个RedisValueType对象，则返回true
-    if (redisValue == other.redisValue)
-        return true;
-    //若两个RedisValue对象的redisValue成员指向的RedisValueType对象的类型不同，则返回false
-    if (redisValue->type() != other.redisValue->type())
+    if (tag != other.tag)
         return false;
-    //get()函数返回智能指针管理的原始指针
-    return redisValue->equals(other.redisValue.get());
+    switch (tag) {
+        case NUMBER: return integerData == other.integerData;
+        case STRING: return stringData == other.stringData;
+        case ARRAY: return *arrayData == *other.arrayData;
+        case OBJECT: return *objectData == *other.objectData;
+        case LIST: return *listData == *other.listData;
+        case HASH: return *hashData == *other.hashData;
+        default: return true; //所有的null值都相等
+    }
 }
 //重载<操作符，比较两个RedisValue对象的大小
+//类型不同时比较类型：NUL < NUMBER < BOOL < STRING < ARRAY < OBJECT < LIST < HASH
 bool RedisValue::operator< (const RedisValue& other) const{
-    //若两个RedisValue对象的redisValue成员（都是智能指针）指向同一个RedisValueType对象，则返回false
-    if (redisValue == other.redisValue)
-        return false;
-    //若两个RedisValue对象的redisValue成员指向的RedisValueType对象的类型不同，则返回类型小的那个
-    //NUL < NUMBER < BOOL < STRING < ARRAY < OBJECT
-    if (redisValue->type() != other.redisValue->type())
-        return redisValue->type() < other.redisValue->type();
-    //比较两个RedisValue对象的redisValue成员指向的RedisValueType对象的value成员变量
-    //less()函数是Value类的成员函数，通过成员函数可以访问该类的所有成员变量，因此redisValue->less可以访问value成员变量
-    return redisValue->less(other.redisValue.get());
+    if (tag != other.tag)
+        return tag < other.tag;
+    switch (tag) {
+        case NUMBER: return integerData < other.integerData;
+        case STRING: return stringData < other.stringData;
+        case ARRAY: return *arrayData < *other.arrayData;
+        case OBJECT: return *objectData < *other.objectData;
+        case LIST: return *listData < *other.listData;
+        case HASH: return *hashData < *other.hashData;
+        default: return false;
+    }
 }
 
 
 // 定义Json类的成员函数dump，用于将Json对象转化为JSON字符串并追加到out中
 void RedisValue::dump(std::string &out) const {
-    redisValue->dump(out); // 调用JsonImpl类的dump函数将Json对象转化为JSON字符串并追加到out中
+    switch (tag) {
+        case NUMBER: //整数编码的字符串，和字符串一样带双引号输出
+            out += '"';
+            ::dump(integerData, out);
+            out += '"';
+            break;
+        case STRING: ::dump(stringData, out); break;
+        case ARRAY: ::dump(*arrayData, out); break;
+        case OBJECT: ::dump(*objectData, out); break;
+        case LIST: ::dump(*listData, out); break;
+        case HASH: ::dump(*hashData, out); break;
+        default: ::dump(NullStruct(), out); break;
+    }
 }
 
 
@@ -228,7 +403,7 @@ bool RedisValue::hasShape(const shape & types, std::string & err)  {
     }
 
     // 获取 JSON 对象的所有成员项
-    auto obj_items = objectItems();
+    const auto& obj_items = objectItems();
     
     // 遍历指定的形状
     for (auto & item : types) {
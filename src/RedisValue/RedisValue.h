@@ -1,21 +1,28 @@
 #ifndef REDISVALUE_H 
 #define REDISVALUE_H
 #include<iostream>
+#include<string>
 #include<vector>
 #include<map>
 #include<initializer_list>
 #include<memory>
+#include<cstdint>
 #include<cmath>
 #include<limits>
-
-class RedisValueType;
+#include"QuickList.h"
+#include"RedisHash.h"
 
 // RedisValue 类定义
+//标签联合体：字符串直接保存在对象内部（std::string自带短字符串优化，短字符串不分配内存），
+//数组和对象在堆上分配，只保存指针；拷贝时深拷贝，类型判断和取值不经过虚函数
 class RedisValue{
 public:
     // 定义 RedisValue 支持的数据类型
+    //NUMBER是整数编码的字符串：可以无损表示为int64的字符串按整数保存，dump的结果和字符串相同
+    //LIST是列表命令使用的列表（QuickList），ARRAY只用于解析出的JSON数组，两者dump的结果相同
+    //HASH是哈希命令使用的哈希表（RedisHash），OBJECT只用于解析出的JSON对象
     enum Type{
-        NUL,NUMBER,BOOL,STRING,ARRAY,OBJECT
+        NUL,NUMBER,BOOL,STRING,ARRAY,OBJECT,LIST,HASH
     };
     typedef std::vector<RedisValue> array; // 定义数组类型
     typedef std::map<std::string,RedisValue> object; // 定义对象类型
@@ -29,6 +36,25 @@ public:
     RedisValue(array&& values);
     RedisValue(const object& values);
     RedisValue(object && values);
+    explicit RedisValue(int64_t value) noexcept; //整数编码，不分配内存
+    explicit RedisValue(QuickList&& values);
+    explicit RedisValue(RedisHash&& values);
+
+    //字符串可以无损地表示为整数时按整数编码保存，否则按字符串保存
+    static RedisValue fromString(const std::string& value);
+    //字符串是否可以无损地保存为整数：0或者不以0开头的十进制数，范围在int64之内
+    static bool toInteger(const std::string& value,int64_t& result);
+    //把数组转换为列表（旧版本的数据库文件中列表按数组保存），字符串元素原样保存，其他元素保存dump的结果
+    static RedisValue listFromArray(const array& items);
+    //把对象转换为哈希表，值的转换方式和listFromArray相同
+    static RedisValue hashFromObject(const object& items);
+
+    //拷贝、移动和析构：根据tag构造或销毁联合体中当前有效的成员
+    RedisValue(const RedisValue& other);
+    RedisValue(RedisValue&& other) noexcept;
+    RedisValue& operator=(const RedisValue& other);
+    RedisValue& operator=(RedisValue&& other) noexcept;
+    ~RedisValue();
 
     // 从具有 toJson 成员函数的类实例构造 RedisValue
     template<class T,class = decltype(&T::toJson)> //模板的第二个参数类型是T的toJson成员函数的类型,进行 SFINAE（Substitution Failure Is Not An Error，替换失败不是错误）检查
@@ -65,18 +91,32 @@ public:
     RedisValue(void*) = delete; // 禁止从 void* 构造
 
     // 类型判断函数
-    Type type() const;
+    Type type() const { return tag; }
     bool isNull() const{ return type()==NUL;}
     bool isNumber() const { return type()==NUMBER;}
     bool isBoolean() const { return type()==BOOL;}
     bool isString() const { return type()==STRING; }
     bool isArray() const { return type() == ARRAY; }
     bool isObject() const { return type() == OBJECT; }
+    bool isList() const { return type() == LIST; }
+    bool isHash() const { return type() == HASH; }
 
-    // 获取值的函数
+    // 获取值的函数，类型不符时返回静态的空值
     std::string& stringValue() ;
     array& arrayItems() ;
     object &objectItems() ;
+    const std::string& stringValue() const;
+    const array& arrayItems() const;
+    const object& objectItems() const;
+    QuickList& listItems();
+    const QuickList& listItems() const;
+    RedisHash& hashItems();
+    const RedisHash& hashItems() const;
+    int64_t integerValue() const { return tag == NUMBER ? integerData : 0; }
+    std::string plainString() const; //作为字符串值时的内容（不带双引号）
+    //值在堆上占用的字节数，不包括RedisValue对象本身：列表和哈希表自己记录分配的字节数，O(1)；
+    //JSON数组和对象逐个元素统计，samples不为0时每一层只统计前samples个元素，按元素个数估算
+    size_t memoryUsage(size_t samples=0) const;
 
     // 重载 [] 操作符，用于访问数组元素和对象成员
     RedisValue & operator[] (size_t i) ;
@@ -119,8 +159,20 @@ public:
     bool hasShape(const shape &types,std::string &err) ;
     
 private:
-    std::shared_ptr<RedisValueType> redisValue; // 指向实际存储的智能指针
-    
+    void copyFrom(const RedisValue& other); //调用前当前对象不持有任何资源
+    void moveFrom(RedisValue& other) noexcept; //移动后other变为NUL
+    void destroy() noexcept; //释放资源，之后tag为NUL
+
+    Type tag; //联合体中哪个成员有效，NUL时都无效
+    union{
+        int64_t integerData;    //NUMBER
+        std::string stringData; //STRING
+        array* arrayData;       //ARRAY
+        object* objectData;     //OBJECT
+        QuickList* listData;    //LIST
+        RedisHash* hashData;    //HASH
+    };
+
 };
 
 #endif
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <algorithm>
 #include <cstdint>
 #include <cstring>
+#include <type_traits>
 #include <iostream>
 using namespace std;
 
@@ -26,17 +27,22 @@ using namespace std;
     然而，std::vector<char> 并没有提供一些字节流操作所需要的功能，
     例如移动当前位置、查找特定的字节、检查是否已经到达末尾等。
     因此，StreamBuffer 类继承自 std::vector<char>，并添加了这些功能。
+
+    反序列化收到的消息时可以不拷贝：attach之后StreamBuffer是外部内存的只读视图，
+    data、current、size、is_eof都作用于视图，写入时先把视图中的数据拷贝到自己的缓冲区。
 */
 
 class StreamBuffer : public vector<char>
 {
 public:
     //默认构造函数：初始化当前字节流的位置m_curpos为0
-    StreamBuffer():m_curpos(0){}
+    StreamBuffer():m_curpos(0),m_view(nullptr),m_view_size(0){}
     //构造函数：初始化当前字节流的位置m_curpos为0，并将输入的字符数组in的前len个字节插入到StreamBuffer缓冲区的起始位置
     StreamBuffer(const char* in, size_t len)
     {
         m_curpos = 0;
+        m_view = nullptr;
+        m_view_size = 0;
         insert(begin(), in, in+len);
     }
     //析构函数
@@ -45,36 +51,80 @@ public:
     //将当前字节流的位置m_curpos重置为0
     void reset(){ m_curpos = 0; }
     
+    //只读视图：从in开始的len个字节，不拷贝，调用者保证这段内存在使用期间有效
+    void attach(const char* in, size_t len)
+    {
+        vector<char>::clear();
+        m_view = in;
+        m_view_size = len;
+        m_curpos = 0;
+    }
+
+    //视图转为自己的缓冲区：拷贝视图中的数据，之后可以写入
+    void detach()
+    {
+        if (m_view != nullptr) {
+            assign(m_view, m_view + m_view_size);
+            m_view = nullptr;
+            m_view_size = 0;
+        }
+    }
+
+    //清空缓冲区，同时去掉视图
+    void clear()
+    {
+        vector<char>::clear();
+        m_view = nullptr;
+        m_view_size = 0;
+    }
+
+    //视图或缓冲区中的字节数（隐藏vector::size，视图没有存放在vector中）
+    size_t size() const { return m_view != nullptr ? m_view_size : vector<char>::size(); }
+
     //获取缓冲区的数据，不能直接返回this，因为this是指向当前StreamBuffer对象的指针，而不是指向其中数据的指针
-    const char* data(){ return &(*this)[0]; } //(*this)[0]是StreamBuffer缓冲区中的第一个元素，&(*this)[0]就是第一个元素的地址
+    const char* data(){ return m_view != nullptr ? m_view : vector<char>::data(); }
     
     // 获取当前位置的数据
     const char* current(){ 
-        return&(*this)[m_curpos]; 
+        return data() + m_curpos; 
     } 
 
     void offset(int offset){ m_curpos += offset; } //移动当前位置，将当前位置向后移动offset个字节
 
     bool is_eof(){ return m_curpos >= size(); } //检查是否已经到达缓冲区末尾
 
+    size_t remaining() { return m_curpos < size() ? size() - m_curpos : 0; } //当前位置之后还有多少字节
+
     //将字符数组in的前len个字节插入到m_iodevice的末尾（序列化）
     void input(const char* in, size_t len) //输入字符数组（追加到缓冲区末尾）
     {
+        detach();
         insert(end(), in, in+len);
     }
 
+    //在缓冲区末尾追加len个字节并返回它们的地址，由调用者直接写入（序列化定长数据时不需要临时数组）
+    char* append(size_t len)
+    {
+        detach();
+        size_t old = vector<char>::size();
+        resize(old + len);
+        return vector<char>::data() + old;
+    }
+
     int findc(char c) //在缓冲区 [当前位置, 缓冲区末尾] 区间查找特定的字节c，返回c的位置
     {
-       iterator itr = find(begin()+m_curpos, end(), c);		
-        if (itr != end())
+        const char* itr = find(current(), data() + size(), c);
+        if (itr != data() + size())
         {
-            return itr - (begin()+m_curpos);
+            return itr - current();
         }
         return -1;
     }
 
 private:
     unsigned int m_curpos; //当前字节流的位置
+    const char* m_view; //只读视图的起始地址，为nullptr时使用自己的缓冲区
+    size_t m_view_size; //只读视图的字节数
 
 };
 
@@ -103,14 +153,39 @@ public:
         LittleEndian = 1 //小端：低位字节存储在低地址
     };
 
+    //本机字节序，编译时确定：序列化的字节序和本机相同时（通常都是小端）读写定长数据只需要一次memcpy
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    static const int HostByteOrder = BigEndian;
+#else
+    static const int HostByteOrder = LittleEndian;
+#endif
+
     //默认构造函数：初始化字节序为小端存储
-    Serializer(){ m_byteorder = LittleEndian; }
+    Serializer(){ m_byteorder = LittleEndian; m_failed = false; }
 
     //构造函数
     Serializer(StreamBuffer dev, int byteorder = LittleEndian)
     {
         m_byteorder = byteorder; //初始化字节序，默认为小端存储
         m_iodevice = dev; //将输入的字节流缓冲区赋值给m_iodevice
+        m_failed = false;
+    }
+
+    //反序列化收到的数据，不拷贝：从data开始的len个字节，调用者保证这段内存在使用期间有效
+    Serializer(const char* data, size_t len, int byteorder = LittleEndian)
+    {
+        m_byteorder = byteorder;
+        m_failed = false;
+        m_iodevice.attach(data, len);
+    }
+
+    //取走序列化的数据，不拷贝：缓冲区移动到堆上返回，由调用者delete（例如交给zmq::message_t的释放回调），之后序列化器为空
+    std::vector<char>* release()
+    {
+        m_iodevice.detach();
+        std::vector<char>* buffer = new std::vector<char>(std::move(static_cast<std::vector<char>&>(m_iodevice)));
+        clear();
+        return buffer;
     }
 
     //重置字节流缓冲区
@@ -118,6 +193,9 @@ public:
         m_iodevice.reset();
     }
 
+    //反序列化时剩余的字节不够（消息被截断或格式错误），读出的值都无效；clear之后重新开始
+    bool failed() const { return m_failed; }
+
     //获取字节流缓冲区的大小
     int size(){
 		return m_iodevice.size();
@@ -133,10 +211,10 @@ public:
         return m_iodevice.data();
     }
 
-    //大端序转小端序
+    //本机字节序和序列化的字节序不同时，反转len个字节
     void byte_orser(char* in, int len){
-		if (m_byteorder == BigEndian){
-			reverse(in, in+len); //大端的话直接反转 
+		if (m_byteorder != HostByteOrder){
+			reverse(in, in+len); //字节序不同的话直接反转
 		}
 	}
     /**
@@ -162,6 +240,7 @@ public:
 	void clear(){
 		m_iodevice.clear();  //清空字节流缓冲区
 		reset(); //m_curpos重置为0
+		m_failed = false;
 	}
         /**
 	 * @brief 输出指定类型的数据。
@@ -177,7 +256,7 @@ public:
 	 * @param t 要输入的数据。
 	 */
     template<typename T>
-	void input_type(T t);  //序列化，将t中的数据写入到字节流缓冲区m_iodevice的末尾
+	void input_type(const T& t);  //序列化，将t中的数据写入到字节流缓冲区m_iodevice的末尾
     /**
 	 * @brief 重载运算符>>，用于从序列化器中读取数据。
 	 * @tparam T 要读取的数据类型。
@@ -202,15 +281,23 @@ public:
 
     //重载输出运算符<<，用于向序列化器中写入数据
     //序列化，将i中的数据写入到字节流缓冲区m_iodevice的末尾
+    //按引用传入，不拷贝参数；字符串字面量等数组类型退化为指针，按const char*序列化
     template<typename T>
-	Serializer &operator << (T i){
-		input_type(i);
+	Serializer &operator << (const T& i){
+		input_type<typename std::decay<const T>::type>(i);
 		return *this;
 	}    
 
 private:
     int m_byteorder; //字节序,大端存储还是小端存储
     StreamBuffer m_iodevice; //字节流缓冲区
+    bool m_failed; //反序列化失败，见failed()
+
+    //剩余的字节不够：标记失败并跳到末尾，之后的读取也都失败，不会读出消息的内存
+    void fail() {
+        m_failed = true;
+        m_iodevice.offset(m_iodevice.remaining());
+    }
     
 
 };  
@@ -222,42 +309,36 @@ template<typename T>
 inline void Serializer::output_type(T& t)
 {
 	int len = sizeof(T);
-	char* d = new char[len];
-	if (!m_iodevice.is_eof()){ //如果没有到达字节流的末尾
-		memcpy(d, m_iodevice.current(), len); //将字节流 [当前位置, 当前位置+len] 区间的数据拷贝到字符数组d中
-		m_iodevice.offset(len); //并将当前位置向后移动len个字节
-		byte_orser(d, len); //将字符数组d转为小端序
-		t = *reinterpret_cast<T*>(&d[0]); //reinterpret_cast<T*>(&d[0])将char*类型的&d[0]转换为T*类型,再通过*解引用取出T类型的数据
+	if (m_iodevice.remaining() < sizeof(T)) { //剩余的字节不够一个T，不拷贝
+		fail();
+		return;
 	}
-	delete [] d;
+	memcpy(&t, m_iodevice.current(), len); //将字节流 [当前位置, 当前位置+len] 区间的数据直接拷贝到t中
+	m_iodevice.offset(len); //并将当前位置向后移动len个字节
+	byte_orser(reinterpret_cast<char*>(&t), len); //转为本机字节序
 }
 template<>
 inline void Serializer::output_type(std::string& in){
-    int marklen = sizeof(uint16_t); //读取长度
-
-    char* d = new char[marklen];
-    memcpy(d, m_iodevice.current(), marklen); //将字节流的数据的两个字节拷贝到d中
-    int len = *reinterpret_cast<uint16_t*>(&d[0]);  //取出长度
-    byte_orser(d, marklen); //将d转为小端序
-    m_iodevice.offset(marklen);  //将当前字节流位置向后移动 2 个字节
-    delete [] d;
-    if(len == 0) return;
+    uint32_t len = 0;
+    output_type(len); //读取长度，并将当前字节流位置向后移动 4 个字节
+    if(len == 0 || m_failed) return;
+    if(len > m_iodevice.remaining()){ //长度超过剩余的字节，和定长数据一样解码失败
+        fail();
+        return;
+    }
     in.insert(in.begin(), m_iodevice.current(), m_iodevice.current() + len); //输入到in中
 	m_iodevice.offset(len);
 }
 
 //input_type函数用于将t中的数据写入到字节流缓冲区m_iodevice的末尾（序列化）
 template<typename T>
-inline void Serializer::input_type(T t)
+inline void Serializer::input_type(const T& t)
 {
     //求出放入缓存区数据的长度
 	int len = sizeof(T); 
-	char* d = new char[len];   
-	const char* p = reinterpret_cast<const char*>(&t);
-	memcpy(d, p, len); //将p的数据拷贝到d中
+	char* d = m_iodevice.append(len); //在字节流缓冲区（m_iodevice是个vector<char>）的末尾留出len个字节
+	memcpy(d, &t, len); //将t的数据直接拷贝到缓冲区中
 	byte_orser(d, len); 
-	m_iodevice.input(d, len); //将d中的数据追加到字节流缓冲区（m_iodevice是个vector<char>）的末尾
-	delete [] d;
 }
 
 /**
@@ -265,20 +346,15 @@ inline void Serializer::input_type(T t)
  * @param in 要输入的字符串。
  */
 template<>
-inline void Serializer::input_type(std::string in)
+inline void Serializer::input_type(const std::string& in)
 {
-    //先将字符串的长度输入到字节流中
-	uint16_t len = in.size(); 
-	char* p = reinterpret_cast<char*>(&len);
-	byte_orser(p, sizeof(uint16_t));
-	m_iodevice.input(p, sizeof(uint16_t)); 
+    //先将字符串的长度输入到字节流中：uint32_t，回复（如keys、lrange的结果）可以超过64KB
+	uint32_t len = static_cast<uint32_t>(in.size()); 
+	input_type(len);
 	if (len == 0) return;
 
-    //再将字符串的数据输入到字节流中
-	char* d = new char[len];
-	memcpy(d, in.c_str(), len); //将字符串的数据拷贝到d中
-	m_iodevice.input(d, len);
-	delete [] d;
+    //再将字符串的数据直接输入到字节流中
+	m_iodevice.input(in.data(), len);
 }
 
 /**
@@ -286,9 +362,39 @@ inline void Serializer::input_type(std::string in)
  * @param in The null-terminated string to input.
  */
 template<>
-inline void Serializer::input_type(const char* in)
+inline void Serializer::input_type(const char* const& in)
+{
+	uint32_t len = static_cast<uint32_t>(strlen(in)); //和std::string的格式相同，不构造临时字符串
+	input_type(len);
+	if (len == 0) return;
+	m_iodevice.input(in, len);
+}
+
+/**
+ * @brief 输入字符串列表到序列化器中（例如redis_batch的命令和回复）。
+ * @param in 要输入的字符串列表。
+ */
+//先写入uint32_t的元素个数，再按字符串的格式依次写入每个元素
+template<>
+inline void Serializer::input_type(const std::vector<std::string>& in)
 {
-	input_type<std::string>(std::string(in)); //调用input_type<std::string>函数
+	input_type<uint32_t>(static_cast<uint32_t>(in.size()));
+	for (auto& item : in) {
+		input_type<std::string>(item);
+	}
+}
+
+template<>
+inline void Serializer::output_type(std::vector<std::string>& in){
+	uint32_t count = 0;
+	output_type(count);
+	in.clear();
+	in.reserve(std::min<size_t>(count, m_iodevice.size() / sizeof(uint32_t))); //每个元素至少有4字节的长度，错误的个数不会预留过多的内存
+	for (uint32_t i = 0; i < count && !m_failed; i++) {
+		std::string item;
+		output_type(item); //output_type<std::string>插入到字符串的开头，每个元素读入新的字符串
+		in.push_back(std::move(item));
+	}
 }
 
 #endif
\ No newline at end of file
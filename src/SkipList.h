@@ -8,10 +8,15 @@
 #include<string>
 #include<fstream>
 #include<mutex>
+#include<new>
+#include<atomic>
+#include<cstdint>
 #include"global.h"
+#include"NodeArena.h"
 #include"RedisValue/RedisValue.h"
 #define MAX_SKIP_LIST_LEVEL 32  //跳表的最大层数
 #define  PROBABILITY_FACTOR 0.25 //晋升概率 每4个节点中抽取一个节点当作高一层索引的节点
+#define SKIP_LIST_SAMPLE_WALK 16 //随机选取节点时最后在第0层最多走的步数，见randomNode
 #define  DELIMITER ":"
 #define SAVE_PATH "data_file"
 //定义跳表节点，包含key，value和指向当前层下一个节点的指针数组
@@ -20,27 +25,48 @@
 */
 
 // 跳表节点类，每个节点包含一个key和value，以及一个指向下一个节点的指针数组
+// 节点由跳表的内存池分配，key、value和forward数组在同一块内存中，节点之间用裸指针连接，查找时没有引用计数的开销
+// 节点对象本身只包含key、value等固定部分，forward数组紧跟在对象之后（allocSize多分配level个指针），
+// 因此节点只能由跳表通过allocSize分配，不能直接定义、拷贝或按sizeof(SkipListNode)复制
 template<typename Key,typename Value>
 class SkipListNode{
 public:
     Key key;
     Value value;
+    int level; //节点的层高，即forward数组的实际长度
+    std::atomic<uint32_t> access{0}; //LRU时钟或LFU计数（见Eviction.h），只读命令也会更新，占用level之后的对齐空间
+    //跳表节点的构造函数，forward数组的每个元素都初始化为nullptr；调用者已经按allocSize(level)分配了内存
+    SkipListNode(const Key& key,const Value& value,int level):
+    key(key),value(value),level(level){
+        for(int i=0;i<level;i++){
+            forward()[i]=nullptr;
+        }
+    }
+    SkipListNode(const SkipListNode&)=delete;
+    SkipListNode& operator=(const SkipListNode&)=delete;
     //因为一个节点可能指向同一层的节点，也可能指向低一层的节点，所以forward是一个数组，其每个元素都是一个指向节点的指针
-    //forward[i]中的i表示第i层
-    //node->forward[i]表示node节点在第i层的下一个节点
-    std::vector<std::shared_ptr<SkipListNode<Key,Value>>>forward; // 指向下一个节点的指针数组
-    //跳表节点的构造函数，forward数组的大小为maxLevel，每个元素都初始化为nullptr，表示每层的头节点的下一个节点都是nullptr
-    SkipListNode(Key key,Value value,int maxLevel=MAX_SKIP_LIST_LEVEL):
-    key(key),value(value),forward(maxLevel,nullptr){}
-    
+    //forward()[i]中的i表示第i层，node->forward()[i]表示node节点在第i层的下一个节点
+    SkipListNode** forward(){
+        static_assert(sizeof(SkipListNode)%alignof(SkipListNode*)==0,"forward array after the node must be pointer aligned");
+        return reinterpret_cast<SkipListNode**>(this+1);
+    }
+    //原始链表层（第0层）中的下一个节点
+    SkipListNode* getNext(){return forward()[0];}
+    //层高为level的节点（包括forward数组）占用的字节数
+    static size_t allocSize(int level){
+        return sizeof(SkipListNode)+level*sizeof(SkipListNode*);
+    }
 };
 
 // 跳表类，包含头节点和当前跳表的最大层数
 template<typename Key, typename Value>
 class SkipList{
+public:
+    typedef SkipListNode<Key,Value> Node;
 private:
     int currentLevel; //当前跳表的最大层数
-    std::shared_ptr<SkipListNode<Key,Value>>head; //头节点
+    NodeArena arena{MAX_SKIP_LIST_LEVEL+1}; //节点内存池，按层高分类
+    Node* head; //头节点
     std::mt19937 generator{ std::random_device{}()}; //随机数生成器
     std::uniform_real_distribution<double> distribution; //随机数均匀分布
     int elementNumber=0; //跳表元素个数
@@ -50,56 +76,97 @@ private:
 private:
     //随机生成新节点的层数
     int randomLevel();
+    Node* createNode(const Key& key,const Value& value,int level); //从内存池分配并构造节点
+    void destroyNode(Node* node); //析构节点并归还给内存池
     bool parseString(const std::string&line,std::string&key,std::string&value);
     bool isVaildString(const std::string&line);
 public:
     SkipList();
     ~SkipList();
-    bool addItem(const Key& key, const Value& value); //添加节点
+    SkipList(const SkipList&)=delete;
+    SkipList& operator=(const SkipList&)=delete;
+    Node* addItem(const Key& key, const Value& value); //添加节点，返回新节点
+    Node* appendItem(const Key& key, const Value& value); //按key从小到大顺序加载时使用，key大于所有已有key时直接接在末尾
     bool modifyItem(const Key& key, const Value& value); //修改节点
-    std::shared_ptr<SkipListNode<Key,Value>> searchItem(const Key& key); //查找节点
+    Node* searchItem(const Key& key); //查找节点
     bool deleteItem(const Key& key); //删除节点
     void printList(); //打印跳表
     void dumpFile(std::string save_path); //保存跳表到文件
     void loadFile(std::string load_path); //从文件加载跳表
     int size(); //返回跳表元素个数
+    Node* randomNode(uint64_t random); //随机选取一个节点，用于淘汰时抽样，跳表为空时返回nullptr
+    size_t allocatedBytes(); //节点内存池向系统申请的字节数
 public:
     int getCurrentLevel(){return currentLevel;} //返回当前跳表的最大层数
-    std::shared_ptr<SkipListNode<Key,Value>> getHead(){return head;} //返回头节点
+    Node* getHead(){return head;} //返回头节点
+    Node* getFirst(){return head->forward()[0];} //返回第一个数据节点
 };
 
 /*--------------函数定义---------------------*/
 
 template<typename Key,typename Value>
-bool SkipList<Key,Value>::addItem(const Key& key,const Value& value){
+SkipListNode<Key,Value>* SkipList<Key,Value>::addItem(const Key& key,const Value& value){
     mutex.lock();
-    auto currentNode=this->head; //从头节点开始查找
-    std::vector<std::shared_ptr<SkipListNode<Key,Value>>>update(MAX_SKIP_LIST_LEVEL,head); //记录每层需要更新的节点
+    Node* currentNode=this->head; //从头节点开始查找
+    Node* update[MAX_SKIP_LIST_LEVEL]; //记录每层需要更新的节点
+    for(int i=0;i<MAX_SKIP_LIST_LEVEL;i++){
+        update[i]=head;
+    }
     //从高层向底层查找，找到小于目标键值的最大节点
     for(int i=currentLevel-1;i>=0;i--){
-        while(currentNode->forward[i]&&currentNode->forward[i]->key<key){
-            currentNode=currentNode->forward[i];
+        while(currentNode->forward()[i]&&currentNode->forward()[i]->key<key){
+            currentNode=currentNode->forward()[i];
         }
         update[i]=currentNode;
     }
     
     int newLevel=this->randomLevel(); //生成新节点的层数
     currentLevel=std::max(newLevel,currentLevel); //更新当前跳表的最大层数
-    std::shared_ptr<SkipListNode<Key,Value>> newNode=std::make_shared<SkipListNode<Key,Value>>(key,value,newLevel); //只分配节点的层高
+    Node* newNode=createNode(key,value,newLevel); //只分配节点的层高
     //在第 i 层索引中插入新节点
     for(int i=0;i<newLevel;i++){
-        newNode->forward[i]=update[i]->forward[i]; //比如在4->6中插入5,先让5->6
-        update[i]->forward[i]=newNode; //再让4->5
+        newNode->forward()[i]=update[i]->forward()[i]; //比如在4->6中插入5,先让5->6
+        update[i]->forward()[i]=newNode; //再让4->5
     }
     elementNumber++;
     mutex.unlock();
-    return true;
+    return newNode;
+}
+
+//沿着每一层的最右侧找到末尾节点，不需要比较key；key不大于末尾节点的key时退回到addItem
+template<typename Key,typename Value>
+SkipListNode<Key,Value>* SkipList<Key,Value>::appendItem(const Key& key,const Value& value){
+    mutex.lock();
+    Node* currentNode=this->head;
+    Node* update[MAX_SKIP_LIST_LEVEL];
+    for(int i=0;i<MAX_SKIP_LIST_LEVEL;i++){
+        update[i]=head;
+    }
+    for(int i=currentLevel-1;i>=0;i--){
+        while(currentNode->forward()[i]!=nullptr){
+            currentNode=currentNode->forward()[i];
+        }
+        update[i]=currentNode;
+    }
+    if(update[0]!=head&&!(update[0]->key<key)){
+        mutex.unlock();
+        return addItem(key,value);
+    }
+    int newLevel=this->randomLevel();
+    currentLevel=std::max(newLevel,currentLevel);
+    Node* newNode=createNode(key,value,newLevel);
+    for(int i=0;i<newLevel;i++){
+        update[i]->forward()[i]=newNode; //末尾节点的forward都是nullptr，新节点的forward保持nullptr
+    }
+    elementNumber++;
+    mutex.unlock();
+    return newNode;
 }
 
 template<typename Key,typename Value>
 bool SkipList<Key,Value>::modifyItem(const Key& key, const Value& value){
 
-    std::shared_ptr<SkipListNode<Key,Value>> targetNode=this->searchItem(key);
+    Node* targetNode=this->searchItem(key);
     mutex.lock();
     if(targetNode==nullptr){ //如果要修改的节点在原始链表中不存在
         mutex.unlock();
@@ -113,16 +180,16 @@ bool SkipList<Key,Value>::modifyItem(const Key& key, const Value& value){
 
 //查找节点
 template<typename Key,typename Value>
-std::shared_ptr<SkipListNode<Key,Value>> SkipList<Key,Value>::searchItem(const Key& key){
+SkipListNode<Key,Value>* SkipList<Key,Value>::searchItem(const Key& key){
     mutex.lock();
-    std::shared_ptr<SkipListNode<Key,Value>> currentNode=this->head; //从头节点开始查找
+    Node* currentNode=this->head; //从头节点开始查找
     if(!currentNode){ //如果头节点为空
         mutex.unlock();
         return nullptr;
     }
     for(int i=currentLevel-1;i>=0;i--){ //从最高层开始往低层查找
-        while(currentNode->forward[i]!=nullptr&&currentNode->forward[i]->key<key){ //查找每一层
-            currentNode=currentNode->forward[i];
+        while(currentNode->forward()[i]!=nullptr&&currentNode->forward()[i]->key<key){ //查找每一层
+            currentNode=currentNode->forward()[i];
         }
     }
     /*
@@ -130,10 +197,10 @@ std::shared_ptr<SkipListNode<Key,Value>> SkipList<Key,Value>::searchItem(const K
     比如：原始链表：1->2->3->4->6->7->8->9，要查找的key是6，那么循环结束后，此时currentNode是4
     */
 
-    //若要查找的key存在，则currentNode->forward[0]就是要查找的节点
-    //若要查找的key不存在，则currentNode->forward[0]是 第一个key>要查找的key 的节点
-    currentNode=currentNode->forward[0]; 
-    //判断currentNode->forward[0]是否是要查找的节点
+    //若要查找的key存在，则currentNode->forward()[0]就是要查找的节点
+    //若要查找的key不存在，则currentNode->forward()[0]是 第一个key>要查找的key 的节点
+    currentNode=currentNode->forward()[0]; 
+    //判断currentNode->forward()[0]是否是要查找的节点
     if(currentNode&&currentNode->key==key){
         mutex.unlock();
         return currentNode;
@@ -146,34 +213,37 @@ std::shared_ptr<SkipListNode<Key,Value>> SkipList<Key,Value>::searchItem(const K
 template<typename Key,typename Value>
 bool SkipList<Key,Value>::deleteItem(const Key& key){
     mutex.lock();
-    std::shared_ptr<SkipListNode<Key,Value>> currentNode=this->head; //从头节点开始查找
-    std::vector<std::shared_ptr<SkipListNode<Key,Value>>>update(MAX_SKIP_LIST_LEVEL,head);
+    Node* currentNode=this->head; //从头节点开始查找
+    Node* update[MAX_SKIP_LIST_LEVEL];
+    for(int i=0;i<MAX_SKIP_LIST_LEVEL;i++){
+        update[i]=head;
+    }
     //在每一层中找到要删除的节点的前一个节点（即update[i]），记录在update数组中
     for(int i=currentLevel-1;i>=0;i--){
-        while(currentNode->forward[i]&&currentNode->forward[i]->key<key){
-            currentNode=currentNode->forward[i];
+        while(currentNode->forward()[i]&&currentNode->forward()[i]->key<key){
+            currentNode=currentNode->forward()[i];
         }
         update[i]=currentNode;
     }
 
-    //若要删除的key存在，则currentNode->forward[0]就是要删除的节点
-    //若要删除的key不存在，则currentNode->forward[0]是 第一个key>要删除的key 的节点
-    currentNode=currentNode->forward[0];
-    //判断currentNode->forward[0]是否是要删除的节点
+    //若要删除的key存在，则currentNode->forward()[0]就是要删除的节点
+    //若要删除的key不存在，则currentNode->forward()[0]是 第一个key>要删除的key 的节点
+    currentNode=currentNode->forward()[0];
+    //判断currentNode->forward()[0]是否是要删除的节点
     if(!currentNode||currentNode->key!=key){
         mutex.unlock();
         return false;
     }
     for(int i=0;i<currentLevel;i++){
-        if(update[i]->forward[i]!=currentNode){
-            break; //如果update[i]->forward[i]!=currentNode，说明要删除的节点currentNode在第i层索引中不存在
+        if(update[i]->forward()[i]!=currentNode){
+            break; //如果update[i]->forward()[i]!=currentNode，说明要删除的节点currentNode在第i层索引中不存在
         }
         //在第i层索引中删除节点，直接将 要删除的节点的前一节点 指向 要删除的节点的下一个节点
-        update[i]->forward[i]=currentNode->forward[i];
+        update[i]->forward()[i]=currentNode->forward()[i];
     }
-    currentNode.reset();
+    destroyNode(currentNode); //节点归还给内存池
     //如果删除掉要删除的节点后，当前索引层就只剩下了头节点head，则将索引层数减1（因为索引层至少要有两个节点）
-    while(currentLevel>1&&head->forward[currentLevel-1]==nullptr){
+    while(currentLevel>1&&head->forward()[currentLevel-1]==nullptr){
         currentLevel--;
     }
     elementNumber--; //完成删除操作后，元素个数减1
@@ -185,12 +255,12 @@ bool SkipList<Key,Value>::deleteItem(const Key& key){
 template<typename Key,typename Value>
 void SkipList<Key,Value>::printList(){
     mutex.lock();
-    for(int i=currentLevel;i>=0;i--){
-        auto node=this->head->forward[i];
+    for(int i=currentLevel-1;i>=0;i--){
+        auto node=this->head->forward()[i];
         std::cout<<"Level"<<i+1<<":";
         while(node!=nullptr){
             std::cout<<node->key<<DELIMITER<<node->value<<"; ";
-            node=node->forward[i];
+            node=node->forward()[i];
         }
         std::cout<<std::endl;
     }
@@ -202,11 +272,11 @@ template<typename Key,typename Value>
 void SkipList<Key,Value>::dumpFile( std::string save_path){
     mutex.lock();
     writeFile.open(save_path); //打开文件
-    auto node=this->head->forward[0];  //从第一层开始遍历
+    auto node=this->head->forward()[0];  //从第一层开始遍历
     //只遍历原始链表层，因此只保存原始链表层的节点
     while(node!=nullptr){
         writeFile<<node->key<<DELIMITER<<node->value.dump()<<"\n"; //写入文件 dump()函数将value转换为字符串 整数 1->"1" 字符串 "hello"->"hello" 二进制数据 0x01 0x02 0x03->"0x01 0x02 0x03"
-        node=node->forward[0];
+        node=node->forward()[0];
     }
     writeFile.flush(); //刷新缓冲区 写入文件 直接写入文件 不用等到文件关闭 
     // 众所周与,你所要输出的内容会先存入缓冲区,而flush()的作用正是强行将缓冲区的数据清空
@@ -221,7 +291,6 @@ void SkipList<Key,Value>::loadFile(std::string load_path){
 
     readFile.open(load_path); //打开文件
     if(!readFile.is_open()){ 
-        mutex.unlock();
         return;
     }
     std::string line;
@@ -262,6 +331,35 @@ bool SkipList<Key,Value>::parseString(const std::string&line,std::string&key,std
 
 } 
 
+//从最高层到第1层，每层在当前节点和它在上一层的后继之间（一段，平均4个节点）均匀选择一个，
+//最后在第0层向前走1~max(SKIP_LIST_SAMPLE_WALK,段长)步，所有节点都可能被选到。
+//不是严格均匀的：只做分层选择时短段中的节点概率偏大，而短段的开头是高层节点，反复淘汰后高层节点越来越少，查找退化为遍历；
+//最后至少再走一步，被选中的概率主要取决于前面的节点，和自己的层高关系不大
+template<typename Key,typename Value>
+SkipListNode<Key,Value>* SkipList<Key,Value>::randomNode(uint64_t random){
+    Node* node=head;
+    uint64_t length=1;
+    for(int i=currentLevel-1;i>=0;i--){
+        Node* end=i+1<MAX_SKIP_LIST_LEVEL?node->forward()[i+1]:nullptr;
+        length=1;
+        for(Node* next=node->forward()[i];next!=end;next=next->forward()[i]){
+            length++;
+        }
+        if(i==0){
+            break;
+        }
+        random=random*6364136223846793005ULL+1442695040888963407ULL; //每次取随机数时推进一步
+        for(uint64_t steps=(random>>32)%length;steps>0;steps--){
+            node=node->forward()[i];
+        }
+    }
+    random=random*6364136223846793005ULL+1442695040888963407ULL;
+    for(uint64_t steps=1+(random>>32)%std::max<uint64_t>(SKIP_LIST_SAMPLE_WALK,length);steps>0&&node->forward()[0]!=nullptr;steps--){
+        node=node->forward()[0];
+    }
+    return node==head?nullptr:node;
+}
+
 //返回跳表元素个数
 template<typename Key,typename Value>
 int SkipList<Key,Value>::size(){
@@ -272,6 +370,30 @@ int SkipList<Key,Value>::size(){
 }
 
 
+//节点内存池向系统申请的字节数
+template<typename Key,typename Value>
+size_t SkipList<Key,Value>::allocatedBytes(){
+    mutex.lock();
+    size_t ret=arena.allocatedBytes();
+    mutex.unlock();
+    return ret;
+}
+
+//从内存池中分配层高为level的节点，并在这块内存上构造节点
+template<typename Key,typename Value>
+SkipListNode<Key,Value>* SkipList<Key,Value>::createNode(const Key& key,const Value& value,int level){
+    void* memory=arena.allocate(level,Node::allocSize(level));
+    return new(memory) Node(key,value,level);
+}
+
+//析构节点（释放key和value持有的资源），再把节点的内存归还给内存池
+template<typename Key,typename Value>
+void SkipList<Key,Value>::destroyNode(Node* node){
+    int level=node->level;
+    node->~Node();
+    arena.deallocate(level,Node::allocSize(level),node);
+}
+
 //跳表构造函数
 template<typename Key,typename Value>
 SkipList<Key,Value>::SkipList()
@@ -279,7 +401,7 @@ SkipList<Key,Value>::SkipList()
 {
     Key key;
     Value value;
-    this->head=std::make_shared<SkipListNode<Key,Value>>(key,value); //初始化头节点,层数为最大层数
+    this->head=createNode(key,value,MAX_SKIP_LIST_LEVEL); //初始化头节点,层数为最大层数
 }
 
 //随机生成 要插入的新节点 应建立的索引的层数
@@ -306,6 +428,14 @@ int SkipList<Key,Value>::randomLevel()
 // 跳表析构函数 关闭文件
 template<typename Key,typename Value>
 SkipList<Key,Value>::~SkipList(){
+    //沿原始链表层释放所有节点，最后释放头节点，内存块随内存池一起释放
+    Node* node=head->forward()[0];
+    while(node!=nullptr){
+        Node* next=node->forward()[0];
+        destroyNode(node);
+        node=next;
+    }
+    destroyNode(head);
     if(this->readFile){
         readFile.close();
     }
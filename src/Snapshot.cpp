@@ -0,0 +1,414 @@
+#include "Snapshot.h"
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <unistd.h>
+
+static const char SNAPSHOT_MAGIC[8]={'\x89','T','R','D','B','\r','\n','\x1a'};
+static const int SNAPSHOT_MAX_DEPTH=64; //嵌套的列表/哈希最大层数，防止损坏的文件导致栈溢出
+
+//CRC32（IEEE 802.3多项式），查表法
+uint32_t crc32Update(uint32_t crc,const void* data,size_t length){
+    static uint32_t table[256];
+    static bool initialized=[](){
+        for(uint32_t i=0;i<256;i++){
+            uint32_t c=i;
+            for(int k=0;k<8;k++){
+                c=(c&1)?(0xEDB88320u^(c>>1)):(c>>1);
+            }
+            table[i]=c;
+        }
+        return true;
+    }();
+    (void)initialized;
+    const unsigned char* p=static_cast<const unsigned char*>(data);
+    crc=~crc;
+    for(size_t i=0;i<length;i++){
+        crc=table[(crc^p[i])&0xFF]^(crc>>8);
+    }
+    return ~crc;
+}
+
+/*--------------SnapshotWriter---------------------*/
+
+SnapshotWriter::SnapshotWriter(const std::string& path):path(path),tempPath(path+".tmp"){
+    buffer.reserve(SNAPSHOT_BUFFER_SIZE);
+}
+
+SnapshotWriter::~SnapshotWriter(){
+    if(file!=nullptr){
+        fclose(file);
+    }
+    if(!committed){
+        std::remove(tempPath.c_str());
+    }
+}
+
+bool SnapshotWriter::begin(uint64_t keyCount,uint64_t aofId,uint64_t aofOffset){
+    file=fopen(tempPath.c_str(),"wb");
+    if(file==nullptr){
+        std::cout<<"文件："<<tempPath<<"打开失败"<<std::endl;
+        return false;
+    }
+    writeBytes(SNAPSHOT_MAGIC,sizeof(SNAPSHOT_MAGIC));
+    writeFixed(SNAPSHOT_VERSION,4);
+    writeFixed(keyCount,8);
+    writeFixed(aofId,8);
+    writeFixed(aofOffset,8);
+    return true;
+}
+
+void SnapshotWriter::append(const std::string& key,const RedisValue& value,int64_t expireAt){
+    writeString(key);
+    if(expireAt>=0){
+        unsigned char type=SNAPSHOT_EXPIRE;
+        writeBytes(&type,1);
+        writeFixed(expireAt,8);
+    }
+    writeValue(value);
+}
+
+bool SnapshotWriter::commit(){
+    if(file==nullptr){
+        return false;
+    }
+    uint32_t checksum=crc32Update(crc,buffer.data(),buffer.size());
+    flushBuffer();
+    //CRC本身不参与计算，直接写入
+    unsigned char trailer[4];
+    for(int i=0;i<4;i++){
+        trailer[i]=(checksum>>(8*i))&0xFF;
+    }
+    if(fwrite(trailer,1,4,file)!=4){
+        failed=true;
+    }
+    if(fflush(file)!=0||fsync(fileno(file))!=0){
+        failed=true;
+    }
+    fclose(file);
+    file=nullptr;
+    if(failed){
+        std::cout<<"快照："<<tempPath<<"写入失败"<<std::endl;
+        return false;
+    }
+    //改名是原子的：读者看到的要么是旧快照，要么是完整的新快照
+    if(std::rename(tempPath.c_str(),path.c_str())!=0){
+        std::cout<<"快照："<<tempPath<<"改名失败"<<std::endl;
+        return false;
+    }
+    committed=true;
+    return true;
+}
+
+void SnapshotWriter::writeBytes(const void* data,size_t length){
+    buffer.append(static_cast<const char*>(data),length);
+    if(buffer.size()>=SNAPSHOT_BUFFER_SIZE){
+        crc=crc32Update(crc,buffer.data(),buffer.size());
+        flushBuffer();
+    }
+}
+
+void SnapshotWriter::flushBuffer(){
+    if(!buffer.empty()&&fwrite(buffer.data(),1,buffer.size(),file)!=buffer.size()){
+        failed=true;
+    }
+    buffer.clear();
+}
+
+void SnapshotWriter::writeFixed(uint64_t value,int bytes){
+    unsigned char out[8];
+    for(int i=0;i<bytes;i++){
+        out[i]=(value>>(8*i))&0xFF;
+    }
+    writeBytes(out,bytes);
+}
+
+void SnapshotWriter::writeVarint(uint64_t value){
+    unsigned char out[10];
+    int length=0;
+    while(value>=0x80){
+        out[length++]=(value&0x7F)|0x80;
+        value>>=7;
+    }
+    out[length++]=value;
+    writeBytes(out,length);
+}
+
+void SnapshotWriter::writeString(const std::string& value){
+    writeVarint(value.size());
+    writeBytes(value.data(),value.size());
+}
+
+void SnapshotWriter::writeValue(const RedisValue& value){
+    unsigned char type;
+    switch(value.type()){
+    case RedisValue::NUL:
+        type=SNAPSHOT_NULL;
+        writeBytes(&type,1);
+        break;
+    case RedisValue::NUMBER:
+        type=SNAPSHOT_INT;
+        writeBytes(&type,1);
+        writeVarint((uint64_t(value.integerValue())<<1)^uint64_t(value.integerValue()>>63)); //zigzag：绝对值小的负数也只占很少的字节
+        break;
+    case RedisValue::STRING:
+        writeStringValue(value.stringValue());
+        break;
+    case RedisValue::LIST:{ //和数组的格式相同，元素都是字符串
+        type=SNAPSHOT_LIST;
+        writeBytes(&type,1);
+        const QuickList& items=value.listItems();
+        writeVarint(items.size());
+        std::string item;
+        items.forEach([&](const char* data,size_t length){
+            item.assign(data,length);
+            writeStringValue(item);
+        });
+        break;
+    }
+    case RedisValue::ARRAY:{
+        type=SNAPSHOT_LIST;
+        writeBytes(&type,1);
+        const RedisValue::array& items=value.arrayItems();
+        writeVarint(items.size());
+        for(auto& item:items){
+            writeValue(item);
+        }
+        break;
+    }
+    case RedisValue::HASH:{ //和对象的格式相同，值都是字符串
+        type=SNAPSHOT_HASH;
+        writeBytes(&type,1);
+        const RedisHash& items=value.hashItems();
+        writeVarint(items.size());
+        std::string field,item;
+        items.forEach([&](const char* fieldData,size_t fieldLength,const char* valueData,size_t valueLength){
+            field.assign(fieldData,fieldLength);
+            item.assign(valueData,valueLength);
+            writeString(field);
+            writeStringValue(item);
+        });
+        break;
+    }
+    case RedisValue::OBJECT:{
+        type=SNAPSHOT_HASH;
+        writeBytes(&type,1);
+        const RedisValue::object& items=value.objectItems();
+        writeVarint(items.size());
+        for(auto& item:items){
+            writeString(item.first);
+            writeValue(item.second);
+        }
+        break;
+    }
+    default: //布尔
+        type=SNAPSHOT_JSON;
+        writeBytes(&type,1);
+        writeString(value.dump());
+        break;
+    }
+}
+
+void SnapshotWriter::writeStringValue(const std::string& value){
+    unsigned char type;
+    int64_t number;
+    if(RedisValue::toInteger(value,number)){ //旧版本按字符串编码保存的整数、列表中的整数元素
+        type=SNAPSHOT_INT;
+        writeBytes(&type,1);
+        writeVarint((uint64_t(number)<<1)^uint64_t(number>>63)); //zigzag：绝对值小的负数也只占很少的字节
+    }else{
+        type=SNAPSHOT_STRING;
+        writeBytes(&type,1);
+        writeString(value);
+    }
+}
+
+/*--------------SnapshotReader---------------------*/
+
+bool SnapshotReader::isSnapshot(const std::string& path){
+    std::ifstream file(path,std::ios::binary);
+    char magic[sizeof(SNAPSHOT_MAGIC)];
+    if(!file.read(magic,sizeof(magic))){
+        return false;
+    }
+    return std::memcmp(magic,SNAPSHOT_MAGIC,sizeof(magic))==0;
+}
+
+bool SnapshotReader::open(const std::string& path){
+    std::ifstream file(path,std::ios::binary|std::ios::ate);
+    if(!file.is_open()){
+        err="cannot open "+path;
+        return false;
+    }
+    data.resize(file.tellg());
+    file.seekg(0);
+    if(!file.read(&data[0],data.size())){
+        err="cannot read "+path;
+        return false;
+    }
+    size_t headerSize=sizeof(SNAPSHOT_MAGIC)+4+8;
+    if(data.size()<headerSize+4||std::memcmp(data.data(),SNAPSHOT_MAGIC,sizeof(SNAPSHOT_MAGIC))!=0){
+        err="not a snapshot file";
+        return false;
+    }
+    end=data.size()-4;
+    uint32_t checksum=0;
+    for(int i=0;i<4;i++){
+        checksum|=uint32_t(static_cast<unsigned char>(data[end+i]))<<(8*i);
+    }
+    if(crc32Update(0,data.data(),end)!=checksum){
+        err="checksum mismatch";
+        return false;
+    }
+    pos=sizeof(SNAPSHOT_MAGIC);
+    uint64_t version=0;
+    if(!readFixed(version,4)){
+        err="truncated snapshot";
+        return false;
+    }
+    if(version<1||version>SNAPSHOT_VERSION){
+        err="unsupported snapshot version "+std::to_string(version);
+        return false;
+    }
+    if(!readFixed(count,8)||(version>=2&&!(readFixed(aofId,8)&&readFixed(aofOffset,8)))){
+        err="truncated snapshot";
+        return false;
+    }
+    remaining=count;
+    return true;
+}
+
+bool SnapshotReader::next(std::string& key,RedisValue& value,int64_t& expireAt){
+    if(remaining==0){
+        return false;
+    }
+    uint64_t when=uint64_t(-1);
+    bool ok=readString(key);
+    if(ok&&pos<end&&static_cast<unsigned char>(data[pos])==SNAPSHOT_EXPIRE){
+        pos++;
+        ok=readFixed(when,8);
+    }
+    expireAt=int64_t(when);
+    if(!ok||!readValue(value,0)){
+        if(err.empty()){
+            err="truncated snapshot";
+        }
+        return false;
+    }
+    remaining--;
+    return true;
+}
+
+bool SnapshotReader::readFixed(uint64_t& value,int bytes){
+    if(end-pos<size_t(bytes)){
+        return false;
+    }
+    value=0;
+    for(int i=0;i<bytes;i++){
+        value|=uint64_t(static_cast<unsigned char>(data[pos+i]))<<(8*i);
+    }
+    pos+=bytes;
+    return true;
+}
+
+bool SnapshotReader::readVarint(uint64_t& value){
+    value=0;
+    for(int shift=0;shift<64&&pos<end;shift+=7){
+        unsigned char byte=data[pos++];
+        value|=uint64_t(byte&0x7F)<<shift;
+        if((byte&0x80)==0){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SnapshotReader::readString(std::string& value){
+    uint64_t length;
+    if(!readVarint(length)||end-pos<length){
+        return false;
+    }
+    value.assign(data,pos,length); //直接从文件缓冲区复制，不经过getline和substr
+    pos+=length;
+    return true;
+}
+
+bool SnapshotReader::readValue(RedisValue& value,int depth){
+    if(pos>=end||depth>SNAPSHOT_MAX_DEPTH){
+        return false;
+    }
+    unsigned char type=data[pos++];
+    switch(type){
+    case SNAPSHOT_NULL:
+        value=RedisValue();
+        return true;
+    case SNAPSHOT_STRING:{
+        std::string item;
+        if(!readString(item)){
+            return false;
+        }
+        value=RedisValue(std::move(item));
+        return true;
+    }
+    case SNAPSHOT_INT:{
+        uint64_t encoded;
+        if(!readVarint(encoded)){
+            return false;
+        }
+        int64_t number=int64_t(encoded>>1)^-int64_t(encoded&1);
+        value=RedisValue(number); //按整数编码加载，incr不需要再解析字符串
+        return true;
+    }
+    case SNAPSHOT_LIST:{
+        uint64_t size;
+        if(!readVarint(size)||size>end-pos){ //每个元素至少占1个字节
+            return false;
+        }
+        RedisValue::array items(size);
+        for(auto& item:items){
+            if(!readValue(item,depth+1)){
+                return false;
+            }
+        }
+        if(depth>0){ //嵌套在其他值中的JSON数组
+            value=RedisValue(std::move(items));
+            return true;
+        }
+        value=RedisValue::listFromArray(items); //键对应的列表按QuickList加载，列表命令直接在上面操作
+        return true;
+    }
+    case SNAPSHOT_HASH:{
+        uint64_t size;
+        if(!readVarint(size)||size>end-pos){
+            return false;
+        }
+        RedisValue::object items;
+        RedisHash hash; //键对应的哈希表直接按RedisHash加载，小哈希表使用紧凑编码
+        std::string field;
+        for(uint64_t i=0;i<size;i++){
+            RedisValue item;
+            if(!readString(field)||!readValue(item,depth+1)){
+                return false;
+            }
+            if(depth>0){ //嵌套在其他值中的JSON对象
+                items.emplace_hint(items.end(),field,std::move(item)); //写入时按字段顺序遍历，这里总是追加在末尾
+            }else{
+                hash.insert(field,item.plainString());
+            }
+        }
+        value=depth>0?RedisValue(std::move(items)):RedisValue(std::move(hash));
+        return true;
+    }
+    case SNAPSHOT_JSON:{
+        std::string text;
+        if(!readString(text)){
+            return false;
+        }
+        value=RedisValue::parse(text,err);
+        return err.empty();
+    }
+    default:
+        err="unknown value type "+std::to_string(type);
+        return false;
+    }
+}
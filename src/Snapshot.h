@@ -0,0 +1,85 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+#include<string>
+#include<cstdio>
+#include<cstdint>
+#include"RedisValue/RedisValue.h"
+#define SNAPSHOT_VERSION 3 //快照格式版本，格式改变时加1
+#define SNAPSHOT_BUFFER_SIZE (64*1024) //写快照时缓冲区满了才写入文件
+
+/*
+    二进制快照格式（整数为小端序，长度为varint编码）：
+    文件头：8字节magic | 4字节版本号 | 8字节key个数 | 8字节AOF编号 | 8字节AOF长度（版本2）
+        快照包含了编号为AOF编号的AOF中前AOF长度字节的命令，重放AOF时跳过；没有开启AOF时都为0
+    键值对：key长度 | key | [EXPIRE | 8字节过期时间（毫秒时间戳），版本3] | 1字节类型 | 按类型编码的value
+        STRING：长度 + 字节    INT：zigzag编码的varint（可以无损转换为整数的字符串）
+        LIST：元素个数 + 每个元素的类型和value    HASH：字段个数 + 每个字段的长度、字段、类型和value
+        JSON：其他类型（数字、布尔）保存dump()的结果，加载时再parse
+    文件尾：4字节CRC32，覆盖之前的所有字节
+    key中可以包含任意字符（包括':'和换行），加载时不需要逐行解析
+*/
+enum SnapshotType{
+    SNAPSHOT_NULL=0,
+    SNAPSHOT_STRING=1,
+    SNAPSHOT_INT=2,
+    SNAPSHOT_LIST=3,
+    SNAPSHOT_HASH=4,
+    SNAPSHOT_JSON=5,
+    SNAPSHOT_EXPIRE=0xFD //不是value的类型：key设置了过期时间，后面是过期时间和真正的类型
+};
+
+uint32_t crc32Update(uint32_t crc,const void* data,size_t length); //crc初始值为0
+
+//写快照：先写到临时文件，commit时写入CRC、刷盘并改名，中途失败不会破坏原来的快照
+class SnapshotWriter{
+public:
+    explicit SnapshotWriter(const std::string& path);
+    ~SnapshotWriter(); //没有commit成功时删除临时文件
+    SnapshotWriter(const SnapshotWriter&)=delete;
+    SnapshotWriter& operator=(const SnapshotWriter&)=delete;
+    bool begin(uint64_t keyCount,uint64_t aofId=0,uint64_t aofOffset=0); //创建临时文件并写入文件头
+    void append(const std::string& key,const RedisValue& value,int64_t expireAt=-1); //写入一个键值对，expireAt为-1表示没有过期时间
+    bool commit(); //写入文件尾，改名为目标文件
+private:
+    void writeBytes(const void* data,size_t length);
+    void writeFixed(uint64_t value,int bytes);
+    void writeVarint(uint64_t value);
+    void writeString(const std::string& value);
+    void writeValue(const RedisValue& value);
+    void writeStringValue(const std::string& value); //字符串值，可以无损表示为整数时按整数写入
+    void flushBuffer();
+    std::string path;
+    std::string tempPath;
+    FILE* file=nullptr;
+    std::string buffer;
+    uint32_t crc=0;
+    bool failed=false;
+    bool committed=false;
+};
+
+//读快照：一次读入整个文件，校验后按顺序取出键值对
+class SnapshotReader{
+public:
+    static bool isSnapshot(const std::string& path); //文件是否以快照的magic开头（否则按旧的文本格式加载）
+    bool open(const std::string& path); //读入文件并校验magic、版本和CRC
+    uint64_t keyCount() const{ return count; }
+    uint64_t appendOnlyId() const{ return aofId; }
+    uint64_t appendOnlyOffset() const{ return aofOffset; }
+    bool next(std::string& key,RedisValue& value,int64_t& expireAt); //读出下一个键值对和过期时间（没有时为-1），读完或格式错误时返回false
+    const std::string& error() const{ return err; }
+private:
+    bool readFixed(uint64_t& value,int bytes);
+    bool readVarint(uint64_t& value);
+    bool readString(std::string& value);
+    bool readValue(RedisValue& value,int depth);
+    std::string data;
+    size_t pos=0;
+    size_t end=0; //数据部分的结尾（CRC之前）
+    uint64_t count=0;
+    uint64_t remaining=0;
+    uint64_t aofId=0;
+    uint64_t aofOffset=0;
+    std::string err;
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include "TimingWheel.h"
+#include<algorithm>
+#include<climits>
+
+namespace{
+const int64_t MAX_DELTA=(int64_t(1)<<(TIMING_WHEEL_SLOT_BITS*TIMING_WHEEL_LEVELS))-1; //时间轮能表示的最大时间差
+
+inline int levelShift(int level){
+    return TIMING_WHEEL_SLOT_BITS*level;
+}
+}
+
+TimingWheel::TimingWheel(int64_t nowMs):current(nowMs){}
+
+//第i层槽位的下标取到期时间的第6i到6i+5位：时间差不超过64^(i+1)时，这个槽位在当前时刻之后的64^i毫秒内第一次被访问
+void TimingWheel::schedule(TimerNode* node){
+    int64_t t=std::max(node->when,current);
+    int64_t delta=t-current;
+    if(delta>MAX_DELTA){ //超出范围的先放在最高层，级联时按真正的到期时间重新放置
+        delta=MAX_DELTA;
+        t=current+delta;
+    }
+    int level=0;
+    while(level+1<TIMING_WHEEL_LEVELS&&delta>=(int64_t(1)<<levelShift(level+1))){
+        level++;
+    }
+    link(node,level,(t>>levelShift(level))&(TIMING_WHEEL_SLOTS-1));
+}
+
+void TimingWheel::link(TimerNode* node,int level,int index){
+    TimerNode*& head=slots[level][index];
+    node->next=head;
+    if(head!=nullptr){
+        head->pprev=&node->next;
+    }
+    head=node;
+    node->pprev=&head;
+    occupied[level]|=uint64_t(1)<<index;
+    count++;
+}
+
+void TimingWheel::cancel(TimerNode* node){
+    if(node->pprev==nullptr){
+        return;
+    }
+    *node->pprev=node->next;
+    if(node->next!=nullptr){
+        node->next->pprev=node->pprev;
+    }else{
+        //pprev指向槽位的头指针并且后面没有节点，说明槽位变空了
+        uintptr_t address=reinterpret_cast<uintptr_t>(node->pprev);
+        uintptr_t base=reinterpret_cast<uintptr_t>(&slots[0][0]);
+        if(address>=base&&address<base+sizeof(slots)){
+            size_t position=(address-base)/sizeof(TimerNode*);
+            occupied[position/TIMING_WHEEL_SLOTS]&=~(uint64_t(1)<<(position%TIMING_WHEEL_SLOTS));
+        }
+    }
+    node->next=nullptr;
+    node->pprev=nullptr;
+    count--;
+}
+
+void TimingWheel::cascade(int level,int index){
+    TimerNode* node=slots[level][index];
+    slots[level][index]=nullptr;
+    occupied[level]&=~(uint64_t(1)<<index);
+    while(node!=nullptr){
+        TimerNode* next=node->next;
+        count--;
+        schedule(node);
+        node=next;
+    }
+}
+
+//每一层从current之后第一次被访问的槽位开始找非空槽位，这一轮没有时取下一轮的第一个非空槽位；
+//这一轮中找到的时刻早于更高层的下一次级联，可以直接返回，除非第一次访问的槽位是0号（同一时刻更高层也可能级联）
+int64_t TimingWheel::nextEvent() const{
+    int64_t best=LLONG_MAX;
+    for(int level=0;level<TIMING_WHEEL_LEVELS;level++){
+        if(occupied[level]==0){
+            continue;
+        }
+        int shift=levelShift(level);
+        int64_t first=((current+(int64_t(1)<<shift)-1)>>shift)<<shift;
+        int start=(first>>shift)&(TIMING_WHEEL_SLOTS-1);
+        uint64_t ahead=occupied[level]>>start;
+        if(ahead!=0){
+            best=std::min(best,first+(int64_t(__builtin_ctzll(ahead))<<shift));
+            if(start!=0){
+                return best;
+            }
+            continue;
+        }
+        int64_t nextRound=((first>>(shift+TIMING_WHEEL_SLOT_BITS))+1)<<(shift+TIMING_WHEEL_SLOT_BITS);
+        best=std::min(best,nextRound+(int64_t(__builtin_ctzll(occupied[level]))<<shift));
+    }
+    return best;
+}
+
+size_t TimingWheel::expire(int64_t nowMs,size_t limit,std::vector<std::string>& keys){
+    size_t expired=0;
+    while(count!=0&&expired<limit){
+        int64_t next=nextEvent();
+        if(next>nowMs){
+            break;
+        }
+        current=next;
+        //第i层在第i-1层走完一圈时级联；达到limit后下次回到这个时刻会再级联一次，此时这些槽位都是空的
+        for(int level=1;level<TIMING_WHEEL_LEVELS&&(current&((int64_t(1)<<levelShift(level))-1))==0;level++){
+            cascade(level,(current>>levelShift(level))&(TIMING_WHEEL_SLOTS-1));
+        }
+        TimerNode*& head=slots[0][current&(TIMING_WHEEL_SLOTS-1)];
+        while(head!=nullptr&&expired<limit){
+            TimerNode* node=head;
+            keys.push_back(*node->key);
+            cancel(node);
+            expired++;
+        }
+        if(head==nullptr){
+            current++;
+        }
+    }
+    if(expired<limit&&current<nowMs){
+        current=nowMs; //到nowMs为止没有需要处理的槽位，新的定时器按nowMs计算时间差
+    }
+    return expired;
+}
@@ -0,0 +1,48 @@
+#ifndef TIMINGWHEEL_H
+#define TIMINGWHEEL_H
+#include<string>
+#include<vector>
+#include<cstdint>
+#include<cstddef>
+#define TIMING_WHEEL_LEVELS 6 //层数，6层64个槽位、精度1毫秒时覆盖2^36毫秒（约795天），更远的到期时间先放在最高层
+#define TIMING_WHEEL_SLOT_BITS 6
+#define TIMING_WHEEL_SLOTS (1<<TIMING_WHEEL_SLOT_BITS) //每层的槽位数
+
+//时间轮中的定时器，嵌入在分片过期表的value中，插入和删除不需要额外分配内存
+struct TimerNode{
+    int64_t when=-1; //到期时间，毫秒时间戳
+    const std::string* key=nullptr; //过期表中的key
+    TimerNode* next=nullptr;
+    TimerNode** pprev=nullptr; //指向前一个节点的next或者槽位的头指针，nullptr表示不在时间轮中
+};
+
+/*
+    分层时间轮：第0层每个槽位对应1毫秒，第i层每个槽位对应64^i毫秒，定时器按到期时间和当前时刻的差放入对应层的槽位；
+    时刻走到第i层槽位的起点时，把这个槽位的定时器重新放入更低的层（级联），到第0层的槽位时到期。
+    插入、删除是O(1)，每层用一个64位的位图记录非空的槽位，推进时直接跳到下一个非空槽位或者级联边界，
+    没有到期的定时器时推进的代价和定时器总数无关，否则和到期的个数成正比。
+    不加锁，由使用它的分片保证互斥。
+*/
+class TimingWheel{
+public:
+    explicit TimingWheel(int64_t nowMs);
+    TimingWheel(const TimingWheel&)=delete;
+    TimingWheel& operator=(const TimingWheel&)=delete;
+
+    size_t size() const{ return count; }
+    void schedule(TimerNode* node); //按node->when放入对应的槽位，已经过去的时间放在下一个要处理的槽位
+    void cancel(TimerNode* node); //不在时间轮中时什么都不做
+    //推进到nowMs，到期的定时器从时间轮中移除，key追加到keys中，最多limit个，返回个数
+    //达到limit时停在当前槽位，下次调用继续
+    size_t expire(int64_t nowMs,size_t limit,std::vector<std::string>& keys);
+private:
+    void link(TimerNode* node,int level,int index);
+    void cascade(int level,int index);
+    int64_t nextEvent() const; //下一个需要处理的时刻：第0层的非空槽位，或者有定时器需要级联的边界
+
+    TimerNode* slots[TIMING_WHEEL_LEVELS][TIMING_WHEEL_SLOTS]={};
+    uint64_t occupied[TIMING_WHEEL_LEVELS]={}; //第i位为1表示这一层第i个槽位非空
+    int64_t current; //下一个要处理的时刻（毫秒）
+    size_t count=0;
+};
+#endif
@@ -4,6 +4,16 @@
 #include <string>
 #include <sstream>
 #include <functional>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <future>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cerrno>
 #include <zmq.hpp> //这个是zeroMQ的头文件
 #include "Serializer.hpp"//这个是序列化和反序列化的头文件
 
@@ -29,6 +39,13 @@ struct type_xx<void> {
 };
 
 
+#define RPC_PIPELINE_DEPTH 64 //客户端流水线默认最多同时在途（已发送、还没有收到回复）的请求数
+#define RPC_FORWARD_BATCH 64 //服务器转发线程每次轮询后从一个套接字最多连续转发的消息数
+#define RPC_FORWARD_QUEUE_LIMIT 3000 //转发线程为一个工作线程暂存的帧数超过这个值时，暂停从前端接收新请求
+#define RPC_ASYNC_MAX_INFLIGHT 1024 //异步调用最多同时在途的请求数，超过的请求在客户端排队，不超过ZeroMQ默认的高水位（1000条消息）太多
+#define RPC_COPY_MESSAGE_SIZE 8192 //不超过这个字节数的消息从序列化器拷贝到zmq消息，序列化器的缓冲区留给下一次复用；更大的消息直接交出缓冲区，不拷贝
+#define RPC_ASYNC_ENDPOINT "inproc://buttonrpc_async" //提交异步请求的线程通过这个地址唤醒I/O线程，inproc地址只在同一个上下文内有效
+
 class buttonrpc
 {
 
@@ -42,7 +59,9 @@ public:
     enum rpc_err_code {  
 		RPC_ERR_SUCCESS = 0, //成功
 		RPC_ERR_FUNCTIION_NOT_BIND,//函数未绑定
-		RPC_ERR_RECV_TIMEOUT //接收超时
+		RPC_ERR_RECV_TIMEOUT, //接收超时
+		RPC_ERR_CLIENT_CLOSED, //客户端析构时异步请求还没有收到回复
+		RPC_ERR_BAD_MESSAGE //请求或回复不完整，反序列化失败
 	};
 
     //返回值
@@ -76,7 +95,7 @@ public:
         }
 		//重载输出运算符 <<
 		//序列化，将错误码、错误信息和值写入字节流
-        friend Serializer& operator << (Serializer& out, value_t<T> d) {
+        friend Serializer& operator << (Serializer& out, const value_t<T>& d) {
 			out << d.code_ << d.msg_ << d.val_; //将错误码、错误信息和值写入字节流
 			return out;
 		}
@@ -93,11 +112,30 @@ public:
 
     // network
     void as_client(std::string ip, int port); //将类对象设为客户端
-	void as_server(int port); //将类对象设为服务器
+	void as_server(int port, int workers = 1); //将类对象设为服务器，workers为工作线程数
 	void send(zmq::message_t& data); //发送数据，将data发送出去
 	void recv(zmq::message_t& data);//接收数据，存储到data中
-	void set_timeout(uint32_t ms);//只有客户端可以设置超时时间
+	void set_timeout(uint32_t ms);//只有客户端可以设置超时时间，同步调用、流水线和异步调用都按这个时间等待回复
 	void run();   //只有服务器可以调用run()函数,循环接收客户端命令，调用相应的函数，将序列化的调用结果发送给客户端
+	void set_stop_fd(int fd) { m_stop_fd = fd; } //服务器：run()同时监听这个文件描述符，可读时返回（例如信号处理函数写入的自管道）
+	//服务器端：当前工作线程正在处理的请求所属客户端的路由标识，被调函数可以据此区分不同的客户端连接
+	static const std::string& current_identity() { return identity_slot(); }
+
+private:
+	void worker_loop(int index); //工作线程的主循环：从自己的inproc后端接收请求，执行后把结果按原路由信封发回
+	static void forward(zmq::message_t& first, zmq::socket_t& from, zmq::socket_t& to); //转发一条多帧消息，first为已经读出的第一帧
+	//把请求转发给工作线程，后端暂时不能发送的帧按顺序放入queue，不阻塞转发线程
+	static void forward_to_worker(zmq::message_t& first, zmq::socket_t& from, zmq::socket_t& to, std::deque<zmq::message_t>& queue);
+	static void flush_worker_queue(zmq::socket_t& to, std::deque<zmq::message_t>& queue); //按顺序发送queue中的帧，直到后端再次不能发送
+	static std::string& identity_slot() { //每个工作线程一份
+		static thread_local std::string identity;
+		return identity;
+	}
+	static Serializer& request_buffer() { //客户端序列化请求用的缓冲区，每个线程一份，发送后清空，容量留给下一个请求
+		static thread_local Serializer buffer;
+		buffer.clear();
+		return buffer;
+	}
 
 
 public:
@@ -137,12 +175,60 @@ public:
     template<typename R, typename P1, typename P2, typename P3, typename P4, typename P5>
 	value_t<R> call(std::string name, P1, P2, P3, P4, P5); //五个参数
 
+	//流水线：对params中的每个参数调用一次name，不等待回复就发送后面的请求，最多depth个请求同时在途，
+	//结果按params的顺序返回；批量写入时每个请求不再单独等待一次往返
+	template<typename R, typename P1>
+	std::vector<value_t<R>> call_pipeline(std::string name, const std::vector<P1>& params, size_t depth = RPC_PIPELINE_DEPTH);
+
+	//异步调用：不阻塞调用线程，第一次调用时启动一个I/O线程，最多RPC_ASYNC_MAX_INFLIGHT个请求同时在途
+	//I/O线程接管客户端的套接字，同步调用之后也交给它收发：两种调用是同一个连接、同一个服务器会话，
+	//之前用call选择的数据库、开启的事务对call_async同样有效，同一个客户端的请求按提交的顺序执行
+	//可以在多个线程中同时调用（同步的call只能在一个线程中使用）
+	//返回future，收到回复后就绪
+	template<typename R, typename... P>
+	std::future<value_t<R>> call_async(std::string name, P... params);
+
+	//收到回复后在I/O线程中调用callback，callback不能阻塞，否则之后的回复都要等待
+	template<typename R, typename... P>
+	void call_async(std::function<void(value_t<R>)> callback, std::string name, P... params);
+
 private:
-    Serializer* call_(std::string name, const char* data, int len);
+    void call_(const std::string& name, const char* data, int len, Serializer* pr); //调用结果序列化到pr中
+	static bool reject_bad_request(Serializer& ds, Serializer* pr); //ds反序列化失败时在pr中写入错误，不调用函数
 
     template<typename R>
 	value_t<R> net_call(Serializer& ds);
 
+	uint32_t send_request(Serializer& ds); //发送一个请求，返回请求编号
+	bool recv_reply(uint32_t id, zmq::message_t& reply); //接收编号为id的回复，丢弃更早的请求超时后才到达的回复；超时返回false
+	template<typename R>
+	static void parse_reply(zmq::message_t& reply, value_t<R>& val); //反序列化调用结果
+	template<typename R>
+	static void set_timeout_value(value_t<R>& val);
+	template<typename R>
+	static value_t<R> async_value(zmq::message_t* reply, rpc_err_code error); //异步请求的结果，没有收到回复时按error设置错误码
+	template<typename R>
+	std::future<value_t<R>> submit_future(Serializer& ds); //提交一个异步请求，返回它的future
+	static void to_message(Serializer& ds, zmq::message_t& msg); //把ds的数据放进msg：小消息拷贝，大消息交出缓冲区，之后ds为空
+	static void free_buffer(void* data, void* hint); //msg释放时由ZeroMQ调用，删除to_message交出的缓冲区
+
+	static void serialize_params(Serializer& ds) {}
+	template<typename P, typename... Rest>
+	static void serialize_params(Serializer& ds, P& param, Rest&... rest) {
+		ds << param;
+		serialize_params(ds, rest...);
+	}
+
+	//异步请求：序列化的请求和收到回复后的处理；reply为nullptr表示没有收到回复，error为原因（超时或客户端析构）
+	typedef std::function<void(zmq::message_t* reply, rpc_err_code error)> async_handler;
+	struct async_request {
+		zmq::message_t request;
+		async_handler complete;
+	};
+	void submit_async(Serializer& ds, async_handler complete); //把请求交给I/O线程
+	void start_async(); //启动I/O线程，由它接管m_socket
+	void async_loop(); //I/O线程的主循环
+
     template<typename F>
 	void callproxy(F fun, Serializer* pr, const char* data, int len);
 
@@ -248,7 +334,25 @@ private:
 	ZeroMQ更像是一个网络编程库，它提供了套接字 (socket) 的抽象，可以用来实现各种复杂的网络模式。
 	*/
     zmq::context_t m_context; //上下文，可以设置 IO 线程的数量
-    zmq::socket_t* m_socket; //套接字，用于发送和接收数据
+    zmq::socket_t* m_socket; //套接字，用于发送和接收数据；服务器端是面向客户端的ZMQ_ROUTER前端，客户端是ZMQ_DEALER
+    std::vector<zmq::socket_t*> m_backends; //服务器端面向工作线程的后端，每个工作线程一个ZMQ_PAIR，绑定在各自的inproc://地址上
+    int m_worker_number; //服务器工作线程数
+    int m_stop_fd; //服务器：可读时run()返回，-1表示一直运行
+    std::vector<std::thread> m_workers; //服务器工作线程
+    uint32_t m_request_id; //客户端下一个请求的编号，随请求发送，服务器原样带回
+    std::string m_endpoint; //客户端连接的服务器地址，I/O线程的套接字也连接到这里
+    std::atomic<int> m_timeout_ms; //客户端等待回复的超时时间（毫秒），-1表示一直等待；异步调用从发送时开始计时
+
+    //同步调用持有m_socket_mutex使用m_socket；I/O线程启动时在这个锁下接管m_socket，之后m_async_running为true，只有I/O线程使用它
+    std::mutex m_socket_mutex;
+    std::atomic<bool> m_async_running;
+    //异步调用，m_async_queue、m_async_stop和m_async_signal由m_async_mutex保护
+    std::mutex m_async_mutex;
+    std::deque<async_request> m_async_queue; //已经提交、I/O线程还没有取走的请求
+    bool m_async_stop; //客户端析构，I/O线程退出
+    zmq::socket_t* m_async_signal; //提交请求的一端，队列由空变为非空时发送一条空消息唤醒I/O线程
+    zmq::socket_t* m_async_wakeup; //I/O线程的一端
+    std::thread m_async_thread;
 
     rpc_err_code m_error_code; //错误码
     int m_role; //角色，客户端或服务器
@@ -256,35 +360,79 @@ private:
 
 //buttonrpc类的构造函数
 //m_context(1)表示使用一个 IO 线程，这个线程负责处理所有的 I/O 操作，包括网络和文件 I/O
-buttonrpc::buttonrpc() : m_context(1){ 
+buttonrpc::buttonrpc() : m_context(1), m_socket(nullptr), m_worker_number(1), m_stop_fd(-1), m_request_id(0), m_timeout_ms(-1),
+	m_async_running(false), m_async_stop(false), m_async_signal(nullptr), m_async_wakeup(nullptr), m_role(RPC_CLIENT){ 
 	m_error_code = RPC_ERR_SUCCESS; 
 }
 
 //buttonrpc类的析构函数
 buttonrpc::~buttonrpc(){ 
-	m_socket->close(); //关闭套接字
-	delete m_socket;   //删除套接字
-	m_context.close(); //关闭上下文
+	if (m_async_thread.joinable()) { //先停止I/O线程，还没有收到回复的异步请求以RPC_ERR_CLIENT_CLOSED结束
+		{
+			std::lock_guard<std::mutex> lock(m_async_mutex);
+			m_async_stop = true;
+			zmq::message_t signal;
+			m_async_signal->send(signal);
+		}
+		m_async_thread.join();
+		m_async_signal->close();
+		delete m_async_signal;
+		m_async_wakeup->close();
+		delete m_async_wakeup;
+	}
+	if (m_socket) {
+		m_socket->close(); //关闭套接字
+		delete m_socket;   //删除套接字
+	}
+	for (auto backend : m_backends) {
+		backend->close();
+		delete backend;
+	}
+	m_context.close(); //关闭上下文，阻塞在recv上的工作线程会因ETERM退出
+	for (auto& worker : m_workers) {
+		if (worker.joinable()) worker.join();
+	}
 }
 
 // network
 //将buttonrpc类对象设为客户端，连接到指定的服务器地址， ip + port就是服务器的地址
+//使用ZMQ_DEALER而不是ZMQ_REQ：REQ必须收到回复才能发送下一个请求，DEALER可以连续发送多个请求（流水线）
+//每个请求为两帧：[请求编号][序列化的请求]，服务器把请求编号放在回复前面原样发回，客户端据此匹配回复
 void buttonrpc::as_client( std::string ip, int port )
 {
     m_role = RPC_CLIENT;
-    m_socket = new zmq::socket_t(m_context, ZMQ_REQ); //创建一个套接字 参数为上下文和套接字类型	 //ZMQ_REQ 用于请求-应答模式
+    m_socket = new zmq::socket_t(m_context, ZMQ_DEALER); //创建一个套接字 参数为上下文和套接字类型
     ostringstream os;//创建一个字符串流
     os << "tcp://" << ip << ":" << port; //拼接成一个字符串"tcp://ip:port"，即服务器的地址
-    m_socket->connect (os.str()); //连接到指定的服务器地址; os.str()获取字符串流中的字符串
+    m_endpoint = os.str();
+    if (m_timeout_ms >= 0) { //在as_client之前调用过set_timeout
+        m_socket->setsockopt(ZMQ_RCVTIMEO, (int)m_timeout_ms);
+    }
+    m_socket->connect (m_endpoint); //连接到指定的服务器地址
 }
+//第i个工作线程通过这个inproc地址加上i连接到服务器的后端
+#define RPC_WORKER_ENDPOINT "inproc://buttonrpc_worker_"
+
 //将buttonrpc类对象设为服务器
-void buttonrpc::as_server( int port )
+/*
+	前端是ZMQ_ROUTER套接字，监听tcp端口，接收所有客户端(ZMQ_DEALER或ZMQ_REQ)的请求；
+	后端是每个工作线程一个ZMQ_PAIR套接字，绑定在各自的inproc地址上，run()中的转发循环按客户端把请求分给工作线程。
+	ROUTER会在每个请求前加上客户端的路由标识，工作线程原样带回这个信封，ROUTER据此把结果发回对应的客户端。
+	一个耗时的请求（如keys、lrange）只占用一个工作线程，其他客户端的新请求交给负载最轻的工作线程，不受影响（见run()）。
+*/
+void buttonrpc::as_server( int port, int workers )
 {
 	m_role = RPC_SERVER; //设置角色为服务器
-	m_socket = new zmq::socket_t(m_context, ZMQ_REP); //创建一个套接字 参数为上下文和套接字类型	 //ZMQ_REP 用于请求-应答模式
+	m_worker_number = workers > 0 ? workers : 1;
+	m_socket = new zmq::socket_t(m_context, ZMQ_ROUTER); //前端，ZMQ_ROUTER 可以同时与多个客户端通信
 	ostringstream os;
 	os << "tcp://*:" << port;  //拼接成一个字符串: "tcp://port"，即服务器要监听的端口
 	m_socket->bind (os.str()); //服务器开始监听这个端口
+	for (int i = 0; i < m_worker_number; ++i) {
+		zmq::socket_t* backend = new zmq::socket_t(m_context, ZMQ_PAIR);
+		backend->bind(RPC_WORKER_ENDPOINT + std::to_string(i)); //inproc要求先bind再connect，所以在启动工作线程之前绑定
+		m_backends.push_back(backend);
+	}
 }
 
 
@@ -301,62 +449,229 @@ void buttonrpc::recv( zmq::message_t& data )
 }
 
 //设置超时时间 只有客户端可以设置
+//同步调用和流水线通过ZMQ_RCVTIMEO：recv超时后请求按RPC_ERR_RECV_TIMEOUT返回，迟到的回复由之后的调用按请求编号丢弃；
+//异步调用的I/O线程不阻塞在recv上，它按每个请求的发送时间检查超时，迟到的回复找不到在途的请求，直接丢弃
 inline void buttonrpc::set_timeout(uint32_t ms)
 {
-	// only client can set
-	// if (m_role == RPC_CLIENT) {
-	// 	m_socket->setsockopt(ZMQ_RCVTIMEO, ms); //设置接收超时时间
-	// }
+	if (m_role != RPC_CLIENT) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(m_socket_mutex);
+	m_timeout_ms = (int)ms;
+	if (m_socket != nullptr && !m_async_running) { //I/O线程接管套接字之后只使用m_timeout_ms
+		m_socket->setsockopt(ZMQ_RCVTIMEO, (int)ms); //设置接收超时时间
+	}
 }
 
 //只有服务器可以调用 run() 函数
+//启动工作线程，然后在当前线程中转发前端和后端之间的消息，一直阻塞直到上下文被关闭
+/*
+	转发线程记录每个工作线程已经收到、还没有回复的请求数，以及每个客户端（第一帧的路由标识）还没有回复的请求在哪个工作线程上：
+	客户端没有未回复的请求时，新请求交给未回复请求最少的工作线程，一条耗时的命令只挡住它自己的客户端，不会挡住其他客户端；
+	客户端还有未回复的请求时（流水线中同时在途的多个请求），新请求排在同一个工作线程的后面，
+	同一个客户端的请求按发送的顺序执行、按顺序回复（和Redis的一个连接一样）。不能分给其他工作线程并发执行：
+	后面的命令依赖前面的命令（select之后的get），回复虽然可以按请求编号对应，执行顺序却不能交换。
+	回复经过转发线程时按第一帧减少计数，客户端的请求全部回复后删除它的记录，下一个请求重新选择工作线程。
+
+	转发线程不能阻塞在发给工作线程的send上：工作线程的PAIR发送队列达到高水位时，它也阻塞在发回结果的send上，
+	等待转发线程接收，两个方向互相等待就会死锁。所以发给工作线程时使用ZMQ_DONTWAIT，发不出去的帧放入该工作线程的队列，
+	后端可写（ZMQ_POLLOUT）时再按顺序发送。某个工作线程的队列超过RPC_FORWARD_QUEUE_LIMIT时，暂停从前端接收请求，
+	请求留在ROUTER和tcp的缓冲区中，由ZeroMQ对客户端施加背压；这时分到其他工作线程的客户端也要等待。
+	发回客户端的方向不会阻塞：ROUTER对达到高水位或已经断开的客户端直接丢弃消息。
+*/
 void buttonrpc::run()
 {
     if (m_role != RPC_SERVER) { //如果不是服务器
 		return;
 	}
-	while (1){
-		zmq::message_t data;  //创建一个消息
-		recv(data); //从客户端接收序列化的消息，存储到data中
-		//将data.data()强转为char*类型，data.size()为size_t类型
-		StreamBuffer iodev((char*)data.data(), data.size());//创建一个字节流缓冲区
-		Serializer ds(iodev); //用iodev初始化一个序列化器
+	for (int i = 0; i < m_worker_number; ++i) {
+		m_workers.emplace_back(&buttonrpc::worker_loop, this, i);
+	}
+	std::vector<zmq::pollitem_t> items;
+	items.push_back({static_cast<void*>(*m_socket), 0, ZMQ_POLLIN, 0});
+	for (auto backend : m_backends) {
+		items.push_back({static_cast<void*>(*backend), 0, ZMQ_POLLIN, 0});
+	}
+	if (m_stop_fd != -1) {
+		items.push_back({nullptr, m_stop_fd, ZMQ_POLLIN, 0});
+	}
+	std::vector<std::deque<zmq::message_t>> pending(m_backends.size()); //每个工作线程还没有发出去的请求帧
+	std::vector<size_t> load(m_backends.size(), 0); //每个工作线程已经转发、还没有回复的请求数
+	std::unordered_map<std::string, std::pair<size_t, size_t>> inflight; //客户端路由标识 -> (处理它的工作线程, 还没有回复的请求数)
+	size_t next = 0; //负载相同时从不同的工作线程开始找，空闲时请求轮流分给各个工作线程
+	try {
+		while (1) {
+			bool backlog = false;
+			for (size_t i = 0; i < m_backends.size(); ++i) {
+				items[i + 1].events = ZMQ_POLLIN | (pending[i].empty() ? 0 : ZMQ_POLLOUT);
+				backlog = backlog || pending[i].size() > RPC_FORWARD_QUEUE_LIMIT;
+			}
+			items[0].events = backlog ? 0 : ZMQ_POLLIN; //有工作线程积压过多时不接收新请求
+			try {
+				zmq::poll(items.data(), items.size(), -1);
+			} catch (const zmq::error_t& e) {
+				if (e.num() != EINTR) throw;
+				continue; //被信号中断，重新poll（信号处理函数写入的自管道会让m_stop_fd可读）
+			}
+			if (m_stop_fd != -1 && (items.back().revents & ZMQ_POLLIN)) {
+				break; //停止转发，工作线程在析构时退出
+			}
+			if (items[0].revents & ZMQ_POLLIN) {
+				zmq::message_t identity;
+				for (int n = 0; n < RPC_FORWARD_BATCH && m_socket->recv(&identity, ZMQ_DONTWAIT); ++n) {
+					std::string key((const char*)identity.data(), identity.size());
+					auto it = inflight.find(key);
+					size_t worker;
+					if (it != inflight.end()) {
+						worker = it->second.first; //排在该客户端前面的请求之后，保证执行顺序
+						++it->second.second;
+					} else {
+						worker = next++ % m_backends.size();
+						for (size_t k = 1; k < m_backends.size(); ++k) {
+							size_t j = (worker + k) % m_backends.size();
+							if (load[j] < load[worker]) worker = j;
+						}
+						inflight.emplace(std::move(key), std::make_pair(worker, (size_t)1));
+					}
+					++load[worker];
+					forward_to_worker(identity, *m_socket, *m_backends[worker], pending[worker]);
+				}
+			}
+			for (size_t i = 0; i < m_backends.size(); ++i) {
+				if (items[i + 1].revents & ZMQ_POLLOUT) {
+					flush_worker_queue(*m_backends[i], pending[i]);
+				}
+				if (!(items[i + 1].revents & ZMQ_POLLIN)) continue;
+				zmq::message_t frame;
+				for (int n = 0; n < RPC_FORWARD_BATCH && m_backends[i]->recv(&frame, ZMQ_DONTWAIT); ++n) {
+					auto it = inflight.find(std::string((const char*)frame.data(), frame.size())); //工作线程每个请求回复一次，第一帧是路由标识
+					if (it != inflight.end() && --it->second.second == 0) {
+						inflight.erase(it);
+					}
+					if (load[i] > 0) --load[i];
+					forward(frame, *m_backends[i], *m_socket);
+				}
+			}
+		}
+	} catch (const zmq::error_t&) {
+		//上下文被关闭，转发循环退出
+	}
+}
 
-		std::string funname;
-		ds >> funname; //从序列化数据中读取要调用的函数名，存到funname中
-		
-		//执行被调函数，将序列化的调用结果存储到 r 中
-		//从ds.current()开始的ds.size()-funname.size()个字节的数据是函数参数
-		Serializer* r = call_(funname, ds.current(), ds.size()- funname.size());
+//多帧消息的各帧是一起到达的，读出第一帧之后其余的帧可以直接接收
+void buttonrpc::forward(zmq::message_t& first, zmq::socket_t& from, zmq::socket_t& to)
+{
+	bool more = first.more();
+	to.send(first, more ? ZMQ_SNDMORE : 0);
+	while (more) {
+		zmq::message_t frame;
+		from.recv(&frame);
+		more = frame.more();
+		to.send(frame, more ? ZMQ_SNDMORE : 0);
+	}
+}
 
-		//下面两行是将序列化的调用结果 r 转为 zmq::message_t 类型
-		zmq::message_t retmsg (r->size()); //创建一个 zmq::message_t 类型的消息，大小为 r->size()一样
-		//将 r 中的序列化调用结果转为 zmq::message_t 类型
-		memcpy (retmsg.data (), r->data(), r->size()); //拷贝数据，将r中的数据拷贝到retmsg中
+//队列不为空时新的帧必须排在后面，保证同一个工作线程收到的请求和帧的顺序不变
+//多帧消息中途不能发送时，已经发出的帧留在后端，剩下的帧之后继续发送，工作线程收到的仍是完整的消息
+void buttonrpc::forward_to_worker(zmq::message_t& first, zmq::socket_t& from, zmq::socket_t& to, std::deque<zmq::message_t>& queue)
+{
+	zmq::message_t frame = std::move(first);
+	while (1) {
+		bool more = frame.more();
+		if (!queue.empty() || !to.send(frame, (more ? ZMQ_SNDMORE : 0) | ZMQ_DONTWAIT)) {
+			queue.push_back(std::move(frame));
+		}
+		if (!more) break;
+		from.recv(&frame);
+	}
+}
 
-		//将序列化的调用结果发送给客户端
-		send(retmsg);
-		delete r;
+void buttonrpc::flush_worker_queue(zmq::socket_t& to, std::deque<zmq::message_t>& queue)
+{
+	while (!queue.empty()) {
+		zmq::message_t& frame = queue.front();
+		if (!to.send(frame, (frame.more() ? ZMQ_SNDMORE : 0) | ZMQ_DONTWAIT)) {
+			return;
+		}
+		queue.pop_front();
 	}
+}
 
+//工作线程：每个线程有自己的ZMQ_PAIR套接字（zmq套接字不能跨线程共享）
+//收到的多帧消息格式为：[路由标识][请求编号或空帧][序列化的请求]，回复时先原样发回信封，再发送序列化的调用结果
+void buttonrpc::worker_loop(int index)
+{
+	zmq::socket_t worker(m_context, ZMQ_PAIR);
+	worker.connect(RPC_WORKER_ENDPOINT + std::to_string(index));
+	std::vector<zmq::message_t> envelope; //路由信封，包括空的分隔帧
+	Serializer reply; //调用结果的缓冲区，每个工作线程一个，请求之间复用，不用每次从空的缓冲区开始增长
+	try {
+		while (1) {
+			envelope.clear();
+			zmq::message_t data;
+			while (1) {
+				worker.recv(&data);
+				if (!data.more()) break; //最后一帧是请求本身
+				envelope.push_back(std::move(data)); //移动后data重新初始化为空消息，可继续接收下一帧
+			}
+			//信封的第一帧是ROUTER为该客户端连接分配的路由标识
+			if (!envelope.empty()) {
+				identity_slot().assign((const char*)envelope.front().data(), envelope.front().size());
+			} else {
+				identity_slot().clear();
+			}
+			//直接在消息的内存上反序列化，不拷贝；data在请求处理完之前一直有效
+			Serializer ds((const char*)data.data(), data.size());
+
+			std::string funname;
+			ds >> funname; //从序列化数据中读取要调用的函数名，存到funname中
+
+			//执行被调函数，将序列化的调用结果存储到 reply 中；参数是函数名之后的剩余数据
+			reply.clear();
+			if (!reject_bad_request(ds, &reply)) {
+				call_(funname, ds.current(), ds.size() - (ds.current() - ds.data()), &reply);
+			}
+
+			zmq::message_t retmsg;
+			to_message(reply, retmsg);
+
+			for (auto& frame : envelope) {
+				worker.send(frame, ZMQ_SNDMORE); //先发回路由信封
+			}
+			worker.send(retmsg); //将序列化的调用结果发送给客户端
+		}
+	} catch (const zmq::error_t&) {
+		//上下文被关闭，工作线程退出
+	}
+	worker.close();
 }
 
 // 处理函数相关
 //这是 server 真正调用函数的地方，在函数名——函数指针映射表m_handlers中找到被调用函数，执行后将调用结果序列化后返回
 //name是函数名；从data指针位置开始的len个字节的数据是函数参数
-Serializer* buttonrpc::call_(std::string name, const char* data, int len)
+void buttonrpc::call_(const std::string& name, const char* data, int len, Serializer* pr)
 {
-    Serializer* ds = new Serializer(); //创建一个序列化器
-    if (m_handlers.find(name) == m_handlers.end()) { //如果在函数映射表中没有找到被调函数名
-		(*ds) << value_t<int>::code_type(RPC_ERR_FUNCTIION_NOT_BIND); //设置错误码，将错误码写入ds
-		(*ds) << value_t<int>::msg_type("function not bind: " + name); //设置错误信息,将错误信息写入ds
-		return ds;
+    //多个工作线程会同时调用call_，这里只读m_handlers，不能用operator[]
+    auto it = m_handlers.find(name);
+    if (it == m_handlers.end()) { //如果在函数映射表中没有找到被调函数名
+		(*pr) << value_t<int>::code_type(RPC_ERR_FUNCTIION_NOT_BIND); //设置错误码，将错误码写入pr
+		(*pr) << value_t<int>::msg_type("function not bind: " + name); //设置错误信息,将错误信息写入pr
+		return;
 	}
 
-    auto fun = m_handlers[name]; //获取被调函数指针
-    fun(ds, data, len);  //执行被调函数，将结果序列化后存储到ds中
-    ds->reset(); //重置序列号容器 Serializer有个StreamBuffer类型的成员变量，将StreamBuffer对象的当前位置m_curpos重置为0
-    return ds;  //返回序列化的调用结果
+    it->second(pr, data, len);  //执行被调函数，将结果序列化后存储到pr中（不拷贝std::function）
+    pr->reset(); //重置序列号容器 Serializer有个StreamBuffer类型的成员变量，将StreamBuffer对象的当前位置m_curpos重置为0
+}
+
+//被截断或格式错误的请求：回复RPC_ERR_BAD_MESSAGE，和函数未绑定一样只有错误码和错误信息
+inline bool buttonrpc::reject_bad_request(Serializer& ds, Serializer* pr)
+{
+	if (!ds.failed()) {
+		return false;
+	}
+	(*pr) << value_t<int>::code_type(RPC_ERR_BAD_MESSAGE);
+	(*pr) << value_t<int>::msg_type("bad request");
+	return true;
 }
 
 template<typename F>
@@ -439,9 +754,10 @@ void buttonrpc::callproxy_(std::function<R()> func, Serializer* pr, const char*
 template<typename R, typename P1>
 void buttonrpc::callproxy_(std::function<R(P1)> func, Serializer* pr, const char* data, int len)
 {
-	Serializer ds(StreamBuffer(data, len));
+	Serializer ds(data, len); //参数直接从请求消息的内存中读取
 	P1 p1;
 	ds >> p1;
+	if (reject_bad_request(ds, pr)) return;
 	typename type_xx<R>::type r = call_helper<R>(std::bind(func, p1));
 
 	value_t<R> val;
@@ -454,9 +770,10 @@ void buttonrpc::callproxy_(std::function<R(P1)> func, Serializer* pr, const char
 template<typename R, typename P1, typename P2>
 void buttonrpc::callproxy_(std::function<R(P1, P2)> func, Serializer* pr, const char* data, int len )
 {
-	Serializer ds(StreamBuffer(data, len));
+	Serializer ds(data, len); //参数直接从请求消息的内存中读取
 	P1 p1; P2 p2;
 	ds >> p1 >> p2;
+	if (reject_bad_request(ds, pr)) return;
 	typename type_xx<R>::type r = call_helper<R>(std::bind(func, p1, p2));
 	
 	value_t<R> val;
@@ -468,9 +785,10 @@ void buttonrpc::callproxy_(std::function<R(P1, P2)> func, Serializer* pr, const
 template<typename R, typename P1, typename P2, typename P3>
 void buttonrpc::callproxy_(std::function<R(P1, P2, P3)> func, Serializer* pr, const char* data, int len)
 {
-	Serializer ds(StreamBuffer(data, len));
+	Serializer ds(data, len); //参数直接从请求消息的内存中读取
 	P1 p1; P2 p2; P3 p3;
 	ds >> p1 >> p2 >> p3;
+	if (reject_bad_request(ds, pr)) return;
 	typename type_xx<R>::type r = call_helper<R>(std::bind(func, p1, p2, p3));
 	value_t<R> val;
 	val.set_code(RPC_ERR_SUCCESS);
@@ -481,9 +799,10 @@ void buttonrpc::callproxy_(std::function<R(P1, P2, P3)> func, Serializer* pr, co
 template<typename R, typename P1, typename P2, typename P3, typename P4>
 void buttonrpc::callproxy_(std::function<R(P1, P2, P3, P4)> func, Serializer* pr, const char* data, int len)
 {
-	Serializer ds(StreamBuffer(data, len));
+	Serializer ds(data, len); //参数直接从请求消息的内存中读取
 	P1 p1; P2 p2; P3 p3; P4 p4;
 	ds >> p1 >> p2 >> p3 >> p4;
+	if (reject_bad_request(ds, pr)) return;
 	typename type_xx<R>::type r = call_helper<R>(std::bind(func, p1, p2, p3, p4));
 	value_t<R> val;
 	val.set_code(RPC_ERR_SUCCESS);
@@ -494,9 +813,10 @@ void buttonrpc::callproxy_(std::function<R(P1, P2, P3, P4)> func, Serializer* pr
 template<typename R, typename P1, typename P2, typename P3, typename P4, typename P5>
 void buttonrpc::callproxy_(std::function<R(P1, P2, P3, P4, P5)> func, Serializer* pr, const char* data, int len)
 {
-	Serializer ds(StreamBuffer(data, len));
+	Serializer ds(data, len); //参数直接从请求消息的内存中读取
 	P1 p1; P2 p2; P3 p3; P4 p4; P5 p5;
 	ds >> p1 >> p2 >> p3 >> p4 >> p5;
+	if (reject_bad_request(ds, pr)) return;
 	typename type_xx<R>::type r = call_helper<R>(std::bind(func, p1, p2, p3, p4, p5));
 	value_t<R> val;
 	val.set_code(RPC_ERR_SUCCESS);
@@ -507,46 +827,159 @@ void buttonrpc::callproxy_(std::function<R(P1, P2, P3, P4, P5)> func, Serializer
 
 
 //客户端通过net_call()发起远程调用，将序列化的数据发送给服务器，接收服务器返回的数据，并将其反序列化后返回
+//I/O线程已经接管套接字时，交给I/O线程发送并等待回复
 template<typename R>
 inline buttonrpc::value_t<R> buttonrpc::net_call(Serializer& ds)
 {
-	zmq::message_t request(ds.size() + 1);
-	//将字节流ds中的序列化的数据拷贝到request中
-	memcpy(request.data(), ds.data(), ds.size());
-	if (m_error_code != RPC_ERR_RECV_TIMEOUT) {
-		//客户端发送序列化的数据给服务器
-		send(request); //由m_socket->send(request)发送数据
+	std::unique_lock<std::mutex> lock(m_socket_mutex);
+	if (m_async_running) {
+		lock.unlock();
+		return submit_future<R>(ds).get();
 	}
+	uint32_t id = send_request(ds); //客户端发送序列化的数据给服务器
 	//接收服务器返回的序列化的调用结果，存储到reply中
 	zmq::message_t reply;
-	recv(reply);  //m_socket->recv(&reply)接收数据，存放到reply中
 	value_t<R> val;
-	if (reply.size() == 0) { //如果没有收到数据，说明超时了
-		// timeout
-		//枚举值（RPC_ERR_RECV_TIMEOUT）可以自动转换为整数
-		m_error_code = RPC_ERR_RECV_TIMEOUT; //设置buttonrpc类对象的错误码
-		val.set_code(RPC_ERR_RECV_TIMEOUT);  //设置value_t类对象的错误码
-		val.set_msg("recv timeout"); //设置value_t类对象的错误信息(string类型)
+	if (!recv_reply(id, reply)) { //没有收到数据，说明超时了
+		set_timeout_value(val);
 		return val;
 	}
-	m_error_code = RPC_ERR_SUCCESS;
-	ds.clear(); //清空ds中m_iodevice的数据，并将m_curpos置为0
-	//将reply中的数据转为char*类型，写到ds中的StreamBuffer类对象m_iodevice中，并将m_curpos后移reply.size()个字节
-	//将 server 返回的序列化的调用结果写入到字节流ds中
-	ds.write_raw_data((char*)reply.data(), reply.size());
-	ds.reset(); //将读取位置m_curpos重置为0，因为下一步要从头读取ds中的数据，存到val中
+	parse_reply(reply, val);
+	return val;
+}
+
+//请求编号作为单独的一帧放在请求前面，服务器把它当作路由信封的一部分原样发回
+inline uint32_t buttonrpc::send_request(Serializer& ds)
+{
+	uint32_t id = m_request_id++;
+	zmq::message_t header(&id, sizeof(id));
+	zmq::message_t request;
+	to_message(ds, request); //ds的缓冲区直接交给request，不拷贝
+	m_socket->send(header, ZMQ_SNDMORE);
+	send(request); //由m_socket->send(request)发送数据
+	return id;
+}
+
+//小消息拷贝到msg中，ds的缓冲区留给下一次序列化（ZeroMQ把很小的消息直接存放在消息对象内部，不分配内存）；
+//大消息的缓冲区移动到堆上，作为msg的数据，ZeroMQ发送完并释放msg时调用free_buffer删除，不拷贝
+inline void buttonrpc::to_message(Serializer& ds, zmq::message_t& msg)
+{
+	if (ds.size() == 0) {
+		msg.rebuild();
+		return;
+	}
+	if (ds.size() <= RPC_COPY_MESSAGE_SIZE) {
+		msg.rebuild(ds.data(), ds.size());
+		ds.clear();
+		return;
+	}
+	std::vector<char>* buffer = ds.release();
+	msg.rebuild(buffer->data(), buffer->size(), free_buffer, buffer);
+}
+
+inline void buttonrpc::free_buffer(void* data, void* hint)
+{
+	delete static_cast<std::vector<char>*>(hint);
+}
+
+//服务器对同一个客户端按请求的顺序回复，编号不等于id的只可能是更早的请求超时之后才到达的回复
+inline bool buttonrpc::recv_reply(uint32_t id, zmq::message_t& reply)
+{
+	while (1) {
+		zmq::message_t header;
+		if (!m_socket->recv(&header)) {
+			m_error_code = RPC_ERR_RECV_TIMEOUT; //设置buttonrpc类对象的错误码
+			return false;
+		}
+		if (!header.more()) { //不完整的回复
+			continue;
+		}
+		recv(reply); //m_socket->recv(&reply)接收数据，存放到reply中
+		if (header.size() == sizeof(id) && memcmp(header.data(), &id, sizeof(id)) == 0) {
+			m_error_code = RPC_ERR_SUCCESS;
+			return true;
+		}
+	}
+}
+
+template<typename R>
+inline void buttonrpc::parse_reply(zmq::message_t& reply, value_t<R>& val)
+{
+	//直接在reply的内存上反序列化，不拷贝到ds中
+	Serializer ds((const char*)reply.data(), reply.size());
 	/*
 	>>运算符被重载，调用>>运算符会调用Serializer类的output_type函数，调用output_type函数会将ds的读取位置m_curpos后移
 	*/
 	ds >> val; //反序列化，将字节流ds中的数据读取到val中
-	return val;
+	if (ds.failed()) { //回复不完整，读出的值无效
+		val.set_code(RPC_ERR_BAD_MESSAGE);
+		val.set_msg("bad reply");
+	}
+}
+
+template<typename R>
+inline void buttonrpc::set_timeout_value(value_t<R>& val)
+{
+	//枚举值（RPC_ERR_RECV_TIMEOUT）可以自动转换为整数
+	val.set_code(RPC_ERR_RECV_TIMEOUT);  //设置value_t类对象的错误码
+	val.set_msg("recv timeout"); //设置value_t类对象的错误信息(string类型)
+}
+
+//先连续发送depth个请求，之后每收到一个回复再发送一个，在途的请求数保持为depth
+//某个回复超时后，它和之后的请求都按超时返回，迟到的回复由之后的调用丢弃
+//I/O线程已经接管套接字时，同样最多depth个请求在途，每个请求由I/O线程按各自的发送时间判断超时
+template<typename R, typename P1>
+inline std::vector<buttonrpc::value_t<R>> buttonrpc::call_pipeline(std::string name, const std::vector<P1>& params, size_t depth)
+{
+	std::vector<value_t<R>> results(params.size());
+	if (depth == 0) {
+		depth = 1;
+	}
+	std::unique_lock<std::mutex> lock(m_socket_mutex);
+	if (m_async_running) {
+		lock.unlock();
+		std::deque<std::future<value_t<R>>> futures;
+		size_t received = 0;
+		for (size_t sent = 0; sent < params.size(); ++sent) {
+			Serializer& ds = request_buffer();
+			ds << name << params[sent];
+			futures.push_back(submit_future<R>(ds));
+			if (futures.size() >= depth) {
+				results[received++] = futures.front().get();
+				futures.pop_front();
+			}
+		}
+		for (; !futures.empty(); futures.pop_front()) {
+			results[received++] = futures.front().get();
+		}
+		return results;
+	}
+	uint32_t first = m_request_id;
+	size_t sent = 0;
+	for (size_t received = 0; received < params.size(); ++received) {
+		while (sent < params.size() && sent - received < depth) {
+			Serializer& ds = request_buffer();
+			ds << name << params[sent];
+			send_request(ds);
+			++sent;
+		}
+		zmq::message_t reply;
+		if (!recv_reply(first + (uint32_t)received, reply)) {
+			for (size_t i = received; i < params.size(); ++i) {
+				set_timeout_value(results[i]);
+			}
+			break;
+		}
+		parse_reply(reply, results[received]);
+	}
+	return results;
 }
 
 //client
 template<typename R>
 inline buttonrpc::value_t<R> buttonrpc::call(std::string name)
 {
-	Serializer ds;
+	Serializer& ds = request_buffer();
 	ds << name;
 	return net_call<R>(ds);
 }
@@ -556,7 +989,7 @@ inline buttonrpc::value_t<R> buttonrpc::call(std::string name)
 template<typename R, typename P1>
 inline buttonrpc::value_t<R> buttonrpc::call(std::string name, P1 p1)
 {
-	Serializer ds;
+	Serializer& ds = request_buffer();
 	ds << name << p1;
 	return net_call<R>(ds);
 }
@@ -564,7 +997,7 @@ inline buttonrpc::value_t<R> buttonrpc::call(std::string name, P1 p1)
 template<typename R, typename P1, typename P2>
 inline buttonrpc::value_t<R> buttonrpc::call( std::string name, P1 p1, P2 p2 )
 {
-	Serializer ds;
+	Serializer& ds = request_buffer();
 	ds << name << p1 << p2;
 	return net_call<R>(ds);
 }
@@ -572,7 +1005,7 @@ inline buttonrpc::value_t<R> buttonrpc::call( std::string name, P1 p1, P2 p2 )
 template<typename R, typename P1, typename P2, typename P3>
 inline buttonrpc::value_t<R> buttonrpc::call(std::string name, P1 p1, P2 p2, P3 p3)
 {
-	Serializer ds;
+	Serializer& ds = request_buffer();
 	ds << name << p1 << p2 << p3;
 	return net_call<R>(ds);
 }
@@ -580,7 +1013,7 @@ inline buttonrpc::value_t<R> buttonrpc::call(std::string name, P1 p1, P2 p2, P3
 template<typename R, typename P1, typename P2, typename P3, typename P4>
 inline buttonrpc::value_t<R> buttonrpc::call(std::string name, P1 p1, P2 p2, P3 p3, P4 p4)
 {
-	Serializer ds;
+	Serializer& ds = request_buffer();
 	ds << name << p1 << p2 << p3 << p4;
 	return net_call<R>(ds);
 }
@@ -588,13 +1021,201 @@ inline buttonrpc::value_t<R> buttonrpc::call(std::string name, P1 p1, P2 p2, P3
 template<typename R, typename P1, typename P2, typename P3, typename P4, typename P5>
 inline buttonrpc::value_t<R> buttonrpc::call(std::string name, P1 p1, P2 p2, P3 p3, P4 p4, P5 p5)
 {
-	Serializer ds;
+	Serializer& ds = request_buffer();
 	ds << name << p1 << p2 << p3 << p4 << p5;
 	return net_call<R>(ds);
 }
 
+template<typename R, typename... P>
+inline std::future<buttonrpc::value_t<R>> buttonrpc::call_async(std::string name, P... params)
+{
+	Serializer& ds = request_buffer();
+	ds << name;
+	serialize_params(ds, params...);
+	return submit_future<R>(ds);
+}
+
+template<typename R, typename... P>
+inline void buttonrpc::call_async(std::function<void(value_t<R>)> callback, std::string name, P... params)
+{
+	Serializer& ds = request_buffer();
+	ds << name;
+	serialize_params(ds, params...);
+	submit_async(ds, [callback](zmq::message_t* reply, rpc_err_code error) {
+		callback(async_value<R>(reply, error));
+	});
+}
 
+template<typename R>
+inline buttonrpc::value_t<R> buttonrpc::async_value(zmq::message_t* reply, rpc_err_code error)
+{
+	value_t<R> val;
+	if (reply != nullptr) {
+		parse_reply(*reply, val);
+	} else if (error == RPC_ERR_RECV_TIMEOUT) {
+		set_timeout_value(val);
+	} else {
+		val.set_code(RPC_ERR_CLIENT_CLOSED);
+		val.set_msg("client closed");
+	}
+	return val;
+}
 
+//回调在I/O线程中设置promise的值；promise由回调共同持有，get返回时I/O线程可能还在set_value中
+template<typename R>
+inline std::future<buttonrpc::value_t<R>> buttonrpc::submit_future(Serializer& ds)
+{
+	auto promise = std::make_shared<std::promise<value_t<R>>>();
+	std::future<value_t<R>> future = promise->get_future();
+	submit_async(ds, [promise](zmq::message_t* reply, rpc_err_code error) {
+		promise->set_value(async_value<R>(reply, error));
+	});
+	return future;
+}
 
+//第一次提交时启动I/O线程；请求在调用线程中序列化，I/O线程只负责收发
+inline void buttonrpc::submit_async(Serializer& ds, async_handler complete)
+{
+	async_request item;
+	to_message(ds, item.request);
+	item.complete = std::move(complete);
 
+	if (!m_async_running) {
+		start_async();
+	}
+	std::lock_guard<std::mutex> lock(m_async_mutex);
+	bool wakeup = m_async_queue.empty(); //队列不为空时I/O线程已经被唤醒过，还没有取走队列
+	m_async_queue.push_back(std::move(item));
+	if (wakeup) {
+		zmq::message_t signal;
+		m_async_signal->send(signal);
+	}
+}
 
+//等待正在进行的同步调用结束，再把m_socket交给I/O线程；之后的同步调用也提交给I/O线程
+//加锁顺序：先m_socket_mutex，后m_async_mutex
+inline void buttonrpc::start_async()
+{
+	std::lock_guard<std::mutex> socket_lock(m_socket_mutex);
+	if (m_async_running) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(m_async_mutex);
+	m_async_wakeup = new zmq::socket_t(m_context, ZMQ_PAIR);
+	m_async_wakeup->bind(RPC_ASYNC_ENDPOINT); //inproc要求先bind再connect
+	m_async_signal = new zmq::socket_t(m_context, ZMQ_PAIR);
+	m_async_signal->connect(RPC_ASYNC_ENDPOINT);
+	m_async_thread = std::thread(&buttonrpc::async_loop, this);
+	m_async_running = true;
+}
+
+/*
+	I/O线程：用zmq_poll同时等待唤醒消息和服务器的回复，I/O线程不会阻塞在发送或接收上
+		被唤醒时取走提交队列，在途的请求数不超过RPC_ASYNC_MAX_INFLIGHT时按提交顺序发送，请求编号由I/O线程分配；
+		回复按编号找到对应的请求，在这个线程中调用它的处理函数。
+		设置了超时时间时，按发送顺序记录每个请求的截止时间，zmq_poll最多等到最早的截止时间，到期还在途的请求按超时结束。
+	和流水线一样，每个请求为两帧：[请求编号][序列化的请求]，同一个客户端的请求在服务器上按发送的顺序执行
+*/
+inline void buttonrpc::async_loop()
+{
+	zmq::socket_t& dealer = *m_socket; //从start_async开始只在I/O线程中使用，由析构函数关闭
+	dealer.setsockopt(ZMQ_LINGER, 0); //析构时不再等待没有发出的请求
+	std::deque<async_request> pending; //从提交队列取出、还没有发送的请求
+	std::unordered_map<uint32_t, async_handler> inflight; //请求编号 -> 处理函数
+	//在途请求的截止时间，按发送顺序，也就是按截止时间从早到晚（超时时间改变时近似）；已经收到回复的请求在队首时弹出
+	std::deque<std::pair<uint32_t, std::chrono::steady_clock::time_point>> deadlines;
+	uint32_t next_id = m_request_id; //接着同步调用的编号，之前超时的同步请求迟到的回复不会被当作异步请求的回复
+	bool stop = false;
+	bool blocked = false; //发送队列已满，等待套接字可写
+	try {
+		while (!stop) {
+			zmq::pollitem_t items[] = {
+				{static_cast<void*>(dealer), 0, (short)(ZMQ_POLLIN | (blocked ? ZMQ_POLLOUT : 0)), 0},
+				{static_cast<void*>(*m_async_wakeup), 0, ZMQ_POLLIN, 0}
+			};
+			long timeout = -1;
+			while (!deadlines.empty() && inflight.count(deadlines.front().first) == 0) {
+				deadlines.pop_front();
+			}
+			if (!deadlines.empty()) {
+				auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadlines.front().second - std::chrono::steady_clock::now());
+				timeout = std::max<long>(0, left.count() + 1); //向上取整，醒来时一定已经到期
+			}
+			zmq::poll(items, 2, timeout);
+			if (items[1].revents & ZMQ_POLLIN) {
+				zmq::message_t signal;
+				while (m_async_wakeup->recv(&signal, ZMQ_DONTWAIT)) {}
+				std::lock_guard<std::mutex> lock(m_async_mutex);
+				stop = m_async_stop;
+				for (auto& item : m_async_queue) {
+					pending.push_back(std::move(item));
+				}
+				m_async_queue.clear();
+			}
+			if (items[0].revents & ZMQ_POLLIN) {
+				zmq::message_t header;
+				while (dealer.recv(&header, ZMQ_DONTWAIT)) {
+					if (!header.more()) { //不完整的回复
+						continue;
+					}
+					zmq::message_t reply;
+					dealer.recv(&reply); //多帧消息的各帧是一起到达的
+					uint32_t id = 0;
+					if (header.size() != sizeof(id)) {
+						continue;
+					}
+					memcpy(&id, header.data(), sizeof(id));
+					auto it = inflight.find(id);
+					if (it != inflight.end()) {
+						auto complete = std::move(it->second);
+						inflight.erase(it);
+						complete(&reply, RPC_ERR_SUCCESS);
+					}
+				}
+			}
+			auto now = std::chrono::steady_clock::now();
+			while (!deadlines.empty() && deadlines.front().second <= now) {
+				auto it = inflight.find(deadlines.front().first);
+				deadlines.pop_front();
+				if (it != inflight.end()) { //之后才到达的回复找不到这个编号，被丢弃
+					auto complete = std::move(it->second);
+					inflight.erase(it);
+					complete(nullptr, RPC_ERR_RECV_TIMEOUT);
+				}
+			}
+			blocked = false;
+			while (!stop && !pending.empty() && inflight.size() < RPC_ASYNC_MAX_INFLIGHT) {
+				uint32_t id = next_id;
+				zmq::message_t header(&id, sizeof(id));
+				if (!dealer.send(header, ZMQ_SNDMORE | ZMQ_DONTWAIT)) { //达到高水位，等待可写，第一帧发出后其余的帧一定能发出
+					blocked = true;
+					break;
+				}
+				dealer.send(pending.front().request);
+				inflight.emplace(id, std::move(pending.front().complete));
+				pending.pop_front();
+				int timeout_ms = m_timeout_ms;
+				if (timeout_ms >= 0) {
+					deadlines.emplace_back(id, std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms));
+				}
+				next_id++;
+			}
+		}
+	} catch (const zmq::error_t&) {
+		//上下文被关闭
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_async_mutex);
+		for (auto& item : m_async_queue) {
+			pending.push_back(std::move(item));
+		}
+		m_async_queue.clear();
+	}
+	//不持有锁时调用处理函数，回调中可以继续提交
+	for (auto& item : inflight) {
+		item.second(nullptr, RPC_ERR_CLIENT_CLOSED);
+	}
+	for (auto& item : pending) {
+		item.complete(nullptr, RPC_ERR_CLIENT_CLOSED);
+	}
+}
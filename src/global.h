@@ -18,6 +18,13 @@ enum Command{ //命令枚举
     EXISTS,
     DEL,
     RENAME,
+    EXPIRE,
+    PEXPIRE,
+    EXPIREAT,
+    PEXPIREAT,
+    TTL,
+    PTTL,
+    PERSIST,
     INCR,
     INCRBY,
     INCRBYFLOAT,
@@ -38,6 +45,12 @@ enum Command{ //命令枚举
     HDEL,
     HKEYS,
     HVALS,
+    SAVE,
+    BGSAVE,
+    BGREWRITEAOF,
+    INFO,
+    CONFIG,
+    MEMORY,
     INVALID_COMMAND
 };
 
@@ -51,6 +64,13 @@ static std::unordered_map<std::string,enum Command>commandMaps={ //命令映射
     {"exists",EXISTS},
     {"del",DEL},
     {"rename",RENAME},
+    {"expire",EXPIRE},
+    {"pexpire",PEXPIRE},
+    {"expireat",EXPIREAT},
+    {"pexpireat",PEXPIREAT},
+    {"ttl",TTL},
+    {"pttl",PTTL},
+    {"persist",PERSIST},
     {"incr",INCR},
     {"incrby",INCRBY},
     {"incrbyfloat",INCRBYFLOAT},
@@ -70,12 +90,21 @@ static std::unordered_map<std::string,enum Command>commandMaps={ //命令映射
     {"hget",HGET},
     {"hdel",HDEL},
     {"hkeys",HKEYS},
-    {"hvals",HVALS}
+    {"hvals",HVALS},
+    {"save",SAVE},
+    {"bgsave",BGSAVE},
+    {"bgrewriteaof",BGREWRITEAOF},
+    {"info",INFO},
+    {"config",CONFIG},
+    {"memory",MEMORY}
 };
 
+//修改数据的命令：AOF写入失败时服务器拒绝执行，定义在RedisServer.cpp中
+bool isWriteCommand(const std::string& command);
+
 
 //命令解析，将字符串s转换为命令，s是待拆分的命令字符串，delimiter是分隔符
-static std::vector<std::string> split(const std::string &s, char delimiter=' ') {
+inline std::vector<std::string> split(const std::string &s, char delimiter=' ') {
     std::vector<std::string> tokens; //存放拆分后的字符串
     std::string token; //临时存放拆分后的子字符串
     std::istringstream tokenStream(s); //将s转换为输入流
@@ -1,18 +1,48 @@
 #include "RedisServer.h"
 #include "buttonrpc.hpp"
 
-int main() {
-    //创建一个rpc server
-    buttonrpc server;  
-    server.as_server(5555); //监听5555端口
-    //server.bind("redis_command", redis_command);
-    RedisServer::getInstance()->start(); //启动RedisServer，打印logo和启动信息
+//rpc绑定的命令处理函数：取出当前请求的客户端路由标识，交给RedisServer按会话处理
+std::string redis_command(std::string receivedData) {
+    return RedisServer::getInstance()->handleClient(buttonrpc::current_identity(), receivedData);
+}
+
+//批量命令：一次请求执行一组命令，返回每条命令的结果
+std::vector<std::string> redis_batch(std::vector<std::string> commands) {
+    return RedisServer::getInstance()->handleBatch(buttonrpc::current_identity(), std::move(commands));
+}
 
-//”redis_command“ 是m_handlers中的key, handleClient是命令处理函数，RedisServer::getInstance()是RedisServer实例
-    server.bind("redis_command", &RedisServer::handleClient, RedisServer::getInstance());
-   // std::cout << "run rpc server on: " << 5555 << std::endl;
-    server.run();  //启动 server，循环处理客户端的远程命令，并返回序列化的执行结果
+int main(int argc, char* argv[]) {
+    //工作线程数：./server [workers]，默认为CPU核数
+    int workers = argc > 1 ? std::atoi(argv[1]) : (int)std::thread::hardware_concurrency();
+    if (workers <= 0) {
+        workers = 1;
+    }
+    //AOF刷盘策略：./server [workers] [always|everysec|no|off]，默认为everysec
+    std::string appendFsync = argc > 2 ? argv[2] : "everysec";
+    if (!RedisServer::getInstance()->enableAppendOnly(appendFsync)) {
+        return 1;
+    }
+    //内存上限和淘汰策略：./server [workers] [appendfsync] [maxmemory] [noeviction|allkeys-lru|volatile-lru|allkeys-lfu]
+    //在重放AOF之后设置，和Redis一样加载数据时不淘汰
+    if (argc > 3 && !RedisServer::getInstance()->setConfig("maxmemory", argv[3])) {
+        return 1;
+    }
+    if (argc > 4 && !RedisServer::getInstance()->setConfig("maxmemory-policy", argv[4])) {
+        return 1;
+    }
+    {
+        //创建一个rpc server
+        buttonrpc server;  
+        server.as_server(5555, workers); //监听5555端口，请求分发给workers个工作线程
+        RedisServer::getInstance()->start(); //启动RedisServer，打印logo和启动信息
 
+    //”redis_command“ 是m_handlers中的key, redis_command是命令处理函数
+        server.bind("redis_command", redis_command);
+        server.bind("redis_batch", redis_batch);
+       // std::cout << "run rpc server on: " << 5555 << std::endl;
+        server.set_stop_fd(RedisServer::getInstance()->stopFd()); //Ctrl+C时run()返回
+        server.run();  //启动 server，循环处理客户端的远程命令，并返回序列化的执行结果
+    } //server析构：关闭上下文，等待工作线程处理完手上的命令后退出
 
-    RedisServer::getInstance()->start();
+    RedisServer::getInstance()->shutdown(); //没有线程再执行命令，保存数据并关闭AOF
 }
@@ -3,7 +3,29 @@
 #include <thread>
 #include <vector>
 #include <chrono>
+#include <string>
+#include <cstdlib>
+#include <deque>
+#include <future>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <set>
+#include <map>
+#include <sstream>
+#include <fstream>
 #include "buttonrpc.hpp" //
+#include "SkipList.h"
+#include "ConcurrentSkipList.h"
+#include "HashIndex.h"
+#include "RedisValue/HashTable.h"
+#include "TimingWheel.h"
+#include "MemoryCounter.h"
+#include "RedisHelper.h"
+#include "RedisServer.h"
+#include <unistd.h>
+#include <dirent.h>
 
 void client_task(int id, int num_requests) {
     buttonrpc client;
@@ -23,15 +45,1333 @@ void client_task(int id, int num_requests) {
     }
 }
 
-int main() {
-    int thread_num = 10000;           // 并发线程数
-    int requests_per_thread = 100; // 每个线程发1个请求
+// 异步测试：threads个线程共用一个客户端，每个线程用call_async发送requests个set，最多window个请求的结果还没有取出
+// 所有请求由客户端的一个I/O线程收发，不需要每个请求一个线程
+#define ASYNC_WINDOW 4096
+void async_task(buttonrpc& client, int id, int requests, int& failed) {
+    std::deque<std::future<buttonrpc::value_t<std::string>>> futures;
+    for (int i = 0; i < requests || !futures.empty(); ++i) {
+        if (i < requests) {
+            std::string cmd = "set key_" + std::to_string(id) + "_" + std::to_string(i) + " val_" + std::to_string(i);
+            futures.push_back(client.call_async<std::string>("redis_command", cmd));
+        }
+        if (futures.size() >= ASYNC_WINDOW || i >= requests) {
+            auto res = futures.front().get();
+            futures.pop_front();
+            if (!res.valid() || res.val() != "OK") {
+                failed++;
+            }
+        }
+    }
+}
+
+// 流水线测试：一个连接上发送total个set，最多depth个请求同时在途
+// 每次提交PIPELINE_BATCH个命令，不需要一次生成total个命令
+#define PIPELINE_BATCH 65536
+void pipeline_task(int total, size_t depth) {
+    buttonrpc client;
+    client.as_client("127.0.0.1", 5555);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    int failed = 0;
+    for (int base = 0; base < total; base += PIPELINE_BATCH) {
+        std::vector<std::string> cmds;
+        for (int i = base; i < total && i < base + PIPELINE_BATCH; ++i) {
+            cmds.push_back("set pipeline_" + std::to_string(depth) + "_" + std::to_string(i) + " val_" + std::to_string(i));
+        }
+        auto results = client.call_pipeline<std::string>("redis_command", cmds, depth);
+        for (auto& res : results) {
+            if (!res.valid() || res.val() != "OK") {
+                failed++;
+            }
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration<double>(end - start).count();
+
+    std::cout << "Pipeline depth " << depth << ": " << total << " sets in " << duration << " seconds, "
+              << total / duration << " req/s, failed " << failed << std::endl;
+}
+
+// 批量命令测试：一个连接上发送total个set，每次redis_batch请求包含size条命令，再以同样的方式读回
+void batch_task(int total, int size) {
+    buttonrpc client;
+    client.as_client("127.0.0.1", 5555);
+
+    for (std::string op : {"set", "get"}) {
+        auto start = std::chrono::high_resolution_clock::now();
+        int failed = 0;
+        for (int base = 0; base < total; base += size) {
+            std::vector<std::string> cmds;
+            for (int i = base; i < total && i < base + size; ++i) {
+                std::string key = "batch_" + std::to_string(size) + "_" + std::to_string(i);
+                cmds.push_back(op == "set" ? "set " + key + " val_" + std::to_string(i) : "get " + key);
+            }
+            auto res = client.call<std::vector<std::string>>("redis_batch", cmds);
+            if (!res.valid() || res.val().size() != cmds.size()) {
+                failed += cmds.size();
+                continue;
+            }
+            std::vector<std::string> replies = res.val();
+            for (size_t i = 0; i < replies.size(); ++i) {
+                std::string expected = op == "set" ? "OK" : "\"val_" + std::to_string(base + i) + "\"";
+                if (replies[i] != expected) {
+                    failed++;
+                }
+            }
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration<double>(end - start).count();
+
+        std::cout << "Batch size " << size << ": " << total << " " << op << "s in " << duration << " seconds, "
+                  << total / duration << " cmd/s, failed " << failed << std::endl;
+    }
+}
+
+// 会话测试：同一个客户端用call执行select、multi之后，call_async发送的命令属于同一个服务器会话，反过来也一样
+// 返回没有通过的检查数
+int session_check() {
+    buttonrpc client;
+    client.set_timeout(5000);
+    client.as_client("127.0.0.1", 5555);
+    std::string key = "session_check_" + std::to_string(getpid());
+    int failed = 0;
+    auto expect = [&failed](const std::string& what, const std::string& got, const std::string& want) {
+        if (got != want) {
+            std::cerr << what << ": got \"" << got << "\", want \"" << want << "\"" << std::endl;
+            failed++;
+        }
+    };
+    auto call = [&client](const std::string& cmd) {
+        return client.call<std::string>("redis_command", cmd).val();
+    };
+    auto call_async = [&client](const std::string& cmd) {
+        return client.call_async<std::string>("redis_command", cmd).get().val();
+    };
+
+    expect("select 0", call("select 0"), "OK");
+    expect("set in db 0", call("set " + key + " db0"), "OK");
+    expect("select 1", call("select 1"), "OK");
+    expect("set in db 1", call("set " + key + " db1"), "OK");
+    expect("call_async get after select 1", call_async("get " + key), "\"db1\"");
+    expect("multi", call("multi"), "OK");
+    expect("call_async set inside multi", call_async("set " + key + " queued"), "QUEUED");
+    expect("exec", call("exec"), "1)OK");
+    expect("get after exec", call("get " + key), "\"queued\"");
+    expect("call_async select 0", call_async("select 0"), "OK");
+    expect("get after call_async select 0", call("get " + key), "\"db0\"");
+    call("del " + key);
+    call("select 1");
+    call("del " + key);
+
+    std::cout << "Session check: " << (failed == 0 ? "passed" : "FAILED") << std::endl;
+    return failed;
+}
+
+// 以下是不经过RPC、直接调用存储结构的基准测试，内存为MemoryCounter统计的堆内存（包括分配器的对齐）
+
+// 跳表基准测试：按随机顺序插入n个key（默认1000万），统计每个key占用的堆内存（节点、key和value），再按另一个随机顺序查找每个key
+void skiplist_benchmark(int n) {
+    std::vector<std::string> keys;
+    keys.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        keys.push_back("key:" + std::to_string(i));
+    }
+    std::mt19937 generator(1);
+    std::shuffle(keys.begin(), keys.end(), generator);
+
+    size_t before = usedMemory();
+    auto start = std::chrono::high_resolution_clock::now();
+    SkipList<std::string, RedisValue>* list = new SkipList<std::string, RedisValue>();
+    for (auto& key : keys) {
+        list->addItem(key, RedisValue("v"));
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double insert = std::chrono::duration<double>(end - start).count();
+    size_t bytes = usedMemory() - before;
+
+    std::shuffle(keys.begin(), keys.end(), generator);
+    size_t hits = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (auto& key : keys) {
+        hits += list->searchItem(key) != nullptr;
+    }
+    end = std::chrono::high_resolution_clock::now();
+    double lookup = std::chrono::duration<double>(end - start).count();
+
+    std::cout << "Skiplist " << n << " keys: " << double(bytes) / n << " bytes/key, insert "
+              << insert * 1e9 / n << " ns/key, lookup " << lookup * 1e9 / n << " ns/key, hits " << hits << std::endl;
+    delete list;
+}
+
+// 索引基准测试：n个key（默认100万）按随机顺序插入跳表和哈希索引，再按另一个随机顺序分别用跳表和哈希索引查找每个key，
+// 内存为哈希索引的槽位数组平均到每个key的字节数（跳表节点本身见skiplist测试）
+void index_benchmark(int n) {
+    typedef SkipList<std::string, RedisValue> List;
+    std::vector<std::string> keys;
+    keys.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        keys.push_back("key:" + std::to_string(i));
+    }
+    std::mt19937 generator(1);
+    std::shuffle(keys.begin(), keys.end(), generator);
+
+    List* list = new List();
+    HashIndex<List::Node>* index = new HashIndex<List::Node>();
+    for (auto& key : keys) {
+        index->insert(list->addItem(key, RedisValue("v")));
+    }
+    std::shuffle(keys.begin(), keys.end(), generator);
+
+    size_t hits = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto& key : keys) {
+        hits += list->searchItem(key) != nullptr;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double skiplist = std::chrono::duration<double>(end - start).count();
+
+    start = std::chrono::high_resolution_clock::now();
+    for (auto& key : keys) {
+        hits += index->find(key) != nullptr;
+    }
+    end = std::chrono::high_resolution_clock::now();
+    double hashed = std::chrono::duration<double>(end - start).count();
+
+    std::cout << "Index " << n << " keys: skiplist lookup " << skiplist * 1e9 / n << " ns/key, hash index lookup "
+              << hashed * 1e9 / n << " ns/key, hash index " << double(index->memoryBytes()) / n << " bytes/key, hits "
+              << hits << std::endl;
+    delete index;
+    delete list;
+}
+
+// 随机化检查：被测的数据结构和标准库容器执行同一个随机操作序列，每一步比较两者的结果，
+// 不一致时计数，只打印前CHECK_REPORT_LIMIT条（操作的序号和内容），最后输出不一致的总数
+#define CHECK_REPORT_LIMIT 10
+class CheckFailures {
+public:
+    explicit CheckFailures(const char* name) : name(name) {}
+    void expect(bool ok, long step, const std::string& what) {
+        if (ok) {
+            return;
+        }
+        if (count < CHECK_REPORT_LIMIT) {
+            std::cerr << name << " step " << step << ": " << what << std::endl;
+        }
+        count++;
+    }
+    int report(long steps) const {
+        std::cout << name << " check: " << steps << " ops, " << count << " failures" << std::endl;
+        return count;
+    }
+private:
+    const char* name;
+    int count = 0;
+};
+
+// 索引检查：HashIndex和unordered_map执行同样的随机插入（包括替换已有的key）、删除、查找和抽样，
+// key的个数在增长和缩小之间交替，覆盖扩容、缩容和删除时的向前移动
+struct CheckNode {
+    std::string key;
+};
+
+int index_check(int n, unsigned seed) {
+    CheckFailures failures("HashIndex");
+    std::mt19937_64 generator(seed);
+    HashIndex<CheckNode> index;
+    std::unordered_map<std::string, std::unique_ptr<CheckNode>> reference;
+    int range = std::max(n / 10, 64);
+    for (int i = 0; i < n; ++i) {
+        bool growing = i / (range * 4) % 2 == 0;
+        std::string key = "k" + std::to_string(generator() % range);
+        int op = generator() % 10;
+        if (op < (growing ? 5 : 2)) {
+            std::unique_ptr<CheckNode> node(new CheckNode{key});
+            index.insert(node.get());
+            failures.expect(index.find(key) == node.get(), i, "insert " + key);
+            reference[key] = std::move(node);
+        } else if (op < 7) {
+            bool erased = index.erase(key);
+            failures.expect(erased == (reference.erase(key) > 0), i, "erase " + key);
+        } else if (op < 9) {
+            auto it = reference.find(key);
+            failures.expect(index.find(key) == (it == reference.end() ? nullptr : it->second.get()), i, "find " + key);
+        } else {
+            CheckNode* node = index.sample(generator());
+            auto it = node == nullptr ? reference.end() : reference.find(node->key);
+            failures.expect(reference.empty() ? node == nullptr : it != reference.end() && it->second.get() == node,
+                            i, "sample");
+        }
+        failures.expect(index.size() == reference.size(), i, "size");
+        if (i % 4096 == 0) {
+            for (auto& entry : reference) {
+                failures.expect(index.find(entry.first) == entry.second.get(), i, "scan " + entry.first);
+            }
+        }
+    }
+    return failures.report(n);
+}
+
+// 临时数据目录：直接使用RedisHelper的测试在这里创建数据库文件，析构时删除目录和其中的文件，
+// RedisHelper析构时保存的数据不会覆盖DEFAULT_DB_FOLDER中已有的数据
+class TempDataFolder {
+public:
+    TempDataFolder() {
+        char pattern[] = "/tmp/tinyredis_test_XXXXXX";
+        if (mkdtemp(pattern) == nullptr) {
+            std::cerr << "Unable to create temporary folder" << std::endl;
+            std::exit(1);
+        }
+        path = pattern;
+    }
+    ~TempDataFolder() {
+        if (DIR* dir = opendir(path.c_str())) {
+            while (dirent* entry = readdir(dir)) {
+                std::string name = entry->d_name;
+                if (name != "." && name != "..") {
+                    std::remove((path + "/" + name).c_str());
+                }
+            }
+            closedir(dir);
+        }
+        rmdir(path.c_str());
+    }
+    const std::string& get() const { return path; }
+private:
+    std::string path;
+};
+
+// 值对象基准测试：通过RedisHelper写入n个小key（默认100万，"key:i" -> "vi"），统计每个key占用的堆内存（节点、索引、key和value）
+// 和set、get的平均延迟
+void values_benchmark(int n) {
+    TempDataFolder folder;
+    std::unique_ptr<RedisHelper> helper(new RedisHelper(folder.get()));
+    helper->select(0);
+    size_t before = usedMemory();
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < n; ++i) {
+        helper->set("key:" + std::to_string(i), RedisValue("v" + std::to_string(i)));
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double set = std::chrono::duration<double>(end - start).count();
+    size_t bytes = usedMemory() - before;
+
+    size_t total = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < n; ++i) {
+        total += helper->get("key:" + std::to_string(i)).size();
+    }
+    end = std::chrono::high_resolution_clock::now();
+    double get = std::chrono::duration<double>(end - start).count();
+
+    std::cout << "Values " << n << " keys: " << double(bytes) / n << " bytes/key, set " << set * 1e9 / n
+              << " ns/key, get " << get * 1e9 / n << " ns/key, " << total << " reply bytes" << std::endl;
+}
+
+// 持久化检查：通过RedisServer在开启AOF（always）的临时数据目录中执行随机的写命令，值覆盖整数编码、短字符串、长字符串、
+// 列表、紧凑编码和哈希表编码的哈希以及过期时间，中途save一次；然后把数据目录复制一份（相当于进程在这一刻崩溃），
+// 从副本的数据库文件加载并重放AOF，所有key必须和原来相同；再保存后只从数据库文件加载，所有key仍然必须相同
+#define PERSISTENCE_CHECK_DBS 3 //使用的数据库数
+#define PERSISTENCE_CHECK_KEYS 40 //每个数据库使用的key数
+#define PERSISTENCE_CHECK_FIELDS 300 //每个哈希使用的字段数，超过HASH_MAX_LISTPACK_ENTRIES时转换为哈希表
+
+void copy_data_folder(const std::string& from, const std::string& to) {
+    if (DIR* dir = opendir(from.c_str())) {
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name != "." && name != "..") {
+                std::ifstream in(from + "/" + name, std::ios::binary);
+                std::ofstream out(to + "/" + name, std::ios::binary);
+                out << in.rdbuf();
+            }
+        }
+        closedir(dir);
+    }
+}
+
+// 通过命令读出所有key的值（哈希表编码的遍历顺序和插入的历史有关，按字段排序后比较）和是否设置了过期时间
+std::map<std::string, std::string> persistence_dump(const std::string& identity) {
+    RedisServer* server = RedisServer::getInstance();
+    auto items = [&](const std::string& command) { //"1) xxx"格式的多行回复
+        std::vector<std::string> result;
+        std::istringstream lines(server->handleClient(identity, command));
+        std::string line;
+        while (std::getline(lines, line)) {
+            size_t start = line.find(") ");
+            result.push_back(start == std::string::npos ? line : line.substr(start + 2));
+        }
+        return result;
+    };
+    std::map<std::string, std::string> dump;
+    for (int db = 0; db < PERSISTENCE_CHECK_DBS; ++db) {
+        server->handleClient(identity, "select " + std::to_string(db));
+        for (auto& quoted : items("keys *")) {
+            if (quoted.size() < 2 || quoted.front() != '"') {
+                continue; //空数据库
+            }
+            std::string key = quoted.substr(1, quoted.size() - 2);
+            std::string value = server->handleClient(identity, "get " + key);
+            if (!value.empty() && value[0] == '{') {
+                std::vector<std::string> fields = items("hkeys " + key), values = items("hvals " + key);
+                std::vector<std::string> pairs;
+                for (size_t i = 0; i < fields.size() && i < values.size(); ++i) {
+                    pairs.push_back(fields[i] + "=" + values[i]);
+                }
+                std::sort(pairs.begin(), pairs.end());
+                value.clear();
+                for (auto& pair : pairs) {
+                    value += pair + " ";
+                }
+            }
+            if (server->handleClient(identity, "ttl " + key) != "(integer) -1") {
+                value += " (ttl)";
+            }
+            dump[std::to_string(db) + " " + key] = value;
+        }
+    }
+    return dump;
+}
+
+int persistence_check(int n, unsigned seed) {
+    CheckFailures failures("Persistence");
+    std::mt19937_64 generator(seed);
+    RedisServer* server = RedisServer::getInstance();
+    std::string identity = "persistence_check";
+    std::shared_ptr<RedisHelper> original = CommandParser::getRedisHelper();
+    TempDataFolder live, crashed;
+    auto helper = std::make_shared<RedisHelper>(live.get());
+    CommandParser::setRedisHelper(helper);
+    if (!server->enableAppendOnly("always")) {
+        failures.expect(false, 0, "enableAppendOnly");
+    }
+    auto text = [&generator](const char* prefix, size_t longLength) {
+        std::string value = prefix + std::to_string(generator() % 1000);
+        if (generator() % 4 == 0) {
+            value += std::string(longLength, 'x'); //超过对象内部保存的长度，或者超过紧凑编码的值长度
+        }
+        return value;
+    };
+    int commands = std::max(n / 100, 200);
+    for (int i = 0; i < commands; ++i) {
+        std::string key = " k" + std::to_string(generator() % PERSISTENCE_CHECK_KEYS);
+        std::string command;
+        switch (generator() % 16) {
+        case 0: command = "select " + std::to_string(generator() % PERSISTENCE_CHECK_DBS); break;
+        case 1: command = "set" + key + " " + std::to_string(int64_t(generator())); break;
+        case 2: command = "set" + key + " " + text("s", 40); break;
+        case 3: command = "incrby" + key + " " + std::to_string(int(generator() % 2001) - 1000); break;
+        case 4: command = "append" + key + " " + text("a", 20); break;
+        case 5: command = "incrbyfloat" + key + " 0.5"; break;
+        case 6: case 7: command = (generator() % 2 ? "lpush" : "rpush") + key + " " + text("e", 100); break;
+        case 8: command = generator() % 2 ? "lpop" + key : "rpop" + key; break;
+        case 9: case 10: case 11:
+            command = "hset" + key + " f" + std::to_string(generator() % PERSISTENCE_CHECK_FIELDS) + " " + text("v", 80);
+            break;
+        case 12: command = "hdel" + key + " f" + std::to_string(generator() % PERSISTENCE_CHECK_FIELDS); break;
+        case 13: command = "del" + key; break;
+        case 14: command = "expireat" + key + " 4102444800"; break; //2100年，检查期间不会到期
+        default: command = "persist" + key; break;
+        }
+        server->handleClient(identity, command);
+        if (i == commands / 2) {
+            server->handleClient(identity, "save"); //之前的命令保存到数据库文件，AOF被清空
+        }
+    }
+    std::map<std::string, std::string> expected = persistence_dump(identity);
+    copy_data_folder(live.get(), crashed.get());
+
+    {
+        auto restored = std::make_shared<RedisHelper>(crashed.get());
+        CommandParser::setRedisHelper(restored);
+        server->enableAppendOnly("always"); //从数据库文件加载，重放save之后的命令
+        failures.expect(persistence_dump(identity) == expected, commands, "load and replay AOF");
+        restored->shutdown(); //保存到数据库文件，清空并关闭AOF
+    }
+    {
+        auto reloaded = std::make_shared<RedisHelper>(crashed.get());
+        CommandParser::setRedisHelper(reloaded);
+        server->enableAppendOnly("off"); //只从数据库文件加载
+        failures.expect(persistence_dump(identity) == expected, commands, "load snapshot");
+    }
+    CommandParser::setRedisHelper(original);
+    return failures.report(commands);
+}
+
+// 列表基准测试：QuickList在两端各push、pop n个12字节的元素（默认100万），
+// 和原来的std::vector<RedisValue>在开头插入、删除比较；vector是O(n^2)，最多测试LIST_VECTOR_LIMIT个元素
+#define LIST_VECTOR_LIMIT 50000
+template<typename F>
+double list_measure(F f) {
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void list_benchmark(int n) {
+    std::string element(12, 'x');
+    std::string value;
+    QuickList list;
+    double lpush = list_measure([&] { for (int i = 0; i < n; ++i) list.pushFront(element.data(), element.size()); });
+    double rpop = list_measure([&] { for (int i = 0; i < n; ++i) list.popBack(value); });
+    double rpush = list_measure([&] { for (int i = 0; i < n; ++i) list.pushBack(element.data(), element.size()); });
+    double lpop = list_measure([&] { for (int i = 0; i < n; ++i) list.popFront(value); });
+    std::cout << "QuickList " << n << " elements: lpush " << lpush << " ms, rpop " << rpop << " ms, rpush "
+              << rpush << " ms, lpop " << lpop << " ms" << std::endl;
+
+    int m = std::min(n, LIST_VECTOR_LIMIT);
+    std::vector<RedisValue> vector;
+    double insert = list_measure([&] { for (int i = 0; i < m; ++i) vector.insert(vector.begin(), RedisValue(element)); });
+    double erase = list_measure([&] { for (int i = 0; i < m; ++i) vector.erase(vector.begin()); });
+    std::cout << "vector " << m << " elements: lpush " << insert << " ms, lpop " << erase << " ms" << std::endl;
+}
+
+// 列表检查：QuickList和deque执行同样的随机push、pop和range，元素多数很短，偶尔有几千字节和超过一个块的元素，
+// 元素个数在增长和缩小之间交替，覆盖块的新建、扩容和释放；定期比较全部元素，并比较拷贝、移动构造和比较运算的结果
+int list_check(int n, unsigned seed) {
+    CheckFailures failures("QuickList");
+    std::mt19937_64 generator(seed);
+    QuickList list;
+    std::deque<std::string> reference;
+    int period = std::max(n / 10, 64);
+    for (int i = 0; i < n; ++i) {
+        bool growing = i / period % 2 == 0;
+        int op = generator() % 10;
+        if (op < (growing ? 6 : 4)) {
+            size_t length = generator() % 1000 == 0 ? QUICKLIST_CHUNK_BYTES + generator() % QUICKLIST_CHUNK_BYTES
+                          : generator() % 100 == 0 ? 100 + generator() % 3000 : generator() % 20;
+            std::string value(length, '\0');
+            for (auto& c : value) {
+                c = char(generator());
+            }
+            if (op % 2 == 0) {
+                list.pushFront(value);
+                reference.push_front(value);
+            } else {
+                list.pushBack(value);
+                reference.push_back(value);
+            }
+        } else if (op < 8) {
+            std::string value;
+            bool front = op % 2 == 0;
+            bool popped = front ? list.popFront(value) : list.popBack(value);
+            bool ok = popped == !reference.empty();
+            if (popped && ok) {
+                ok = value == (front ? reference.front() : reference.back());
+                front ? reference.pop_front() : reference.pop_back();
+            }
+            failures.expect(ok, i, front ? "popFront" : "popBack");
+        } else if (!reference.empty()) {
+            size_t start = generator() % reference.size();
+            size_t stop = start + generator() % std::min<size_t>(reference.size() - start, 64);
+            std::vector<std::string> values;
+            list.range(start, stop, [&](const char* data, size_t length) { values.emplace_back(data, length); });
+            failures.expect(values == std::vector<std::string>(reference.begin() + start, reference.begin() + stop + 1),
+                            i, "range " + std::to_string(start) + " " + std::to_string(stop));
+        }
+        failures.expect(list.size() == reference.size(), i, "size");
+        if (i % 4096 == 0) {
+            failures.expect(list.items() == std::vector<std::string>(reference.begin(), reference.end()), i, "items");
+        }
+        if (i % 10007 == 0) {
+            QuickList copy(list);
+            failures.expect(copy == list && !(copy < list) && !(list < copy), i, "copy");
+            copy.pushBack("x");
+            failures.expect(list < copy && !(copy < list) && !(copy == list), i, "compare");
+            QuickList moved(std::move(copy));
+            failures.expect(copy.empty() && moved.size() == reference.size() + 1, i, "move");
+        }
+    }
+    return failures.report(n);
+}
+
+// 哈希基准测试：一个哈希中分别有1万、10万、100万个字段（16字节的value），比较HashTable和原来的std::unordered_map
+// hset、命中和未命中的hget的平均延迟，以及每个字段占用的堆内存
+template<typename Table, typename Insert, typename Find>
+void hash_measure(const char* name, const std::vector<std::string>& fields, const std::vector<std::string>& misses,
+                  Insert insert, Find find) {
+    std::string value(16, 'v');
+    size_t n = fields.size();
+    size_t before = usedMemory();
+    Table* table = new Table();
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto& field : fields) {
+        insert(*table, field, value);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double hset = std::chrono::duration<double>(end - start).count();
+    size_t bytes = usedMemory() - before;
+
+    size_t hits = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (auto& field : fields) {
+        hits += find(*table, field);
+    }
+    end = std::chrono::high_resolution_clock::now();
+    double hit = std::chrono::duration<double>(end - start).count();
+    start = std::chrono::high_resolution_clock::now();
+    for (auto& field : misses) {
+        hits += find(*table, field);
+    }
+    end = std::chrono::high_resolution_clock::now();
+    double miss = std::chrono::duration<double>(end - start).count();
+
+    std::cout << name << " " << n << " fields: hset " << hset * 1e9 / n << " ns, hget hit " << hit * 1e9 / n
+              << " ns, hget miss " << miss * 1e9 / n << " ns, " << double(bytes) / n << " bytes/field, hits " << hits << std::endl;
+    delete table;
+}
+
+void hash_benchmark() {
+    typedef std::unordered_map<std::string, std::string> Map;
+    for (int n : {10000, 100000, 1000000}) {
+        std::vector<std::string> fields, misses;
+        for (int i = 0; i < n; ++i) {
+            fields.push_back("field:" + std::to_string(i));
+            misses.push_back("missing:" + std::to_string(i));
+        }
+        std::mt19937 generator(1);
+        std::shuffle(fields.begin(), fields.end(), generator);
+        hash_measure<Map>("unordered_map", fields, misses,
+            [](Map& map, const std::string& field, const std::string& value) { map.emplace(field, value); },
+            [](Map& map, const std::string& field) {
+                auto it = map.find(field);
+                std::string value; //和HashTable::get一样取出value
+                if (it != map.end()) value = it->second;
+                return it != map.end();
+            });
+        hash_measure<HashTable>("HashTable", fields, misses,
+            [](HashTable& table, const std::string& field, const std::string& value) { table.insert(field, value); },
+            [](HashTable& table, const std::string& field) { std::string value; return table.get(field, value); });
+    }
+}
+
+// 哈希检查：HashTable和unordered_map执行同样的随机插入、删除和查找，字段和值的长度不固定（包括空串和'\0'），
+// 字段的个数在增长和缩小之间交替，覆盖渐进式rehash期间的读写；定期用forEach比较全部内容，并比较拷贝和移动构造的结果
+std::unordered_map<std::string, std::string> hash_contents(const HashTable& table) {
+    std::unordered_map<std::string, std::string> contents;
+    table.forEach([&](const char* field, size_t fieldLength, const char* value, size_t valueLength) {
+        contents.emplace(std::string(field, fieldLength), std::string(value, valueLength));
+    });
+    return contents;
+}
+
+int hash_check(int n, unsigned seed) {
+    CheckFailures failures("HashTable");
+    std::mt19937_64 generator(seed);
+    HashTable table;
+    std::unordered_map<std::string, std::string> reference;
+    int range = std::max(n / 10, 64);
+    for (int i = 0; i < n; ++i) {
+        bool growing = i / (range * 4) % 2 == 0;
+        int id = generator() % range;
+        std::string field = "f" + std::to_string(id) + std::string(id % 37, char(id)); //同一个id总是同一个字段
+        int op = generator() % 10;
+        if (op < (growing ? 5 : 2)) {
+            std::string value(generator() % 50 == 0 ? 200 + generator() % 800 : generator() % 24, '\0');
+            for (auto& c : value) {
+                c = char(generator());
+            }
+            bool inserted = table.insert(field, value);
+            failures.expect(inserted == reference.emplace(field, value).second, i, "insert " + std::to_string(id));
+        } else if (op < 7) {
+            bool erased = table.erase(field);
+            failures.expect(erased == (reference.erase(field) > 0), i, "erase " + std::to_string(id));
+        } else {
+            std::string value;
+            bool found = table.get(field, value);
+            auto it = reference.find(field);
+            failures.expect(found == (it != reference.end()) && (!found || value == it->second), i,
+                            "get " + std::to_string(id));
+        }
+        failures.expect(table.size() == reference.size(), i, "size");
+        if (i % 4096 == 0) {
+            failures.expect(hash_contents(table) == reference, i, "forEach");
+        }
+        if (i % 10007 == 0) {
+            HashTable copy(table);
+            failures.expect(!copy.isRehashing() && hash_contents(copy) == reference, i, "copy");
+            HashTable moved(std::move(copy));
+            failures.expect(copy.size() == 0 && hash_contents(moved) == reference, i, "move");
+        }
+    }
+    return failures.report(n);
+}
+
+// 过期基准测试：n个key的TTL在1秒到1小时之间均匀分布，放入一个时间轮，统计schedule的平均延迟，
+// 再以100毫秒为间隔推进120秒，统计每次推进的平均和最大耗时、每个回收的key的耗时，最后cancel十分之一的key
+void expire_benchmark(int n) {
+    std::vector<std::string> keys(n);
+    std::vector<TimerNode> nodes(n);
+    std::mt19937_64 generator(1);
+    int64_t now = 1700000000000LL;
+    TimingWheel wheel(now);
+    for (int i = 0; i < n; ++i) {
+        keys[i] = "key:" + std::to_string(i);
+        nodes[i].key = &keys[i];
+        nodes[i].when = now + 1000 + int64_t(generator() % 3600000);
+    }
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto& node : nodes) {
+        wheel.schedule(&node);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double schedule = std::chrono::duration<double>(end - start).count();
+
+    std::vector<std::string> expired;
+    size_t reclaimed = 0;
+    double total = 0, worst = 0;
+    const int ticks = 1200;
+    for (int t = 0; t < ticks; ++t) {
+        now += 100;
+        expired.clear();
+        start = std::chrono::high_resolution_clock::now();
+        reclaimed += wheel.expire(now, SIZE_MAX, expired);
+        end = std::chrono::high_resolution_clock::now();
+        double tick = std::chrono::duration<double>(end - start).count();
+        total += tick;
+        worst = std::max(worst, tick);
+    }
+
+    int cancels = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < n; i += 10, ++cancels) {
+        wheel.cancel(&nodes[i]);
+    }
+    end = std::chrono::high_resolution_clock::now();
+    double cancel = std::chrono::duration<double>(end - start).count();
+
+    std::cout << n << " keys: schedule " << schedule * 1e9 / n << " ns, cancel " << cancel * 1e9 / std::max(cancels, 1)
+              << " ns, tick avg " << total * 1e6 / ticks << " us, tick max " << worst * 1e6 << " us, "
+              << total * 1e9 / std::max<size_t>(reclaimed, 1) << " ns per reclaimed key, reclaimed " << reclaimed << std::endl;
+}
+
+// 过期检查：时间轮和按到期时间排序的set执行同样的随机schedule（包括重新设置已有的定时器）、cancel和推进，
+// 到期时间从已经过去到超出时间轮的范围，推进的步长从0到2^30毫秒，expire的limit有时很小；
+// expire返回的key都必须已经到期、在时间轮中并且不重复，没有达到limit时所有应该到期的key都必须返回。
+// 时间轮处理过的时刻不再回头：expire(now)之后设置的不晚于now的定时器放在下一个要处理的槽位，在now之后的推进中到期
+int expire_check(int n, unsigned seed) {
+    CheckFailures failures("TimingWheel");
+    std::mt19937_64 generator(seed);
+    int64_t now = 1700000000000LL;
+    TimingWheel wheel(now);
+    std::unordered_map<std::string, TimerNode> nodes; //节点的地址和key的地址在rehash时不变
+    std::set<std::pair<int64_t, std::string>> reference; //在时间轮中的定时器，按应该到期的时间排序
+    std::unordered_map<std::string, int64_t> due; //key -> reference中应该到期的时间
+    int64_t horizon = now; //之后设置的定时器最早在这个时刻到期
+    std::vector<std::string> expired;
+    int range = std::max(n / 10, 64);
+    for (int i = 0; i < n; ++i) {
+        std::string key = "t" + std::to_string(generator() % range);
+        int op = generator() % 10;
+        if (op < 5) {
+            auto it = nodes.emplace(key, TimerNode()).first;
+            TimerNode& node = it->second;
+            node.key = &it->first;
+            if (node.pprev != nullptr) {
+                wheel.cancel(&node);
+                reference.erase({due[key], key});
+            }
+            node.when = now + int64_t(generator() % (uint64_t(1) << (generator() % 40))) - (op == 0 ? 1000 : 0);
+            wheel.schedule(&node);
+            due[key] = std::max(node.when, horizon);
+            reference.emplace(due[key], key);
+        } else if (op < 7) {
+            auto it = nodes.find(key);
+            if (it != nodes.end()) {
+                reference.erase({due[key], key});
+                wheel.cancel(&it->second); //已经到期或取消的定时器不在时间轮中，什么都不做
+                failures.expect(it->second.pprev == nullptr, i, "cancel " + key);
+            }
+        } else {
+            now += int64_t(generator() % (uint64_t(1) << (generator() % 31)));
+            size_t limit = op == 7 ? 1 + generator() % 8 : SIZE_MAX;
+            expired.clear();
+            size_t count = wheel.expire(now, limit, expired);
+            horizon = now + 1;
+            bool ok = count == expired.size() && count <= limit;
+            for (auto& k : expired) {
+                TimerNode& node = nodes[k];
+                ok = ok && node.pprev == nullptr && node.when <= now && reference.erase({due[k], k}) == 1;
+            }
+            if (count < limit) {
+                ok = ok && (reference.empty() || reference.begin()->first > now);
+            }
+            failures.expect(ok, i, "expire " + std::to_string(now) + " limit " + std::to_string(limit));
+        }
+        failures.expect(wheel.size() == reference.size(), i, "size");
+    }
+    return failures.report(n);
+}
+
+// 淘汰基准测试：先写入n个key（100字节的value），把maxmemory设为这些数据占用内存的一半，
+// 再按Zipf分布（s=0.99）访问ops次：get命中计为命中，未命中时set（缓存的用法），统计各淘汰策略的命中率和吞吐量
+void eviction_benchmark(int n, long ops) {
+    std::vector<double> cdf(n);
+    double sum = 0;
+    for (int i = 0; i < n; ++i) {
+        sum += 1.0 / std::pow(i + 1, 0.99);
+        cdf[i] = sum;
+    }
+    for (auto& c : cdf) {
+        c /= sum;
+    }
+    std::string value(100, 'x');
+    for (const char* policy : {"allkeys-lru", "allkeys-lfu"}) {
+        TempDataFolder folder;
+        std::unique_ptr<RedisHelper> helper(new RedisHelper(folder.get()));
+        helper->select(0);
+        size_t before = usedMemory();
+        for (int i = 0; i < n; ++i) {
+            helper->set("evict:" + std::to_string(i), RedisValue(value));
+        }
+        size_t limit = before + (usedMemory() - before) / 2;
+        helper->configSet("maxmemory-policy", policy);
+        helper->configSet("maxmemory", std::to_string(limit));
+        helper->set("evict:start", RedisValue(value)); //写命令执行前才淘汰：先淘汰到上限以下，访问时的命中率才有意义
+
+        std::mt19937_64 generator(1);
+        std::uniform_real_distribution<double> uniform(0, 1);
+        long hits = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (long i = 0; i < ops; ++i) {
+            int rank = std::lower_bound(cdf.begin(), cdf.end(), uniform(generator)) - cdf.begin();
+            int id = (int)((uint64_t(rank) * 2654435761u) % n); //热点key分散在整个key空间中
+            std::string key = "evict:" + std::to_string(id);
+            if (helper->get(key).find("does not exist") == std::string::npos) {
+                hits++;
+            } else {
+                helper->set(key, RedisValue(value));
+            }
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        double duration = std::chrono::duration<double>(end - start).count();
+        std::cout << "Eviction " << policy << ": hit rate " << 100.0 * hits / ops << "%, "
+                  << ops / duration << " ops/s, dbsize " << helper->dbsize() << std::endl;
+        helper->configSet("maxmemory", "0");
+    }
+}
+
+// 无锁跳表检查：CONCURRENT_CHECK_THREADS个线程在range个key上同时随机插入、删除和查找，每个线程ops次；
+// 查找到的节点在Guard的作用域内读取key和value（value比短字符串优化的长度长，节点被提前释放时ASan能发现），必须和查找的key一致。
+// 结束后每个key插入成功的次数减去删除成功的次数只能是0或1，并且和最后能否查到一致，size()和第0层遍历的节点数相同、key严格递增
+#define CONCURRENT_CHECK_THREADS 8
+int concurrent_skiplist_check(int range, long ops) {
+    typedef ConcurrentSkipList<std::string, std::string> List;
+    CheckFailures failures("ConcurrentSkipList");
+    List list;
+    auto value_of = [](const std::string& key) { return key + std::string(32, 'v'); };
+    std::vector<std::vector<long>> balance(CONCURRENT_CHECK_THREADS, std::vector<long>(range));
+    std::atomic<long> bad_reads{0};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < CONCURRENT_CHECK_THREADS; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937_64 generator(t + 1);
+            for (long i = 0; i < ops; ++i) {
+                int id = generator() % range;
+                std::string key = "k" + std::to_string(id);
+                int op = generator() % 4;
+                if (op == 0) {
+                    balance[t][id] += list.addItem(key, value_of(key)) != nullptr;
+                } else if (op == 1) {
+                    balance[t][id] -= list.deleteItem(key);
+                } else {
+                    EpochManager::Guard guard;
+                    List::Node* node = list.searchItem(key);
+                    if (node != nullptr && (node->key != key || node->value != value_of(key))) {
+                        bad_reads++;
+                    }
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    failures.expect(bad_reads == 0, 0, std::to_string(bad_reads.load()) + " lookups returned a wrong node");
+    int present = 0;
+    for (int id = 0; id < range; ++id) {
+        std::string key = "k" + std::to_string(id);
+        long added = 0;
+        for (auto& counts : balance) {
+            added += counts[id];
+        }
+        bool found = list.searchItem(key) != nullptr;
+        failures.expect(added == (found ? 1 : 0), id, "balance " + key + " " + std::to_string(added));
+        present += found;
+    }
+    int walked = 0;
+    for (List::Node* node = list.getFirst(); node != nullptr; node = node->getNext()) {
+        List::Node* next = node->getNext();
+        failures.expect(next == nullptr || node->key < next->key, walked, "order " + node->key);
+        walked++;
+    }
+    failures.expect(list.size() == present && walked == present, 0,
+                    "size " + std::to_string(list.size()) + " walked " + std::to_string(walked) + " present " + std::to_string(present));
+    return failures.report(ops * CONCURRENT_CHECK_THREADS);
+}
+
+// mget和get的回复：去掉编号和字符串两边的引号
+std::vector<std::string> concurrent_reply_lines(const std::string& reply) {
+    std::vector<std::string> lines;
+    std::istringstream in(reply);
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t prefix = line.find(") ");
+        if (prefix != std::string::npos && prefix < 4) {
+            line = line.substr(prefix + 2);
+        }
+        if (line.size() >= 2 && line.front() == '"' && line.back() == '"') {
+            line = line.substr(1, line.size() - 2);
+        }
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+// 写时复制检查：通过RedisHelper，2个写线程执行ops条命令：mset把成对的key设为同一个值、del同时删除一对key、append只追加x、
+// incr计数器、set带几毫秒后过期的key；6个读线程同时get、strlen、exists和mget，检查读到的都是某一时刻的完整结果：
+// 成对的key在mget中相同，exists为0或2，追加的字符串全是x并且长度不减少，计数器不减少；最后计数器等于incr的次数。
+// 打开USE_CONCURRENT_SKIPLIST时这些读取大多不加分片锁，读取发布的副本
+#define CONCURRENT_CHECK_PAIRS 16
+int concurrent_helper_check(long ops) {
+    CheckFailures failures("Copy-on-write reads");
+    TempDataFolder folder;
+    std::unique_ptr<RedisHelper> helper(new RedisHelper(folder.get()));
+    helper->select(0);
+    const int writers = 2, readers = 6;
+    std::atomic<int> running{writers};
+    std::atomic<long> torn_pairs{0}, torn_strings{0}, stale_reads{0}, reads{0};
+    std::vector<long> increments(writers);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < writers; ++t) {
+        threads.emplace_back([&, t] {
+            std::mt19937_64 generator(t + 1);
+            for (long i = 0; i < ops; ++i) {
+                std::string id = std::to_string(generator() % CONCURRENT_CHECK_PAIRS);
+                int op = generator() % 5;
+                if (op == 0) {
+                    std::string value = "w" + std::to_string(t) + "_" + std::to_string(i) + std::string(24, 'p');
+                    std::vector<std::string> items = {"pair:a:" + id, value, "pair:b:" + id, value};
+                    helper->mset(items);
+                } else if (op == 1) {
+                    helper->del({"pair:a:" + id, "pair:b:" + id});
+                } else if (op == 2) {
+                    helper->append("str:" + id, "xxx");
+                } else if (op == 3) {
+                    helper->incr("num:" + id);
+                    increments[t]++;
+                } else {
+                    helper->set("ttl:" + id, RedisValue("t" + std::to_string(i)), NONE, RedisHelper::currentTimeMs() + 2);
+                }
+            }
+            running--;
+        });
+    }
+    for (int t = 0; t < readers; ++t) {
+        threads.emplace_back([&, t] {
+            std::mt19937_64 generator(t + 100);
+            std::vector<long> lengths(CONCURRENT_CHECK_PAIRS), counters(CONCURRENT_CHECK_PAIRS);
+            while (running > 0) {
+                int index = generator() % CONCURRENT_CHECK_PAIRS;
+                std::string id = std::to_string(index);
+                std::vector<std::string> pair = {"pair:a:" + id, "pair:b:" + id};
+                std::vector<std::string> lines = concurrent_reply_lines(helper->mget(pair));
+                if (lines.size() != 2 || lines[0] != lines[1]) {
+                    torn_pairs++;
+                }
+                std::string exists = helper->exists(pair);
+                if (exists != "(integer) 0" && exists != "(integer) 2") {
+                    torn_pairs++;
+                }
+                std::string text = concurrent_reply_lines(helper->get("str:" + id)).front();
+                if (text.find("does not exist") == std::string::npos && text.find_first_not_of('x') != std::string::npos) {
+                    torn_strings++;
+                }
+                std::string reply = helper->strlen("str:" + id);
+                long length = std::atol(reply.substr(reply.find(' ') + 1).c_str());
+                if (length < lengths[index] || length % 3 != 0) {
+                    stale_reads++;
+                }
+                lengths[index] = length;
+                std::string counter = concurrent_reply_lines(helper->get("num:" + id)).front();
+                long value = counter.find("does not exist") == std::string::npos ? std::atol(counter.c_str()) : 0;
+                if (value < counters[index]) {
+                    stale_reads++;
+                }
+                counters[index] = value;
+                helper->get("ttl:" + id);
+                reads++;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    failures.expect(torn_pairs == 0, 0, std::to_string(torn_pairs.load()) + " mget/exists saw half of an mset or del");
+    failures.expect(torn_strings == 0, 0, std::to_string(torn_strings.load()) + " get saw a partial append");
+    failures.expect(stale_reads == 0, 0, std::to_string(stale_reads.load()) + " reads went backwards");
+    long total = 0;
+    for (int i = 0; i < CONCURRENT_CHECK_PAIRS; ++i) {
+        std::string counter = concurrent_reply_lines(helper->get("num:" + std::to_string(i))).front();
+        total += counter.find("does not exist") == std::string::npos ? std::atol(counter.c_str()) : 0;
+    }
+    failures.expect(total == increments[0] + increments[1], 0, "counters " + std::to_string(total));
+    std::cout << "Copy-on-write reads: " << reads.load() << " reader rounds" << std::endl;
+    return failures.report(ops * writers);
+}
+
+// 并发读基准测试：threads个线程同时查找随机的key，每个线程ops次，返回总吞吐量（百万次/秒）
+template<typename F>
+double concurrent_measure(int threads, long ops, int n, F lookup) {
+    std::atomic<long> hits{0};
+    std::vector<std::thread> workers;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937 generator(t + 1);
+            long local = 0;
+            for (long i = 0; i < ops; ++i) {
+                local += lookup((int)(generator() % n));
+            }
+            hits += local;
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    if (hits != threads * ops) {
+        std::cerr << "Concurrent benchmark: " << threads * ops - hits << " lookups missed" << std::endl;
+    }
+    return threads * ops / std::chrono::duration<double>(end - start).count() / 1e6;
+}
+
+// 并发读基准测试：n个key（默认10万）分别放入加锁的SkipList和无锁的ConcurrentSkipList（每次查找进入一次EpochManager临界区），
+// 1、4、16个线程同时查找，每个线程ops次（默认100万）；另外通过RedisHelper用同样的线程数get，使用编译时选择的存储引擎。
+// 线程数超过CPU核数时吞吐量不再增加，单核机器上看不到扩展
+void concurrent_benchmark(int n, long ops) {
+    typedef SkipList<std::string, RedisValue> LockedList;
+    typedef ConcurrentSkipList<std::string, RedisValue> LockFreeList;
+    std::vector<std::string> keys;
+    for (int i = 0; i < n; ++i) {
+        keys.push_back("key:" + std::to_string(i));
+    }
+    std::unique_ptr<LockedList> locked(new LockedList());
+    std::unique_ptr<LockFreeList> lock_free(new LockFreeList());
+    TempDataFolder folder;
+    std::unique_ptr<RedisHelper> helper(new RedisHelper(folder.get()));
+    helper->select(0);
+    for (auto& key : keys) {
+        locked->addItem(key, RedisValue("v"));
+        lock_free->addItem(key, RedisValue("v"));
+        helper->set(key, RedisValue("v"));
+    }
+#ifdef USE_CONCURRENT_SKIPLIST
+    const char* engine = "ConcurrentSkipList";
+#else
+    const char* engine = "SkipList";
+#endif
+    for (int threads : {1, 4, 16}) {
+        double mutex = concurrent_measure(threads, ops, n, [&](int i) { return locked->searchItem(keys[i]) != nullptr; });
+        double epoch = concurrent_measure(threads, ops, n, [&](int i) {
+            EpochManager::Guard guard;
+            return lock_free->searchItem(keys[i]) != nullptr;
+        });
+        double get = concurrent_measure(threads, ops, n, [&](int i) { return helper->get(keys[i]) == "\"v\""; });
+        std::cout << "Concurrent reads " << n << " keys, " << threads << " threads: SkipList " << mutex
+                  << " Mops/s, ConcurrentSkipList " << epoch << " Mops/s, RedisHelper get (" << engine << ") " << get
+                  << " Mops/s" << std::endl;
+    }
+}
+
+// 分配次数基准测试：用MemoryCounter统计每次操作的operator new和countedMalloc次数（整个进程，包括服务器的工作线程和ZeroMQ内部的new）
+// 序列化器的缓冲区和RPC的请求、回复缓冲区都会复用，预热之后的稳态分配次数才有意义
+#define ALLOC_BENCHMARK_PORT 5556 //进程内RPC服务器监听的端口，不和./server的5555冲突
+int alloc_add(int a, int b) { return a + b; }
+std::string alloc_echo(std::string s) { return s; }
+
+template<typename F>
+void alloc_measure(const char* name, int n, F f) {
+    for (int i = 0; i < 1000; ++i) {
+        f(i); //预热：复用的缓冲区达到稳定的容量
+    }
+    size_t before = allocationCount();
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < n; ++i) {
+        f(i);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double duration = std::chrono::duration<double>(end - start).count();
+    std::cout << name << ": " << double(allocationCount() - before) / n << " allocations/call, "
+              << duration * 1e9 / n << " ns/call" << std::endl;
+}
+
+void alloc_benchmark(int n) {
+    Serializer serializer;
+    std::string key = "user:1";
+    long sink = 0;
+    alloc_measure("Serializer round trip", n, [&](int i) {
+        serializer.clear();
+        serializer << int32_t(i) << double(1.5) << key << int64_t(i);
+        Serializer reader(serializer.data(), serializer.size());
+        int32_t a = 0; double b = 0; std::string k; int64_t c = 0;
+        reader >> a >> b >> k >> c;
+        sink += a + c + k.size();
+    });
+
+    int stop[2];
+    if (pipe(stop) != 0) {
+        return;
+    }
+    std::thread server_thread([&stop] {
+        buttonrpc server;
+        server.as_server(ALLOC_BENCHMARK_PORT, 1);
+        server.bind("add", alloc_add);
+        server.bind("echo", alloc_echo);
+        server.set_stop_fd(stop[0]);
+        server.run();
+    });
+    {
+        buttonrpc client;
+        client.as_client("127.0.0.1", ALLOC_BENCHMARK_PORT);
+        alloc_measure("RPC add(int, int)", n / 10, [&](int i) {
+            sink += client.call<int>("add", i, 2).val();
+        });
+        std::string value = "hello";
+        alloc_measure("RPC echo(string)", n / 10, [&](int) {
+            sink += client.call<std::string>("echo", value).val().size();
+        });
+    }
+    char byte = 0;
+    if (write(stop[1], &byte, 1) == 1) {
+        server_thread.join();
+    } else {
+        server_thread.detach();
+    }
+    close(stop[0]);
+    close(stop[1]);
+    if (sink == 42) {
+        std::cout << std::endl; //使用结果，避免被优化掉
+    }
+}
+
+// 序列化检查：每一步随机生成一组整数、浮点数、字符串（包括空串、'\0'和几百字节的长串）和字符串数组，
+// 用复用缓冲区的序列化器（大端和小端各一个）写入，再不拷贝地按原来的类型读出，必须和写入的值相同并且正好读完；
+// 随机截短后读取必须失败（failed()），不能读到截短的数据之外
+struct SerializerField {
+    int type; //0: int32_t，1: uint64_t，2: double，3: string，4: vector<string>
+    int32_t small = 0;
+    uint64_t large = 0;
+    double real = 0;
+    std::string text;
+    std::vector<std::string> texts;
+};
+
+bool serializer_read(Serializer& in, const std::vector<SerializerField>& fields) {
+    bool same = true;
+    for (auto& field : fields) {
+        if (field.type == 0) {
+            int32_t value = 0;
+            in >> value;
+            same = same && value == field.small;
+        } else if (field.type == 1) {
+            uint64_t value = 0;
+            in >> value;
+            same = same && value == field.large;
+        } else if (field.type == 2) {
+            double value = 0;
+            in >> value;
+            same = same && value == field.real;
+        } else if (field.type == 3) {
+            std::string value;
+            in >> value;
+            same = same && value == field.text;
+        } else {
+            std::vector<std::string> value;
+            in >> value;
+            same = same && value == field.texts;
+        }
+    }
+    return same;
+}
+
+int serializer_check(int n, unsigned seed) {
+    CheckFailures failures("Serializer");
+    std::mt19937_64 generator(seed);
+    Serializer writers[2] = {Serializer(StreamBuffer(), Serializer::BigEndian), Serializer(StreamBuffer(), Serializer::LittleEndian)};
+    auto text = [&generator]() {
+        std::string value(generator() % 20 == 0 ? 256 + generator() % 512 : generator() % 16, '\0');
+        for (auto& c : value) {
+            c = char(generator());
+        }
+        return value;
+    };
+    std::vector<SerializerField> fields;
+    for (int i = 0; i < n; ++i) {
+        int order = generator() % 2;
+        Serializer& out = writers[order];
+        out.clear();
+        fields.assign(1 + generator() % 8, SerializerField());
+        for (auto& field : fields) {
+            field.type = generator() % 5;
+            if (field.type == 0) {
+                field.small = int32_t(generator());
+                out << field.small;
+            } else if (field.type == 1) {
+                field.large = generator();
+                out << field.large;
+            } else if (field.type == 2) {
+                field.real = double(int64_t(generator())) / 1024;
+                out << field.real;
+            } else if (field.type == 3) {
+                field.text = text();
+                out << field.text;
+            } else {
+                field.texts.resize(generator() % 4);
+                for (auto& t : field.texts) {
+                    t = text();
+                }
+                out << field.texts;
+            }
+        }
+        Serializer in(out.data(), out.size(), order);
+        bool same = serializer_read(in, fields);
+        failures.expect(same && !in.failed() && in.current() == in.data() + in.size(), i, "round trip");
+
+        Serializer truncated(out.data(), generator() % out.size(), order);
+        serializer_read(truncated, fields);
+        failures.expect(truncated.failed(), i, "truncated to " + std::to_string(truncated.size()) + " of " + std::to_string(out.size()));
+    }
+    return failures.report(n);
+}
+
+// ./test [T] [N]         异步测试：T个线程（默认4）共用一个客户端，共发送N个set（默认100万）
+// ./test threads          多线程并发测试：10000个线程各自创建客户端，用同步的call发送
+// ./test pipeline [N]     流水线测试：分别以深度1、16、128发送N个set（默认100万）
+// ./test batch [N]        批量命令测试：分别以每批10、100、1000条命令发送N个set和get（默认100万）
+// ./test session          会话测试：同一个客户端的call和call_async共用select选择的数据库和multi开启的事务
+// ./test skiplist [N]     跳表基准测试：N个key（默认1000万）的每key内存和查找延迟
+// ./test index [N]        索引基准测试：N个key（默认100万）用跳表和哈希索引查找的延迟，哈希索引的每key内存
+// ./test values [N]       值对象基准测试：通过RedisHelper写入N个小key（默认100万）的每key内存和set、get延迟
+// ./test list [N]         列表基准测试：QuickList两端各push、pop N个元素（默认100万），和vector在开头插入、删除比较
+// ./test hash             哈希基准测试：1万、10万、100万个字段的HashTable和unordered_map的hset、hget延迟和每字段内存
+// ./test expire [N]       过期基准测试：N个key（默认1000万）的TTL在1秒到1小时之间，时间轮schedule、cancel的延迟和每100毫秒推进的耗时
+// ./test eviction [N] [OPS] 淘汰基准测试：N个key（默认100万），maxmemory为一半数据的内存，按Zipf分布访问OPS次（默认500万）
+// ./test check [N] [SEED] 随机化检查：被测的数据结构和标准库容器执行N步（默认10万）同样的随机操作，
+//                         以及N/100条随机写命令的数据库文件和AOF往返，有不一致时返回1
+// ./test concurrent [N] [OPS] 并发测试：8个线程同时增删查无锁跳表、写线程和读线程同时通过RedisHelper读写，检查读到的结果，
+//                         再用1、4、16个线程比较SkipList、ConcurrentSkipList和RedisHelper get查找N个key（默认10万）的吞吐量，
+//                         每个线程OPS次（默认100万），检查有不一致时返回1
+// ./test alloc [N]        分配次数基准测试：序列化N次（默认100万），进程内RPC调用N/10次，统计每次的分配次数和耗时
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "check") {
+        int n = argc > 2 ? std::atoi(argv[2]) : 100000;
+        unsigned seed = argc > 3 ? (unsigned)std::atoi(argv[3]) : 1;
+        int failed = 0;
+        failed += index_check(n, seed);
+        failed += hash_check(n, seed);
+        failed += list_check(n, seed);
+        failed += expire_check(n, seed);
+        failed += serializer_check(n, seed);
+        failed += persistence_check(n, seed);
+        return failed == 0 ? 0 : 1;
+    }
+    if (argc > 1 && std::string(argv[1]) == "concurrent") {
+        int n = argc > 2 ? std::atoi(argv[2]) : 100000;
+        long ops = argc > 3 ? std::atol(argv[3]) : 1000000;
+        int failed = 0;
+        failed += concurrent_skiplist_check(64, ops / 10);
+        failed += concurrent_skiplist_check(4096, ops / 10);
+        failed += concurrent_helper_check(ops / 10);
+        concurrent_benchmark(n, ops);
+        return failed == 0 ? 0 : 1;
+    }
+    if (argc > 1 && std::string(argv[1]) == "alloc") {
+        alloc_benchmark(argc > 2 ? std::atoi(argv[2]) : 1000000);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "index") {
+        index_benchmark(argc > 2 ? std::atoi(argv[2]) : 1000000);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "values") {
+        values_benchmark(argc > 2 ? std::atoi(argv[2]) : 1000000);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "list") {
+        list_benchmark(argc > 2 ? std::atoi(argv[2]) : 1000000);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "hash") {
+        hash_benchmark();
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "expire") {
+        expire_benchmark(argc > 2 ? std::atoi(argv[2]) : 10000000);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "eviction") {
+        eviction_benchmark(argc > 2 ? std::atoi(argv[2]) : 1000000, argc > 3 ? std::atol(argv[3]) : 5000000);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "skiplist") {
+        skiplist_benchmark(argc > 2 ? std::atoi(argv[2]) : 10000000);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "session") {
+        return session_check() == 0 ? 0 : 1;
+    }
+    if (argc > 1 && std::string(argv[1]) == "pipeline") {
+        int total = argc > 2 ? std::atoi(argv[2]) : 1000000;
+        for (size_t depth : {1, 16, 128}) {
+            pipeline_task(total, depth);
+        }
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "batch") {
+        int total = argc > 2 ? std::atoi(argv[2]) : 1000000;
+        for (int size : {10, 100, 1000}) {
+            batch_task(total, size);
+        }
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "threads") {
+        int thread_num = 10000;           // 并发线程数
+        int requests_per_thread = 100; // 每个线程发100个请求
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < thread_num; ++i) {
+            threads.emplace_back(client_task, i, requests_per_thread);
+        }
+
+        for (auto& t : threads) {
+            t.join();
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration<double>(end - start).count();
+
+        std::cout << "Total time: " << duration << " seconds" << std::endl;
+        std::cout << "Throughput: " << (thread_num * requests_per_thread) / duration << " req/s" << std::endl;
+        return 0;
+    }
+
+    int thread_num = argc > 1 ? std::atoi(argv[1]) : 4;
+    int total = argc > 2 ? std::atoi(argv[2]) : 1000000;
+    if (thread_num <= 0) {
+        thread_num = 1;
+    }
+    buttonrpc client;
+    client.as_client("127.0.0.1", 5555);
 
     auto start = std::chrono::high_resolution_clock::now();
 
     std::vector<std::thread> threads;
+    std::vector<int> failed(thread_num, 0);
     for (int i = 0; i < thread_num; ++i) {
-        threads.emplace_back(client_task, i, requests_per_thread);
+        threads.emplace_back(async_task, std::ref(client), i, total / thread_num, std::ref(failed[i]));
     }
 
     for (auto& t : threads) {
@@ -40,9 +1380,13 @@ int main() {
 
     auto end = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration<double>(end - start).count();
+    int failed_total = 0;
+    for (int f : failed) {
+        failed_total += f;
+    }
 
-    std::cout << "Total time: " << duration << " seconds" << std::endl;
-    std::cout << "Throughput: " << (thread_num * requests_per_thread) / duration << " req/s" << std::endl;
+    std::cout << "Total time: " << duration << " seconds, failed " << failed_total << std::endl;
+    std::cout << "Throughput: " << (total / thread_num * thread_num) / duration << " req/s" << std::endl;
 
     return 0;
 }